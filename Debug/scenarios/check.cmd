@@ -0,0 +1,7 @@
+@echo off
+rem the fixed simulation scenarios, run from the directory of winpcs.exe.
+rem each replays its config on the virtual clock from a fixed start, and
+rem winpcs exits with 2 when a count diverges from the expected
+rem <spawns> <restarts> <runs> <skipped>.
+
+winpcs.exe --simulate scenarios\day.conf 24 --simulate-start "2016-01-01 00:00:30" --simulate-lifetime 1800 --simulate-jitter 1800 --simulate-exit-code 1 --simulate-expect 151 95 53 116 || exit /b 1
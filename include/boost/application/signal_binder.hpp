@@ -51,7 +51,8 @@ namespace boost { namespace application {
 
    public:
       explicit signal_binder(context &cxt)
-         : signals_(io_service_)
+         : io_service_(own_io_service_)
+         , signals_(io_service_)
          , context_(cxt) {
          signals_.async_wait(
             boost::bind(&signal_binder::signal_handler, this,
@@ -60,7 +61,8 @@ namespace boost { namespace application {
       }
 
       explicit signal_binder(global_context_ptr cxt)
-         : signals_(io_service_)
+         : io_service_(own_io_service_)
+         , signals_(io_service_)
          , context_(*cxt.get()) {
          signals_.async_wait(
             boost::bind(&signal_binder::signal_handler, this,
@@ -68,6 +70,21 @@ namespace boost { namespace application {
             boost::asio::placeholders::signal_number));
       }
 
+      /*!
+       * Waits for signals on an io_service run by its owner, instead of
+       * on a thread of its own.
+       *
+       */
+      signal_binder(context &cxt, asio::io_service &io_service)
+         : io_service_(io_service)
+         , signals_(io_service_)
+         , context_(cxt) {
+         signals_.async_wait(
+            boost::bind(&signal_binder::signal_handler, this,
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::signal_number));
+      }
+
       virtual ~signal_binder() {
          if(io_service_thread_) {
             io_service_.stop();
@@ -192,6 +209,10 @@ namespace boost { namespace application {
     protected:
 
       void start() {
+         if (&io_service_ != &own_io_service_) {
+            return;
+         }
+
          io_service_thread_.reset(new csbl::thread(
             boost::bind(&signal_binder::run_io_service, this)));
       }
@@ -202,6 +223,10 @@ namespace boost { namespace application {
 
       void signal_handler(const boost::system::error_code& ec,
          int signal_number) {
+         // the signal set is gone, an external io_service may outlive it
+         if (ec == asio::error::operation_aborted)
+            return;
+
          csbl::thread thread(&signal_binder::spawn, this, ec, signal_number);
 
          // triggers again
@@ -238,7 +263,8 @@ namespace boost { namespace application {
       // if first handler returns true, the second handler are called
       csbl::unordered_map<int, std::pair< handler<>, handler<> > > handler_map_;
 
-      asio::io_service io_service_;
+      asio::io_service own_io_service_;
+      asio::io_service &io_service_;
       asio::signal_set signals_;
 
       csbl::shared_ptr<csbl::thread> io_service_thread_;
@@ -267,6 +293,26 @@ namespace boost { namespace application {
          register_signals(ec);
       }
 
+      signal_manager(application::context &context,
+         asio::io_service &io_service, boost::system::error_code& ec)
+         : signal_binder(context, io_service)
+      {
+         register_signals(ec);
+      }
+
+      signal_manager(application::context &context,
+         asio::io_service &io_service)
+         : signal_binder(context, io_service)
+      {
+         boost::system::error_code ec;
+
+         register_signals(ec);
+
+         if(ec)
+            BOOST_APPLICATION_THROW_LAST_SYSTEM_ERROR_USING_MY_EC(
+               "signal_manager() failed", ec);
+      }
+
       signal_manager(application::context &context)
          : signal_binder(context)
       {
@@ -406,10 +406,22 @@ namespace cereal
       /*! @param stream The stream to read from */
       JSONInputArchive(std::istream & stream) :
         InputArchive<JSONInputArchive>(this),
-        itsNextName( nullptr ),
-        itsReadStream(stream)
+        itsNextName( nullptr )
       {
-        itsDocument.ParseStream<0>(itsReadStream);
+        ReadStream readStream(stream);
+        itsDocument.ParseStream<0>(readStream);
+        itsIteratorStack.emplace_back(itsDocument.MemberBegin(), itsDocument.MemberEnd());
+      }
+
+      //! Construct, parsing the provided buffer in place
+      /*! The buffer is modified by the parser and string values refer into it, so it
+          must be null terminated and must outlive the archive.
+          @param buffer The mutable, null terminated JSON text to parse */
+      JSONInputArchive(char * buffer) :
+        InputArchive<JSONInputArchive>(this),
+        itsNextName( nullptr )
+      {
+        itsDocument.ParseInsitu<0>(buffer);
         itsIteratorStack.emplace_back(itsDocument.MemberBegin(), itsDocument.MemberEnd());
       }
 
@@ -504,6 +516,19 @@ namespace cereal
             throw Exception("JSON Parsing failed - provided NVP not found");
           }
 
+          //! Whether a member of this node has the given name
+          bool contains( const char * searchName ) const
+          {
+            if( itsType != Member )
+              return false;
+
+            for( auto it = itsMemberItBegin; it != itsMemberItEnd; ++it )
+              if( std::strcmp( searchName, it->name.GetString() ) == 0 )
+                return true;
+
+            return false;
+          }
+
         private:
           MemberIterator itsMemberItBegin, itsMemberItEnd; //!< The member iterator (object)
           ValueIterator itsValueItBegin, itsValueItEnd;    //!< The value iterator (array)
@@ -571,6 +596,26 @@ namespace cereal
         return itsIteratorStack.back().name();
       }
 
+      //! Whether the current node has a member with the given name
+      bool hasName( const char * name ) const
+      {
+        return itsIteratorStack.back().contains( name );
+      }
+
+      //! Depth of the node stack, saved before a load that may fail part way
+      size_t nodeDepth() const
+      {
+        return itsIteratorStack.size();
+      }
+
+      //! Drops the nodes a failed load left started, back to a saved depth
+      void unwindTo( size_t depth )
+      {
+        if( depth != 0 && depth < itsIteratorStack.size() )
+          itsIteratorStack.resize( depth );
+        itsNextName = nullptr;
+      }
+
       //! Sets the name for the next node created with startNode
       void setNextName( const char * name )
       {
@@ -611,7 +656,7 @@ namespace cereal
       //! Loads a value from the current node - double overload
       void loadValue(double & val)      { search(); val = itsIteratorStack.back().value().GetDouble(); ++itsIteratorStack.back(); }
       //! Loads a value from the current node - string overload
-      void loadValue(std::string & val) { search(); val = itsIteratorStack.back().value().GetString(); ++itsIteratorStack.back(); }
+      void loadValue(std::string & val) { search(); val.assign(itsIteratorStack.back().value().GetString(), itsIteratorStack.back().value().GetStringLength()); ++itsIteratorStack.back(); }
 
       // Special cases to handle various flavors of long, which tend to conflict with
       // the int32_t or int64_t on various compiler/OS combinations.  MSVC doesn't need any of this.
@@ -686,7 +731,6 @@ namespace cereal
 
     private:
       const char * itsNextName;               //!< Next name set by NVP
-      ReadStream itsReadStream;               //!< Rapidjson write stream
       std::vector<Iterator> itsIteratorStack; //!< 'Stack' of rapidJSON iterators
       rapidjson::Document itsDocument;        //!< Rapidjson document
   };
@@ -66,6 +66,13 @@ namespace cinatra
 			return *this;
 		}
 
+		/// Serve on an io_service run by the caller, run() then returns at once.
+		Cinatra& io_service(boost::asio::io_service& service)
+		{
+			io_service_ = &service;
+			return *this;
+		}
+
 
 		Cinatra& error_handler(error_handler_t error_handler)
 		{
@@ -123,11 +130,18 @@ namespace cinatra
 
 		void run()
 		{
+			if (io_service_ != nullptr)
+			{
+				http_server_.reset(new HTTPServer(*io_service_));
+			}
+			else
+			{
 #ifndef CINATRA_SINGLE_THREAD
-			http_server_.reset(new HTTPServer(num_threads_));
+				http_server_.reset(new HTTPServer(num_threads_));
 #else
-			http_server_.reset(new HTTPServer);
+				http_server_.reset(new HTTPServer);
 #endif
+			}
 			aop_.set_func(std::bind(&HTTPRouter::dispatch, router_, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 			http_server_->set_request_handler([this](Request& req, Response& res)
 			{
@@ -196,6 +210,8 @@ namespace cinatra
 		app_ctx_container_t app_container_;
 
 		std::unique_ptr<HTTPServer> http_server_;
+
+		boost::asio::io_service* io_service_ = nullptr;
 	};
 
 	using SimpleApp = Cinatra<>;
@@ -161,6 +161,23 @@ namespace cinatra
 				}
 				return true;
 			};
+
+			res.wait_func_ = [&yield, this](const std::function<void(const std::function<void()>&)>& start)
+			{
+				typedef boost::asio::handler_type<boost::asio::yield_context,
+					void(boost::system::error_code)>::type handler_t;
+
+				// the resume is posted through the strand of the coroutine, so it cannot run before get() has suspended it
+				boost::system::error_code ec;
+				handler_t handler(yield[ec]);
+				boost::asio::async_result<handler_t> result(handler);
+				boost::asio::io_service& service = service_;
+				start([handler, &service]()
+				{
+					service.post(boost::asio::detail::bind_handler(handler, boost::system::error_code()));
+				});
+				result.get();
+			};
 		}
 
 		bool response_file(Request& req, bool keep_alive, const boost::asio::yield_context& yield)
@@ -338,8 +355,14 @@ namespace cinatra
 					std::array<char, 8192> buffer;
 					RequestParser parser;
 
-					std::size_t total_size = 0;
-					for (;;)
+					// a pipelined request may already be buffered, it is parsed before reading more
+					std::size_t total_size = req_buf_.size();
+					auto ret = total_size == 0 ? RequestParser::indeterminate : parser.parse(req_buf_);
+					if (ret != RequestParser::indeterminate)
+					{
+						cancel_timer();
+					}
+					while (ret == RequestParser::indeterminate)
 					{
 						std::size_t n = socket_.async_read_some(boost::asio::buffer(buffer), yield[ec]);
 						if (ec)
@@ -367,15 +390,11 @@ namespace cinatra
 							throw HttpError(400,"Request tooooooooo large");
 						}
 
-						auto ret = parser.parse(req_buf_);
-						if (ret == RequestParser::good)
-						{
-							break;
-						}
-						if (ret == RequestParser::bad)
-						{
-							throw HttpError(400,"HTTP Parser error");
-						}
+						ret = parser.parse(req_buf_);
+					}
+					if (ret == RequestParser::bad)
+					{
+						throw HttpError(400,"HTTP Parser error");
 					}
 
 					req = parser.get_request();
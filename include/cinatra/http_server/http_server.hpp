@@ -15,6 +15,8 @@
 
 #include <unordered_map>
 #include <functional>
+#include <mutex>
+#include <vector>
 #include <memory>
 #include <string>
 
@@ -72,6 +74,12 @@ namespace cinatra
 
 		}
 
+		HTTPServer(boost::asio::io_service& io_service)
+			:io_service_pool_(io_service)
+		{
+
+		}
+
 		~HTTPServer()
 		{}
 
@@ -133,6 +141,19 @@ namespace cinatra
 		void stop()
 		{
 			LOG_DBG << "Stop HTTP server";
+
+			// a shared io_service keeps running, so the listeners are closed instead
+			std::lock_guard<std::mutex> lock(acceptors_mutex_);
+			for (auto const & acceptor : acceptors_)
+			{
+				acceptor->get_io_service().post([acceptor]()
+				{
+					boost::system::error_code ec;
+					acceptor->close(ec);
+				});
+			}
+			acceptors_.clear();
+
 			io_service_pool_.stop();
 		}
 
@@ -143,7 +164,8 @@ namespace cinatra
 			const boost::asio::yield_context& yield)
 		{
 			LOG_DBG << "Listen on " << address << ":" << port;
-			boost::asio::ip::tcp::acceptor acceptor(io_service_pool_.get_io_service());
+			auto acceptor_ptr = std::make_shared<boost::asio::ip::tcp::acceptor>(io_service_pool_.get_io_service());
+			boost::asio::ip::tcp::acceptor& acceptor = *acceptor_ptr;
 			boost::asio::ip::tcp::resolver resolver(acceptor.get_io_service());
 			boost::asio::ip::tcp::resolver::query query(address, port);
 			boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
@@ -151,6 +173,10 @@ namespace cinatra
 			acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
 			acceptor.bind(endpoint);
 			acceptor.listen();
+			{
+				std::lock_guard<std::mutex> lock(acceptors_mutex_);
+				acceptors_.push_back(acceptor_ptr);
+			}
 
 			for (;;)
 			{
@@ -164,6 +190,8 @@ namespace cinatra
 				if (ec)
 				{
 					LOG_DBG << "Accept new connection failed: " << ec.message();
+					if (ec == boost::asio::error::operation_aborted || !acceptor.is_open())
+						return;
 					continue;
 				}
 
@@ -179,7 +207,8 @@ namespace cinatra
 			const boost::asio::yield_context& yield)
 		{
 			LOG_DBG << "Listen on " << address << ":" << port;
-			boost::asio::ip::tcp::acceptor acceptor(io_service_pool_.get_io_service());
+			auto acceptor_ptr = std::make_shared<boost::asio::ip::tcp::acceptor>(io_service_pool_.get_io_service());
+			boost::asio::ip::tcp::acceptor& acceptor = *acceptor_ptr;
 			boost::asio::ip::tcp::resolver resolver(acceptor.get_io_service());
 			boost::asio::ip::tcp::resolver::query query(address, port);
 			boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
@@ -187,6 +216,10 @@ namespace cinatra
 			acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
 			acceptor.bind(endpoint);
 			acceptor.listen();
+			{
+				std::lock_guard<std::mutex> lock(acceptors_mutex_);
+				acceptors_.push_back(acceptor_ptr);
+			}
 
 			std::unique_ptr<boost::asio::ssl::context> ctx;
 
@@ -238,6 +271,8 @@ namespace cinatra
 				if (ec)
 				{
 					LOG_DBG << "Accept new connection failed: " << ec.message();
+					if (ec == boost::asio::error::operation_aborted || !acceptor.is_open())
+						return;
 					continue;
 				}
 
@@ -248,6 +283,9 @@ namespace cinatra
 	private:
 		IOServicePool io_service_pool_;
 
+		std::mutex acceptors_mutex_;
+		std::vector<std::shared_ptr<boost::asio::ip::tcp::acceptor>> acceptors_;
+
 		request_handler_t request_handler_;
 		error_handler_t error_handler_;
 
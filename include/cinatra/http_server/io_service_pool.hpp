@@ -27,7 +27,7 @@ namespace cinatra
 	public:
 		/// Construct the io_service pool.
 		explicit IOServicePool(std::size_t pool_size)
-			:next_io_service_(0)
+			:next_io_service_(0), external_(false)
 		{
 			if (pool_size == 0)
 				throw std::runtime_error("io_service_pool size is 0");
@@ -43,6 +43,13 @@ namespace cinatra
 			}
 		}
 
+		/// Construct the pool on an io_service run and stopped by its owner.
+		explicit IOServicePool(boost::asio::io_service& io_service)
+			:next_io_service_(0), external_(true)
+		{
+			io_services_.push_back(io_service_ptr(&io_service, [](boost::asio::io_service*) {}));
+		}
+
 		~IOServicePool()
 		{
 			stop();
@@ -51,6 +58,9 @@ namespace cinatra
 		/// Run all io_service objects in the pool.
 		void run()
 		{
+			if (external_)
+				return;
+
 			// Create a pool of threads to run all of the io_services.
 			std::vector<std::shared_ptr<std::thread> > threads;
 			for (auto service : io_services_)
@@ -69,6 +79,9 @@ namespace cinatra
 		/// Stop all io_service objects in the pool.
 		void stop()
 		{
+			if (external_)
+				return;
+
 			// Explicitly stop all io_services.
 			for (std::size_t i = 0; i < io_services_.size(); ++i)
 				io_services_[i]->stop();
@@ -97,5 +110,8 @@ namespace cinatra
 
 		/// The next io_service to use for a connection.
 		std::size_t next_io_service_;
+
+		/// The io_service belongs to someone else, who runs and stops it.
+		bool external_;
 	};
 } // namespace http
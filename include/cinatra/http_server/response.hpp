@@ -185,6 +185,13 @@ namespace cinatra
 		{
 			return is_complete_;
 		}
+
+		// suspends the handler until the resume function handed to start is called, once, from any thread.
+		// a handler can wait for work done off the event loop without holding one of its threads.
+		void wait(const std::function<void(const std::function<void()>&)>& start)
+		{
+			wait_func_(start);
+		}
 		
 		int status_code_;
 		std::string status_description_;
@@ -192,6 +199,8 @@ namespace cinatra
 		int version_minor_;
 		std::function < bool(const char*, std::size_t) >
 			direct_write_func_;
+		std::function < void(const std::function<void(const std::function<void()>&)>&) >
+			wait_func_;
 		bool is_complete_;
 		boost::asio::streambuf buffer_;
 
@@ -0,0 +1,396 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	autoscaler.cpp for sizing multi-instance programs by a metric.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "autoscaler.h"
+#include "time_utils.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <cmath>
+#include <sstream>
+
+
+autoscaler::autoscaler() :
+    pm_(NULL), timer_(NULL), history_(NULL), timer_handler_(0)
+{
+}
+
+autoscaler::~autoscaler()
+{
+    stop();
+}
+
+bool autoscaler::start(const autoscaler_config& config, std::vector<process_config>& process_info, process_manager& pm,
+    timer_generator& timer, history_store& history, boost::system::error_code& ec)
+{
+    LOCK lock(mutex_);
+
+    boost::posix_time::ptime now = timer.now();
+    std::for_each(process_info.begin(), process_info.end(),
+        [&](process_config& info) {
+        if (!info.schedule.empty() || !info.autoscale.enabled())
+        {
+            return;
+        }
+
+        // a group starts in its cooldown, instances just started are not measured fairly
+        group item;
+        item.info = info;
+        item.last_scale = now;
+        item.status.name = info.name;
+        item.status.metric = info.autoscale.metric;
+        item.status.target = info.autoscale.target;
+        item.status.min = info.autoscale.min;
+        item.status.max = info.autoscale.max;
+        groups_.push_back(item);
+    }
+    );
+
+    if (groups_.empty() || config.evaluate_second == 0)
+    {
+        return true;
+    }
+
+    config_ = config;
+    pm_ = &pm;
+    timer_ = &timer;
+    history_ = &history;
+
+    if (config_.report_port != 0)
+    {
+        boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::address_v4::loopback(),
+            static_cast<unsigned short>(config_.report_port));
+        socket_.reset(new boost::asio::ip::udp::socket(timer.io_service()));
+        socket_->open(endpoint.protocol(), ec) || socket_->bind(endpoint, ec);
+        if (ec)
+        {
+            WRITE_LOG(error) << "autoscale report port unavailable >> " << config_.report_port << " | " << ec.message();
+            socket_.reset();
+            return false;
+        }
+        _receive();
+    }
+
+    timer_handler_ = timer.set_timer(boost::bind(&autoscaler::_evaluate, this), config_.evaluate_second);
+
+    WRITE_LOG(trace) << "autoscaler started >> groups " << groups_.size() << " | every " << config_.evaluate_second << "s";
+    return true;
+}
+
+void autoscaler::stop()
+{
+    if (timer_ == NULL)
+    {
+        return;
+    }
+
+    if (timer_handler_ != 0)
+    {
+        timer_->kill_timer(timer_handler_);
+        timer_handler_ = 0;
+    }
+
+    if (socket_)
+    {
+        boost::system::error_code ec;
+        socket_->close(ec);
+    }
+
+    timer_ = NULL;
+}
+
+std::vector<autoscale_status> autoscaler::status()
+{
+    std::vector<autoscale_status> result;
+
+    LOCK lock(mutex_);
+    result.reserve(groups_.size());
+    std::for_each(groups_.begin(), groups_.end(),
+        [&](const group& item) {
+        result.push_back(item.status);
+    }
+    );
+
+    return result;
+}
+
+void autoscaler::_evaluate()
+{
+    if (timer_ == NULL)
+    {
+        return;
+    }
+
+    boost::posix_time::ptime now = timer_->now();
+
+    LOCK lock(mutex_);
+
+    std::for_each(groups_.begin(), groups_.end(),
+        [&](group& item) {
+        double value = 0;
+        bool measured = _measure(item, now, value);
+        std::size_t instances = pm_->instances(item.info.name);
+
+        std::string reason;
+        std::size_t desired = _decide(item, instances, measured, value, now, reason);
+
+        item.status.value = value;
+        item.status.measured = measured;
+        item.status.instances = instances;
+
+        if (desired == instances)
+        {
+            if (!reason.empty())
+            {
+                item.status.last_decision = reason;
+            }
+            return;
+        }
+
+        std::ostringstream ss;
+        ss << instances << " -> " << desired << " instances, " << reason;
+        reason = ss.str();
+
+        if (pm_->scale(item.info.name, desired, reason))
+        {
+            history_->record(item.info.name, history_event::ev_scaled, 0, 0, reason);
+            item.last_scale = now;
+            item.status.instances = desired;
+            item.status.last_decision = reason;
+            item.status.last_scale_time = time_utils::format_time(now);
+        }
+    }
+    );
+}
+
+bool autoscaler::_measure(group& item, const boost::posix_time::ptime& now, double& value)
+{
+    value = 0;
+
+    if (item.info.autoscale.metric == "cpu")
+    {
+        boost::unordered_map<std::string, unsigned long long> cpu_times;
+        unsigned long long used = 0;
+        std::size_t counted = 0;
+
+        auto runners = pm_->runners();
+        std::for_each(runners.begin(), runners.end(),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            if (runner->get_info().name != item.info.name || runner->process_id() == 0)
+            {
+                return;
+            }
+
+            unsigned long long cpu_time = 0, working_set = 0;
+            runner->usage(cpu_time, working_set);
+            cpu_times[runner->key()] = cpu_time;
+
+            // an instance restarted since the last sample starts over at zero
+            auto last = item.cpu_times.find(runner->key());
+            if (last != item.cpu_times.end() && cpu_time >= last->second)
+            {
+                used += cpu_time - last->second;
+                ++counted;
+            }
+        }
+        );
+
+        boost::posix_time::ptime last_sample = item.last_sample;
+        item.cpu_times.swap(cpu_times);
+        item.last_sample = now;
+
+        if (counted == 0 || last_sample.is_not_a_date_time() || now <= last_sample)
+        {
+            return false;
+        }
+
+        // cpu time is in 100ns units, the percent is of one core
+        double elapsed = static_cast<double>((now - last_sample).total_microseconds()) * 10;
+        value = static_cast<double>(used) * 100 / elapsed / counted;
+        return true;
+    }
+
+    if (item.info.autoscale.metric == "report")
+    {
+        boost::posix_time::time_duration fresh = boost::posix_time::seconds(config_.evaluate_second * 3);
+        double total = 0;
+        std::size_t counted = 0;
+
+        std::for_each(reports_.begin(), reports_.end(),
+            [&](const std::pair<const std::string, report>& entry) {
+            const std::string& key = entry.first;
+            if (key.compare(0, key.find(':'), item.info.name) != 0 || now - entry.second.time > fresh)
+            {
+                return;
+            }
+
+            total += entry.second.value;
+            ++counted;
+        }
+        );
+
+        if (counted == 0)
+        {
+            return false;
+        }
+
+        value = total / counted;
+        return true;
+    }
+
+    return false;
+}
+
+std::size_t autoscaler::_decide(group& item, std::size_t instances, bool measured, double value,
+    const boost::posix_time::ptime& now, std::string& reason)
+{
+    const autoscale_config& scale = item.info.autoscale;
+
+    // the bounds hold whether or not there is a measurement
+    if (instances < scale.min || instances > scale.max)
+    {
+        reason = "bounds " + boost::lexical_cast<std::string>(scale.min) + "-" + boost::lexical_cast<std::string>(scale.max);
+        return instances < scale.min ? scale.min : scale.max;
+    }
+
+    if (!measured)
+    {
+        return instances;
+    }
+
+    double ratio = value / scale.target;
+    double wanted = 0;
+
+    if (instances == 0)
+    {
+        // nothing runs to share the value, it is taken as the load of the whole group
+        if (value <= 0)
+        {
+            return instances;
+        }
+
+        std::ostringstream ss;
+        ss << scale.metric << " " << value << " with no instance, target " << scale.target;
+        reason = ss.str();
+
+        wanted = std::ceil(ratio);
+    }
+    else
+    {
+        std::ostringstream ss;
+        ss << scale.metric << " " << value << " per instance, target " << scale.target;
+        reason = ss.str();
+
+        double tolerance = static_cast<double>(scale.tolerance_percent) / 100;
+        if (std::fabs(ratio - 1) <= tolerance)
+        {
+            return instances;
+        }
+
+        wanted = std::ceil(instances * ratio);
+    }
+
+    // bounded before the cast, a double out of the range of size_t has no defined conversion
+    if (!(wanted >= scale.min))
+    {
+        wanted = scale.min;
+    }
+    if (wanted > scale.max)
+    {
+        wanted = scale.max;
+    }
+    std::size_t desired = static_cast<std::size_t>(wanted);
+
+    if (desired > instances && now - item.last_scale < boost::posix_time::seconds(scale.up_cooldown_second))
+    {
+        reason += ", held by the up cooldown";
+        return instances;
+    }
+
+    if (desired < instances && now - item.last_scale < boost::posix_time::seconds(scale.down_cooldown_second))
+    {
+        reason += ", held by the down cooldown";
+        return instances;
+    }
+
+    return desired;
+}
+
+void autoscaler::_receive()
+{
+    socket_->async_receive_from(boost::asio::buffer(buffer_, sizeof(buffer_)), sender_,
+        timer_->wrap(boost::bind(&autoscaler::_on_receive, this,
+        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+}
+
+void autoscaler::_on_receive(const boost::system::error_code& error, std::size_t size)
+{
+    if (error == boost::asio::error::operation_aborted || timer_ == NULL)
+    {
+        return;
+    }
+
+    if (!error)
+    {
+        // one "name[:instance] value" per line, the latest value of a key wins
+        std::vector<std::string> lines;
+        std::string text(buffer_, size);
+        boost::split(lines, text, boost::is_any_of("\r\n"), boost::token_compress_on);
+
+        boost::posix_time::ptime now = timer_->now();
+        std::for_each(lines.begin(), lines.end(),
+            [&](const std::string& line) {
+            std::istringstream ss(line);
+            std::string key;
+            report item;
+            if (!(ss >> key >> item.value))
+            {
+                return;
+            }
+
+            // a load is never negative, and an infinite one would size the group by itself
+            if (!std::isfinite(item.value) || item.value < 0)
+            {
+                WRITE_LOG_LIMIT(warning, 10, 60) << "autoscale report dropped >> " << line;
+                return;
+            }
+
+            item.time = now;
+            reports_[key] = item;
+        }
+        );
+    }
+
+    _receive();
+}
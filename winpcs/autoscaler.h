@@ -0,0 +1,144 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	autoscaler.h for sizing multi-instance programs by a metric.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+#include "process_manager.h"
+#include "history_store.h"
+#include "timer.h"
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+//
+// an autoscaled group as returned by the /autoscale route.
+//
+struct autoscale_status
+{
+    autoscale_status() :
+        target(0), value(0), measured(false), instances(0), min(0), max(0)
+    {
+    }
+
+    std::string name;
+    std::string metric;
+    double target;
+    double value;               // metric per instance at the last evaluation
+    bool measured;              // false while there is nothing to measure yet
+    std::size_t instances;
+    unsigned int min;
+    unsigned int max;
+    std::string last_decision;
+    std::string last_scale_time;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(name),
+            CEREAL_NVP(metric),
+            CEREAL_NVP(target),
+            CEREAL_NVP(value),
+            CEREAL_NVP(measured),
+            CEREAL_NVP(instances),
+            CEREAL_NVP(min),
+            CEREAL_NVP(max),
+            CEREAL_NVP(last_decision),
+            CEREAL_NVP(last_scale_time)
+        );
+    }
+};
+
+//
+// resizes the programs that carry an autoscale setting. every evaluate_second
+// each group is measured, by the cpu its instances used since the last
+// evaluation or by the latest values they reported on the loopback udp port,
+// and sized to bring the metric per instance back to the target. a metric
+// within tolerance of the target changes nothing, and a group does not grow
+// or shrink again until its cooldown has passed since it last changed.
+//
+class autoscaler : boost::noncopyable
+{
+public:
+    autoscaler();
+    ~autoscaler();
+
+    bool start(const autoscaler_config& config, std::vector<process_config>& process_info, process_manager& pm,
+        timer_generator& timer, history_store& history, boost::system::error_code& ec);
+    void stop();
+
+    std::vector<autoscale_status> status();
+
+private:
+    struct group
+    {
+        process_config info;
+        boost::unordered_map<std::string, unsigned long long> cpu_times;
+        boost::posix_time::ptime last_sample;
+        boost::posix_time::ptime last_scale;
+        autoscale_status status;
+    };
+
+    struct report
+    {
+        double value;
+        boost::posix_time::ptime time;
+    };
+
+    void _evaluate();
+    bool _measure(group& item, const boost::posix_time::ptime& now, double& value);
+    std::size_t _decide(group& item, std::size_t instances, bool measured, double value,
+        const boost::posix_time::ptime& now, std::string& reason);
+
+    void _receive();
+    void _on_receive(const boost::system::error_code& error, std::size_t size);
+
+    autoscaler_config config_;
+    process_manager* pm_;
+    timer_generator* timer_;
+    history_store* history_;
+    unsigned long timer_handler_;
+
+    MUTEX mutex_;
+    std::vector<group> groups_;
+
+    // touched only by timer callbacks
+    boost::unordered_map<std::string, report> reports_;
+    boost::shared_ptr<boost::asio::ip::udp::socket> socket_;
+    boost::asio::ip::udp::endpoint sender_;
+    char buffer_[1500];
+};
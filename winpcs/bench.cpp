@@ -0,0 +1,441 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	bench.cpp for timing the hot paths of the supervisor.
+*/
+
+#define WINPCS_LOG_MODULE log_general
+
+#include "bench.h"
+#include "parse_config.h"
+#include "event_loop.h"
+#include "process_manager.h"
+#include "tcp_proxy.h"
+#include "virtual_clock.h"
+
+#include <boost/asio/spawn.hpp>
+#include <boost/chrono.hpp>
+
+#include <numeric>
+#include <sstream>
+
+
+namespace
+{
+    typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+    typedef boost::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor_ptr;
+
+    const std::size_t bench_buffer = 64 * 1024;
+    const unsigned int bench_clients = 4;
+
+    // a proxied instance, the connection is read to its end and answered with a byte
+    void sink_serve(socket_ptr socket, boost::asio::yield_context yield)
+    {
+        std::vector<char> buffer(bench_buffer);
+        boost::system::error_code ec;
+        while (!ec)
+        {
+            socket->async_read_some(boost::asio::buffer(buffer), yield[ec]);
+        }
+
+        if (ec == boost::asio::error::eof)
+        {
+            boost::asio::async_write(*socket, boost::asio::buffer(&buffer[0], 1), yield[ec]);
+        }
+    }
+
+    void sink_accept(acceptor_ptr acceptor, boost::asio::yield_context yield)
+    {
+        for (;;)
+        {
+            boost::system::error_code ec;
+            socket_ptr socket(new boost::asio::ip::tcp::socket(acceptor->get_io_service()));
+            acceptor->async_accept(*socket, yield[ec]);
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+
+            if (!ec)
+            {
+                socket->set_option(boost::asio::ip::tcp::no_delay(true), ec);
+                boost::asio::spawn(acceptor->get_io_service(), boost::bind(sink_serve, socket, _1));
+            }
+        }
+    }
+
+    // one client connection, size bytes sent, the send side shut and the answer read
+    bool bench_send(boost::asio::io_service& io_service, unsigned short port, std::size_t size)
+    {
+        using boost::asio::ip::tcp;
+
+        boost::system::error_code ec;
+        tcp::socket socket(io_service);
+        socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), ec);
+        if (ec)
+        {
+            return false;
+        }
+
+        socket.set_option(tcp::no_delay(true), ec);
+        std::vector<char> buffer((std::min)(size, bench_buffer), 'x');
+        for (std::size_t sent = 0; sent < size && !ec; )
+        {
+            std::size_t chunk = (std::min)(size - sent, buffer.size());
+            sent += boost::asio::write(socket, boost::asio::buffer(&buffer[0], chunk), ec);
+        }
+
+        socket.shutdown(tcp::socket::shutdown_send, ec);
+        char answer = 0;
+        boost::asio::read(socket, boost::asio::buffer(&answer, 1), ec);
+        return !ec;
+    }
+
+    // connections short connections from bench_clients threads, the connections a second
+    double bench_connections(unsigned short port, unsigned long connections, unsigned long& failed)
+    {
+        boost::atomic<unsigned long> failures(0);
+        boost::thread_group clients;
+        boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < bench_clients; ++i)
+        {
+            unsigned long count = connections / bench_clients + (i < connections % bench_clients ? 1 : 0);
+            clients.create_thread([port, count, &failures]() {
+                boost::asio::io_service io_service;
+                for (unsigned long n = 0; n < count; ++n)
+                {
+                    if (!bench_send(io_service, port, 1))
+                    {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        clients.join_all();
+
+        failed = failures;
+        return connections / boost::chrono::duration<double>(boost::chrono::steady_clock::now() - begin).count();
+    }
+
+    // megabytes down one connection, the megabytes a second
+    double bench_throughput(unsigned short port, unsigned long megabytes, bool& failed)
+    {
+        boost::asio::io_service io_service;
+        boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+        failed = !bench_send(io_service, port, megabytes * 1024 * 1024);
+        return megabytes / boost::chrono::duration<double>(boost::chrono::steady_clock::now() - begin).count();
+    }
+
+    // a free loopback port, the acceptor is closed again
+    unsigned short free_port(boost::asio::io_service& io_service)
+    {
+        using boost::asio::ip::tcp;
+
+        boost::system::error_code ec;
+        tcp::acceptor acceptor(io_service);
+        acceptor.open(tcp::v4(), ec);
+        acceptor.bind(tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), ec);
+        return ec ? 0 : acceptor.local_endpoint(ec).port();
+    }
+
+    bool sink_listen(acceptor_ptr acceptor, unsigned short port)
+    {
+        using boost::asio::ip::tcp;
+
+        boost::system::error_code ec;
+        acceptor->open(tcp::v4(), ec);
+        if (!ec)
+        {
+            acceptor->set_option(tcp::acceptor::reuse_address(true), ec);
+        }
+        if (!ec)
+        {
+            acceptor->bind(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), ec);
+        }
+        if (!ec)
+        {
+            acceptor->listen(boost::asio::socket_base::max_connections, ec);
+        }
+        return !ec;
+    }
+}
+
+int bench::log(unsigned long calls, unsigned int threads, std::ostream& out)
+{
+    if (calls == 0 || threads == 0)
+    {
+        out << "usage: --bench-log <calls> <threads>" << std::endl;
+        return 1;
+    }
+
+    // the threads start together so the calls contend with each other
+    // each thread times its own calls, the wall time includes the waits for the others
+    boost::barrier start(threads + 1);
+    std::vector<double> elapsed(threads);
+    boost::thread_group group;
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        group.create_thread([&start, &elapsed, calls, i]() {
+            start.wait();
+            boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+            for (unsigned long n = 0; n < calls; ++n)
+            {
+                WRITE_LOG(trace) << "bench thread " << i << " record " << n;
+            }
+            elapsed[i] = boost::chrono::duration<double, boost::nano>(boost::chrono::steady_clock::now() - begin).count();
+        });
+    }
+
+    start.wait();
+    boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+    group.join_all();
+    boost::chrono::steady_clock::time_point logged = boost::chrono::steady_clock::now();
+    logger::instance().flush();
+    boost::chrono::steady_clock::time_point written = boost::chrono::steady_clock::now();
+
+    double total = static_cast<double>(calls) * threads;
+    double call = std::accumulate(elapsed.begin(), elapsed.end(), 0.0) / total;
+    out << "log file: " << logger::instance().logfile() << std::endl;
+    out << "records: " << calls << " x " << threads << " threads" << std::endl;
+    out << "call: " << call << " ns" << std::endl;
+    out << "throughput: " << static_cast<unsigned long>(total / boost::chrono::duration<double>(logged - begin).count()) << " records/s" << std::endl;
+    out << "drain: " << boost::chrono::duration_cast<boost::chrono::milliseconds>(written - logged).count() << " ms" << std::endl;
+    return 0;
+}
+
+std::string bench::_generate_config(unsigned long programs)
+{
+    std::ostringstream text;
+    text << "{\"processes\": [";
+    for (unsigned long i = 0; i < programs; ++i)
+    {
+        text << (i == 0 ? "" : ",") << "\n    {"
+            << "\"name\": \"program_" << i << "\", "
+            << "\"command\": \"C:/programs/worker.exe --id " << i << " --port " << 10000 + i % 50000 << "\", "
+            << "\"process_name\": \"program_" << i << "\", "
+            << "\"directory\": \"C:/programs/worker_" << i << "\", "
+            << "\"environment\": \"WORKER_ID=" << i << "\", "
+            << "\"autostart\": true, \"startsecs\": 10, \"numprocs\": 1, \"exitcodes\": [0, 2]}";
+    }
+    text << "\n]}\n";
+    return text.str();
+}
+
+int bench::config(unsigned long programs, unsigned int rounds, std::ostream& out)
+{
+    if (programs == 0 || rounds == 0)
+    {
+        out << "usage: --bench-config <programs> <rounds>" << std::endl;
+        return 1;
+    }
+
+    std::string text = _generate_config(programs);
+
+    // the load before parsing in place, the evaluated text went through a
+    // string and a stringstream and the archive read the stream char by char
+    boost::chrono::steady_clock::duration copied(0);
+    for (unsigned int i = 0; i < rounds; ++i)
+    {
+        boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+        std::string json(text.c_str());
+        std::stringstream stream(json);
+        cereal::JSONInputArchive ar(stream);
+        std::vector<process_config> processes;
+        ar(cereal::make_nvp("processes", processes));
+        copied += boost::chrono::steady_clock::now() - begin;
+    }
+
+    // the buffer stands for the one jsonnet returns, it is filled outside the
+    // timing as ParseInsitu rewrites it
+    boost::chrono::steady_clock::duration in_place(0);
+    boost::shared_array<char> buffer(new char[text.size() + 1]);
+    for (unsigned int i = 0; i < rounds; ++i)
+    {
+        std::copy(text.c_str(), text.c_str() + text.size() + 1, buffer.get());
+        boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+        cereal::JSONInputArchive ar(buffer.get());
+        std::vector<process_config> processes;
+        ar(cereal::make_nvp("processes", processes));
+        in_place += boost::chrono::steady_clock::now() - begin;
+    }
+
+    // the whole load, jsonnet evaluation included
+    boost::filesystem::path file = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("winpcs-bench-%%%%%%%%.jsonnet");
+    {
+        std::ofstream stream(file.string().c_str(), std::ios::binary);
+        stream << text;
+    }
+
+    boost::system::error_code ec;
+    boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+    std::size_t loaded = 0;
+    {
+        parse_config config(file, ec);
+        loaded = ec ? 0 : config.get_processes().size();
+    }
+    boost::chrono::steady_clock::duration whole = boost::chrono::steady_clock::now() - begin;
+
+    boost::system::error_code ignored;
+    boost::filesystem::remove(file, ignored);
+
+    if (ec || loaded != programs)
+    {
+        out << "config load failed >> " << ec.message() << " | loaded " << loaded << " of " << programs << std::endl;
+        return 1;
+    }
+
+    out << "programs: " << programs << ", " << text.size() << " bytes" << std::endl;
+    out << "parse copied: " << boost::chrono::duration_cast<boost::chrono::microseconds>(copied).count() / rounds << " us" << std::endl;
+    out << "parse in place: " << boost::chrono::duration_cast<boost::chrono::microseconds>(in_place).count() / rounds << " us" << std::endl;
+    out << "load with evaluate: " << boost::chrono::duration_cast<boost::chrono::microseconds>(whole).count() << " us" << std::endl;
+    return 0;
+}
+
+int bench::proxy(unsigned long connections, unsigned long megabytes, std::ostream& out)
+{
+    if (connections == 0 || megabytes == 0)
+    {
+        out << "usage: --bench-proxy <connections> <megabytes>" << std::endl;
+        return 1;
+    }
+
+    event_loop loop;
+    loop.start(bench_clients);
+    boost::asio::io_service& io_service = loop.io_service();
+
+    // the instances listen on two ports in a row
+    std::vector<acceptor_ptr> sinks;
+    unsigned short backend_port = 0;
+    for (int attempt = 0; attempt < 20 && backend_port == 0; ++attempt)
+    {
+        unsigned short port = free_port(io_service);
+        acceptor_ptr first(new boost::asio::ip::tcp::acceptor(io_service));
+        acceptor_ptr second(new boost::asio::ip::tcp::acceptor(io_service));
+        if (port != 0 && port < 65535 && sink_listen(first, port) && sink_listen(second, port + 1))
+        {
+            sinks.push_back(first);
+            sinks.push_back(second);
+            backend_port = port;
+        }
+    }
+
+    unsigned short listen_port = free_port(io_service);
+    if (backend_port == 0 || listen_port == 0)
+    {
+        out << "no free loopback port" << std::endl;
+        return 1;
+    }
+
+    std::for_each(sinks.begin(), sinks.end(),
+        [](acceptor_ptr& acceptor) {
+        boost::asio::spawn(acceptor->get_io_service(), boost::bind(sink_accept, acceptor, _1));
+    }
+    );
+
+    process_config info;
+    info.name = "bench";
+    info.process_name = "bench.exe";
+    info.command = "bench.exe";
+    info.numprocs = 2;
+    info.autostart = true;
+    info.proxy.listen_address = "127.0.0.1";
+    info.proxy.listen_port = listen_port;
+    info.proxy.backend_port = backend_port;
+    info.proxy.balance = "roundrobin";
+    std::vector<process_config> processes(1, info);
+
+    // the instances are simulated processes that run until killed, only the sockets are real
+    timer_generator timer(io_service);
+    virtual_clock clock(boost::posix_time::second_clock::universal_time());
+    simulated_process_backend backend(clock);
+    state_journal journal;
+    history_store history;
+    process_manager pm;
+    pm.set_backend(backend);
+    tcp_proxy proxy;
+
+    boost::system::error_code ec;
+    timer.start();
+    pm.start(processes, timer, journal, history, ec);
+    if (!ec)
+    {
+        proxy.start(processes, pm, timer, ec);
+    }
+
+    // the proxy learns its instances on its next refresh
+    for (int wait = 0; !ec && wait < 50; ++wait)
+    {
+        auto groups = proxy.status();
+        if (!groups.empty() && std::count_if(groups[0].backends.begin(), groups[0].backends.end(),
+            [](const proxy_backend_status& item) { return item.up; }) == 2)
+        {
+            break;
+        }
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    }
+
+    int result = 1;
+    if (ec)
+    {
+        out << "proxy start failed >> " << ec.message() << std::endl;
+    }
+    else
+    {
+        unsigned long direct_failed = 0, proxied_failed = 0;
+        bool direct_lost = false, proxied_lost = false;
+        double direct_rate = bench_connections(backend_port, connections, direct_failed);
+        double proxied_rate = bench_connections(listen_port, connections, proxied_failed);
+        double direct_mb = bench_throughput(backend_port, megabytes, direct_lost);
+        double proxied_mb = bench_throughput(listen_port, megabytes, proxied_lost);
+
+        out << "connections: " << connections << " from " << bench_clients << " threads" << std::endl;
+        out << "  direct    " << static_cast<unsigned long>(direct_rate) << " /s, failed " << direct_failed << std::endl;
+        out << "  proxied   " << static_cast<unsigned long>(proxied_rate) << " /s, failed " << proxied_failed << std::endl;
+        out << "throughput: " << megabytes << " MB on one connection" << std::endl;
+        out << "  direct    " << static_cast<unsigned long>(direct_mb) << " MB/s" << (direct_lost ? ", failed" : "") << std::endl;
+        out << "  proxied   " << static_cast<unsigned long>(proxied_mb) << " MB/s" << (proxied_lost ? ", failed" : "") << std::endl;
+        result = direct_failed + proxied_failed == 0 && !direct_lost && !proxied_lost ? 0 : 1;
+    }
+
+    timer.shutdown([&proxy, &pm]() {
+        proxy.stop();
+        pm.stop();
+    });
+
+    std::for_each(sinks.begin(), sinks.end(),
+        [](acceptor_ptr& acceptor) {
+        acceptor->get_io_service().post([acceptor]() {
+            boost::system::error_code ignored;
+            acceptor->close(ignored);
+        });
+    }
+    );
+
+    loop.stop();
+    return result;
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	bench.h for timing the hot paths of the supervisor.
+*/
+#pragma once
+
+#include "config.hpp"
+
+#include <ostream>
+
+
+//
+// benchmarks run from the command line, each prints its numbers to out and
+// returns the exit code of the process.
+//
+class bench : boost::noncopyable
+{
+public:
+    // calls records logged by each of threads threads through the configured
+    // sinks, prints the nanoseconds a call takes and the time the writer needs
+    // to put the backlog in the file
+    static int log(unsigned long calls, unsigned int threads, std::ostream& out);
+
+    // a generated config of programs programs, parsed rounds times through the
+    // old copying path, a stringstream read by the archive, and in place from
+    // the evaluated buffer, then loaded once end to end through parse_config
+    static int config(unsigned long programs, unsigned int rounds, std::ostream& out);
+
+    // a proxied program of two simulated instances, each a loopback sink that
+    // reads a connection to its end and answers with a byte. connections short
+    // connections are made, then megabytes are sent down one connection, both
+    // straight to an instance and through the proxy
+    static int proxy(unsigned long connections, unsigned long megabytes, std::ostream& out);
+
+private:
+    static std::string _generate_config(unsigned long programs);
+};
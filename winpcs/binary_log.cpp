@@ -0,0 +1,549 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	binary_log.cpp for the deferred formatting binary log.
+*/
+
+#include "binary_log.h"
+
+#include <Windows.h>
+#include <boost/date_time/c_local_time_adjustor.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+std::uint64_t log_stream::_now()
+{
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    return (static_cast<std::uint64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+
+binary_log::binary_log() :
+    enabled_(false),
+    stopping_(false),
+    record_id_(1),
+    dropped_(0),
+    policy_(overflow_unbounded),
+    sites_written_(0)
+{
+}
+
+binary_log& binary_log::instance()
+{
+    static binary_log ins;
+    return ins;
+}
+
+bool binary_log::start(const std::string& file_name, log_overflow_policy policy, boost::system::error_code& ec)
+{
+    file_name_ = file_name;
+    policy_ = policy;
+
+    if (!_open_file())
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        return false;
+    }
+
+    stopping_ = false;
+    writer_.reset(new boost::thread(boost::bind(&binary_log::_write_run, this)));
+    enabled_ = true;
+    return true;
+}
+
+void binary_log::stop()
+{
+    if (!writer_)
+    {
+        return;
+    }
+
+    // records logged from now on take the text path and go nowhere
+    enabled_ = false;
+    stopping_ = true;
+    writer_->join();
+    writer_.reset();
+    file_.close();
+}
+
+unsigned int binary_log::register_site(log_site& site, const std::vector< std::pair<bool, std::string> >& segments)
+{
+    boost::mutex::scoped_lock lock(sites_mutex_);
+
+    unsigned int id = site.id.load(boost::memory_order_acquire);
+    if (id != 0)
+    {
+        return id;
+    }
+
+    id = static_cast<unsigned int>(sites_.size() + 1);
+
+    std::string body;
+    auto put = [&body](const void* data, std::size_t size) {
+        body.append(static_cast<const char*>(data), size);
+    };
+
+    std::uint32_t line = site.line;
+    std::uint16_t file_len = static_cast<std::uint16_t>(std::strlen(site.file));
+    std::uint16_t count = static_cast<std::uint16_t>(segments.size());
+    put(&id, sizeof(std::uint32_t));
+    put(&line, sizeof(line));
+    put(&file_len, sizeof(file_len));
+    put(site.file, file_len);
+    put(&count, sizeof(count));
+
+    std::for_each(segments.begin(), segments.end(), [&put](const std::pair<bool, std::string>& segment) {
+        std::uint8_t is_arg = segment.first ? 1 : 0;
+        put(&is_arg, sizeof(is_arg));
+        if (!segment.first)
+        {
+            std::uint16_t len = static_cast<std::uint16_t>(segment.second.size());
+            put(&len, sizeof(len));
+            put(segment.second.data(), len);
+        }
+    });
+
+    std::string frame;
+    std::uint8_t kind = blog_site;
+    std::uint32_t size = static_cast<std::uint32_t>(body.size());
+    frame.append(reinterpret_cast<const char*>(&kind), sizeof(kind));
+    frame.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    frame.append(body);
+
+    sites_.push_back(frame);
+    site.id.store(id, boost::memory_order_release);
+    return id;
+}
+
+binary_log::thread_buffer& binary_log::_local_buffer()
+{
+    thread_buffer_holder* holder = local_buffer_.get();
+    if (holder == nullptr)
+    {
+        holder = new thread_buffer_holder;
+        holder->buffer = boost::make_shared<thread_buffer>();
+        local_buffer_.reset(holder);
+
+        boost::mutex::scoped_lock lock(buffers_mutex_);
+        buffers_.push_back(holder->buffer);
+    }
+
+    return *holder->buffer;
+}
+
+void binary_log::push(const char* data, std::size_t size)
+{
+    thread_buffer& buffer = _local_buffer();
+
+    // a record is pushed whole or not at all, so the writer never sees half of one.
+    // the per thread queue is fixed size, unbounded behaves like block here.
+    while (buffer.queue.write_available() < size)
+    {
+        if (policy_ == overflow_drop || !enabled_)
+        {
+            dropped_.fetch_add(1, boost::memory_order_relaxed);
+            return;
+        }
+
+        boost::this_thread::yield();
+    }
+
+    buffer.queue.push(data, size);
+}
+
+bool binary_log::_open_file()
+{
+    file_date_ = boost::gregorian::to_iso_extended_string(boost::gregorian::day_clock::local_day());
+
+    if (file_.is_open())
+    {
+        file_.close();
+    }
+
+    std::string path = file_name_ + file_date_ + ".blog";
+    file_.open(path, std::ios::binary | std::ios::app);
+    if (!file_)
+    {
+        return false;
+    }
+
+    if (file_.tellp() == std::streampos(0))
+    {
+        file_.write(BINARY_LOG_MAGIC, std::strlen(BINARY_LOG_MAGIC));
+    }
+
+    // every file carries the formats of all sites seen so far
+    sites_written_ = 0;
+    return true;
+}
+
+void binary_log::_write_run()
+{
+    std::vector<char> batch;
+    batch.reserve(1024 * 1024);
+    char chunk[4096];
+
+    for (;;)
+    {
+        bool stopping = stopping_.load();
+
+        std::vector< boost::shared_ptr<thread_buffer> > buffers;
+        {
+            boost::mutex::scoped_lock lock(buffers_mutex_);
+            buffers = buffers_;
+        }
+
+        // drain one queue completely before the next, records never interleave
+        std::for_each(buffers.begin(), buffers.end(), [&](boost::shared_ptr<thread_buffer>& buffer) {
+            std::size_t n;
+            while ((n = buffer->queue.pop(chunk, sizeof(chunk))) > 0)
+            {
+                batch.insert(batch.end(), chunk, chunk + n);
+            }
+        });
+
+        boost::uint64_t dropped = dropped_.exchange(0);
+        if (!batch.empty() || dropped != 0)
+        {
+            _write_batch(batch, dropped);
+            batch.clear();
+        }
+        else
+        {
+            file_.flush();
+            if (stopping)
+            {
+                break;
+            }
+
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(2));
+        }
+
+        // forget the queues of exited threads once they are empty
+        boost::mutex::scoped_lock lock(buffers_mutex_);
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), [](boost::shared_ptr<thread_buffer>& buffer) {
+            return buffer->orphaned.load() && buffer->queue.read_available() == 0;
+        }), buffers_.end());
+    }
+}
+
+void binary_log::_write_batch(std::vector<char>& batch, boost::uint64_t dropped)
+{
+    if (file_date_ != boost::gregorian::to_iso_extended_string(boost::gregorian::day_clock::local_day()))
+    {
+        _open_file();
+    }
+
+    {
+        // the sites of every popped record are registered by now
+        boost::mutex::scoped_lock lock(sites_mutex_);
+        for (; sites_written_ < sites_.size(); ++sites_written_)
+        {
+            file_.write(sites_[sites_written_].data(), sites_[sites_written_].size());
+        }
+    }
+
+    if (dropped != 0)
+    {
+        std::uint8_t kind = blog_dropped;
+        std::uint32_t size = sizeof(dropped);
+        file_.write(reinterpret_cast<const char*>(&kind), sizeof(kind));
+        file_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file_.write(reinterpret_cast<const char*>(&dropped), sizeof(dropped));
+    }
+
+    file_.write(batch.data(), batch.size());
+}
+
+namespace
+{
+    struct blog_reader
+    {
+        blog_reader(const char* begin, const char* end) :
+            pos(begin), end(end)
+        {
+        }
+
+        template <typename T>
+        bool read(T& value)
+        {
+            if (static_cast<std::size_t>(end - pos) < sizeof(T))
+            {
+                return false;
+            }
+
+            std::memcpy(&value, pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        bool read(std::string& value, std::size_t size)
+        {
+            if (static_cast<std::size_t>(end - pos) < size)
+            {
+                return false;
+            }
+
+            value.assign(pos, size);
+            pos += size;
+            return true;
+        }
+
+        const char* pos;
+        const char* end;
+    };
+
+    struct blog_line
+    {
+        blog_line(std::uint64_t run, std::uint64_t sequence, const std::string& text) :
+            run(run), sequence(sequence), text(text)
+        {
+        }
+
+        std::uint64_t run;
+        std::uint64_t sequence;
+        std::string text;
+    };
+
+    struct blog_site_format
+    {
+        std::string file;
+        std::uint32_t line;
+        std::vector< std::pair<bool, std::string> > segments;
+    };
+
+    bool decode_arg(blog_reader& reader, std::ostream& out)
+    {
+        char tag;
+        if (!reader.read(tag))
+        {
+            return false;
+        }
+
+        switch (tag)
+        {
+        case blog_int:
+        {
+            std::int64_t v;
+            if (!reader.read(v)) return false;
+            out << v;
+            return true;
+        }
+        case blog_uint:
+        {
+            std::uint64_t v;
+            if (!reader.read(v)) return false;
+            out << v;
+            return true;
+        }
+        case blog_bool:
+        {
+            std::uint8_t v;
+            if (!reader.read(v)) return false;
+            out << (v != 0);
+            return true;
+        }
+        case blog_double:
+        {
+            double v;
+            if (!reader.read(v)) return false;
+            out << v;
+            return true;
+        }
+        case blog_pointer:
+        {
+            std::uint64_t v;
+            if (!reader.read(v)) return false;
+            out << "0x" << std::hex << v << std::dec;
+            return true;
+        }
+        case blog_string:
+        {
+            std::uint16_t len;
+            std::string v;
+            if (!reader.read(len) || !reader.read(v, len)) return false;
+            out << v;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+bool binary_log::decode(const std::string& file, std::ostream& out)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::size_t magic_len = std::strlen(BINARY_LOG_MAGIC);
+    if (data.size() < magic_len || std::memcmp(data.data(), BINARY_LOG_MAGIC, magic_len) != 0)
+    {
+        return false;
+    }
+
+    // same layout as the text file sink
+    std::ostringstream time_text;
+    time_text.imbue(std::locale(time_text.getloc(),
+        new boost::posix_time::time_facet("%Y-%m-%d %H:%M:%S.%f")));
+
+    const boost::posix_time::ptime filetime_epoch(boost::gregorian::date(1601, 1, 1));
+    std::map<std::uint32_t, blog_site_format> sites;
+
+    // the writer drains one thread's queue after the other, so records reach
+    // the file out of order. they are formatted in file order, where their
+    // site is known, and printed by record id. the ids restart with every run
+    // of the supervisor, which starts writing its sites again from id 1
+    std::vector<blog_line> lines;
+    std::uint64_t run = 0, sequence = 0, wrap = 0;
+    std::uint32_t last_site = 0, last_record = 0;
+
+    blog_reader frames(data.data() + magic_len, data.data() + data.size());
+    while (frames.pos != frames.end)
+    {
+        std::uint8_t kind;
+        std::uint32_t size;
+        if (!frames.read(kind) || !frames.read(size) ||
+            static_cast<std::size_t>(frames.end - frames.pos) < size)
+        {
+            // torn tail, the writer was cut off mid frame
+            break;
+        }
+
+        blog_reader body(frames.pos, frames.pos + size);
+        frames.pos += size;
+
+        if (kind == blog_site)
+        {
+            std::uint32_t id;
+            std::uint16_t file_len, count;
+            blog_site_format format;
+            if (!body.read(id) || !body.read(format.line) || !body.read(file_len) ||
+                !body.read(format.file, file_len) || !body.read(count))
+            {
+                continue;
+            }
+
+            if (id <= last_site)
+            {
+                ++run;
+                sequence = wrap = 0;
+                last_record = 0;
+            }
+            last_site = id;
+
+            for (std::uint16_t i = 0; i < count; ++i)
+            {
+                std::uint8_t is_arg;
+                std::uint16_t len = 0;
+                std::string text;
+                if (!body.read(is_arg) || (!is_arg && (!body.read(len) || !body.read(text, len))))
+                {
+                    break;
+                }
+
+                format.segments.push_back(std::make_pair(is_arg != 0, text));
+            }
+
+            sites[id] = format;
+        }
+        else if (kind == blog_dropped)
+        {
+            std::uint64_t count;
+            if (body.read(count))
+            {
+                // stays behind the record before it
+                lines.push_back(blog_line(run, sequence, "[dropped " + boost::lexical_cast<std::string>(count) + " records]"));
+            }
+        }
+        else if (kind == blog_record)
+        {
+            std::uint32_t site_id, record_id;
+            std::uint64_t filetime;
+            std::uint8_t severity;
+            if (!body.read(site_id) || !body.read(record_id) || !body.read(filetime) || !body.read(severity))
+            {
+                continue;
+            }
+
+            // a far step back is the 32 bit id wrapping, not a late record
+            if (record_id < last_record && last_record - record_id > 0x80000000u)
+            {
+                wrap += 0x100000000ull;
+            }
+            last_record = record_id;
+            sequence = wrap + record_id;
+
+            std::ostringstream line;
+            boost::posix_time::ptime utc = filetime_epoch + boost::posix_time::microseconds(filetime / 10);
+            time_text.str("");
+            time_text << boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(utc);
+
+            line << "[" << record_id << "][" << time_text.str() << "][" << static_cast<severity_level>(severity) << "]";
+
+            auto site = sites.find(site_id);
+            if (site != sites.end())
+            {
+                std::for_each(site->second.segments.begin(), site->second.segments.end(),
+                    [&](const std::pair<bool, std::string>& segment) {
+                    if (!segment.first)
+                    {
+                        line << segment.second;
+                    }
+                    else
+                    {
+                        decode_arg(body, line);
+                    }
+                });
+            }
+
+            // arguments past the site format, or all of them if the site is unknown
+            while (body.pos != body.end && decode_arg(body, line))
+            {
+            }
+
+            lines.push_back(blog_line(run, sequence, line.str()));
+        }
+    }
+
+    std::stable_sort(lines.begin(), lines.end(), [](const blog_line& left, const blog_line& right) {
+        return left.run != right.run ? left.run < right.run : left.sequence < right.sequence;
+    });
+
+    std::for_each(lines.begin(), lines.end(), [&out](const blog_line& line) {
+        out << line.text << std::endl;
+    });
+
+    return true;
+}
@@ -0,0 +1,467 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	binary_log.h for the deferred formatting binary log.
+*/
+#pragma once
+
+#include "logger.h"
+
+#include <boost/atomic.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread.hpp>
+#include <boost/optional.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <type_traits>
+
+//
+// one WRITE_LOG call site. the id is handed out the first time the site is
+// committed in binary mode, together with its static format.
+//
+struct log_site
+{
+    log_site(const char* file, int line) :
+        file(file), line(line), id(0)
+    {
+    }
+
+    const char* file;
+    int line;
+    boost::atomic<unsigned int> id;
+};
+
+//
+// binary log file layout. every frame is [u8 kind][u32 size][body].
+//
+//  site     [u32 id][u32 line][u16 len][file][u16 count]{[u8 0][u16 len][text] | [u8 1]}
+//  record   [u32 site][u32 record id][u64 filetime][u8 severity]{[u8 tag][value]}
+//  dropped  [u64 count]
+//
+enum binary_log_kind
+{
+    blog_site = 1,
+    blog_record = 2,
+    blog_dropped = 3
+};
+
+enum binary_log_tag
+{
+    blog_int = 'i',
+    blog_uint = 'u',
+    blog_bool = 'b',
+    blog_double = 'd',
+    blog_pointer = 'p',
+    blog_string = 's'
+};
+
+#define BINARY_LOG_MAGIC "WPCSBLOG"
+#define BINARY_LOG_RECORD_SIZE 1024
+
+//
+// the binary log writer. log sites push encoded records into a lock-free
+// queue owned by their thread, one writer thread drains all of them into
+// the file queue by queue. nothing is formatted until the file is decoded,
+// which puts the records back in the order they were logged.
+//
+class binary_log : boost::noncopyable
+{
+public:
+    static binary_log& instance();
+
+    bool start(const std::string& file_name, log_overflow_policy policy, boost::system::error_code& ec);
+    void stop();
+
+    bool enabled() const
+    {
+        return enabled_.load(boost::memory_order_relaxed);
+    }
+
+    unsigned int next_record_id()
+    {
+        return record_id_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // register the static format of a site, returns its id
+    unsigned int register_site(log_site& site, const std::vector< std::pair<bool, std::string> >& segments);
+
+    // queue one complete record from the calling thread
+    void push(const char* data, std::size_t size);
+
+    // decode a binary log into the text layout of the file sink, ordered by record id
+    static bool decode(const std::string& file, std::ostream& out);
+
+private:
+    binary_log();
+
+    struct thread_buffer
+    {
+        thread_buffer() :
+            queue(256 * 1024), orphaned(false)
+        {
+        }
+
+        boost::lockfree::spsc_queue<char> queue;
+        boost::atomic<bool> orphaned;
+    };
+
+    // owned by the thread local pointer, marks the buffer orphaned on thread exit
+    struct thread_buffer_holder
+    {
+        ~thread_buffer_holder()
+        {
+            buffer->orphaned.store(true);
+        }
+
+        boost::shared_ptr<thread_buffer> buffer;
+    };
+
+    thread_buffer& _local_buffer();
+    void _write_run();
+    void _write_batch(std::vector<char>& batch, boost::uint64_t dropped);
+    bool _open_file();
+
+    boost::atomic<bool> enabled_;
+    boost::atomic<bool> stopping_;
+    boost::atomic<unsigned int> record_id_;
+    boost::atomic<boost::uint64_t> dropped_;
+    log_overflow_policy policy_;
+
+    std::string file_name_;
+    std::string file_date_;
+    std::ofstream file_;
+
+    boost::mutex buffers_mutex_;
+    std::vector< boost::shared_ptr<thread_buffer> > buffers_;
+    boost::thread_specific_ptr<thread_buffer_holder> local_buffer_;
+
+    boost::mutex sites_mutex_;
+    std::vector<std::string> sites_;
+    std::size_t sites_written_;
+
+    boost::shared_ptr<boost::thread> writer_;
+};
+
+//
+// classifies WRITE_LOG arguments for the binary encoder.
+//
+template <typename T>
+struct log_arg_kind : std::integral_constant<int,
+    std::is_same<T, char>::value ? 0 :
+    std::is_integral<T>::value && std::is_signed<T>::value ? 1 :
+    std::is_integral<T>::value ? 2 :
+    std::is_floating_point<T>::value ? 3 :
+    std::is_pointer<T>::value && std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value ? 4 :
+    std::is_pointer<T>::value ? 5 : 6>
+{
+};
+
+//
+// stream manipulators would change how later arguments are formatted, but a
+// binary record formats nothing until it is decoded. they are rejected at
+// compile time instead of being written as empty arguments.
+//
+template <typename T>
+struct log_manipulator : std::integral_constant<bool,
+    std::is_function<typename std::remove_pointer<T>::type>::value ||
+    std::is_same<T, decltype(std::setw(0))>::value ||
+    std::is_same<T, decltype(std::setprecision(0))>::value ||
+    std::is_same<T, decltype(std::setfill('0'))>::value ||
+    std::is_same<T, decltype(std::setbase(0))>::value ||
+    std::is_same<T, decltype(std::setiosflags(std::ios_base::fmtflags()))>::value ||
+    std::is_same<T, decltype(std::resetiosflags(std::ios_base::fmtflags()))>::value>
+{
+};
+
+//
+// the stream behind WRITE_LOG. in text mode it forwards to a Boost.Log
+// record, in binary mode it copies the raw arguments into a record buffer
+// and keeps the string literals only the first time the site runs.
+//
+class log_stream : boost::noncopyable
+{
+public:
+    log_stream(severity_level level, log_site& site) :
+        level_(level), site_(site), size_(0), binary_(false), defining_(false), done_(true)
+    {
+        binary_log& blog = binary_log::instance();
+        if (blog.enabled())
+        {
+            binary_ = true;
+            defining_ = site.id.load(boost::memory_order_acquire) == 0;
+            done_ = false;
+
+            // the site id is filled in by commit, once it is known
+            std::uint8_t kind = blog_record;
+            std::uint32_t size = 0, site_id = 0, record_id = blog.next_record_id();
+            std::uint64_t now = _now();
+            std::uint8_t severity = static_cast<std::uint8_t>(level);
+            _put(&kind, sizeof(kind));
+            _put(&size, sizeof(size));
+            _put(&site_id, sizeof(site_id));
+            _put(&record_id, sizeof(record_id));
+            _put(&now, sizeof(now));
+            _put(&severity, sizeof(severity));
+            return;
+        }
+
+        record_ = logger::log_filter().open_record(keywords::severity = level);
+        if (record_)
+        {
+            stream_.emplace(record_);
+            done_ = false;
+        }
+    }
+
+    explicit operator bool() const
+    {
+        return !done_;
+    }
+
+    void commit()
+    {
+        done_ = true;
+
+        if (!binary_)
+        {
+            stream_->flush();
+            logger::log_filter().push_record(boost::move(record_));
+            return;
+        }
+
+        binary_log& blog = binary_log::instance();
+        std::uint32_t site_id = site_.id.load(boost::memory_order_acquire);
+        if (site_id == 0)
+        {
+            site_id = blog.register_site(site_, segments_);
+        }
+
+        std::uint32_t size = static_cast<std::uint32_t>(size_ - 5);
+        std::memcpy(buffer_ + 1, &size, sizeof(size));
+        std::memcpy(buffer_ + 5, &site_id, sizeof(site_id));
+        blog.push(buffer_, size_);
+    }
+
+    // string literals are the static format of the site
+    template <std::size_t N>
+    log_stream& operator<<(const char (&text)[N])
+    {
+        if (!binary_)
+        {
+            *stream_ << text;
+        }
+        else if (defining_)
+        {
+            segments_.push_back(std::make_pair(false, std::string(text)));
+        }
+        return *this;
+    }
+
+    // writable buffers are data
+    template <std::size_t N>
+    log_stream& operator<<(char (&text)[N])
+    {
+        if (!binary_)
+        {
+            *stream_ << text;
+        }
+        else
+        {
+            _string(text, _strnlen(text, N));
+        }
+        return *this;
+    }
+
+    template <typename T>
+    log_stream& operator<<(const T& value)
+    {
+        static_assert(!log_manipulator<T>::value,
+            "WRITE_LOG takes no stream manipulators, format the value into a string first");
+
+        if (!binary_)
+        {
+            *stream_ << value;
+        }
+        else
+        {
+            _encode(value, std::integral_constant<int, log_arg_kind<T>::value>());
+        }
+        return *this;
+    }
+
+    // std::endl and std::flush, a record ends with its statement
+    log_stream& operator<<(std::ostream& (*)(std::ostream&)) = delete;
+
+    log_stream& operator<<(const std::string& value)
+    {
+        if (!binary_)
+        {
+            *stream_ << value;
+        }
+        else
+        {
+            _string(value.data(), value.size());
+        }
+        return *this;
+    }
+
+    log_stream& operator<<(bool value)
+    {
+        if (!binary_)
+        {
+            *stream_ << value;
+        }
+        else
+        {
+            std::uint8_t v = value ? 1 : 0;
+            _arg(blog_bool, &v, sizeof(v));
+        }
+        return *this;
+    }
+
+private:
+    static std::uint64_t _now();
+
+    static std::size_t _strnlen(const char* text, std::size_t n)
+    {
+        const char* end = static_cast<const char*>(std::memchr(text, 0, n));
+        return end ? end - text : n;
+    }
+
+    void _put(const void* data, std::size_t size)
+    {
+        std::memcpy(buffer_ + size_, data, size);
+        size_ += size;
+    }
+
+    void _arg(char tag, const void* data, std::size_t size)
+    {
+        // arguments that do not fit are dropped, the record stays well formed
+        if (size_ + 1 + size > sizeof(buffer_))
+        {
+            return;
+        }
+
+        if (defining_)
+        {
+            segments_.push_back(std::make_pair(true, std::string()));
+        }
+
+        _put(&tag, 1);
+        _put(data, size);
+    }
+
+    void _string(const char* text, std::size_t size)
+    {
+        std::size_t room = sizeof(buffer_) - size_;
+        if (room < 1 + sizeof(std::uint16_t))
+        {
+            return;
+        }
+
+        std::uint16_t len = static_cast<std::uint16_t>(
+            (std::min)(size, room - 1 - sizeof(std::uint16_t)));
+        char tag = blog_string;
+
+        if (defining_)
+        {
+            segments_.push_back(std::make_pair(true, std::string()));
+        }
+
+        _put(&tag, 1);
+        _put(&len, sizeof(len));
+        _put(text, len);
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 0>)
+    {
+        _string(&value, 1);
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 1>)
+    {
+        std::int64_t v = value;
+        _arg(blog_int, &v, sizeof(v));
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 2>)
+    {
+        std::uint64_t v = value;
+        _arg(blog_uint, &v, sizeof(v));
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 3>)
+    {
+        double v = value;
+        _arg(blog_double, &v, sizeof(v));
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 4>)
+    {
+        _string(value, value ? std::strlen(value) : 0);
+    }
+
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 5>)
+    {
+        std::uint64_t v = reinterpret_cast<std::uintptr_t>(value);
+        _arg(blog_pointer, &v, sizeof(v));
+    }
+
+    // anything else is formatted on the spot
+    template <typename T>
+    void _encode(const T& value, std::integral_constant<int, 6>)
+    {
+        std::ostringstream ss;
+        ss << value;
+        std::string text(ss.str());
+        _string(text.data(), text.size());
+    }
+
+    severity_level level_;
+    log_site& site_;
+
+    logging::record record_;
+    boost::optional<logging::record_ostream> stream_;
+
+    char buffer_[BINARY_LOG_RECORD_SIZE];
+    std::size_t size_;
+    bool binary_;
+    bool defining_;
+    bool done_;
+    std::vector< std::pair<bool, std::string> > segments_;
+};
@@ -98,3 +98,7 @@ ScopeExit<F> MakeScopeExit(F f) {
 #define SCOPE_EXIT(code) \
     auto STRING_JOIN2(scope_exit_, __LINE__) = MakeScopeExit([=](){code;})
 
+// captures by reference, for code that reports values set later in the scope
+#define SCOPE_EXIT_REF(code) \
+    auto STRING_JOIN2(scope_exit_, __LINE__) = MakeScopeExit([&](){code;})
+
@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	event_loop.cpp for the io_service shared by the supervisor.
+*/
+
+#include "event_loop.h"
+
+
+event_loop::event_loop() :
+    work_(new boost::asio::io_service::work(io_service_)),
+    started_(false)
+{
+}
+
+event_loop::~event_loop()
+{
+    stop();
+}
+
+boost::asio::io_service& event_loop::io_service()
+{
+    return io_service_;
+}
+
+void event_loop::start(unsigned int threads)
+{
+    if (started_)
+    {
+        return;
+    }
+    started_ = true;
+
+    threads = (std::max)(threads, 1u);
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        threads_.create_thread(boost::bind(&event_loop::_run, this));
+    }
+
+    WRITE_LOG(trace) << "event loop started >> threads " << threads;
+}
+
+void event_loop::stop()
+{
+    if (!started_)
+    {
+        return;
+    }
+    started_ = false;
+
+    work_.reset();
+    io_service_.stop();
+    threads_.join_all();
+
+    WRITE_LOG(trace) << "event loop stopped";
+}
+
+void event_loop::_run()
+{
+    // a handler that throws is logged and the thread goes back to the loop
+    for (;;)
+    {
+        try
+        {
+            io_service_.run();
+            return;
+        }
+        catch (std::exception& e)
+        {
+            WRITE_LOG(error) << "event loop handler failed >> " << e.what();
+        }
+    }
+}
@@ -0,0 +1,350 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	file_watcher.cpp for restarting programs when their watched files change.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "file_watcher.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+
+namespace
+{
+    const ULONG_PTR stop_key = static_cast<ULONG_PTR>(-1);
+    const std::size_t notify_buffer_size = 16 * 1024;
+    const DWORD drain_wait_millisecond = 1000;
+
+    const DWORD notify_filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME
+        | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION;
+
+    std::string narrow(const WCHAR* text, int length)
+    {
+        int size = WideCharToMultiByte(CP_ACP, 0, text, length, NULL, 0, NULL, NULL);
+        std::string result(size, '\0');
+        if (size != 0)
+        {
+            WideCharToMultiByte(CP_ACP, 0, text, length, &result[0], size, NULL, NULL);
+        }
+        return result;
+    }
+}
+
+file_watcher::file_watcher() :
+    port_(NULL)
+{
+}
+
+file_watcher::~file_watcher()
+{
+    stop();
+}
+
+bool file_watcher::start(const std::vector<process_config>& process_info, restart_callback callback, boost::system::error_code& ec)
+{
+    if (thread_)
+    {
+        return true;
+    }
+
+    callback_ = callback;
+
+    std::for_each(process_info.begin(), process_info.end(),
+        [this](const process_config& info) {
+        std::for_each(info.watch.begin(), info.watch.end(),
+            [this, &info](const std::string& path) {
+            this->_add(info.name, path, info.watch_debounce_ms);
+        }
+        );
+    }
+    );
+
+    if (directories_.empty())
+    {
+        return true;
+    }
+
+    port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (port_ == NULL)
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        WRITE_LOG(error) << "create watch completion port failed >> " << ec.message();
+        directories_.clear();
+        return false;
+    }
+
+    for (std::size_t i = 0; i < directories_.size(); ++i)
+    {
+        watched_directory& directory = *directories_[i];
+
+        directory.handle = CreateFile(directory.path.c_str(), FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (directory.handle == INVALID_HANDLE_VALUE)
+        {
+            WRITE_LOG(error) << "watch directory open failed >> " << directory.path << " | error :" << GetLastError();
+            continue;
+        }
+
+        if (CreateIoCompletionPort(directory.handle, port_, static_cast<ULONG_PTR>(i), 0) == NULL
+            || !_read(directory))
+        {
+            WRITE_LOG(error) << "watch directory failed >> " << directory.path << " | error :" << GetLastError();
+            continue;
+        }
+
+        WRITE_LOG(trace) << "watching >> " << directory.path << " | entries " << directory.entries.size();
+    }
+
+    thread_.reset(new boost::thread(boost::bind(&file_watcher::_run, this)));
+    return true;
+}
+
+void file_watcher::stop()
+{
+    if (!thread_)
+    {
+        return;
+    }
+
+    PostQueuedCompletionStatus(port_, 0, stop_key, NULL);
+    thread_->join();
+    thread_.reset();
+
+    _close();
+
+    WRITE_LOG(trace) << "file watcher stopped";
+}
+
+void file_watcher::_add(const std::string& program, const std::string& path, unsigned int debounce_ms)
+{
+    boost::system::error_code ec;
+    boost::filesystem::path target = boost::filesystem::absolute(path);
+
+    watch_entry entry;
+    entry.program = program;
+    entry.debounce_ms = debounce_ms;
+
+    // a directory is watched with everything below it, a file through its parent
+    boost::filesystem::path directory_path = target;
+    bool subtree = boost::filesystem::is_directory(target, ec);
+    if (!subtree)
+    {
+        entry.file = target.filename().string();
+        directory_path = target.parent_path();
+    }
+
+    std::string key = directory_path.string();
+    std::vector<boost::shared_ptr<watched_directory> >::iterator iter = std::find_if(directories_.begin(), directories_.end(),
+        [&key](const boost::shared_ptr<watched_directory>& directory) {
+        return boost::algorithm::iequals(directory->path, key);
+    });
+
+    if (iter == directories_.end())
+    {
+        boost::shared_ptr<watched_directory> directory(new watched_directory);
+        directory->path = key;
+        directory->buffer.resize(notify_buffer_size / sizeof(DWORD));
+        directories_.push_back(directory);
+        iter = directories_.end() - 1;
+    }
+
+    (*iter)->subtree = (*iter)->subtree || subtree;
+    (*iter)->entries.push_back(entry);
+}
+
+bool file_watcher::_read(watched_directory& directory)
+{
+    ZeroMemory(&directory.overlapped, sizeof(directory.overlapped));
+    directory.pending = ReadDirectoryChangesW(directory.handle, &directory.buffer[0],
+        static_cast<DWORD>(directory.buffer.size() * sizeof(DWORD)), directory.subtree ? TRUE : FALSE,
+        notify_filter, NULL, &directory.overlapped, NULL) != FALSE;
+    return directory.pending;
+}
+
+void file_watcher::_run()
+{
+    DWORD timeout = INFINITE;
+
+    for (;;)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = NULL;
+        BOOL completed = GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, timeout);
+
+        if (key == stop_key && overlapped == NULL)
+        {
+            return;
+        }
+
+        if (!completed && overlapped == NULL && GetLastError() != WAIT_TIMEOUT)
+        {
+            WRITE_LOG(error) << "watch completion port failed >> error :" << GetLastError();
+            return;
+        }
+
+        if (overlapped != NULL && key < directories_.size())
+        {
+            watched_directory& directory = *directories_[key];
+            directory.pending = false;
+
+            if (completed)
+            {
+                _changed(directory, bytes);
+            }
+            else
+            {
+                WRITE_LOG(error) << "watch read failed >> " << directory.path << " | error :" << GetLastError();
+            }
+
+            if (!_read(directory))
+            {
+                WRITE_LOG(error) << "watch rearm failed >> " << directory.path << " | error :" << GetLastError();
+            }
+        }
+
+        timeout = _fire_due();
+    }
+}
+
+void file_watcher::_changed(watched_directory& directory, DWORD bytes)
+{
+    // an empty completion means the buffer overflowed and the changes are unknown
+    if (bytes == 0)
+    {
+        std::for_each(directory.entries.begin(), directory.entries.end(),
+            [this, &directory](const watch_entry& entry) {
+            this->_debounce(entry, "changes overflowed in " + directory.path);
+        }
+        );
+        return;
+    }
+
+    const char* base = reinterpret_cast<const char*>(&directory.buffer[0]);
+    for (DWORD offset = 0;;)
+    {
+        const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(base + offset);
+        _match(directory, narrow(info->FileName, static_cast<int>(info->FileNameLength / sizeof(WCHAR))));
+
+        if (info->NextEntryOffset == 0)
+        {
+            break;
+        }
+        offset += info->NextEntryOffset;
+    }
+}
+
+void file_watcher::_match(watched_directory& directory, const std::string& file)
+{
+    std::for_each(directory.entries.begin(), directory.entries.end(),
+        [this, &directory, &file](const watch_entry& entry) {
+        if (entry.file.empty() || boost::algorithm::iequals(entry.file, file))
+        {
+            this->_debounce(entry, "changed " + directory.path + "\\" + file);
+        }
+    }
+    );
+}
+
+void file_watcher::_debounce(const watch_entry& entry, const std::string& reason)
+{
+    // every change pushes the restart back, so a copy in progress restarts once
+    pending_restart& restart = pending_[entry.program];
+    restart.due = GetTickCount64() + entry.debounce_ms;
+    restart.reason = reason;
+}
+
+DWORD file_watcher::_fire_due()
+{
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG next_due = 0;
+
+    for (std::map<std::string, pending_restart>::iterator iter = pending_.begin(); iter != pending_.end();)
+    {
+        if (iter->second.due <= now)
+        {
+            WRITE_LOG(warning) << "watched files changed >> " << iter->first << " | " << iter->second.reason;
+            callback_(iter->first, iter->second.reason);
+            iter = pending_.erase(iter);
+            continue;
+        }
+
+        if (next_due == 0 || iter->second.due < next_due)
+        {
+            next_due = iter->second.due;
+        }
+        ++iter;
+    }
+
+    return next_due == 0 ? INFINITE : static_cast<DWORD>(next_due - now);
+}
+
+void file_watcher::_close()
+{
+    // the reads are cancelled by closing their handles, their completions are
+    // drained before the buffers they write into go away
+    std::size_t pending = 0;
+    std::for_each(directories_.begin(), directories_.end(),
+        [&pending](boost::shared_ptr<watched_directory>& directory) {
+        if (directory->handle != INVALID_HANDLE_VALUE)
+        {
+            CancelIo(directory->handle);
+            CloseHandle(directory->handle);
+            directory->handle = INVALID_HANDLE_VALUE;
+        }
+        if (directory->pending)
+        {
+            ++pending;
+        }
+    }
+    );
+
+    while (pending != 0)
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = NULL;
+        if (!GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, drain_wait_millisecond) && overlapped == NULL)
+        {
+            break;
+        }
+        if (overlapped != NULL)
+        {
+            --pending;
+        }
+    }
+
+    CloseHandle(port_);
+    port_ = NULL;
+    directories_.clear();
+    pending_.clear();
+}
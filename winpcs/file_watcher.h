@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	file_watcher.h for restarting programs when their watched files change.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <Windows.h>
+
+//
+// watches the "watch" paths of every program. the directories of all paths
+// share one completion port read by one thread, so hundreds of files cost
+// no polling. a burst of changes is debounced per program, and the program
+// is restarted once the burst has been quiet for its watch_debounce_ms.
+//
+class file_watcher : boost::noncopyable
+{
+public:
+    typedef boost::function<void(const std::string& name, const std::string& reason)> restart_callback;
+
+    file_watcher();
+    ~file_watcher();
+
+    bool start(const std::vector<process_config>& process_info, restart_callback callback, boost::system::error_code& ec);
+    void stop();
+
+private:
+    // a watched file, or a whole directory tree when file is empty
+    struct watch_entry
+    {
+        std::string file;
+        std::string program;
+        unsigned int debounce_ms;
+    };
+
+    struct watched_directory
+    {
+        watched_directory() :
+            handle(INVALID_HANDLE_VALUE), subtree(false), pending(false)
+        {
+            ZeroMemory(&overlapped, sizeof(overlapped));
+        }
+
+        std::string path;
+        HANDLE handle;
+        OVERLAPPED overlapped;
+        std::vector<DWORD> buffer;  // FILE_NOTIFY_INFORMATION records are DWORD aligned
+        bool subtree;
+        bool pending;
+        std::vector<watch_entry> entries;
+    };
+
+    struct pending_restart
+    {
+        ULONGLONG due;
+        std::string reason;
+    };
+
+    void _add(const std::string& program, const std::string& path, unsigned int debounce_ms);
+    bool _read(watched_directory& directory);
+    void _run();
+    void _changed(watched_directory& directory, DWORD bytes);
+    void _match(watched_directory& directory, const std::string& file);
+    void _debounce(const watch_entry& entry, const std::string& reason);
+    DWORD _fire_due();
+    void _close();
+
+    restart_callback callback_;
+    HANDLE port_;
+    std::vector<boost::shared_ptr<watched_directory> > directories_;
+    std::map<std::string, pending_restart> pending_;
+    boost::shared_ptr<boost::thread> thread_;
+};
@@ -0,0 +1,412 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	fleet_aggregator.cpp for fanning in the status of many winpcs instances.
+*/
+
+#define WINPCS_LOG_MODULE log_http
+
+#include "fleet_aggregator.h"
+
+namespace {
+
+    typedef boost::asio::ip::tcp tcp;
+
+    std::string json_string(const rapidjson::Value& object, const char* name)
+    {
+        if (!object.HasMember(name) || !object[name].IsString())
+        {
+            return std::string();
+        }
+
+        return std::string(object[name].GetString(), object[name].GetStringLength());
+    }
+
+    unsigned long json_uint(const rapidjson::Value& object, const char* name)
+    {
+        if (!object.HasMember(name) || !object[name].IsUint())
+        {
+            return 0;
+        }
+
+        return object[name].GetUint();
+    }
+}
+
+fleet_aggregator::fleet_aggregator()
+{
+}
+
+fleet_aggregator::~fleet_aggregator()
+{
+    stop();
+}
+
+void fleet_aggregator::start(const aggregator_config& config, boost::system::error_code& ec)
+{
+    if (thread_ != 0)
+    {
+        return;
+    }
+
+    config_ = config;
+    if (config_.poll_second == 0)
+    {
+        config_.poll_second = 1;
+    }
+
+    for (std::vector<std::string>::const_iterator iter = config_.peers.begin(); iter != config_.peers.end(); ++iter)
+    {
+        peer_ptr p = boost::make_shared<peer>(boost::ref(io_service_), *iter);
+
+        std::string::size_type colon = iter->rfind(':');
+        p->host = iter->substr(0, colon);
+        p->port = colon == std::string::npos ? std::string("http") : iter->substr(colon + 1);
+
+        peers_.push_back(p);
+    }
+
+    asio_work_.reset(new boost::asio::io_service::work(io_service_));
+
+    for (std::vector<peer_ptr>::iterator iter = peers_.begin(); iter != peers_.end(); ++iter)
+    {
+        boost::asio::spawn(io_service_, boost::bind(&fleet_aggregator::_poll_loop, this, *iter, _1));
+    }
+
+    thread_.reset(new boost::thread([this]()
+    {
+        this->io_service_.run();
+    }));
+
+    WRITE_LOG(trace) << "fleet aggregator started >> peers >> " << peers_.size();
+}
+
+void fleet_aggregator::stop()
+{
+    if (thread_ == 0)
+    {
+        return;
+    }
+
+    asio_work_.reset();
+    io_service_.stop();
+    thread_->join();
+    thread_.reset();
+
+    WRITE_LOG(trace) << "fleet aggregator stopped";
+}
+
+bool fleet_aggregator::empty() const
+{
+    return peers_.empty();
+}
+
+std::vector<fleet_entry> fleet_aggregator::programs(const std::string& status)
+{
+    std::vector<fleet_entry> res;
+
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    for (std::vector<peer_ptr>::iterator iter = peers_.begin(); iter != peers_.end(); ++iter)
+    {
+        peer& p = **iter;
+
+        fleet_entry entry;
+        entry.peer = p.address;
+        entry.age_ms = _age_ms(p);
+
+        if (status.empty())
+        {
+            for (std::vector<fleet_program>::iterator program = p.programs.begin(); program != p.programs.end(); ++program)
+            {
+                entry.program = *program;
+                res.push_back(entry);
+            }
+            continue;
+        }
+
+        auto range = p.by_status.equal_range(status);
+        for (auto index = range.first; index != range.second; ++index)
+        {
+            entry.program = p.programs[index->second];
+            res.push_back(entry);
+        }
+    }
+
+    return res;
+}
+
+std::vector<fleet_peer_status> fleet_aggregator::peers()
+{
+    std::vector<fleet_peer_status> res;
+
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    for (std::vector<peer_ptr>::iterator iter = peers_.begin(); iter != peers_.end(); ++iter)
+    {
+        peer& p = **iter;
+
+        fleet_peer_status ps;
+        ps.peer = p.address;
+        ps.age_ms = _age_ms(p);
+        ps.fresh = p.updated && p.failures == 0;
+        ps.failures = p.failures;
+        ps.last_error = p.last_error;
+        ps.programs = p.programs.size();
+
+        res.push_back(ps);
+    }
+
+    return res;
+}
+
+void fleet_aggregator::_poll_loop(peer_ptr p, boost::asio::yield_context yield)
+{
+    for (;;)
+    {
+        std::string body;
+        std::string error;
+
+        if (!_fetch(p, body, yield, error))
+        {
+            boost::system::error_code ignored_ec;
+            p->socket.close(ignored_ec);
+            p->buffer.consume(p->buffer.size());
+            _fail(p, error);
+        }
+        else
+        {
+            std::vector<fleet_program> programs;
+            if (_parse(body, programs))
+            {
+                _update(p, programs);
+            }
+            else
+            {
+                _fail(p, "invalid status response");
+            }
+        }
+
+        boost::system::error_code ec;
+        p->poll.expires_from_now(boost::posix_time::seconds(config_.poll_second));
+        p->poll.async_wait(yield[ec]);
+        if (ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+    }
+}
+
+bool fleet_aggregator::_fetch(peer_ptr p, std::string& body, boost::asio::yield_context& yield, std::string& error)
+{
+    boost::system::error_code ec;
+
+    // cancelling the resolver and closing the socket fail whatever operation is still pending,
+    // a peer whose name does not resolve is given up on as soon as one that does not answer
+    p->timeout.expires_from_now(boost::posix_time::seconds(config_.timeout_second));
+    p->timeout.async_wait([p](const boost::system::error_code& timeout_ec)
+    {
+        if (!timeout_ec)
+        {
+            boost::system::error_code ignored_ec;
+            p->resolver.cancel();
+            p->socket.close(ignored_ec);
+        }
+    });
+    SCOPE_EXIT(p->timeout.cancel());
+
+    if (!p->socket.is_open())
+    {
+        tcp::resolver::iterator endpoints = p->resolver.async_resolve(tcp::resolver::query(p->host, p->port), yield[ec]);
+        if (!ec)
+        {
+            boost::asio::async_connect(p->socket, endpoints, yield[ec]);
+        }
+
+        if (ec)
+        {
+            error = "connect failed: " + ec.message();
+            return false;
+        }
+
+        p->socket.set_option(tcp::no_delay(true), ec);
+    }
+
+    std::string request = "GET /status/pid/0 HTTP/1.1\r\nHost: " + p->host + "\r\nConnection: Keep-Alive\r\n\r\n";
+    boost::asio::async_write(p->socket, boost::asio::buffer(request), yield[ec]);
+    if (ec)
+    {
+        error = "send failed: " + ec.message();
+        return false;
+    }
+
+    std::size_t header_size = boost::asio::async_read_until(p->socket, p->buffer, "\r\n\r\n", yield[ec]);
+    if (ec)
+    {
+        error = "receive failed: " + ec.message();
+        return false;
+    }
+
+    std::string header(boost::asio::buffers_begin(p->buffer.data()),
+        boost::asio::buffers_begin(p->buffer.data()) + header_size);
+    p->buffer.consume(header_size);
+
+    if (header.size() < 12 || header.compare(9, 3, "200") != 0)
+    {
+        error = "bad response: " + header.substr(0, header.find('\r'));
+        return false;
+    }
+
+    std::size_t content_length = 0;
+    auto length_field = boost::ifind_first(header, "content-length:");
+    if (!length_field)
+    {
+        error = "response without content-length";
+        return false;
+    }
+
+    try
+    {
+        std::string::size_type value_begin = length_field.end() - header.begin();
+        std::string::size_type value_end = header.find('\r', value_begin);
+        content_length = boost::lexical_cast<std::size_t>(
+            boost::trim_copy(header.substr(value_begin, value_end - value_begin)));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+        error = "invalid content-length";
+        return false;
+    }
+
+    if (p->buffer.size() < content_length)
+    {
+        boost::asio::async_read(p->socket, p->buffer,
+            boost::asio::transfer_exactly(content_length - p->buffer.size()), yield[ec]);
+        if (ec)
+        {
+            error = "receive failed: " + ec.message();
+            return false;
+        }
+    }
+
+    body.assign(boost::asio::buffers_begin(p->buffer.data()),
+        boost::asio::buffers_begin(p->buffer.data()) + content_length);
+    p->buffer.consume(content_length);
+
+    if (boost::ifind_first(header, "connection: close")
+        || (header.compare(0, 8, "HTTP/1.0") == 0 && !boost::ifind_first(header, "connection: keep-alive")))
+    {
+        boost::system::error_code ignored_ec;
+        p->socket.close(ignored_ec);
+    }
+
+    return true;
+}
+
+bool fleet_aggregator::_parse(std::string& body, std::vector<fleet_program>& programs)
+{
+    if (body.empty())
+    {
+        return false;
+    }
+
+    // the body is not used afterwards, parse it in place
+    rapidjson::Document doc;
+    doc.ParseInsitu<0>(&body[0]);
+    if (doc.HasParseError() || !doc.IsObject())
+    {
+        return false;
+    }
+
+    if (!doc.HasMember("status") || !doc["status"].IsArray())
+    {
+        return false;
+    }
+
+    const rapidjson::Value& status = doc["status"];
+    programs.reserve(status.Size());
+    for (rapidjson::SizeType i = 0; i < status.Size(); ++i)
+    {
+        const rapidjson::Value& item = status[i];
+        if (!item.IsObject())
+        {
+            continue;
+        }
+
+        fleet_program program;
+        program.name = json_string(item, "name");
+        program.process_name = json_string(item, "process_name");
+        program.status = json_string(item, "status");
+        program.instance = json_uint(item, "instance");
+        program.pid = json_uint(item, "pid");
+        program.exit_code = json_uint(item, "exit_code");
+
+        programs.push_back(program);
+    }
+
+    return true;
+}
+
+void fleet_aggregator::_update(peer_ptr p, std::vector<fleet_program>& programs)
+{
+    std::multimap<std::string, std::size_t> by_status;
+    for (std::size_t i = 0; i < programs.size(); ++i)
+    {
+        by_status.insert(std::make_pair(programs[i].status, i));
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    p->programs.swap(programs);
+    p->by_status.swap(by_status);
+    p->last_update = boost::posix_time::microsec_clock::universal_time();
+    p->updated = true;
+    p->failures = 0;
+    p->last_error.clear();
+}
+
+void fleet_aggregator::_fail(peer_ptr p, const std::string& error)
+{
+    WRITE_LOG(warning) << "fleet peer poll failed >> " << p->address << " | " << error;
+
+    // the last good view stays, its age tells how stale it is
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    ++p->failures;
+    p->last_error = error;
+}
+
+long long fleet_aggregator::_age_ms(const peer& p) const
+{
+    if (!p.updated)
+    {
+        return -1;
+    }
+
+    return (boost::posix_time::microsec_clock::universal_time() - p.last_update).total_milliseconds();
+}
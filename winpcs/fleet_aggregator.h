@@ -0,0 +1,170 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	fleet_aggregator.h for fanning in the status of many winpcs instances.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <boost/asio/spawn.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/json.hpp>
+
+//
+// one program as reported by a peer.
+//
+struct fleet_program
+{
+    std::string name;
+    std::string process_name;
+    std::string status;
+    unsigned int instance;
+    unsigned long pid;
+    unsigned long exit_code;
+};
+
+//
+// a program in a fleet query, tagged with its peer and how old the data is.
+//
+struct fleet_entry
+{
+    std::string peer;
+    fleet_program program;
+    long long age_ms;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(peer),
+            cereal::make_nvp("name", program.name),
+            cereal::make_nvp("process_name", program.process_name),
+            cereal::make_nvp("status", program.status),
+            cereal::make_nvp("instance", program.instance),
+            cereal::make_nvp("pid", program.pid),
+            cereal::make_nvp("exit_code", program.exit_code),
+            CEREAL_NVP(age_ms)
+        );
+    }
+};
+
+struct fleet_peer_status
+{
+    std::string peer;
+    bool fresh;
+    long long age_ms;
+    unsigned int failures;
+    std::string last_error;
+    std::size_t programs;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(peer),
+            CEREAL_NVP(fresh),
+            CEREAL_NVP(age_ms),
+            CEREAL_NVP(failures),
+            CEREAL_NVP(last_error),
+            CEREAL_NVP(programs)
+        );
+    }
+};
+
+//
+// polls the peers concurrently over keep-alive connections, all on one io_service,
+// and keeps the merged status indexed by program status for queries from memory.
+//
+class fleet_aggregator : boost::noncopyable
+{
+public:
+    fleet_aggregator();
+    ~fleet_aggregator();
+
+    void start(const aggregator_config& config, boost::system::error_code& ec);
+    void stop();
+
+    bool empty() const;
+
+    // all programs, or only the ones in the given status, e.g. "exited"
+    std::vector<fleet_entry> programs(const std::string& status);
+    std::vector<fleet_peer_status> peers();
+
+private:
+
+    struct peer : boost::noncopyable
+    {
+        peer(boost::asio::io_service& io_service, const std::string& peer_address) :
+            address(peer_address), resolver(io_service), socket(io_service), timeout(io_service), poll(io_service),
+            updated(false), failures(0)
+        {
+        }
+
+        std::string address;
+        std::string host;
+        std::string port;
+
+        boost::asio::ip::tcp::resolver resolver;
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::streambuf buffer;
+        boost::asio::deadline_timer timeout;
+        boost::asio::deadline_timer poll;
+
+        // guarded by fleet_aggregator::mutex_
+        std::vector<fleet_program> programs;
+        std::multimap<std::string, std::size_t> by_status;
+        boost::posix_time::ptime last_update;
+        bool updated;
+        unsigned int failures;
+        std::string last_error;
+    };
+
+    typedef boost::shared_ptr<peer> peer_ptr;
+
+    void _poll_loop(peer_ptr p, boost::asio::yield_context yield);
+    bool _fetch(peer_ptr p, std::string& body, boost::asio::yield_context& yield, std::string& error);
+    bool _parse(std::string& body, std::vector<fleet_program>& programs);
+    void _update(peer_ptr p, std::vector<fleet_program>& programs);
+    void _fail(peer_ptr p, const std::string& error);
+    long long _age_ms(const peer& p) const;
+
+    aggregator_config config_;
+
+    boost::asio::io_service io_service_;
+    boost::shared_ptr<boost::asio::io_service::work> asio_work_;
+    boost::shared_ptr<boost::thread> thread_;
+
+    boost::shared_mutex mutex_;
+    std::vector<peer_ptr> peers_;
+};
@@ -0,0 +1,500 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	history_store.cpp for the on-disk history of program state transitions.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "history_store.h"
+#include "time_utils.h"
+
+#include <Windows.h>
+#include <boost/crc.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace {
+
+    const char* const segment_extension = ".seg";
+    const char* const index_extension = ".idx";
+
+    // an event is a program name, a reason and a few numbers, a larger frame is garbage
+    const std::uint32_t max_frame_size = 64 * 1024;
+
+    std::uint32_t frame_crc(const std::string& payload)
+    {
+        boost::crc_32_type crc;
+        crc.process_bytes(payload.data(), payload.size());
+        return crc.checksum();
+    }
+
+    boost::filesystem::path index_file(const boost::filesystem::path& segment_file)
+    {
+        boost::filesystem::path file(segment_file);
+        return file.replace_extension(index_extension);
+    }
+
+    const char* event_name(std::uint8_t event)
+    {
+        switch (event)
+        {
+        case history_event::ev_started: return "started";
+        case history_event::ev_exited: return "exited";
+        case history_event::ev_adopted: return "adopted";
+        case history_event::ev_stopped: return "stopped";
+        case history_event::ev_detached: return "detached";
+        case history_event::ev_spawn_failed: return "spawn_failed";
+        case history_event::ev_paused: return "paused";
+        case history_event::ev_resumed: return "resumed";
+        case history_event::ev_scaled: return "scaled";
+        default: return "unknown";
+        }
+    }
+}
+
+history_store::history_store()
+{
+}
+
+history_store::~history_store()
+{
+    close();
+}
+
+bool history_store::open(const history_config& config, boost::system::error_code& ec)
+{
+    LOCK lock(mutex_);
+
+    config_ = config;
+    segments_.clear();
+
+    boost::filesystem::path directory(config_.directory);
+    boost::filesystem::create_directories(directory, ec);
+    if (ec)
+    {
+        WRITE_LOG(error) << "create history directory failed >> " << config_.directory << " | " << ec.message();
+        return false;
+    }
+
+    std::vector<boost::filesystem::path> files;
+    for (boost::filesystem::directory_iterator iter(directory, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        if (iter->path().extension() == segment_extension)
+        {
+            files.push_back(iter->path());
+        }
+    }
+
+    // segment names are zero padded start times, so name order is time order
+    std::sort(files.begin(), files.end());
+
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        segment seg;
+        seg.file = files[i];
+        if (!_load_segment(seg))
+        {
+            continue;
+        }
+
+        segments_.push_back(seg);
+
+        // only the newest unsealed segment stays open for appends
+        if (i + 1 < files.size() && !boost::filesystem::exists(index_file(seg.file)))
+        {
+            _seal_active();
+        }
+    }
+
+    if (!segments_.empty() && !boost::filesystem::exists(index_file(segments_.back().file)))
+    {
+        active_.open(segments_.back().file.string().c_str(), std::ios::binary | std::ios::app);
+    }
+
+    _retain();
+
+    WRITE_LOG(trace) << "history opened >> " << config_.directory << " | segments >> " << segments_.size();
+    return true;
+}
+
+void history_store::close()
+{
+    LOCK lock(mutex_);
+
+    if (active_.is_open())
+    {
+        active_.flush();
+        active_.close();
+    }
+}
+
+bool history_store::_load_segment(segment& seg)
+{
+    boost::system::error_code ec;
+    boost::uintmax_t file_size = boost::filesystem::file_size(seg.file, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    // a sealed segment comes with its index
+    boost::filesystem::path idx(index_file(seg.file));
+    {
+        std::ifstream is(idx.string().c_str(), std::ios::binary);
+        if (is.is_open())
+        {
+            try
+            {
+                cereal::BinaryInputArchive ar(is);
+                ar(seg);
+                if (seg.size == file_size)
+                {
+                    return true;
+                }
+            }
+            catch (...)
+            {
+            }
+
+            is.close();
+            boost::filesystem::remove(idx, ec);
+        }
+    }
+
+    // otherwise rebuild the index from the records
+    seg.index.clear();
+    seg.first_time = 0;
+    seg.last_time = 0;
+    seg.size = 0;
+
+    std::ifstream is(seg.file.string().c_str(), std::ios::binary);
+    history_event event;
+    while (_read_event(is, seg.size, event))
+    {
+        if (seg.first_time == 0)
+        {
+            seg.first_time = event.time;
+        }
+        seg.last_time = event.time;
+        seg.index[event.name].push_back(std::make_pair(event.time, seg.size));
+        seg.size = static_cast<std::uint32_t>(is.tellg());
+    }
+    is.close();
+
+    // drop a torn tail so appends continue from the last good record
+    if (seg.size != file_size)
+    {
+        WRITE_LOG(warning) << "history segment has a torn tail, dropped >> " << seg.file.string();
+        boost::filesystem::resize_file(seg.file, seg.size, ec);
+    }
+
+    if (seg.first_time == 0)
+    {
+        boost::filesystem::remove(seg.file, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool history_store::_read_event(std::ifstream& is, std::uint32_t offset, history_event& event)
+{
+    is.clear();
+    is.seekg(offset);
+
+    std::uint32_t size = 0;
+    std::uint32_t crc = 0;
+    if (!is.read(reinterpret_cast<char*>(&size), sizeof(size))
+        || !is.read(reinterpret_cast<char*>(&crc), sizeof(crc)))
+    {
+        return false;
+    }
+
+    // checked before the allocation, a corrupt header could ask for gigabytes
+    if (size == 0 || size > max_frame_size)
+    {
+        return false;
+    }
+
+    std::string payload(size, '\0');
+    if (!is.read(&payload[0], size) || frame_crc(payload) != crc)
+    {
+        return false;
+    }
+
+    try
+    {
+        std::istringstream ss(payload);
+        cereal::BinaryInputArchive ar(ss);
+        ar(event);
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool history_store::_open_active(boost::system::error_code& ec)
+{
+    std::uint64_t start = time_utils::now();
+
+    char name[32];
+    sprintf_s(name, sizeof(name), "%020llu", static_cast<unsigned long long>(start));
+
+    segment seg;
+    seg.file = boost::filesystem::path(config_.directory) / (std::string(name) + segment_extension);
+    seg.first_time = start;
+    seg.last_time = start;
+
+    active_.open(seg.file.string().c_str(), std::ios::binary | std::ios::trunc);
+    if (!active_.is_open())
+    {
+        ec = boost::system::error_code(ERROR_OPEN_FAILED, boost::system::system_category());
+        WRITE_LOG(error) << "open history segment failed >> " << seg.file.string();
+        return false;
+    }
+
+    segments_.push_back(seg);
+    return true;
+}
+
+void history_store::_seal_active()
+{
+    if (active_.is_open())
+    {
+        active_.close();
+    }
+
+    if (segments_.empty())
+    {
+        return;
+    }
+
+    segment& seg = segments_.back();
+    boost::filesystem::path idx(index_file(seg.file));
+    boost::filesystem::path tmp_file(idx);
+    tmp_file += ".tmp";
+
+    {
+        std::ofstream os(tmp_file.string().c_str(), std::ios::binary | std::ios::trunc);
+        cereal::BinaryOutputArchive ar(os);
+        ar(seg);
+    }
+
+    if (!::MoveFileEx(tmp_file.string().c_str(), idx.string().c_str(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        WRITE_LOG(error) << "seal history segment failed >> " << seg.file.string() << " | error :" << GetLastError();
+        return;
+    }
+
+    // the index of a sealed segment is only needed by queries, keep it in memory all the same
+    WRITE_LOG(trace) << "history segment sealed >> " << seg.file.string() << " | size >> " << seg.size;
+}
+
+void history_store::_retain()
+{
+    std::uint64_t oldest = time_utils::now() - static_cast<std::uint64_t>(config_.max_age_day) * 24 * 3600 * 1000000;
+
+    // the active segment, the last one, is never retired
+    while (segments_.size() > 1)
+    {
+        const segment& seg = segments_.front();
+        if (!(config_.max_segments != 0 && segments_.size() > config_.max_segments) &&
+            !(config_.max_age_day != 0 && seg.last_time < oldest))
+        {
+            break;
+        }
+
+        boost::system::error_code ec;
+        boost::filesystem::remove(seg.file, ec);
+        boost::filesystem::remove(index_file(seg.file), ec);
+        WRITE_LOG(trace) << "history segment retired >> " << seg.file.string();
+        segments_.erase(segments_.begin());
+    }
+}
+
+void history_store::record(const std::string& name, history_event::event_type event,
+    unsigned long pid, unsigned long exit_code, const std::string& reason)
+{
+    history_event ev;
+    ev.time = time_utils::now();
+    ev.event = static_cast<std::uint8_t>(event);
+    ev.name = name;
+    ev.pid = pid;
+    ev.exit_code = exit_code;
+    ev.reason = reason;
+
+    std::ostringstream ss;
+    {
+        cereal::BinaryOutputArchive ar(ss);
+        ar(ev);
+    }
+    std::string payload(ss.str());
+    if (payload.size() > max_frame_size)
+    {
+        WRITE_LOG(error) << "history event too large, dropped >> " << name << " | " << payload.size();
+        return;
+    }
+
+    std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+    std::uint32_t crc = frame_crc(payload);
+
+    LOCK lock(mutex_);
+
+    if (config_.directory.empty())
+    {
+        return;
+    }
+
+    if (active_.is_open())
+    {
+        const segment& seg = segments_.back();
+        if (seg.size >= static_cast<std::uint64_t>(config_.segment_kb) * 1024 ||
+            ev.time - seg.first_time >= static_cast<std::uint64_t>(config_.segment_second) * 1000000)
+        {
+            _seal_active();
+            _retain();
+        }
+    }
+
+    boost::system::error_code ec;
+    if (!active_.is_open() && !_open_active(ec))
+    {
+        return;
+    }
+
+    segment& seg = segments_.back();
+    active_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    active_.write(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    active_.write(payload.data(), payload.size());
+    active_.flush();
+    if (!active_)
+    {
+        WRITE_LOG(error) << "append history failed >> " << seg.file.string();
+        return;
+    }
+
+    seg.index[name].push_back(std::make_pair(ev.time, seg.size));
+    seg.size += static_cast<std::uint32_t>(sizeof(size) + sizeof(crc) + payload.size());
+    seg.last_time = ev.time;
+}
+
+std::vector<history_entry> history_store::query(const std::string& name,
+    std::uint64_t since, std::uint64_t until, std::size_t limit)
+{
+    typedef std::pair<boost::filesystem::path, std::vector<std::uint32_t> > segment_offsets;
+    std::vector<segment_offsets> plan;
+    std::size_t planned = 0;
+
+    // pick the offsets under the lock, read the records without it
+    {
+        LOCK lock(mutex_);
+
+        for (std::vector<segment>::iterator seg = segments_.begin(); seg != segments_.end() && planned < limit; ++seg)
+        {
+            if (seg->last_time < since || seg->first_time > until)
+            {
+                continue;
+            }
+
+            std::vector<std::pair<std::uint64_t, std::uint32_t> > hits;
+            auto collect = [&](const offsets_container& offsets) {
+                auto first = std::lower_bound(offsets.begin(), offsets.end(),
+                    std::make_pair(since, std::uint32_t(0)));
+                for (; first != offsets.end() && first->first <= until; ++first)
+                {
+                    hits.push_back(*first);
+                }
+            };
+
+            if (name.empty())
+            {
+                std::for_each(seg->index.begin(), seg->index.end(), [&](const index_container::value_type& program) {
+                    collect(program.second);
+                });
+
+                // offsets grow with time inside a segment
+                std::sort(hits.begin(), hits.end(),
+                    [](const std::pair<std::uint64_t, std::uint32_t>& a, const std::pair<std::uint64_t, std::uint32_t>& b) {
+                    return a.second < b.second;
+                });
+            }
+            else
+            {
+                index_container::const_iterator program = seg->index.find(name);
+                if (program == seg->index.end())
+                {
+                    continue;
+                }
+                collect(program->second);
+            }
+
+            if (hits.empty())
+            {
+                continue;
+            }
+
+            segment_offsets offsets;
+            offsets.first = seg->file;
+            for (std::size_t i = 0; i < hits.size() && planned < limit; ++i, ++planned)
+            {
+                offsets.second.push_back(hits[i].second);
+            }
+            plan.push_back(offsets);
+        }
+    }
+
+    std::vector<history_entry> entries;
+    entries.reserve(planned);
+
+    std::for_each(plan.begin(), plan.end(), [&](const segment_offsets& offsets) {
+        std::ifstream is(offsets.first.string().c_str(), std::ios::binary);
+        std::for_each(offsets.second.begin(), offsets.second.end(), [&](std::uint32_t offset) {
+            history_event event;
+            if (!this->_read_event(is, offset, event))
+            {
+                return;
+            }
+
+            history_entry entry;
+            entry.time = time_utils::format_time(time_utils::epoch + boost::posix_time::microseconds(event.time));
+            entry.time_us = event.time;
+            entry.event = event_name(event.event);
+            entry.name = event.name;
+            entry.pid = event.pid;
+            entry.exit_code = event.exit_code;
+            entry.reason = event.reason;
+            entries.push_back(entry);
+        });
+    });
+
+    return entries;
+}
@@ -0,0 +1,167 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	history_store.h for the on-disk history of program state transitions.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/utility.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <fstream>
+
+//
+// one state transition of one runner.
+//
+struct history_event
+{
+    enum event_type
+    {
+        ev_started = 1,
+        ev_exited = 2,
+        ev_adopted = 3,
+        ev_stopped = 4,
+        ev_detached = 5,
+        ev_spawn_failed = 6,
+        ev_paused = 7,
+        ev_resumed = 8,
+        ev_scaled = 9
+    };
+
+    history_event() :
+        time(0), event(ev_started), pid(0), exit_code(0)
+    {
+    }
+
+    std::uint64_t time;         // microseconds since the unix epoch, utc
+    std::uint8_t event;
+    std::string name;
+    std::uint32_t pid;
+    std::uint32_t exit_code;
+    std::string reason;
+
+    template<class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(time, event, name, pid, exit_code, reason);
+    }
+};
+
+//
+// a history event as returned by the /history route.
+//
+struct history_entry
+{
+    std::string time;
+    std::uint64_t time_us;
+    std::string event;
+    std::string name;
+    std::uint32_t pid;
+    std::uint32_t exit_code;
+    std::string reason;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(time),
+            CEREAL_NVP(time_us),
+            CEREAL_NVP(event),
+            CEREAL_NVP(name),
+            CEREAL_NVP(pid),
+            CEREAL_NVP(exit_code),
+            CEREAL_NVP(reason)
+        );
+    }
+};
+
+//
+// append-only history split into time ordered segment files. every segment
+// has an index of record offsets per program, kept in memory and written
+// next to the segment once it is sealed, so a query only reads the records
+// it returns.
+//
+class history_store : boost::noncopyable
+{
+public:
+    history_store();
+    ~history_store();
+
+    bool open(const history_config& config, boost::system::error_code& ec);
+    void close();
+
+    void record(const std::string& name, history_event::event_type event,
+        unsigned long pid, unsigned long exit_code, const std::string& reason);
+
+    // events of one program, or of all programs when name is empty, oldest first
+    std::vector<history_entry> query(const std::string& name,
+        std::uint64_t since, std::uint64_t until, std::size_t limit);
+
+private:
+    // (time, offset) of every record of a program, in append order
+    typedef std::vector<std::pair<std::uint64_t, std::uint32_t> > offsets_container;
+    typedef std::map<std::string, offsets_container> index_container;
+
+    struct segment
+    {
+        segment() :
+            first_time(0), last_time(0), size(0)
+        {
+        }
+
+        boost::filesystem::path file;
+        std::uint64_t first_time;
+        std::uint64_t last_time;
+        std::uint32_t size;
+        index_container index;
+
+        template<class Archive>
+        void serialize(Archive & ar)
+        {
+            ar(first_time, last_time, size, index);
+        }
+    };
+
+    bool _load_segment(segment& seg);
+    bool _open_active(boost::system::error_code& ec);
+    void _seal_active();
+    void _retain();
+    bool _read_event(std::ifstream& is, std::uint32_t offset, history_event& event);
+
+    MUTEX mutex_;
+    history_config config_;
+    std::vector<segment> segments_;     // oldest first, the last one is active
+    std::ofstream active_;
+};
@@ -29,15 +29,175 @@
 	http_server.cpp for services of http server.
 */
 
+#define WINPCS_LOG_MODULE log_http
+
 #include "http_server.h"
 
-void http_server::start(process_manager& pm, boost::system::error_code &ec)
+namespace
+{
+    const std::size_t search_threads = 2;
+    const std::size_t max_search_limit = 10000;             // lines a search returns at most, whatever it asks for
+    const std::size_t max_search_queued = 1024 * 1024;      // bytes found ahead of a slow connection before the scan waits
+
+    //
+    // the batches of one output search, found on a search thread and written out by the
+    // connection. the connection's coroutine is suspended while it waits, so a long scan or
+    // a slow reader holds neither a thread of the event loop nor unbounded memory.
+    //
+    class search_stream : boost::noncopyable
+    {
+    public:
+        explicit search_stream(const boost::atomic<bool>& stopping) :
+            stopping_(stopping), queued_(0), done_(false), cancelled_(false)
+        {
+        }
+
+        // search thread, false once the connection is gone or the server stops
+        bool push(const std::string& lines)
+        {
+            std::function<void()> resume;
+            {
+                LOCK lock(mutex_);
+                while (!cancelled_ && !stopping_ && queued_ >= max_search_queued)
+                {
+                    space_.wait_for(lock, boost::chrono::milliseconds(100));
+                }
+
+                if (cancelled_ || stopping_)
+                {
+                    return false;
+                }
+
+                batches_.push_back(lines);
+                queued_ += lines.size();
+                resume.swap(resume_);
+            }
+
+            if (resume)
+            {
+                resume();
+            }
+            return true;
+        }
+
+        // search thread, once the search has returned
+        void finish()
+        {
+            std::function<void()> resume;
+            {
+                LOCK lock(mutex_);
+                done_ = true;
+                resume.swap(resume_);
+            }
+
+            if (resume)
+            {
+                resume();
+            }
+        }
+
+        // connection, false when the search has ended and every batch was taken
+        bool pop(std::string& lines, cinatra::Response& res)
+        {
+            for (;;)
+            {
+                {
+                    LOCK lock(mutex_);
+                    if (!batches_.empty())
+                    {
+                        lines.swap(batches_.front());
+                        batches_.pop_front();
+                        queued_ -= lines.size();
+                        space_.notify_one();
+                        return true;
+                    }
+
+                    if (done_)
+                    {
+                        return false;
+                    }
+                }
+
+                res.wait([this](const std::function<void()>& resume) {
+                    {
+                        LOCK lock(mutex_);
+                        if (batches_.empty() && !done_)
+                        {
+                            resume_ = resume;
+                            return;
+                        }
+                    }
+                    resume();
+                });
+            }
+        }
+
+        // connection, the client has gone
+        void cancel()
+        {
+            LOCK lock(mutex_);
+            cancelled_ = true;
+            space_.notify_one();
+        }
+
+    private:
+        const boost::atomic<bool>& stopping_;
+
+        MUTEX mutex_;
+        boost::condition_variable space_;
+        std::deque<std::string> batches_;
+        std::size_t queued_;
+        bool done_;
+        bool cancelled_;
+        std::function<void()> resume_;      // set while the connection waits for a batch
+    };
+
+    // the routes that start processes, change the supervisor or read captured output need the configured token,
+    // compared over its whole length so the response time does not leak the matching prefix
+    bool authorized(cinatra::Request& req, cinatra::Response& res, const std::string& token)
+    {
+        const std::string& given = req.header().get_val("X-Winpcs-Token");
+
+        bool ok = !token.empty() && given.size() == token.size();
+        unsigned char diff = 0;
+        for (std::size_t i = 0; ok && i < token.size(); ++i)
+        {
+            diff |= static_cast<unsigned char>(given[i] ^ token[i]);
+        }
+
+        if (!ok || diff != 0)
+        {
+            WRITE_LOG_LIMIT(warning, 10, 60) << "http request refused, admin token " << (token.empty() ? "not configured" : "mismatch") << " >> " << req.path();
+            res.set_status_code(403);
+            res.end("{\"result\":403}");
+            return false;
+        }
+
+        return true;
+    }
+}
+
+void http_server::start(boost::asio::io_service& io_service, process_manager& pm, const server_config& server, fleet_aggregator& fleet,
+    history_store& history, job_runner& jobs, scheduler& schedules,
+    pressure_monitor& pressure, autoscaler& scaler, tcp_proxy& proxy, output_store& output, log_forwarder& forwarder, const boost::filesystem::path& config_file, boost::system::error_code &ec)
 {
     if (impl_.get() != nullptr) {
         return;
     }
 
-    impl_.reset(new cinatra::Cinatra<>);
+    impl_.reset(new cinatra::Cinatra<http_trace_aspect>);
+    impl_->io_service(io_service);
+
+    search_work_.reset(new boost::asio::io_service::work(search_service_));
+    for (std::size_t i = 0; i < search_threads; ++i)
+    {
+        search_threads_.push_back(boost::make_shared<boost::thread>([this]()
+        {
+            this->search_service_.run();
+        }));
+    }
+
+    const std::string token = server.admin_token;
 
     impl_->route("/status/pid/:pid", [this, &pm](cinatra::Request& /* req */, cinatra::Response& res, int pid)
     {
@@ -53,38 +213,489 @@ void http_server::start(process_manager& pm, boost::system::error_code &ec)
         return;
     });
 
-    impl_->route("/start", [](cinatra::Request& /* req */, cinatra::Response& res)
+    // every instance of a program, the change is queued and the response does not wait for it
+    impl_->route("/start/:name", [this, &pm, token](cinatra::Request& req, cinatra::Response& res, const std::string& name)
     {
-        res.end("{\"result\":0}");
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        res.end(pm.control(name, "start", "started over http") ? "{\"result\":0}" : "{\"result\":1}");
         return;
     });
 
-    impl_->route("/stop", [](cinatra::Request& /* req */, cinatra::Response& res)
+    impl_->route("/stop/:name", [this, &pm, token](cinatra::Request& req, cinatra::Response& res, const std::string& name)
     {
-        res.end("{\"result\":0}");
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        res.end(pm.control(name, "stop", "stopped over http") ? "{\"result\":0}" : "{\"result\":1}");
+        return;
+    });
+
+    impl_->route("/restart/:name", [this, &pm, token](cinatra::Request& req, cinatra::Response& res, const std::string& name)
+    {
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        res.end(pm.control(name, "restart", "restarted over http") ? "{\"result\":0}" : "{\"result\":1}");
         return;
     });
 
-    impl_->route("/restart", [](cinatra::Request& /* req */, cinatra::Response& res)
+    // re-reads the configuration file, see process_manager::reload for what is applied
+    impl_->route("/reload", [this, &pm, config_file, token](cinatra::Request& req, cinatra::Response& res)
     {
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        std::vector<std::string> added;
+        std::vector<std::string> removed;
+
+        try
+        {
+            boost::system::error_code load_ec;
+            parse_config fresh(config_file, load_ec);
+            if (load_ec)
+            {
+                WRITE_LOG(error) << "reload failed, config file not loaded >> " << load_ec.message();
+                res.end("{\"result\":1}");
+                return;
+            }
+
+            pm.reload(fresh.get_processes(), added, removed);
+        }
+        catch (std::exception& e)
+        {
+            WRITE_LOG(error) << "reload failed, config file not loaded >> " << e.what();
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        WRITE_LOG(warning) << "config file reloaded >> added " << added.size() << " | removed " << removed.size();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("result", 0), CEREAL_NVP(added), CEREAL_NVP(removed));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    // /history?name=<key>&since=<unix seconds>&until=<unix seconds>&limit=<count>
+    impl_->route("/history", [this, &history](cinatra::Request& req, cinatra::Response& res)
+    {
+        const cinatra::CaseMap& query = req.query();
+
+        std::string name;
+        std::uint64_t since = 0;
+        std::uint64_t until = (std::numeric_limits<std::uint64_t>::max)();
+        std::size_t limit = 1000;
+
+        try
+        {
+            if (query.has_key("name"))
+            {
+                name = query.get_val("name");
+            }
+            if (query.has_key("since"))
+            {
+                since = boost::lexical_cast<std::uint64_t>(query.get_val("since")) * 1000000;
+            }
+            if (query.has_key("until"))
+            {
+                until = boost::lexical_cast<std::uint64_t>(query.get_val("until")) * 1000000;
+            }
+            if (query.has_key("limit"))
+            {
+                limit = boost::lexical_cast<std::size_t>(query.get_val("limit"));
+            }
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        auto events = history.query(name, since, until, limit);
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("events", events));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    // POST a program definition to queue it as a job, GET to list the known jobs
+    impl_->route("/jobs", [this, &jobs, token](cinatra::Request& req, cinatra::Response& res)
+    {
+        if (req.method() != cinatra::Request::method_t::POST)
+        {
+            auto list = jobs.jobs();
+
+            std::ostringstream ss;
+            {
+                cereal::JSONOutputArchive ar(ss);
+                ar(cereal::make_nvp("jobs", list));
+            }
+
+            res.end(ss.str());
+            return;
+        }
+
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        job_request request;
+        try
+        {
+            // parsed in place, so the body is copied into a terminated buffer first
+            std::vector<char> body(req.body().begin(), req.body().end());
+            body.push_back('\0');
+
+            cereal::JSONInputArchive ar(&body[0]);
+            request.load(ar);
+        }
+        catch (...)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        std::uint64_t id = jobs.submit(request);
+        if (id == 0)
+        {
+            res.end("{\"result\":2}");
+            return;
+        }
+
+        res.end("{\"result\":0,\"id\":" + boost::lexical_cast<std::string>(id) + "}");
+        return;
+    });
+
+    // one job with its output. not /jobs/:id, the router files that under /jobs and the
+    // list handler above would take the request
+    impl_->route("/job/:id", [this, &jobs](cinatra::Request& /* req */, cinatra::Response& res, const std::string& id)
+    {
+        job_status status;
+        try
+        {
+            if (!jobs.status(boost::lexical_cast<std::uint64_t>(id), status))
+            {
+                res.end("{\"result\":1}");
+                return;
+            }
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("job", status));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/schedules", [this, &schedules](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto list = schedules.status();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("schedules", list));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/pressure", [this, &pressure](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto status = pressure.status();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("pressure", status));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/autoscale", [this, &scaler](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto groups = scaler.status();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("groups", groups));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/proxy", [this, &proxy](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto groups = proxy.status();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("groups", groups));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/log/levels", [](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto levels = logger::module_levels();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("levels", levels));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    impl_->route("/log/forward", [this, &forwarder](cinatra::Request& /* req */, cinatra::Response& res)
+    {
+        auto status = forwarder.status();
+
+        std::ostringstream ss;
+        {
+            cereal::JSONOutputArchive ar(ss);
+            ar(cereal::make_nvp("forward", status));
+        }
+
+        res.end(ss.str());
+        return;
+    });
+
+    // /log/<name>/search?q=<words>&since=<unix seconds>&limit=<count>[&tail=1], matching lines as chunked plain text,
+    // the first limit of them or with tail the last ones. captured output can hold secrets, so it needs the token
+    impl_->route("/log/:name/:action", [this, &output, token](cinatra::Request& req, cinatra::Response& res, const std::string& name, const std::string& action)
+    {
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        const cinatra::CaseMap& query = req.query();
+
+        std::string words;
+        std::uint64_t since = 0;
+        std::size_t limit = 1000;
+        bool newest = query.has_key("tail") && query.get_val("tail") != "0";
+
+        try
+        {
+            if (query.has_key("q"))
+            {
+                words = query.get_val("q");
+            }
+            if (query.has_key("since"))
+            {
+                since = boost::lexical_cast<std::uint64_t>(query.get_val("since")) * 1000000;
+            }
+            if (query.has_key("limit"))
+            {
+                limit = boost::lexical_cast<std::size_t>(query.get_val("limit"));
+            }
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        if (action != "search")
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        limit = (std::min)(limit, max_search_limit);
+
+        if (searches_stopping_)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        auto stream = boost::make_shared<search_stream>(boost::cref(searches_stopping_));
+        search_service_.post([this, stream, &output, name, words, since, limit, newest]() {
+            // a search still queued when the server stops is not run, but its response still ends
+            if (!this->searches_stopping_)
+            {
+                output.search(name, words, since, limit, newest, [stream](const std::string& lines) {
+                    return stream->push(lines);
+                });
+            }
+            stream->finish();
+        });
+
+        res.header.add("Content-Type", "text/plain; charset=utf-8");
+
+        std::string lines;
+        while (stream->pop(lines, res))
+        {
+            if (!res.direct_write(lines))
+            {
+                stream->cancel();
+                break;
+            }
+        }
+
+        res.end();
+        return;
+    });
+
+    impl_->route("/log/level/:module/:level", [token](cinatra::Request& req, cinatra::Response& res, const std::string& module, const std::string& level)
+    {
+        if (!authorized(req, res, token))
+        {
+            return;
+        }
+
+        if (!logger::set_module_level(module, level))
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        WRITE_LOG(warning) << "log level changed >> " << module << " | " << level;
         res.end("{\"result\":0}");
         return;
     });
 
-    impl_->listen("http");
+    // the spans of the last seconds as Chrome Trace Event JSON
+    impl_->route("/debug/trace", [](cinatra::Request& req, cinatra::Response& res)
+    {
+        const cinatra::CaseMap& query = req.query();
+
+        unsigned int seconds = 10;
+        try
+        {
+            if (query.has_key("seconds"))
+            {
+                seconds = boost::lexical_cast<unsigned int>(query.get_val("seconds"));
+            }
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            res.end("{\"result\":1}");
+            return;
+        }
+
+        std::ostringstream ss;
+        trace_recorder::instance().dump(seconds, ss);
+
+        res.end(ss.str());
+        return;
+    });
 
-    thread_.reset(new boost::thread([this]()
+    if (!fleet.empty())
     {
-        this->impl_->run();
-    }));
+        impl_->route("/fleet/programs", [this, &fleet](cinatra::Request& /* req */, cinatra::Response& res)
+        {
+            auto programs = fleet.programs(std::string());
+
+            std::ostringstream ss;
+            {
+                cereal::JSONOutputArchive ar(ss);
+                ar(cereal::make_nvp("programs", programs));
+            }
+
+            res.end(ss.str());
+            return;
+        });
+
+        impl_->route("/fleet/state/:status", [this, &fleet](cinatra::Request& /* req */, cinatra::Response& res, const std::string& status)
+        {
+            auto programs = fleet.programs(status);
+
+            std::ostringstream ss;
+            {
+                cereal::JSONOutputArchive ar(ss);
+                ar(cereal::make_nvp("programs", programs));
+            }
+
+            res.end(ss.str());
+            return;
+        });
+
+        impl_->route("/fleet/peers", [this, &fleet](cinatra::Request& /* req */, cinatra::Response& res)
+        {
+            auto peers = fleet.peers();
+
+            std::ostringstream ss;
+            {
+                cereal::JSONOutputArchive ar(ss);
+                ar(cereal::make_nvp("peers", peers));
+            }
+
+            res.end(ss.str());
+            return;
+        });
+    }
+
+    impl_->listen(server.listen_address, static_cast<unsigned short>(server.port));
+
+    // the listeners are only set up here, the caller's io_service serves them
+    impl_->run();
+
+    WRITE_LOG(trace) << "http server listening >> " << server.listen_address << ":" << server.port;
 }
 
 void http_server::stop()
 {
-    if (impl_.get() == nullptr) {
+    if (impl_.get() == nullptr || stopped_) {
         return;
     }
 
     impl_->stop();
-    impl_.reset();
+    stopped_ = true;
+
+    // a scan waiting on a slow connection sees the stop and returns. the queue is
+    // drained rather than dropped, so every queued search ends its response
+    searches_stopping_ = true;
+    search_work_.reset();
+    std::for_each(search_threads_.begin(), search_threads_.end(),
+        [](boost::shared_ptr<boost::thread>& thread) {
+        thread->join();
+    }
+    );
+    search_threads_.clear();
+
+    // one posted while the threads were draining has nobody left to run it
+    search_service_.reset();
+    search_service_.poll();
 }
@@ -34,15 +34,71 @@
 #include "cinatra/cinatra.hpp"
 #include "http_struct.hpp"
 #include "process_manager.h"
+#include "fleet_aggregator.h"
+#include "history_store.h"
+#include "job_runner.h"
+#include "scheduler.h"
+#include "pressure_monitor.h"
+#include "autoscaler.h"
+#include "tcp_proxy.h"
+#include "output_store.h"
+#include "log_forwarder.h"
+#include "trace.h"
+
+
+//
+// records every request as one http span of the trace timeline.
+//
+struct http_trace_aspect
+{
+    struct Context
+    {
+        boost::uint64_t begin;
+    };
+
+    void before(cinatra::Request& /* req */, cinatra::Response& /* res */, cinatra::ContextContainer& ctx)
+    {
+        Context context = { trace_recorder::instance().enabled() ? trace_recorder::now() : 0 };
+        ctx.add_req_ctx(context);
+    }
+
+    void after(cinatra::Request& req, cinatra::Response& /* res */, cinatra::ContextContainer& ctx)
+    {
+        boost::uint64_t begin = ctx.get_req_ctx<http_trace_aspect>().begin;
+        if (begin != 0)
+        {
+            const std::string& path = req.path();
+            trace_recorder::instance().record("http", "request", begin, trace_recorder::now() - begin,
+                path.data(), path.size());
+        }
+    }
+};
 
 
 class http_server : boost::noncopyable
 {
 public:
-    void start(process_manager& pm, boost::system::error_code &ec);
+    http_server() :
+        stopped_(false), searches_stopping_(false)
+    {
+    }
+
+    // serves on the given io_service, which the caller runs
+    void start(boost::asio::io_service& io_service, process_manager& pm, const server_config& server, fleet_aggregator& fleet,
+        history_store& history, job_runner& jobs, scheduler& schedules,
+        pressure_monitor& pressure, autoscaler& scaler, tcp_proxy& proxy, output_store& output, log_forwarder& forwarder, const boost::filesystem::path& config_file, boost::system::error_code &ec);
+
+    // closes the listeners and ends the searches. the routes stay until the io_service
+    // has stopped, a request in flight may still be using them.
     void stop();
 
 private:
-	boost::shared_ptr<cinatra::Cinatra<> > impl_;
-	boost::shared_ptr<boost::thread> thread_;
+	boost::shared_ptr<cinatra::Cinatra<http_trace_aspect> > impl_;
+	bool stopped_;
+
+	// output searches read segment files, they run here instead of on the event loop
+	boost::asio::io_service search_service_;
+	boost::atomic<bool> searches_stopping_;
+	boost::shared_ptr<boost::asio::io_service::work> search_work_;
+	std::vector<boost::shared_ptr<boost::thread> > search_threads_;
 };
\ No newline at end of file
@@ -54,6 +54,14 @@ struct process_status
     std::string environment;
     unsigned long pid;
     unsigned long exit_code;
+    unsigned int instance;
+    std::string cpu_affinity;
+    int numa_node;
+    std::string priority_class;
+    int io_priority;
+    int memory_priority;
+    unsigned int restart_count;
+    unsigned long last_exit_code;
 
     template<class Archive>
     void save(Archive & ar) const
@@ -72,7 +80,15 @@ struct process_status
             CEREAL_NVP(environment),
             CEREAL_NVP(pid),
             CEREAL_NVP(exit_code),
-            CEREAL_NVP(status)
+            CEREAL_NVP(status),
+            CEREAL_NVP(instance),
+            CEREAL_NVP(cpu_affinity),
+            CEREAL_NVP(numa_node),
+            CEREAL_NVP(priority_class),
+            CEREAL_NVP(io_priority),
+            CEREAL_NVP(memory_priority),
+            CEREAL_NVP(restart_count),
+            CEREAL_NVP(last_exit_code)
         );
     }
 };
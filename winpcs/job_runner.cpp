@@ -0,0 +1,329 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	job_runner.cpp for running ad-hoc commands next to the managed programs.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "job_runner.h"
+#include "time_utils.h"
+#include "process_manager.h"
+
+
+namespace
+{
+    const DWORD poll_millisecond = 50;
+    const DWORD kill_wait_millisecond = 5000;
+}
+
+job_runner::job_runner() :
+    stopping_(true), next_id_(1)
+{
+}
+
+job_runner::~job_runner()
+{
+    stop();
+}
+
+bool job_runner::start(const jobs_config& config, boost::system::error_code& ec)
+{
+    if (config.max_concurrency == 0)
+    {
+        return true;
+    }
+
+    config_ = config;
+    stopping_ = false;
+
+    for (unsigned int i = 0; i < config_.max_concurrency; ++i)
+    {
+        workers_.create_thread(boost::bind(&job_runner::_run, this));
+    }
+
+    WRITE_LOG(trace) << "job runner started >> concurrency " << config_.max_concurrency;
+    return true;
+}
+
+void job_runner::stop()
+{
+    {
+        LOCK lock(mutex_);
+        if (stopping_)
+        {
+            return;
+        }
+        stopping_ = true;
+
+        // waiting jobs never start, running ones are killed by their worker
+        while (!queue_.empty())
+        {
+            queue_.top()->state = "cancelled";
+            queue_.top()->finish_time = boost::posix_time::microsec_clock::universal_time();
+            queue_.pop();
+        }
+    }
+
+    queue_cond_.notify_all();
+    workers_.join_all();
+
+    WRITE_LOG(trace) << "job runner stopped";
+}
+
+std::uint64_t job_runner::submit(const job_request& request)
+{
+    job_ptr item(new job);
+    item->priority = request.priority;
+    item->program = request.program;
+    item->timeout_second = request.timeout_second != 0 ? request.timeout_second : config_.timeout_second;
+    item->state = "queued";
+    item->submit_time = boost::posix_time::microsec_clock::universal_time();
+
+    {
+        LOCK lock(mutex_);
+        if (stopping_ || queue_.size() >= config_.max_queued)
+        {
+            return 0;
+        }
+
+        item->id = next_id_++;
+        queue_.push(item);
+        jobs_[item->id] = item;
+    }
+
+    queue_cond_.notify_one();
+
+    WRITE_LOG(trace) << "job queued >> " << item->id << " | " << item->program.name << " | priority " << item->priority;
+    return item->id;
+}
+
+bool job_runner::status(std::uint64_t id, job_status& status)
+{
+    LOCK lock(mutex_);
+
+    std::map<std::uint64_t, job_ptr>::iterator iter = jobs_.find(id);
+    if (iter == jobs_.end())
+    {
+        return false;
+    }
+
+    status = _status(*iter->second, true);
+    return true;
+}
+
+std::vector<job_status> job_runner::jobs()
+{
+    std::vector<job_status> result;
+
+    LOCK lock(mutex_);
+    result.reserve(jobs_.size());
+    std::for_each(jobs_.begin(), jobs_.end(), [this, &result](const std::pair<const std::uint64_t, job_ptr>& item)
+    {
+        result.push_back(_status(*item.second, false));
+    });
+
+    return result;
+}
+
+void job_runner::_run()
+{
+    for (;;)
+    {
+        job_ptr item;
+        {
+            LOCK lock(mutex_);
+            while (!stopping_ && queue_.empty())
+            {
+                queue_cond_.wait(lock);
+            }
+
+            if (stopping_)
+            {
+                return;
+            }
+
+            item = queue_.top();
+            queue_.pop();
+        }
+
+        _execute(item);
+    }
+}
+
+void job_runner::_execute(const job_ptr& item)
+{
+    // the child writes both of its outputs into one pipe, only the write end is inheritable
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    HANDLE read_pipe = NULL;
+    HANDLE write_pipe = NULL;
+    if (!CreatePipe(&read_pipe, &write_pipe, &sa, 0))
+    {
+        WRITE_LOG(error) << "create job pipe failed >> " << item->id << " | error :" << GetLastError();
+        _finish(item, "failed", 0);
+        return;
+    }
+    SCOPE_EXIT_REF(CloseHandle(read_pipe));
+    SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+    process_utils::spawn_options options = instance_spawn_options(item->program, 0);
+    options.std_output = write_pipe;
+    options.std_error = write_pipe;
+
+    unsigned long pid = 0;
+    HANDLE handle = NULL;
+    bool created = process_utils::create_process(item->program.process_name, item->program.command,
+        item->program.directory, options, pid, handle);
+
+    // the child holds its own copy, the pipe reports end of file once it exits
+    CloseHandle(write_pipe);
+
+    if (!created)
+    {
+        WRITE_LOG(error) << "job spawn failed >> " << item->id << " | " << item->program.command;
+        _finish(item, "failed", 0);
+        return;
+    }
+    SCOPE_EXIT_REF(CloseHandle(handle));
+
+    boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+    {
+        LOCK lock(mutex_);
+        item->state = "running";
+        item->pid = pid;
+        item->start_time = start_time;
+    }
+
+    WRITE_LOG(trace) << "job started >> " << item->id << " | " << item->program.name << " | pid " << pid;
+
+    boost::posix_time::ptime deadline = item->timeout_second != 0
+        ? start_time + boost::posix_time::seconds(item->timeout_second)
+        : boost::posix_time::ptime(boost::posix_time::pos_infin);
+
+    std::string state = "exited";
+    for (;;)
+    {
+        _read_output(read_pipe, item);
+
+        if (WaitForSingleObject(handle, poll_millisecond) == WAIT_OBJECT_0)
+        {
+            break;
+        }
+
+        if (stopping_)
+        {
+            state = "cancelled";
+        }
+        else if (boost::posix_time::microsec_clock::universal_time() >= deadline)
+        {
+            state = "timeout";
+        }
+        else
+        {
+            continue;
+        }
+
+        WRITE_LOG(warning) << "job killed >> " << item->id << " | " << item->program.name << " | " << state;
+        process_utils::kill_processes(handle, pid);
+        WaitForSingleObject(handle, kill_wait_millisecond);
+        break;
+    }
+
+    _read_output(read_pipe, item);
+
+    DWORD exit_code = 0;
+    GetExitCodeProcess(handle, &exit_code);
+    _finish(item, state, exit_code);
+}
+
+void job_runner::_read_output(HANDLE pipe, const job_ptr& item)
+{
+    const std::size_t limit = static_cast<std::size_t>(config_.output_kb) * 1024;
+    char buffer[4096];
+
+    // only what is already in the pipe is read, so a silent child never blocks its worker
+    DWORD available = 0;
+    while (PeekNamedPipe(pipe, NULL, 0, NULL, &available, NULL) && available != 0)
+    {
+        DWORD read = 0;
+        if (!ReadFile(pipe, buffer, (std::min)(available, static_cast<DWORD>(sizeof(buffer))), &read, NULL) || read == 0)
+        {
+            return;
+        }
+
+        LOCK lock(mutex_);
+        item->output.append(buffer, read);
+        if (item->output.size() > limit)
+        {
+            std::size_t excess = item->output.size() - limit;
+            item->output.erase(0, excess);
+            item->output_dropped += excess;
+        }
+    }
+}
+
+void job_runner::_finish(const job_ptr& item, const std::string& state, unsigned long exit_code)
+{
+    {
+        LOCK lock(mutex_);
+        item->state = state;
+        item->exit_code = exit_code;
+        item->finish_time = boost::posix_time::microsec_clock::universal_time();
+
+        // the oldest finished jobs are forgotten first
+        finished_.push_back(item->id);
+        while (finished_.size() > config_.keep_finished)
+        {
+            jobs_.erase(finished_.front());
+            finished_.pop_front();
+        }
+    }
+
+    WRITE_LOG(trace) << "job finished >> " << item->id << " | " << item->program.name << " | " << state << " | exit code " << exit_code;
+}
+
+job_status job_runner::_status(const job& item, bool with_output)
+{
+    job_status status;
+    status.id = item.id;
+    status.name = item.program.name;
+    status.command = item.program.command;
+    status.priority = item.priority;
+    status.state = item.state;
+    status.pid = item.pid;
+    status.exit_code = item.exit_code;
+    status.submit_time = time_utils::format_time(item.submit_time);
+    status.start_time = time_utils::format_time(item.start_time);
+    status.finish_time = time_utils::format_time(item.finish_time);
+    status.output_dropped = item.output_dropped;
+    if (with_output)
+    {
+        status.output = item.output;
+    }
+    return status;
+}
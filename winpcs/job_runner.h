@@ -0,0 +1,187 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	job_runner.h for running ad-hoc commands next to the managed programs.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <Windows.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <queue>
+#include <deque>
+#include <map>
+
+//
+// a job as posted to the /jobs route: the fields of a program plus its
+// priority and run time limit.
+//
+struct job_request
+{
+    job_request() :
+        priority(0), timeout_second(0)
+    {
+    }
+
+    process_config program;
+    int priority;                   // higher runs first, equal priorities run in submission order
+    unsigned int timeout_second;    // 0 for the configured default
+
+    template<class Archive>
+    void load(Archive & ar)
+    {
+        program.load(ar);
+
+        CEREAL_AR_NVP_DEFAULT(ar, priority, 0);
+        CEREAL_AR_NVP_DEFAULT(ar, timeout_second, 0);
+    }
+};
+
+//
+// a job as returned by the /jobs routes.
+//
+struct job_status
+{
+    std::uint64_t id;
+    std::string name;
+    std::string command;
+    int priority;
+    std::string state;              // queued, running, exited, timeout, failed or cancelled
+    unsigned long pid;
+    unsigned long exit_code;
+    std::string submit_time;
+    std::string start_time;
+    std::string finish_time;
+    std::string output;
+    std::uint64_t output_dropped;   // bytes of output dropped from the front
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(id),
+            CEREAL_NVP(name),
+            CEREAL_NVP(command),
+            CEREAL_NVP(priority),
+            CEREAL_NVP(state),
+            CEREAL_NVP(pid),
+            CEREAL_NVP(exit_code),
+            CEREAL_NVP(submit_time),
+            CEREAL_NVP(start_time),
+            CEREAL_NVP(finish_time),
+            CEREAL_NVP(output),
+            CEREAL_NVP(output_dropped)
+        );
+    }
+};
+
+//
+// runs ad-hoc commands on a fixed number of worker threads. waiting jobs
+// are ordered by priority, every job is spawned through the same path and
+// with the same scheduling options as a managed program, its output is
+// captured through a pipe into a bounded buffer, and it is killed with its
+// process tree once it runs past its time limit.
+//
+class job_runner : boost::noncopyable
+{
+public:
+    job_runner();
+    ~job_runner();
+
+    bool start(const jobs_config& config, boost::system::error_code& ec);
+    void stop();
+
+    // the id of the queued job, 0 when the runner is stopped or the queue is full
+    std::uint64_t submit(const job_request& request);
+
+    bool status(std::uint64_t id, job_status& status);
+
+    // every known job, without its output
+    std::vector<job_status> jobs();
+
+private:
+    struct job
+    {
+        job() :
+            id(0), priority(0), timeout_second(0), pid(0), exit_code(0), output_dropped(0)
+        {
+        }
+
+        std::uint64_t id;
+        int priority;
+        process_config program;
+        unsigned int timeout_second;
+        std::string state;
+        unsigned long pid;
+        unsigned long exit_code;
+        boost::posix_time::ptime submit_time;
+        boost::posix_time::ptime start_time;
+        boost::posix_time::ptime finish_time;
+        std::string output;
+        std::uint64_t output_dropped;
+    };
+
+    typedef boost::shared_ptr<job> job_ptr;
+
+    struct job_order
+    {
+        bool operator()(const job_ptr& left, const job_ptr& right) const
+        {
+            if (left->priority != right->priority)
+            {
+                return left->priority < right->priority;
+            }
+            return left->id > right->id;
+        }
+    };
+
+    void _run();
+    void _execute(const job_ptr& item);
+    void _read_output(HANDLE pipe, const job_ptr& item);
+    void _finish(const job_ptr& item, const std::string& state, unsigned long exit_code);
+    job_status _status(const job& item, bool with_output);
+
+    jobs_config config_;
+    boost::atomic<bool> stopping_;
+
+    MUTEX mutex_;
+    boost::condition_variable queue_cond_;
+    std::priority_queue<job_ptr, std::vector<job_ptr>, job_order> queue_;
+    std::map<std::uint64_t, job_ptr> jobs_;
+    std::deque<std::uint64_t> finished_;
+    std::uint64_t next_id_;
+
+    boost::thread_group workers_;
+};
@@ -0,0 +1,320 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	log_archiver.cpp for compressing and retiring rotated log files.
+*/
+
+#include "log_archiver.h"
+
+#include <Windows.h>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+
+namespace
+{
+    const char* const archive_extension = ".gz";
+    const char* const temp_extension = ".tmp";
+
+    bool has_extension(const boost::filesystem::path& file, const char* extension)
+    {
+        return file.extension().string() == extension;
+    }
+}
+
+log_archiver::log_archiver()
+{
+}
+
+log_archiver::~log_archiver()
+{
+    stop();
+}
+
+void log_archiver::add(const boost::filesystem::path& directory, const std::string& prefix, const std::vector<std::string>& extensions)
+{
+    LOCK lock(sets_mutex_);
+
+    log_set set;
+    set.directory = directory;
+    set.prefix = prefix;
+    set.extensions = extensions;
+    sets_.push_back(set);
+}
+
+bool log_archiver::_match(const log_set& set, const boost::filesystem::path& file) const
+{
+    std::string name = file.filename().string();
+    if (name.compare(0, set.prefix.size(), set.prefix) != 0)
+    {
+        return false;
+    }
+
+    boost::filesystem::path stem(name);
+    if (has_extension(stem, temp_extension))
+    {
+        stem = stem.stem();
+    }
+    if (has_extension(stem, archive_extension))
+    {
+        stem = stem.stem();
+    }
+
+    std::string extension = stem.extension().string();
+    return std::find(set.extensions.begin(), set.extensions.end(), extension) != set.extensions.end();
+}
+
+bool log_archiver::start(const log_retention_config& config, boost::system::error_code& ec)
+{
+    if (thread_)
+    {
+        return true;
+    }
+
+    config_ = config;
+    if (config_.scan_second == 0)
+    {
+        config_.scan_second = 60;
+    }
+
+    thread_.reset(new boost::thread(boost::bind(&log_archiver::_run, this)));
+
+    WRITE_LOG(trace) << "log archiver started >> sets >> " << sets_.size();
+    return true;
+}
+
+void log_archiver::stop()
+{
+    if (!thread_)
+    {
+        return;
+    }
+
+    thread_->interrupt();
+    thread_->join();
+    thread_.reset();
+
+    WRITE_LOG(trace) << "log archiver stopped";
+}
+
+void log_archiver::_run()
+{
+    // background mode lowers both the cpu and the io priority of this thread
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    try
+    {
+        for (;;)
+        {
+            std::vector<log_set> sets;
+            {
+                LOCK lock(sets_mutex_);
+                sets = sets_;
+            }
+
+            std::for_each(sets.begin(), sets.end(), [this](const log_set& set) {
+                this->_scan(set);
+            });
+
+            boost::this_thread::sleep_for(boost::chrono::seconds(config_.scan_second));
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+}
+
+bool log_archiver::_is_active(const boost::filesystem::path& file, std::time_t write_time) const
+{
+    std::string today = boost::gregorian::to_iso_extended_string(boost::gregorian::day_clock::local_day());
+    if (file.filename().string().find(today) != std::string::npos)
+    {
+        return true;
+    }
+
+    return std::time(nullptr) - write_time < static_cast<std::time_t>(config_.idle_second);
+}
+
+void log_archiver::_scan(const log_set& set)
+{
+    boost::system::error_code ec;
+    std::vector<log_file> files;
+
+    for (boost::filesystem::directory_iterator iter(set.directory, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        const boost::filesystem::path& file = iter->path();
+        if (!_match(set, file) || !boost::filesystem::is_regular_file(file, ec))
+        {
+            continue;
+        }
+
+        // a left over from an interrupted compression
+        if (has_extension(file, temp_extension))
+        {
+            boost::filesystem::remove(file, ec);
+            continue;
+        }
+
+        log_file entry;
+        entry.path = file;
+        entry.write_time = boost::filesystem::last_write_time(file, ec);
+        entry.size = boost::filesystem::file_size(file, ec);
+        if (ec || _is_active(file, entry.write_time))
+        {
+            ec.clear();
+            continue;
+        }
+
+        files.push_back(entry);
+    }
+
+    if (config_.compress)
+    {
+        std::for_each(files.begin(), files.end(), [this](log_file& entry) {
+            if (has_extension(entry.path, archive_extension))
+            {
+                return;
+            }
+
+            boost::system::error_code ec;
+            boost::filesystem::path archive(entry.path.string() + archive_extension);
+            if (!this->_compress(entry.path, ec))
+            {
+                WRITE_LOG(warning) << "compress log failed >> " << entry.path.string() << " | " << ec.message();
+                return;
+            }
+
+            // the archive keeps the time of the original for the age limit
+            boost::filesystem::last_write_time(archive, entry.write_time, ec);
+            entry.path = archive;
+            entry.size = boost::filesystem::file_size(archive, ec);
+        });
+    }
+
+    _retain(files);
+}
+
+bool log_archiver::_compress(const boost::filesystem::path& file, boost::system::error_code& ec)
+{
+    boost::filesystem::path archive(file.string() + archive_extension);
+    boost::filesystem::path temp(archive.string() + temp_extension);
+
+    {
+        std::ifstream in(file.string(), std::ios::binary);
+        std::ofstream out(temp.string(), std::ios::binary | std::ios::trunc);
+        if (!in || !out)
+        {
+            ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+            return false;
+        }
+
+        boost::iostreams::filtering_ostream gz;
+        gz.push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(boost::iostreams::gzip::default_compression)));
+        gz.push(out);
+
+        // read in chunks and sleep between them to stay under the configured rate
+        const std::size_t chunk_size = 64 * 1024;
+        boost::scoped_array<char> chunk(new char[chunk_size]);
+        boost::chrono::steady_clock::time_point begin = boost::chrono::steady_clock::now();
+        boost::uintmax_t total = 0;
+
+        while (in)
+        {
+            in.read(chunk.get(), chunk_size);
+            std::streamsize n = in.gcount();
+            if (n <= 0)
+            {
+                break;
+            }
+
+            gz.write(chunk.get(), n);
+            total += n;
+
+            if (config_.compress_kb_per_second != 0)
+            {
+                boost::chrono::milliseconds due(total * 1000 / (config_.compress_kb_per_second * 1024ULL));
+                boost::chrono::steady_clock::duration spent = boost::chrono::steady_clock::now() - begin;
+                if (due > spent)
+                {
+                    // interruption leaves the temp file for the next scan to clean up
+                    boost::this_thread::sleep_for(due - spent);
+                }
+            }
+        }
+
+        boost::iostreams::close(gz);
+        if (!out)
+        {
+            ec = boost::system::error_code(ERROR_WRITE_FAULT, boost::system::system_category());
+            return false;
+        }
+    }
+
+    // the archive appears complete or not at all
+    if (!MoveFileEx(temp.string().c_str(), archive.string().c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        boost::system::error_code ignore;
+        boost::filesystem::remove(temp, ignore);
+        return false;
+    }
+
+    boost::filesystem::remove(file, ec);
+
+    WRITE_LOG(trace) << "log compressed >> " << archive.string();
+    return !ec;
+}
+
+void log_archiver::_retain(std::vector<log_file>& files)
+{
+    // newest first, everything past a limit goes
+    std::sort(files.begin(), files.end(), [](const log_file& a, const log_file& b) {
+        return a.write_time > b.write_time;
+    });
+
+    std::time_t oldest = std::time(nullptr) - static_cast<std::time_t>(config_.max_age_day) * 24 * 3600;
+    boost::uintmax_t max_total = static_cast<boost::uintmax_t>(config_.max_total_mb) * 1024 * 1024;
+    boost::uintmax_t total = 0;
+    std::size_t count = 0;
+
+    std::for_each(files.begin(), files.end(), [&](const log_file& entry) {
+        ++count;
+        total += entry.size;
+
+        if ((config_.max_files != 0 && count > config_.max_files) ||
+            (config_.max_age_day != 0 && entry.write_time < oldest) ||
+            (config_.max_total_mb != 0 && total > max_total))
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove(entry.path, ec);
+            WRITE_LOG(trace) << "log retired >> " << entry.path.string();
+        }
+    });
+}
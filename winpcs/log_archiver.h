@@ -0,0 +1,84 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	log_archiver.h for compressing and retiring rotated log files.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <boost/filesystem.hpp>
+
+//
+// compresses rotated log files with gzip on a background thread and keeps
+// each set of logs within its count, age and size limits. the live file of
+// a set is never touched, so writers never wait on the archiver.
+//
+class log_archiver : boost::noncopyable
+{
+public:
+    log_archiver();
+    ~log_archiver();
+
+    // a set is every file in the directory whose name starts with prefix and
+    // ends with one of the extensions, or with one of them and ".gz"
+    void add(const boost::filesystem::path& directory, const std::string& prefix, const std::vector<std::string>& extensions);
+
+    bool start(const log_retention_config& config, boost::system::error_code& ec);
+    void stop();
+
+private:
+    struct log_set
+    {
+        boost::filesystem::path directory;
+        std::string prefix;
+        std::vector<std::string> extensions;
+    };
+
+    struct log_file
+    {
+        boost::filesystem::path path;
+        std::time_t write_time;
+        boost::uintmax_t size;
+    };
+
+    void _run();
+    bool _match(const log_set& set, const boost::filesystem::path& file) const;
+    void _scan(const log_set& set);
+    bool _compress(const boost::filesystem::path& file, boost::system::error_code& ec);
+    void _retain(std::vector<log_file>& files);
+    bool _is_active(const boost::filesystem::path& file, std::time_t write_time) const;
+
+    log_retention_config config_;
+
+    MUTEX sets_mutex_;
+    std::vector<log_set> sets_;
+
+    boost::shared_ptr<boost::thread> thread_;
+};
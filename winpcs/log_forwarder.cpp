@@ -0,0 +1,633 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	log_forwarder.cpp for shipping child output and the supervisor's log to a collector.
+*/
+
+#define WINPCS_LOG_MODULE log_general
+
+#include "log_forwarder.h"
+#include "time_utils.h"
+
+#include <Windows.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+#include <cstdlib>
+#include <fstream>
+
+using boost::asio::ip::tcp;
+
+namespace
+{
+    const char* const spill_extension = ".batch";
+
+    // RFC 5424 facilities
+    const int facility_user = 1;
+    const int facility_daemon = 3;
+
+    // RFC 5424 severities
+    const int severity_error = 3;
+    const int severity_warning = 4;
+    const int severity_info = 6;
+
+    // header fields are printable ascii without spaces, "-" when empty
+    std::string header_field(const std::string& value, std::size_t limit)
+    {
+        if (value.empty())
+        {
+            return "-";
+        }
+
+        std::string field = value.substr(0, limit);
+        std::for_each(field.begin(), field.end(), [](char& c) {
+            if (c < 33 || c > 126)
+            {
+                c = '_';
+            }
+        });
+        return field;
+    }
+
+    void append_json_string(std::string& out, const char* text, std::size_t size)
+    {
+        out += '"';
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            switch (c)
+            {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20)
+                {
+                    char escaped[8];
+                    sprintf_s(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+                    out += escaped;
+                }
+                else
+                {
+                    out += static_cast<char>(c);
+                }
+            }
+        }
+        out += '"';
+    }
+
+    std::string gzip(const std::string& data)
+    {
+        std::string compressed;
+        boost::iostreams::filtering_ostream gz;
+        gz.push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(boost::iostreams::gzip::default_compression)));
+        gz.push(boost::iostreams::back_inserter(compressed));
+        gz.write(data.data(), data.size());
+        boost::iostreams::close(gz);
+        return compressed;
+    }
+}
+
+log_forwarder::log_forwarder() :
+    json_(false),
+    socket_(io_service_),
+    timeout_(io_service_),
+    wait_(io_service_),
+    backoff_ms_(0),
+    stopping_(false),
+    queued_bytes_(0),
+    spilled_bytes_(0),
+    spill_sequence_(0)
+{
+    stats_.connected = false;
+    stats_.records = 0;
+    stats_.sent_bytes = 0;
+    stats_.dropped_bytes = 0;
+    stats_.queued_bytes = 0;
+    stats_.spilled_bytes = 0;
+    stats_.spill_files = 0;
+    stats_.reconnects = 0;
+}
+
+log_forwarder::~log_forwarder()
+{
+    stop();
+}
+
+bool log_forwarder::start(const forward_config& config, boost::system::error_code& ec)
+{
+    if (thread_ != 0 || !config.enabled())
+    {
+        return true;
+    }
+
+    config_ = config;
+    config_.batch_kb = (std::max)(config_.batch_kb, 1u);
+    config_.batch_ms = (std::max)(config_.batch_ms, 1u);
+    config_.min_backoff_ms = (std::max)(config_.min_backoff_ms, 1u);
+    config_.max_backoff_ms = (std::max)(config_.max_backoff_ms, config_.min_backoff_ms);
+    config_.timeout_second = (std::max)(config_.timeout_second, 1u);
+    json_ = (config_.format == "json");
+
+    std::string::size_type colon = config_.address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == config_.address.size())
+    {
+        ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        WRITE_LOG(error) << "forward address is not host:port >> " << config_.address;
+        return false;
+    }
+    host_ = config_.address.substr(0, colon);
+    port_ = config_.address.substr(colon + 1);
+
+    char name[MAX_COMPUTERNAME_LENGTH + 1] = { 0 };
+    DWORD length = sizeof(name);
+    hostname_ = GetComputerNameA(name, &length) ? std::string(name, length) : std::string();
+    pid_ = std::to_string(static_cast<unsigned long>(GetCurrentProcessId()));
+
+    _load_spill();
+
+    stats_.address = config_.address;
+    stats_.format = json_ ? "json" : "syslog";
+    backoff_ms_ = config_.min_backoff_ms;
+    stopping_ = false;
+
+    asio_work_.reset(new boost::asio::io_service::work(io_service_));
+    boost::asio::spawn(io_service_, boost::bind(&log_forwarder::_send_loop, this, _1));
+
+    thread_.reset(new boost::thread([this]()
+    {
+        this->io_service_.run();
+    }));
+
+    WRITE_LOG(trace) << "log forwarder started >> " << config_.address << " | " << stats_.format
+        << " | spilled batches >> " << spill_files_.size();
+    return true;
+}
+
+void log_forwarder::stop()
+{
+    if (thread_ == 0)
+    {
+        return;
+    }
+
+    stopping_ = true;
+    asio_work_.reset();
+    io_service_.stop();
+    thread_->join();
+    thread_.reset();
+
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
+
+    // whatever was not sent waits on disk for the next start
+    LOCK lock(mutex_);
+    if (!inflight_.empty() && inflight_file_.empty())
+    {
+        _spill(inflight_);
+    }
+    inflight_.clear();
+    inflight_file_.clear();
+
+    std::for_each(queue_.begin(), queue_.end(), [this](batch& item) {
+        if (!item.data.empty())
+        {
+            this->_spill(item.data);
+        }
+    });
+    queue_.clear();
+    queued_bytes_ = 0;
+
+    WRITE_LOG(trace) << "log forwarder stopped >> spilled batches >> " << spill_files_.size();
+}
+
+bool log_forwarder::enabled()
+{
+    return thread_ != 0;
+}
+
+void log_forwarder::forward_output(const std::string& name, const std::string& key, std::uint64_t time, const char* text, std::size_t size)
+{
+    if (thread_ == 0 || stopping_)
+    {
+        return;
+    }
+
+    std::string record;
+    record.reserve(size + 128);
+
+    if (json_)
+    {
+        record = "{\"time\":\"" + time_utils::format_time(time) + "\",\"host\":";
+        append_json_string(record, hostname_.data(), hostname_.size());
+        record += ",\"program\":";
+        append_json_string(record, name.data(), name.size());
+        record += ",\"instance\":";
+        append_json_string(record, key.data(), key.size());
+        record += ",\"severity\":\"info\",\"message\":";
+        append_json_string(record, text, size);
+        record += "}\n";
+    }
+    else
+    {
+        record = "<" + std::to_string(facility_user * 8 + severity_info) + ">1 " + time_utils::format_time(time) + " " +
+            header_field(hostname_, 255) + " " + header_field(name, 48) + " " + header_field(key, 128) + " - - ";
+        record.append(text, size);
+    }
+
+    _push(record);
+}
+
+void log_forwarder::forward_log(severity_level level, const std::string& message)
+{
+    if (thread_ == 0 || stopping_)
+    {
+        return;
+    }
+
+    std::string record;
+    std::string text = message;
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+    {
+        text.pop_back();
+    }
+
+    if (json_)
+    {
+        static const char* const names[] = { "info", "warning", "error" };
+        record = "{\"time\":\"" + time_utils::format_time(time_utils::now()) + "\",\"host\":";
+        append_json_string(record, hostname_.data(), hostname_.size());
+        record += ",\"program\":\"winpcs\",\"instance\":\"" + pid_ + "\",\"severity\":\"" + names[level] + "\",\"message\":";
+        append_json_string(record, text.data(), text.size());
+        record += "}\n";
+    }
+    else
+    {
+        int severity = level == error ? severity_error : level == warning ? severity_warning : severity_info;
+        record = "<" + std::to_string(facility_daemon * 8 + severity) + ">1 " + time_utils::format_time(time_utils::now()) + " " +
+            header_field(hostname_, 255) + " winpcs " + pid_ + " - - " + text;
+    }
+
+    _push(record);
+}
+
+forward_status log_forwarder::status()
+{
+    LOCK lock(mutex_);
+    forward_status result = stats_;
+    result.queued_bytes = queued_bytes_;
+    result.spilled_bytes = spilled_bytes_;
+    result.spill_files = spill_files_.size();
+    return result;
+}
+
+void log_forwarder::_push(std::string& record)
+{
+    if (!json_)
+    {
+        // octet counting, a message may hold any byte
+        record = std::to_string(record.size()) + " " + record;
+    }
+
+    bool wake = false;
+    {
+        LOCK lock(mutex_);
+
+        ++stats_.records;
+        if (queue_.empty() || queue_.back().data.size() >= config_.batch_kb * 1024)
+        {
+            wake = !queue_.empty();
+            queue_.push_back(batch());
+            queue_.back().created = boost::posix_time::microsec_clock::universal_time();
+        }
+        queue_.back().data += record;
+        queued_bytes_ += record.size();
+
+        while (queued_bytes_ > static_cast<std::uint64_t>(config_.queue_kb) * 1024 && queue_.size() > 1)
+        {
+            queued_bytes_ -= queue_.front().data.size();
+            _spill(queue_.front().data);
+            queue_.pop_front();
+        }
+    }
+
+    if (wake)
+    {
+        // a batch is full, the send loop does not wait out batch_ms for it
+        io_service_.post([this]() {
+            boost::system::error_code ignored_ec;
+            this->wait_.cancel(ignored_ec);
+        });
+    }
+}
+
+void log_forwarder::_spill(std::string& data)
+{
+    // called with mutex_ held
+    if (config_.spill_directory.empty() || data.size() > static_cast<std::uint64_t>(config_.spill_mb) * 1024 * 1024)
+    {
+        stats_.dropped_bytes += data.size();
+        WRITE_LOG_LIMIT(warning, 1, 60) << "forward batch dropped, no room to spill it >> " << data.size();
+        return;
+    }
+
+    while (!spill_files_.empty() && spilled_bytes_ + data.size() > static_cast<std::uint64_t>(config_.spill_mb) * 1024 * 1024)
+    {
+        // the send loop may be reading the oldest one, it is sent again if it cannot be removed
+        boost::system::error_code ec;
+        boost::filesystem::remove(spill_files_.front().first, ec);
+        spilled_bytes_ -= spill_files_.front().second;
+        stats_.dropped_bytes += spill_files_.front().second;
+        spill_files_.pop_front();
+        WRITE_LOG_LIMIT(warning, 1, 60) << "spill directory full, oldest forward batch dropped >> " << config_.spill_directory;
+    }
+
+    char name[32];
+    sprintf_s(name, sizeof(name), "%020llu", static_cast<unsigned long long>(++spill_sequence_));
+    boost::filesystem::path file = boost::filesystem::path(config_.spill_directory) / (std::string(name) + spill_extension);
+
+    std::ofstream out(file.string().c_str(), std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out)
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(file, ec);
+        stats_.dropped_bytes += data.size();
+        WRITE_LOG_LIMIT(error, 1, 60) << "write spill file failed >> " << file.string();
+        return;
+    }
+
+    spill_files_.push_back(std::make_pair(file, static_cast<std::uint64_t>(data.size())));
+    spilled_bytes_ += data.size();
+}
+
+void log_forwarder::_load_spill()
+{
+    if (config_.spill_directory.empty())
+    {
+        return;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::path directory(config_.spill_directory);
+    boost::filesystem::create_directories(directory, ec);
+    if (ec)
+    {
+        WRITE_LOG(error) << "create spill directory failed, batches are dropped while the collector is down >> "
+            << config_.spill_directory << " | " << ec.message();
+        config_.spill_directory.clear();
+        return;
+    }
+
+    // the names are the zero padded sequence, so they sort oldest first
+    std::vector<boost::filesystem::path> files;
+    for (boost::filesystem::directory_iterator iter(directory, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        if (iter->path().extension() == spill_extension)
+        {
+            files.push_back(iter->path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    LOCK lock(mutex_);
+    std::for_each(files.begin(), files.end(), [this](const boost::filesystem::path& file) {
+        boost::system::error_code size_ec;
+        std::uint64_t size = boost::filesystem::file_size(file, size_ec);
+        if (size_ec)
+        {
+            return;
+        }
+
+        this->spill_files_.push_back(std::make_pair(file, size));
+        this->spilled_bytes_ += size;
+        this->spill_sequence_ = (std::max)(this->spill_sequence_,
+            static_cast<std::uint64_t>(std::strtoull(file.stem().string().c_str(), NULL, 10)));
+    });
+}
+
+bool log_forwarder::_take()
+{
+    // the oldest data goes first, the spill files hold batches older than the queue
+    boost::filesystem::path file;
+    {
+        LOCK lock(mutex_);
+
+        if (spill_files_.empty())
+        {
+            if (queue_.empty())
+            {
+                return false;
+            }
+
+            batch& front = queue_.front();
+            if (queue_.size() == 1 && front.data.size() < config_.batch_kb * 1024 &&
+                boost::posix_time::microsec_clock::universal_time() - front.created < boost::posix_time::milliseconds(config_.batch_ms))
+            {
+                return false;
+            }
+
+            inflight_.swap(front.data);
+            queued_bytes_ -= inflight_.size();
+            queue_.pop_front();
+            return !inflight_.empty();
+        }
+
+        file = spill_files_.front().first;
+    }
+
+    std::ifstream in(file.string().c_str(), std::ios::binary);
+    inflight_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    inflight_file_ = file;
+
+    if (!in.is_open())
+    {
+        // dropped to make room meanwhile, or removed from outside
+        LOCK lock(mutex_);
+        if (!spill_files_.empty() && spill_files_.front().first == file)
+        {
+            spilled_bytes_ -= spill_files_.front().second;
+            spill_files_.pop_front();
+        }
+        inflight_.clear();
+        inflight_file_.clear();
+        return _take();
+    }
+
+    return !inflight_.empty();
+}
+
+void log_forwarder::_send_loop(boost::asio::yield_context yield)
+{
+    while (!stopping_)
+    {
+        if (inflight_.empty() && !_take())
+        {
+            if (!inflight_file_.empty())
+            {
+                // an empty spill file
+                boost::system::error_code ignored_ec;
+                boost::filesystem::remove(inflight_file_, ignored_ec);
+
+                LOCK lock(mutex_);
+                if (!spill_files_.empty() && spill_files_.front().first == inflight_file_)
+                {
+                    spill_files_.pop_front();
+                }
+                inflight_file_.clear();
+                continue;
+            }
+
+            _wait(config_.batch_ms, yield);
+            continue;
+        }
+
+        if (!socket_.is_open() && !_connect(yield))
+        {
+            _wait(backoff_ms_, yield);
+            backoff_ms_ = (std::min)(backoff_ms_ * 2, config_.max_backoff_ms);
+            continue;
+        }
+
+        if (!_write(config_.compress ? gzip(inflight_) : inflight_, yield))
+        {
+            // the whole batch goes again on the next connection
+            boost::system::error_code ignored_ec;
+            socket_.close(ignored_ec);
+            _wait(backoff_ms_, yield);
+            backoff_ms_ = (std::min)(backoff_ms_ * 2, config_.max_backoff_ms);
+            continue;
+        }
+
+        LOCK lock(mutex_);
+        stats_.sent_bytes += inflight_.size();
+        if (!inflight_file_.empty())
+        {
+            boost::system::error_code ignored_ec;
+            boost::filesystem::remove(inflight_file_, ignored_ec);
+            if (!spill_files_.empty() && spill_files_.front().first == inflight_file_)
+            {
+                spilled_bytes_ -= spill_files_.front().second;
+                spill_files_.pop_front();
+            }
+            inflight_file_.clear();
+        }
+        inflight_.clear();
+    }
+}
+
+bool log_forwarder::_connect(boost::asio::yield_context& yield)
+{
+    boost::system::error_code ec;
+
+    // closing the socket fails whatever operation is still pending
+    timeout_.expires_from_now(boost::posix_time::seconds(config_.timeout_second));
+    timeout_.async_wait([this](const boost::system::error_code& timeout_ec)
+    {
+        if (!timeout_ec)
+        {
+            boost::system::error_code ignored_ec;
+            this->socket_.close(ignored_ec);
+        }
+    });
+    SCOPE_EXIT(timeout_.cancel());
+
+    tcp::resolver resolver(io_service_);
+    tcp::resolver::iterator endpoints = resolver.async_resolve(tcp::resolver::query(host_, port_), yield[ec]);
+    if (!ec)
+    {
+        boost::asio::async_connect(socket_, endpoints, yield[ec]);
+    }
+
+    if (ec)
+    {
+        boost::system::error_code ignored_ec;
+        socket_.close(ignored_ec);
+        _fail("connect failed: " + ec.message());
+        return false;
+    }
+
+    socket_.set_option(tcp::no_delay(true), ec);
+    backoff_ms_ = config_.min_backoff_ms;
+
+    LOCK lock(mutex_);
+    ++stats_.reconnects;
+    stats_.connected = true;
+    WRITE_LOG(trace) << "log forwarder connected >> " << config_.address;
+    return true;
+}
+
+bool log_forwarder::_write(const std::string& data, boost::asio::yield_context& yield)
+{
+    boost::system::error_code ec;
+
+    timeout_.expires_from_now(boost::posix_time::seconds(config_.timeout_second));
+    timeout_.async_wait([this](const boost::system::error_code& timeout_ec)
+    {
+        if (!timeout_ec)
+        {
+            boost::system::error_code ignored_ec;
+            this->socket_.close(ignored_ec);
+        }
+    });
+    SCOPE_EXIT(timeout_.cancel());
+
+    boost::asio::async_write(socket_, boost::asio::buffer(data), yield[ec]);
+    if (ec)
+    {
+        _fail("send failed: " + ec.message());
+        return false;
+    }
+
+    return true;
+}
+
+void log_forwarder::_wait(unsigned int ms, boost::asio::yield_context& yield)
+{
+    boost::system::error_code ec;
+    wait_.expires_from_now(boost::posix_time::milliseconds(ms));
+    wait_.async_wait(yield[ec]);
+}
+
+void log_forwarder::_fail(const std::string& error)
+{
+    {
+        LOCK lock(mutex_);
+        stats_.connected = false;
+        stats_.last_error = error;
+    }
+
+    // once a minute at most, while the collector is down this goes to the spill as well
+    WRITE_LOG_LIMIT(warning, 1, 60) << "log forwarder >> " << config_.address << " | " << error;
+}
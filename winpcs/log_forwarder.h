@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	log_forwarder.h for shipping child output and the supervisor's log to a collector.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <boost/asio/spawn.hpp>
+#include <boost/atomic.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/archives/json.hpp>
+
+#include <deque>
+
+struct forward_status
+{
+    std::string address;
+    std::string format;
+    bool connected;
+    std::uint64_t records;          // accepted since start
+    std::uint64_t sent_bytes;       // framed, before compression
+    std::uint64_t dropped_bytes;    // did not fit the spill directory
+    std::uint64_t queued_bytes;
+    std::uint64_t spilled_bytes;
+    std::size_t spill_files;
+    unsigned int reconnects;
+    std::string last_error;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(address),
+            CEREAL_NVP(format),
+            CEREAL_NVP(connected),
+            CEREAL_NVP(records),
+            CEREAL_NVP(sent_bytes),
+            CEREAL_NVP(dropped_bytes),
+            CEREAL_NVP(queued_bytes),
+            CEREAL_NVP(spilled_bytes),
+            CEREAL_NVP(spill_files),
+            CEREAL_NVP(reconnects),
+            CEREAL_NVP(last_error)
+        );
+    }
+};
+
+//
+// forwards records over one tcp connection to a collector, as RFC 5424
+// syslog messages framed by octet counting (RFC 6587) or as one json object
+// per line. records are framed as they arrive and collected into batches of
+// batch_kb, a batch is written once it is full or batch_ms passed, as one
+// gzip member when compress is set.
+//
+// past queue_kb in memory the oldest batches go to files in the spill
+// directory, which are sent first once the collector is back, oldest first,
+// and the oldest are dropped past spill_mb. the queue is spilled on stop and
+// sent on the next start. a batch cut by a failed write is sent again whole,
+// so the collector may see a record twice but never misses one it was given.
+//
+class log_forwarder : boost::noncopyable
+{
+public:
+    log_forwarder();
+    ~log_forwarder();
+
+    bool start(const forward_config& config, boost::system::error_code& ec);
+    void stop();
+
+    bool enabled();
+
+    // a line of captured output, time in microseconds since the unix epoch
+    void forward_output(const std::string& name, const std::string& key, std::uint64_t time, const char* text, std::size_t size);
+
+    // a record of the supervisor's own log
+    void forward_log(severity_level level, const std::string& message);
+
+    forward_status status();
+
+private:
+    struct batch
+    {
+        std::string data;
+        boost::posix_time::ptime created;
+    };
+
+    void _push(std::string& record);
+    void _spill(std::string& data);
+    void _load_spill();
+    bool _take();
+    void _send_loop(boost::asio::yield_context yield);
+    bool _connect(boost::asio::yield_context& yield);
+    bool _write(const std::string& data, boost::asio::yield_context& yield);
+    void _wait(unsigned int ms, boost::asio::yield_context& yield);
+    void _fail(const std::string& error);
+
+    forward_config config_;
+    bool json_;
+    std::string host_;
+    std::string port_;
+    std::string hostname_;
+    std::string pid_;
+
+    boost::asio::io_service io_service_;
+    boost::shared_ptr<boost::asio::io_service::work> asio_work_;
+    boost::shared_ptr<boost::thread> thread_;
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::deadline_timer timeout_;
+    boost::asio::deadline_timer wait_;
+    unsigned int backoff_ms_;
+    boost::atomic<bool> stopping_;
+
+    // owned by the send loop, the batch being sent and the spill file it came from
+    std::string inflight_;
+    boost::filesystem::path inflight_file_;
+
+    MUTEX mutex_;
+    std::deque<batch> queue_;           // the last one is filling
+    std::uint64_t queued_bytes_;
+    std::deque<std::pair<boost::filesystem::path, std::uint64_t> > spill_files_;    // oldest first
+    std::uint64_t spilled_bytes_;
+    std::uint64_t spill_sequence_;
+    forward_status stats_;
+};
@@ -0,0 +1,335 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	log_ring_queue.h for the per thread rings behind the asynchronous log sinks.
+*/
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/log/core/record_view.hpp>
+
+#include <algorithm>
+#include <vector>
+
+
+// records one thread's ring holds before the overflow policy applies
+#define LOG_RING_SIZE 4096
+
+// what the asynchronous sinks do when the writer thread falls behind.
+enum log_overflow_policy
+{
+	overflow_unbounded,		// a full ring gets another one chained behind it
+	overflow_block,			// the logging thread waits for room in its ring
+	overflow_drop			// the record is discarded
+};
+
+//
+// the queueing strategy of the asynchronous sinks. every logging thread
+// pushes into a single producer ring of its own, so a log call shares no
+// lock with the other threads. the writer thread merges the rings by the
+// sequence taken at enqueue, the records leave in the order they were logged.
+//
+template <log_overflow_policy Policy>
+class thread_ring_queue
+{
+protected:
+    thread_ring_queue() :
+        sequence_(0), version_(0), seen_version_(static_cast<unsigned int>(-1)), sleeping_(false), interrupted_(false)
+    {
+    }
+
+    template <typename ArgsT>
+    explicit thread_ring_queue(ArgsT const&) :
+        sequence_(0), version_(0), seen_version_(static_cast<unsigned int>(-1)), sleeping_(false), interrupted_(false)
+    {
+    }
+
+    void enqueue(boost::log::record_view const& rec)
+    {
+        _push(rec, Policy == overflow_block);
+    }
+
+    bool try_enqueue(boost::log::record_view const& rec)
+    {
+        return _push(rec, false);
+    }
+
+    bool try_dequeue_ready(boost::log::record_view& rec)
+    {
+        return _pop(rec);
+    }
+
+    bool try_dequeue(boost::log::record_view& rec)
+    {
+        return _pop(rec);
+    }
+
+    // the writer thread, false when woken by interrupt_dequeue
+    bool dequeue_ready(boost::log::record_view& rec)
+    {
+        for (;;)
+        {
+            if (_pop(rec))
+            {
+                return true;
+            }
+
+            boost::mutex::scoped_lock lock(wait_mutex_);
+            if (interrupted_.exchange(false))
+            {
+                return false;
+            }
+
+            // a producer that pushes after this sees sleeping_ and wakes the writer
+            sleeping_.store(true);
+            if (_pop(rec))
+            {
+                sleeping_.store(false);
+                return true;
+            }
+
+            wait_.timed_wait(lock, boost::posix_time::milliseconds(100));
+            sleeping_.store(false);
+        }
+    }
+
+    void interrupt_dequeue()
+    {
+        boost::mutex::scoped_lock lock(wait_mutex_);
+        interrupted_.store(true);
+        wait_.notify_one();
+    }
+
+private:
+    struct entry
+    {
+        entry() :
+            sequence(0)
+        {
+        }
+
+        boost::uint64_t sequence;
+        boost::log::record_view rec;
+    };
+
+    struct ring
+    {
+        ring() :
+            queue(LOG_RING_SIZE), next(NULL)
+        {
+        }
+
+        boost::lockfree::spsc_queue<entry> queue;
+        boost::atomic<ring*> next;      // the ring the producer moved on to once this one was full
+    };
+
+    // the rings of one thread, the writer reads from head and the thread pushes to tail
+    struct chain : boost::noncopyable
+    {
+        chain() :
+            head(new ring), tail(head), orphaned(false)
+        {
+        }
+
+        ~chain()
+        {
+            while (head != NULL)
+            {
+                ring* next = head->next.load();
+                delete head;
+                head = next;
+            }
+        }
+
+        ring* head;
+        ring* tail;
+        boost::atomic<bool> orphaned;
+    };
+
+    // owned by the thread local pointer, marks the chain orphaned on thread exit
+    struct chain_holder
+    {
+        ~chain_holder()
+        {
+            owned->orphaned.store(true);
+        }
+
+        boost::shared_ptr<chain> owned;
+    };
+
+    chain& _local_chain()
+    {
+        chain_holder* holder = local_.get();
+        if (holder == NULL)
+        {
+            holder = new chain_holder;
+            holder->owned = boost::make_shared<chain>();
+            local_.reset(holder);
+
+            // the only lock a logging thread takes, once
+            boost::mutex::scoped_lock lock(chains_mutex_);
+            chains_.push_back(holder->owned);
+            version_.fetch_add(1, boost::memory_order_release);
+        }
+
+        return *holder->owned;
+    }
+
+    bool _push(boost::log::record_view const& rec, bool block)
+    {
+        chain& local = _local_chain();
+
+        entry item;
+        item.sequence = sequence_.fetch_add(1, boost::memory_order_relaxed);
+        item.rec = rec;
+
+        while (!local.tail->queue.push(item))
+        {
+            if (Policy == overflow_unbounded)
+            {
+                ring* next = new ring;
+                local.tail->next.store(next, boost::memory_order_release);
+                local.tail = next;
+                continue;
+            }
+
+            if (!block)
+            {
+                return false;
+            }
+
+            boost::this_thread::yield();
+        }
+
+        if (sleeping_.load())
+        {
+            boost::mutex::scoped_lock lock(wait_mutex_);
+            wait_.notify_one();
+        }
+        return true;
+    }
+
+    // the writer's view of the head ring of a chain, empty rings the producer left are freed
+    static ring* _head(chain& item)
+    {
+        for (;;)
+        {
+            ring* head = item.head;
+            if (head->queue.read_available() != 0)
+            {
+                return head;
+            }
+
+            // the producer never goes back to a ring once it has linked the next one
+            ring* next = head->next.load(boost::memory_order_acquire);
+            if (next == NULL || head->queue.read_available() != 0)
+            {
+                return head->queue.read_available() != 0 ? head : NULL;
+            }
+
+            item.head = next;
+            delete head;
+        }
+    }
+
+    bool _pop(boost::log::record_view& rec)
+    {
+        if (seen_version_ != version_.load(boost::memory_order_acquire))
+        {
+            boost::mutex::scoped_lock lock(chains_mutex_);
+            seen_version_ = version_.load(boost::memory_order_acquire);
+            readers_ = chains_;
+        }
+
+        ring* oldest = NULL;
+        boost::uint64_t oldest_sequence = 0;
+        bool orphans = false;
+        for (std::size_t i = 0; i < readers_.size(); ++i)
+        {
+            ring* head = _head(*readers_[i]);
+            if (head == NULL)
+            {
+                orphans = orphans || readers_[i]->orphaned.load();
+                continue;
+            }
+
+            boost::uint64_t sequence = head->queue.front().sequence;
+            if (oldest == NULL || sequence < oldest_sequence)
+            {
+                oldest = head;
+                oldest_sequence = sequence;
+            }
+        }
+
+        if (orphans)
+        {
+            _forget_orphans();
+        }
+
+        if (oldest == NULL)
+        {
+            return false;
+        }
+
+        entry item;
+        oldest->queue.pop(item);
+        rec = boost::move(item.rec);
+        return true;
+    }
+
+    // the chains of exited threads go once the writer has emptied them
+    void _forget_orphans()
+    {
+        boost::mutex::scoped_lock lock(chains_mutex_);
+        chains_.erase(std::remove_if(chains_.begin(), chains_.end(), [](boost::shared_ptr<chain>& item) {
+            return item->orphaned.load() && _head(*item) == NULL;
+        }), chains_.end());
+        seen_version_ = version_.fetch_add(1, boost::memory_order_release) + 1;
+        readers_ = chains_;
+    }
+
+    boost::atomic<boost::uint64_t> sequence_;
+
+    boost::mutex chains_mutex_;
+    std::vector< boost::shared_ptr<chain> > chains_;
+    boost::atomic<unsigned int> version_;
+    boost::thread_specific_ptr<chain_holder> local_;
+
+    // the writer's copy of chains_, refreshed when a thread registers
+    std::vector< boost::shared_ptr<chain> > readers_;
+    unsigned int seen_version_;
+
+    boost::mutex wait_mutex_;
+    boost::condition_variable wait_;
+    boost::atomic<bool> sleeping_;
+    boost::atomic<bool> interrupted_;
+};
@@ -30,44 +30,108 @@
 */
 #include "logger.h"
 
+namespace
+{
+    const char* const module_names[log_module_count] =
+    {
+        "general",
+        "process",
+        "timer",
+        "http",
+        "config"
+    };
+
+    const char* const level_names[] =
+    {
+        "trace",
+        "warning",
+        "error",
+        "off"
+    };
+
+    const int level_count = sizeof(level_names) / sizeof(*level_names);
+}
+
+boost::atomic<int> log_module_levels[log_module_count];
+
 src::severity_logger< severity_level >& logger::log_filter()
 {
     static src::severity_logger< severity_level > slg;
     return slg;
 }
 
+template <typename BackendT>
+boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > logger::_make_sink(boost::shared_ptr< BackendT > backend)
+{
+    // the frontend owns the writer thread, records are queued by the logging
+    // thread in a ring of its own and formatted and written in batches by the writer.
+    switch (overflow_policy_)
+    {
+    case overflow_block:
+        return _make_ring_sink< BackendT, overflow_block >(backend);
+    case overflow_drop:
+        return _make_ring_sink< BackendT, overflow_drop >(backend);
+    default:
+        return _make_ring_sink< BackendT, overflow_unbounded >(backend);
+    }
+}
+
+template <typename BackendT, log_overflow_policy Policy>
+boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > logger::_make_ring_sink(boost::shared_ptr< BackendT > backend)
+{
+    typedef sinks::asynchronous_sink< BackendT, thread_ring_queue< Policy > > sink_t;
+    auto sink = boost::make_shared< sink_t >(backend);
+    flush_sinks_.push_back([sink]() { sink->flush(); });
+    stop_sinks_.push_back([sink]() { sink->stop(); sink->flush(); });
+    return sink;
+}
+
 logger& logger::init()
 {
+    if (binary_)
+    {
+        // the text sinks are not installed, WRITE_LOG bypasses Boost.Log
+        boost::system::error_code ec;
+        if (binary_log::instance().start(file_name_, overflow_policy_, ec))
+        {
+            _start_flush_thread();
+            return *this;
+        }
+
+        binary_ = false;
+    }
+
     typedef sinks::debug_output_backend backend_t;
     auto pDebugBackend = boost::make_shared< backend_t >();
 
-    auto pDebugSink = boost::make_shared< sinks::synchronous_sink< backend_t > >(pDebugBackend);
-    pDebugSink->set_filter(expr::attr<severity_level>("Severity") >= trace);
-    pDebugSink->set_formatter(
+    debug_sink_ = _make_sink(pDebugBackend);
+    debug_sink_->set_filter(expr::attr<severity_level>("Severity") >= trace);
+    debug_sink_->set_formatter(
         expr::stream
         << "[" << expr::attr<UINT>("RecordID")
         << "][" << expr::format_date_time(_timestamp, "%Y-%m-%d %H:%M:%S.%f")
         << "][" << _severity
         << "]" << expr::message
         << std::endl);
-    logging::core::get()->add_sink(pDebugSink);
+    logging::core::get()->add_sink(debug_sink_);
 
-    sink_ = logging::add_file_log(
+    auto pFileBackend = boost::make_shared< sinks::text_file_backend >(
         keywords::open_mode = std::ios::app, // append write
         keywords::file_name = file_name_ + "%Y-%m-%d.log",
         keywords::rotation_size = rotation_size_,
-        keywords::time_based_rotation = sinks::file::rotation_at_time_point(0, 0, 0),
-        keywords::min_free_space = min_free_space_,
+        keywords::time_based_rotation = sinks::file::rotation_at_time_point(0, 0, 0));
 
-        keywords::format = (
-            expr::stream
-            << "[" << expr::attr<UINT>("RecordID")
-            << "][" << expr::format_date_time(_timestamp, "%Y-%m-%d %H:%M:%S.%f")
-            << "][" << _severity
-            << "]" << expr::message)
-        );
+    // the writer thread flushes on its own schedule, see _flush_run
+    pFileBackend->auto_flush(auto_flush_);
 
-    sink_->locked_backend()->auto_flush(auto_flush_);
+    sink_ = _make_sink(pFileBackend);
+    sink_->set_formatter(
+        expr::stream
+        << "[" << expr::attr<UINT>("RecordID")
+        << "][" << expr::format_date_time(_timestamp, "%Y-%m-%d %H:%M:%S.%f")
+        << "][" << _severity
+        << "]" << expr::message);
+    logging::core::get()->add_sink(sink_);
 
     logging::add_common_attributes();
 
@@ -76,6 +140,93 @@ logger& logger::init()
 
     this->set_filter_trace();
 
+    _start_flush_thread();
+
+    return *this;
+}
+
+void logger::_start_flush_thread()
+{
+    if (flush_second_ != 0)
+    {
+        flush_thread_.reset(new boost::thread(boost::bind(&logger::_flush_run, this)));
+    }
+}
+
+void logger::_flush_run()
+{
+    try
+    {
+        for (;;)
+        {
+            boost::this_thread::sleep_for(boost::chrono::seconds(flush_second_));
+            log_limit::report_all();
+            flush();
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+    }
+}
+
+logger& logger::flush()
+{
+    std::for_each(flush_sinks_.begin(), flush_sinks_.end(), [](boost::function< void() >& f) {
+        f();
+    });
+    return *this;
+}
+
+bool logger::add_forward(const std::string& level, log_forward_callback callback)
+{
+    auto l = std::find(level_names, level_names + (level_count - 1), level);
+    if (binary_ || forward_sink_ || l == level_names + (level_count - 1))
+    {
+        return false;
+    }
+
+    forward_sink_ = boost::make_shared< sinks::asynchronous_sink< log_forward_backend, sinks::unbounded_fifo_queue > >(
+        boost::make_shared< log_forward_backend >(callback));
+    forward_sink_->set_filter(expr::attr<severity_level>("Severity") >= static_cast<severity_level>(l - level_names));
+    forward_sink_->set_formatter(expr::stream << expr::message);
+    logging::core::get()->add_sink(forward_sink_);
+    return true;
+}
+
+logger& logger::remove_forward()
+{
+    if (forward_sink_)
+    {
+        logging::core::get()->remove_sink(forward_sink_);
+        forward_sink_->stop();
+        forward_sink_->flush();
+        forward_sink_.reset();
+    }
+    return *this;
+}
+
+logger& logger::close()
+{
+    log_limit::report_all();
+    binary_log::instance().stop();
+    remove_forward();
+
+    if (flush_thread_)
+    {
+        flush_thread_->interrupt();
+        flush_thread_->join();
+        flush_thread_.reset();
+    }
+
+    std::for_each(stop_sinks_.begin(), stop_sinks_.end(), [](boost::function< void() >& f) {
+        f();
+    });
+
+    logging::core::get()->remove_all_sinks();
+    flush_sinks_.clear();
+    stop_sinks_.clear();
+    sink_.reset();
+    debug_sink_.reset();
     return *this;
 }
 
@@ -114,7 +265,9 @@ logger& logger::set_filter_error()
 template <int level>
 void logger::set_filter()
 {
-    sink_->set_filter(expr::attr<severity_level>("Severity") >= level);
+    std::for_each(log_module_levels, log_module_levels + log_module_count, [](boost::atomic<int>& module_level) {
+        module_level.store(level, boost::memory_order_relaxed);
+    });
 }
 
 
@@ -124,6 +277,68 @@ logger& logger::set_logfile(const std::string& log_file)
     return *this;
 }
 
+const std::string& logger::logfile() const
+{
+    return file_name_;
+}
+
+logger& logger::set_overflow_policy(log_overflow_policy policy)
+{
+    overflow_policy_ = policy;
+    return *this;
+}
+
+logger& logger::set_overflow_policy(const std::string& policy)
+{
+    if (policy == "block")
+    {
+        return set_overflow_policy(overflow_block);
+    }
+
+    if (policy == "drop")
+    {
+        return set_overflow_policy(overflow_drop);
+    }
+
+    return set_overflow_policy(overflow_unbounded);
+}
+
+logger& logger::set_flush_second(const unsigned int second)
+{
+    flush_second_ = second;
+    return *this;
+}
+
+bool logger::set_module_level(const std::string& module, const std::string& level)
+{
+    auto m = std::find(module_names, module_names + log_module_count, module);
+    auto l = std::find(level_names, level_names + level_count, level);
+    if (m == module_names + log_module_count || l == level_names + level_count)
+    {
+        return false;
+    }
+
+    log_module_levels[m - module_names].store(static_cast<int>(l - level_names), boost::memory_order_relaxed);
+    return true;
+}
+
+std::map<std::string, std::string> logger::module_levels()
+{
+    std::map<std::string, std::string> levels;
+    for (int m = 0; m < log_module_count; ++m)
+    {
+        int l = log_module_levels[m].load(boost::memory_order_relaxed);
+        levels[module_names[m]] = level_names[(std::min)((std::max)(l, 0), level_count - 1)];
+    }
+    return levels;
+}
+
+logger& logger::set_format(const std::string& format)
+{
+    binary_ = (format == "binary");
+    return *this;
+}
+
 logger& logger::set_min_free_space(const size_t size)
 {
     min_free_space_ = size * 1024 * 1024;
@@ -135,3 +350,96 @@ logger& logger::set_rotation_size(const size_t size)
     rotation_size_ = size * 1024 * 1024;
     return *this;
 }
+
+
+namespace
+{
+    boost::mutex& log_limits_mutex()
+    {
+        static boost::mutex mutex;
+        return mutex;
+    }
+
+    std::vector<log_limit*>& log_limits()
+    {
+        static std::vector<log_limit*> limits;
+        return limits;
+    }
+
+    boost::uint64_t steady_ms()
+    {
+        return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+            boost::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+log_limit::log_limit(const char* file, int line, log_module module, unsigned int count, unsigned int second) :
+    file_(file),
+    line_(line),
+    module_(module),
+    count_(count),
+    window_ms_(static_cast<boost::uint64_t>(second) * 1000),
+    window_start_(steady_ms()),
+    used_(0),
+    suppressed_(0),
+    level_(trace)
+{
+    // sites are function local statics, they live until exit
+    boost::mutex::scoped_lock lock(log_limits_mutex());
+    log_limits().push_back(this);
+}
+
+bool log_limit::admit(severity_level level)
+{
+    boost::uint64_t now = steady_ms();
+    level_.store(level, boost::memory_order_relaxed);
+
+    if (now - window_start_.load(boost::memory_order_relaxed) >= window_ms_)
+    {
+        _report(now);
+    }
+
+    if (used_.fetch_add(1, boost::memory_order_relaxed) < count_)
+    {
+        return true;
+    }
+
+    suppressed_.fetch_add(1, boost::memory_order_relaxed);
+    return false;
+}
+
+void log_limit::_report(boost::uint64_t now)
+{
+    // only the thread that moves the window on refills the budget and reports
+    boost::uint64_t start = window_start_.load(boost::memory_order_relaxed);
+    if (now - start < window_ms_ || !window_start_.compare_exchange_strong(start, now))
+    {
+        return;
+    }
+
+    used_.store(0, boost::memory_order_relaxed);
+    unsigned int suppressed = suppressed_.exchange(0);
+    if (suppressed == 0)
+    {
+        return;
+    }
+
+    severity_level level = static_cast<severity_level>(level_.load(boost::memory_order_relaxed));
+    if (log_enabled(module_, level))
+    {
+        WRITE_LOG_STREAM(level) << "suppressed " << suppressed << " similar messages >> " << file_ << ":" << line_;
+    }
+}
+
+void log_limit::report_all()
+{
+    boost::uint64_t now = steady_ms();
+
+    boost::mutex::scoped_lock lock(log_limits_mutex());
+    std::for_each(log_limits().begin(), log_limits().end(), [now](log_limit* limit) {
+        if (limit->suppressed_.load(boost::memory_order_relaxed) != 0)
+        {
+            limit->_report(now);
+        }
+    });
+}
@@ -35,6 +35,7 @@
 #include <cassert>  
 #include <iostream>  
 #include <fstream>  
+#include <map>
 #include <boost/date_time/posix_time/posix_time_types.hpp>  
 
 #include <boost/log/common.hpp>
@@ -49,6 +50,13 @@
 #include <boost/log/detail/thread_id.hpp>   
 #include <boost/log/sources/global_logger_storage.hpp>  
 #include <boost/log/sinks/debug_output_backend.hpp>
+#include <boost/atomic.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/unbounded_fifo_queue.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/function.hpp>
+
+#include "log_ring_queue.h"
 
 namespace logging = boost::log;
 namespace sinks = boost::log::sinks;
@@ -81,16 +89,73 @@ inline std::basic_ostream< CharT, TraitsT >& operator<< (std::basic_ostream< Cha
 	return strm;
 }
 
+// the subsystem a translation unit logs for, define WINPCS_LOG_MODULE before
+// the includes of a source file to pick one. code in headers is compiled into
+// many source files, it names its module with WRITE_LOG_MODULE.
+enum log_module
+{
+	log_general,
+	log_process,
+	log_timer,
+	log_http,
+	log_config,
+	log_module_count
+};
+
+#ifndef WINPCS_LOG_MODULE
+#define WINPCS_LOG_MODULE log_general
+#endif
+
+// levels below this are compiled out of WRITE_LOG
+#ifndef WINPCS_LOG_MIN_LEVEL
+#define WINPCS_LOG_MIN_LEVEL trace
+#endif
+
+// a module level past error turns the module off
+extern boost::atomic<int> log_module_levels[log_module_count];
+
+inline bool log_enabled(log_module module, severity_level level)
+{
+	return static_cast<int>(level) >= log_module_levels[module].load(boost::memory_order_relaxed);
+}
+
 BOOST_LOG_ATTRIBUTE_KEYWORD(_severity, "Severity", severity_level)
 BOOST_LOG_ATTRIBUTE_KEYWORD(_timestamp, "TimeStamp", boost::posix_time::ptime)
 
 
+// the records of the supervisor's own log as they are written
+typedef boost::function< void(severity_level level, const std::string& message) > log_forward_callback;
+
+// hands each formatted record to a callback, see logger::add_forward
+class log_forward_backend : public sinks::basic_formatted_sink_backend< char >
+{
+public:
+	explicit log_forward_backend(log_forward_callback callback) :
+		callback_(callback)
+	{
+	}
+
+	void consume(const logging::record_view& rec, const string_type& message)
+	{
+		logging::value_ref< severity_level, tag::_severity > level = rec[_severity];
+		callback_(level ? level.get() : trace, message);
+	}
+
+private:
+	log_forward_callback callback_;
+};
 
 class logger : boost::noncopyable
 {
 
 private:
-	logger(void)
+	logger(void) :
+		min_free_space_(0),
+		rotation_size_(10 * 1024 * 1024),
+		auto_flush_(false),
+		overflow_policy_(overflow_unbounded),
+		flush_second_(1),
+		binary_(false)
 	{
 	}
 
@@ -109,6 +174,29 @@ public:
     logger& set_min_free_space(const size_t size);
     logger& set_rotation_size(const size_t size);
     logger& set_logfile(const std::string& log_file);
+    const std::string& logfile() const;
+    logger& set_overflow_policy(log_overflow_policy policy);
+    logger& set_overflow_policy(const std::string& policy);
+    logger& set_flush_second(const unsigned int second);
+
+    // runtime level of one module, level is trace, warning, error or off
+    static bool set_module_level(const std::string& module, const std::string& level);
+    static std::map<std::string, std::string> module_levels();
+
+    // "binary" writes deferred formatting records, see binary_log
+    logger& set_format(const std::string& format);
+
+    // records at or above level, trace, warning or error, also go to callback on
+    // a writer thread of their own. false with the binary format, whose records
+    // never pass through Boost.Log
+    bool add_forward(const std::string& level, log_forward_callback callback);
+    logger& remove_forward();
+
+    // drain the pending records and write them out
+    logger& flush();
+
+    // drain, stop the writer threads and detach the sinks, call before exit
+    logger& close();
     static src::severity_logger< severity_level >& log_filter();
 
 
@@ -126,7 +214,123 @@ protected:
 	size_t rotation_size_;
 	std::string file_name_;
 	bool auto_flush_;
-	boost::shared_ptr< sinks::synchronous_sink< sinks::text_file_backend > > sink_;
+	log_overflow_policy overflow_policy_;
+	unsigned int flush_second_;
+	bool binary_;
+
+	template <typename BackendT>
+	boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > _make_sink(boost::shared_ptr< BackendT > backend);
+
+	template <typename BackendT, log_overflow_policy Policy>
+	boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > _make_ring_sink(boost::shared_ptr< BackendT > backend);
+
+	void _flush_run();
+	void _start_flush_thread();
+
+	boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > sink_;
+	boost::shared_ptr< sinks::basic_formatting_sink_frontend< char > > debug_sink_;
+	std::vector< boost::function< void() > > flush_sinks_;
+	std::vector< boost::function< void() > > stop_sinks_;
+	boost::shared_ptr< boost::thread > flush_thread_;
+	boost::shared_ptr< sinks::asynchronous_sink< log_forward_backend, sinks::unbounded_fifo_queue > > forward_sink_;
 };
 
-#define WRITE_LOG(level) BOOST_LOG_SEV(logger::log_filter(), level)
\ No newline at end of file
+#include "binary_log.h"
+
+// true when file, a __FILE__, is a header
+template <std::size_t N>
+constexpr bool log_header_file(const char (&file)[N])
+{
+	return (N > 3 && file[N - 3] == '.' && file[N - 2] == 'h') ||
+		(N > 5 && file[N - 5] == '.' && file[N - 4] == 'h' && file[N - 3] == 'p' && file[N - 2] == 'p');
+}
+
+// WINPCS_LOG_MODULE is the module of the file being compiled, so an inline
+// function logging with it would differ from one source file to the next
+template <bool Header>
+inline log_module log_source_module(log_module module)
+{
+	static_assert(!Header, "code in a header logs with WRITE_LOG_MODULE, WRITE_LOG takes the module of the including file");
+	return module;
+}
+
+#define WINPCS_LOG_SOURCE_MODULE log_source_module<log_header_file(__FILE__)>(WINPCS_LOG_MODULE)
+
+// the level check runs before the stream is built, the compile time part
+// folds away. the site is a function local static, registered once.
+#define WRITE_LOG_MODULE(module, level) \
+    if (!((level) >= WINPCS_LOG_MIN_LEVEL && log_enabled((module), (level)))) {} else \
+    WRITE_LOG_STREAM(level)
+
+#define WRITE_LOG(level) WRITE_LOG_MODULE(WINPCS_LOG_SOURCE_MODULE, level)
+
+//
+// per site budget for noisy messages. at most count messages pass in each
+// window of second seconds, the rest are counted and reported as one
+// "suppressed" line when the window closes.
+//
+class log_limit : boost::noncopyable
+{
+public:
+    log_limit(const char* file, int line, log_module module, unsigned int count, unsigned int second);
+
+    bool admit(severity_level level);
+
+    // report the sites whose window closed with suppressed messages
+    static void report_all();
+
+private:
+    void _report(boost::uint64_t now);
+
+    const char* file_;
+    int line_;
+    log_module module_;
+    unsigned int count_;
+    boost::uint64_t window_ms_;
+
+    boost::atomic<boost::uint64_t> window_start_;
+    boost::atomic<unsigned int> used_;
+    boost::atomic<unsigned int> suppressed_;
+    boost::atomic<int> level_;
+};
+
+//
+// passes one message in every count.
+//
+class log_sample : boost::noncopyable
+{
+public:
+    explicit log_sample(unsigned int count) :
+        count_(count == 0 ? 1 : count), seen_(0)
+    {
+    }
+
+    bool admit()
+    {
+        return seen_.fetch_add(1, boost::memory_order_relaxed) % count_ == 0;
+    }
+
+private:
+    unsigned int count_;
+    boost::atomic<unsigned int> seen_;
+};
+
+#define WRITE_LOG_STREAM(level) \
+    for (log_stream _log_stream(level, []() -> log_site& { static log_site site(__FILE__, __LINE__); return site; }()); \
+        _log_stream; _log_stream.commit()) _log_stream
+
+// count and second must be constants, they initialize the site's budget
+#define WRITE_LOG_LIMIT_MODULE(module, level, count, second) \
+    if (!((level) >= WINPCS_LOG_MIN_LEVEL && log_enabled((module), (level)) && \
+        []() -> log_limit& { static log_limit limit(__FILE__, __LINE__, (module), count, second); return limit; }().admit(level))) {} else \
+    WRITE_LOG_STREAM(level)
+
+#define WRITE_LOG_LIMIT(level, count, second) WRITE_LOG_LIMIT_MODULE(WINPCS_LOG_SOURCE_MODULE, level, count, second)
+
+// count must be a constant
+#define WRITE_LOG_SAMPLE_MODULE(module, level, count) \
+    if (!((level) >= WINPCS_LOG_MIN_LEVEL && log_enabled((module), (level)) && \
+        []() -> log_sample& { static log_sample sample(count); return sample; }().admit())) {} else \
+    WRITE_LOG_STREAM(level)
+
+#define WRITE_LOG_SAMPLE(level, count) WRITE_LOG_SAMPLE_MODULE(WINPCS_LOG_SOURCE_MODULE, level, count)
@@ -32,11 +32,18 @@
 
 #include "config.hpp"
 
+#include <boost/lexical_cast.hpp>
+
 #include "setup_app.h"
 #include "service_app.h"
+#include "simulation.h"
+#include "bench.h"
 
 int main(int argc, char *argv[])
 {
+	// pending records are written out by the writer threads before exit
+	SCOPE_EXIT(logger::instance().close());
+
 	try
 	{
         boost::application::context app_context;
@@ -47,29 +54,131 @@ int main(int argc, char *argv[])
 			ns::make_shared<boost::application::path>());
 
 
-		ns::shared_ptr<boost::application::path> path = app_context.find<boost::application::path>();
-		logger::instance().set_logfile(path->executable_path_name().string());
-		logger::instance().init();
-
 		po::variables_map vm;
 		po::options_description desc;
 
 		desc.add_options()
 			(",b", "run on backend service")
 			(",d", "run for debug")
+			("log-overflow", po::value<std::string>()->default_value("unbounded"), "log queue overflow policy: unbounded, block or drop")
+			("log-flush-second", po::value<unsigned int>()->default_value(1), "seconds between log file flushes")
+			("log-format", po::value<std::string>()->default_value("text"), "log file format: text or binary")
+			("decode-log", po::value<std::string>(), "print a binary log file as text and exit")
+			("simulate", po::value<std::vector<std::string> >()->multitoken(), "replay <config> for <hours> on a virtual clock, print the counts and exit")
+			("simulate-lifetime", po::value<unsigned long>()->default_value(1800), "simulate: seconds a process runs before it exits, 0 until killed")
+			("simulate-jitter", po::value<unsigned long>()->default_value(1800), "simulate: random extra seconds of lifetime")
+			("simulate-exit-code", po::value<unsigned long>()->default_value(1), "simulate: exit code of a process at the end of its lifetime")
+			("simulate-start", po::value<std::string>(), "simulate: virtual start time as \"2016-01-01 00:00:30\", the counts of a fixed start do not change between runs")
+			("simulate-expect", po::value<std::vector<unsigned long long> >()->multitoken(), "simulate: expected <spawns> <restarts> <runs> <skipped>, exit with 2 when a count diverges")
+			("bench-log", po::value<std::vector<unsigned long> >()->multitoken(), "log <calls> records on each of <threads> threads through the log file, print ns per call and exit")
+			("bench-config", po::value<std::vector<unsigned long> >()->multitoken(), "parse a generated config of <programs> programs <rounds> times, copied and in place, print the times and exit")
+			("bench-proxy", po::value<std::vector<unsigned long> >()->multitoken(), "make <connections> loopback connections and send <megabytes> through a proxied program, print the rates and exit")
 			;
 		po::store(po::parse_command_line_allow_unregistered(argc, argv, desc), vm);
 
+		if (vm.count("decode-log"))
+		{
+			return binary_log::decode(vm["decode-log"].as<std::string>(), std::cout) ? 0 : 1;
+		}
+
+		ns::shared_ptr<boost::application::path> path = app_context.find<boost::application::path>();
+		logger::instance().set_logfile(path->executable_path_name().string());
+		logger::instance().set_overflow_policy(vm["log-overflow"].as<std::string>());
+		logger::instance().set_flush_second(vm["log-flush-second"].as<unsigned int>());
+		logger::instance().set_format(vm["log-format"].as<std::string>());
+		logger::instance().init();
+
+		if (vm.count("bench-log"))
+		{
+			std::vector<unsigned long> args = vm["bench-log"].as<std::vector<unsigned long> >();
+			return bench::log(args.size() > 0 ? args[0] : 0, args.size() > 1 ? static_cast<unsigned int>(args[1]) : 1, std::cout);
+		}
+
+		if (vm.count("bench-config"))
+		{
+			std::vector<unsigned long> args = vm["bench-config"].as<std::vector<unsigned long> >();
+			return bench::config(args.size() > 0 ? args[0] : 0, args.size() > 1 ? static_cast<unsigned int>(args[1]) : 1, std::cout);
+		}
+
+		if (vm.count("bench-proxy"))
+		{
+			std::vector<unsigned long> args = vm["bench-proxy"].as<std::vector<unsigned long> >();
+			return bench::proxy(args.size() > 0 ? args[0] : 0, args.size() > 1 ? args[1] : 0, std::cout);
+		}
+
+		if (vm.count("simulate"))
+		{
+			std::vector<std::string> args = vm["simulate"].as<std::vector<std::string> >();
+			simulation_options options;
+			try
+			{
+				options.hours = args.size() == 2 ? boost::lexical_cast<double>(args[1]) : -1;
+			}
+			catch (boost::bad_lexical_cast&)
+			{
+				options.hours = -1;
+			}
+
+			if (options.hours <= 0)
+			{
+				std::cerr << "usage: --simulate <config> <hours>" << std::endl;
+				return 1;
+			}
+
+			options.lifetime_second = vm["simulate-lifetime"].as<unsigned long>();
+			options.lifetime_jitter_second = vm["simulate-jitter"].as<unsigned long>();
+			options.exit_code = vm["simulate-exit-code"].as<unsigned long>();
+
+			if (vm.count("simulate-start"))
+			{
+				try
+				{
+					options.start = boost::posix_time::time_from_string(vm["simulate-start"].as<std::string>());
+				}
+				catch (std::exception&)
+				{
+					options.start = boost::posix_time::ptime();
+				}
+
+				if (options.start.is_not_a_date_time())
+				{
+					std::cerr << "usage: --simulate-start \"yyyy-mm-dd hh:mm:ss\"" << std::endl;
+					return 1;
+				}
+			}
+
+			if (vm.count("simulate-expect"))
+			{
+				std::vector<unsigned long long> expected = vm["simulate-expect"].as<std::vector<unsigned long long> >();
+				if (expected.size() != 4)
+				{
+					std::cerr << "usage: --simulate-expect <spawns> <restarts> <runs> <skipped>" << std::endl;
+					return 1;
+				}
+
+				options.check = true;
+				options.expected.spawns = expected[0];
+				options.expected.restarts = expected[1];
+				options.expected.scheduled_runs = expected[2];
+				options.expected.skipped_runs = expected[3];
+			}
+
+			return simulation::run(args[0], options, std::cout);
+		}
+
+		// signals are waited for on the supervisor's own event loop
 		if (vm.count("-d"))
 		{
 			service_app app(app_context);
-			return boost::application::launch<boost::application::common>(app, app_context);
+			boost::application::signal_manager signals(app_context, app.io_service());
+			return boost::application::launch<boost::application::common>(app, signals, app_context);
 		}
 
 		if (vm.count("-b"))
 		{
 			service_app app(app_context);
-			return boost::application::launch<boost::application::server>(app, app_context);
+			boost::application::signal_manager signals(app_context, app.io_service());
+			return boost::application::launch<boost::application::server>(app, signals, app_context);
 		}
 
 		setup_app app(app_context);
@@ -0,0 +1,803 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	output_store.cpp for keeping and searching the captured output of programs.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "output_store.h"
+#include "time_utils.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+
+
+namespace
+{
+    const char* const segment_extension = ".out";
+    const char* const index_extension = ".idx";
+
+    const std::size_t time_width = 27;              // "2026-10-19T08:30:00.000000Z"
+    const std::size_t max_line = 64 * 1024;         // longer output is split into lines of this size
+    const std::size_t batch_size = 64 * 1024;       // search results are handed out in batches of this size
+    const unsigned int bloom_hashes = 4;
+
+    std::uint64_t parse_time(const std::string& line)
+    {
+        if (line.size() < time_width)
+        {
+            return 0;
+        }
+
+        auto field = [&line](std::size_t pos, std::size_t length) {
+            return std::atoi(line.substr(pos, length).c_str());
+        };
+
+        try
+        {
+            boost::posix_time::ptime t(boost::gregorian::date(field(0, 4), field(5, 2), field(8, 2)),
+                boost::posix_time::hours(field(11, 2)) + boost::posix_time::minutes(field(14, 2)) +
+                boost::posix_time::seconds(field(17, 2)) + boost::posix_time::microseconds(field(20, 6)));
+            return (t - time_utils::epoch).total_microseconds();
+        }
+        catch (std::exception&)
+        {
+            return 0;
+        }
+    }
+
+    // the text of a line, after its time and instance key
+    std::size_t text_offset(const std::string& line)
+    {
+        std::size_t pos = line.find(' ', time_width + 1);
+        return pos == std::string::npos ? line.size() : pos + 1;
+    }
+
+    // runs of letters, digits and '_', lower cased. bytes of utf-8 sequences count as letters
+    template <typename Func>
+    void for_each_word(const char* text, std::size_t size, Func func)
+    {
+        std::string word;
+        for (std::size_t i = 0; i <= size; ++i)
+        {
+            unsigned char c = i < size ? static_cast<unsigned char>(text[i]) : ' ';
+            if (std::isalnum(c) || c == '_' || c >= 0x80)
+            {
+                word += static_cast<char>(std::tolower(c));
+            }
+            else if (!word.empty())
+            {
+                func(word);
+                word.clear();
+            }
+        }
+    }
+
+    // fnv-1a, the filters are kept on disk so the hash must not change
+    std::uint64_t word_hash(const std::string& word)
+    {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < word.size(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(word[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    void bloom_add(std::vector<std::uint64_t>& bloom, std::uint64_t hash)
+    {
+        std::uint64_t bits = bloom.size() * 64;
+        std::uint64_t step = (hash >> 33) | 1;
+        for (unsigned int i = 0; i < bloom_hashes; ++i)
+        {
+            std::uint64_t bit = (hash + i * step) % bits;
+            bloom[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    bool bloom_has(const std::vector<std::uint64_t>& bloom, std::uint64_t hash)
+    {
+        // a segment without a filter may hold anything
+        if (bloom.empty())
+        {
+            return true;
+        }
+
+        std::uint64_t bits = bloom.size() * 64;
+        std::uint64_t step = (hash >> 33) | 1;
+        for (unsigned int i = 0; i < bloom_hashes; ++i)
+        {
+            std::uint64_t bit = (hash + i * step) % bits;
+            if ((bloom[bit / 64] & (1ULL << (bit % 64))) == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    boost::filesystem::path index_file(const boost::filesystem::path& segment_file)
+    {
+        boost::filesystem::path file(segment_file);
+        return file.replace_extension(index_extension);
+    }
+}
+
+output_store::output_store() :
+    opened_(false), stopping_(false)
+{
+}
+
+output_store::~output_store()
+{
+    close();
+}
+
+bool output_store::open(const output_config& config, boost::system::error_code& ec)
+{
+    {
+        LOCK lock(mutex_);
+
+        config_ = config;
+        if (config_.directory.empty())
+        {
+            return true;
+        }
+
+        boost::filesystem::path directory(config_.directory);
+        boost::filesystem::create_directories(directory, ec);
+        if (ec)
+        {
+            WRITE_LOG(error) << "create output directory failed >> " << config_.directory << " | " << ec.message();
+            return false;
+        }
+
+        // what earlier runs captured is searchable whether or not the program still captures
+        for (boost::filesystem::directory_iterator iter(directory, ec), end; !ec && iter != end; iter.increment(ec))
+        {
+            if (boost::filesystem::is_directory(iter->path()))
+            {
+                _program(iter->path().filename().string());
+            }
+        }
+
+        opened_ = true;
+    }
+
+    stopping_ = false;
+    thread_.reset(new boost::thread(boost::bind(&output_store::_run, this)));
+
+    WRITE_LOG(trace) << "output store opened >> " << config_.directory << " | programs >> " << programs_.size();
+    return true;
+}
+
+void output_store::close()
+{
+    if (thread_)
+    {
+        stopping_ = true;
+        thread_->join();
+        thread_.reset();
+    }
+
+    {
+        LOCK lock(captures_mutex_);
+        std::for_each(captures_.begin(), captures_.end(),
+            [](capture& item) {
+            CloseHandle(item.pipe);
+        }
+        );
+        captures_.clear();
+    }
+
+    LOCK lock(mutex_);
+    std::for_each(programs_.begin(), programs_.end(),
+        [](std::pair<const std::string, program_ptr>& program) {
+        if (program.second->active.is_open())
+        {
+            program.second->active.close();
+        }
+    }
+    );
+    programs_.clear();
+    opened_ = false;
+}
+
+bool output_store::enabled()
+{
+    LOCK lock(mutex_);
+    return opened_;
+}
+
+void output_store::set_listener(line_listener listener)
+{
+    LOCK lock(mutex_);
+    listener_ = listener;
+}
+
+bool output_store::create_pipe(HANDLE& read_pipe, HANDLE& write_pipe)
+{
+    if (!enabled())
+    {
+        return false;
+    }
+
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    if (!CreatePipe(&read_pipe, &write_pipe, &sa, config_.pipe_kb * 1024))
+    {
+        WRITE_LOG_LIMIT(error, 10, 60) << "create output pipe failed >> error :" << GetLastError();
+        read_pipe = NULL;
+        write_pipe = NULL;
+        return false;
+    }
+
+    SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+    return true;
+}
+
+void output_store::attach(const std::string& name, const std::string& key, HANDLE pipe)
+{
+    capture item;
+    item.name = name;
+    item.key = key;
+    item.pipe = pipe;
+
+    LOCK lock(captures_mutex_);
+    captures_.push_back(item);
+}
+
+std::size_t output_store::search(const std::string& name, const std::string& query,
+    std::uint64_t since, std::size_t limit, bool newest, search_sink sink)
+{
+    struct candidate
+    {
+        boost::filesystem::path file;
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    std::vector<std::uint64_t> hashes;
+    std::vector<std::string> words;
+    for_each_word(query.data(), query.size(), [&](const std::string& word) {
+        words.push_back(word);
+        hashes.push_back(word_hash(word));
+    });
+
+    // the segments to read are picked under the lock, read without it
+    std::vector<candidate> candidates;
+    {
+        LOCK lock(mutex_);
+
+        auto program = programs_.find(name);
+        if (program == programs_.end())
+        {
+            return 0;
+        }
+
+        program_log& log = *program->second;
+        if (log.active.is_open())
+        {
+            log.active.flush();
+        }
+
+        std::for_each(log.segments.begin(), log.segments.end(),
+            [&](const segment& seg) {
+            if (seg.last_time < since ||
+                std::find_if(hashes.begin(), hashes.end(), [&seg](std::uint64_t hash) {
+                return !bloom_has(seg.bloom, hash);
+            }) != hashes.end())
+            {
+                return;
+            }
+
+            // start at the last indexed line before since
+            candidate item;
+            item.file = seg.file;
+            item.offset = 0;
+            item.size = seg.size;
+            for (std::size_t i = 0; i < seg.index.size() && seg.index[i].first < since; ++i)
+            {
+                item.offset = seg.index[i].second;
+            }
+            candidates.push_back(item);
+        }
+        );
+    }
+
+    std::string since_text = time_utils::format_time(since);
+
+    // calls match with every line of a candidate at or after since holding every word, until it returns false
+    auto scan = [&](const candidate& item, const std::function<bool(const std::string&)>& match) {
+        std::ifstream is(item.file.string().c_str(), std::ios::binary);
+        if (!is.is_open())
+        {
+            return true;
+        }
+
+        is.seekg(item.offset);
+        std::uint64_t offset = item.offset;
+        std::string line;
+        while (offset < item.size && std::getline(is, line))
+        {
+            offset += line.size() + 1;
+
+            if (line.compare(0, time_width, since_text) < 0)
+            {
+                continue;
+            }
+
+            // every word of the query has to be a word of the line
+            std::size_t text = text_offset(line);
+            std::vector<bool> seen(words.size(), false);
+            std::size_t missing = words.size();
+            for_each_word(line.data() + text, line.size() - text, [&](const std::string& word) {
+                for (std::size_t w = 0; w < words.size(); ++w)
+                {
+                    if (!seen[w] && words[w] == word)
+                    {
+                        seen[w] = true;
+                        --missing;
+                    }
+                }
+            });
+
+            if (missing == 0 && !match(line))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::string batch;
+    std::size_t found = 0;
+    bool more = true;
+
+    auto emit = [&](const std::string& line) {
+        batch += line;
+        batch += '\n';
+        ++found;
+
+        if (batch.size() >= batch_size)
+        {
+            more = sink(batch);
+            batch.clear();
+        }
+        return more && found < limit;
+    };
+
+    if (!newest)
+    {
+        for (std::size_t i = 0; i < candidates.size() && more && found < limit; ++i)
+        {
+            scan(candidates[i], emit);
+        }
+    }
+    else
+    {
+        // the newest segments are read first, each keeps the last lines it still has room for
+        std::deque<std::string> lines;
+        for (std::size_t i = candidates.size(); i > 0 && lines.size() < limit; --i)
+        {
+            std::size_t room = limit - lines.size();
+            std::deque<std::string> last;
+            scan(candidates[i - 1], [&](const std::string& line) {
+                last.push_back(line);
+                if (last.size() > room)
+                {
+                    last.pop_front();
+                }
+                return true;
+            });
+            lines.insert(lines.begin(), last.begin(), last.end());
+        }
+
+        for (std::size_t i = 0; i < lines.size() && emit(lines[i]); ++i)
+        {
+        }
+    }
+
+    if (more && !batch.empty())
+    {
+        sink(batch);
+    }
+
+    return found;
+}
+
+void output_store::_run()
+{
+    while (!stopping_)
+    {
+        {
+            LOCK lock(captures_mutex_);
+            for (auto iter = captures_.begin(); iter != captures_.end();)
+            {
+                if (_read(*iter))
+                {
+                    ++iter;
+                    continue;
+                }
+
+                CloseHandle(iter->pipe);
+                iter = captures_.erase(iter);
+            }
+        }
+
+        {
+            LOCK lock(mutex_);
+            std::for_each(programs_.begin(), programs_.end(),
+                [](std::pair<const std::string, program_ptr>& program) {
+                if (program.second->active.is_open())
+                {
+                    program.second->active.flush();
+                }
+            }
+            );
+        }
+
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(config_.poll_ms));
+    }
+}
+
+bool output_store::_read(capture& item)
+{
+    char buffer[4096];
+
+    // only what is already in the pipe is read, a broken pipe means every writer has exited
+    DWORD available = 0;
+    while (PeekNamedPipe(item.pipe, NULL, 0, NULL, &available, NULL))
+    {
+        if (available == 0)
+        {
+            return true;
+        }
+
+        DWORD read = 0;
+        if (!ReadFile(item.pipe, buffer, (std::min)(available, static_cast<DWORD>(sizeof(buffer))), &read, NULL) || read == 0)
+        {
+            break;
+        }
+
+        std::uint64_t time = time_utils::now();
+        item.partial.append(buffer, read);
+
+        std::size_t begin = 0;
+        for (std::size_t end = item.partial.find('\n'); end != std::string::npos; end = item.partial.find('\n', begin))
+        {
+            std::size_t size = end - begin;
+            if (size != 0 && item.partial[end - 1] == '\r')
+            {
+                --size;
+            }
+            _append(item.name, item.key, item.partial.data() + begin, size, time);
+            begin = end + 1;
+        }
+        item.partial.erase(0, begin);
+
+        if (item.partial.size() >= max_line)
+        {
+            _append(item.name, item.key, item.partial.data(), item.partial.size(), time);
+            item.partial.clear();
+        }
+    }
+
+    if (!item.partial.empty())
+    {
+        _append(item.name, item.key, item.partial.data(), item.partial.size(), time_utils::now());
+        item.partial.clear();
+    }
+
+    return false;
+}
+
+void output_store::_append(const std::string& name, const std::string& key, const char* text, std::size_t size, std::uint64_t time)
+{
+    LOCK lock(mutex_);
+
+    if (!opened_)
+    {
+        return;
+    }
+
+    program_ptr log = _program(name);
+    if (!log)
+    {
+        return;
+    }
+
+    std::uint64_t bucket_size = static_cast<std::uint64_t>((std::max)(config_.segment_second, 1u)) * 1000000;
+    if (log->active.is_open() && log->segments.back().first_time / bucket_size != time / bucket_size)
+    {
+        _seal_active(*log);
+        _retain(*log);
+    }
+
+    if (!log->active.is_open() && !_open_active(*log, time))
+    {
+        return;
+    }
+
+    std::string line = time_utils::format_time(time) + " " + key + " ";
+    line.append(text, size);
+    line += '\n';
+
+    log->active.write(line.data(), line.size());
+    _add_line(log->segments.back(), log->unindexed, line, time);
+
+    if (listener_)
+    {
+        listener_(name, key, time, text, size);
+    }
+}
+
+output_store::program_ptr output_store::_program(const std::string& name)
+{
+    auto found = programs_.find(name);
+    if (found != programs_.end())
+    {
+        return found->second;
+    }
+
+    program_ptr log(new program_log);
+    log->directory = boost::filesystem::path(config_.directory) / name;
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(log->directory, ec);
+    if (ec)
+    {
+        WRITE_LOG(error) << "create output directory failed >> " << log->directory.string() << " | " << ec.message();
+        return program_ptr();
+    }
+
+    std::vector<boost::filesystem::path> files;
+    for (boost::filesystem::directory_iterator iter(log->directory, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        if (iter->path().extension() == segment_extension)
+        {
+            files.push_back(iter->path());
+        }
+    }
+
+    // segment names are zero padded bucket times, so name order is time order
+    std::sort(files.begin(), files.end());
+
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        segment seg;
+        seg.file = files[i];
+        if (!_load_segment(seg))
+        {
+            continue;
+        }
+
+        log->segments.push_back(seg);
+        if (!boost::filesystem::exists(index_file(seg.file)))
+        {
+            _seal_active(*log);
+        }
+    }
+
+    _retain(*log);
+
+    programs_[name] = log;
+    return log;
+}
+
+bool output_store::_load_segment(segment& seg)
+{
+    boost::system::error_code ec;
+    boost::uintmax_t file_size = boost::filesystem::file_size(seg.file, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    // a sealed segment comes with its index and filter
+    boost::filesystem::path idx(index_file(seg.file));
+    {
+        std::ifstream is(idx.string().c_str(), std::ios::binary);
+        if (is.is_open())
+        {
+            try
+            {
+                cereal::BinaryInputArchive ar(is);
+                ar(seg);
+                if (seg.size == file_size)
+                {
+                    return true;
+                }
+            }
+            catch (...)
+            {
+            }
+
+            is.close();
+            boost::filesystem::remove(idx, ec);
+        }
+    }
+
+    // otherwise both are rebuilt from the lines
+    seg.first_time = 0;
+    seg.last_time = 0;
+    seg.size = 0;
+    seg.index.clear();
+    seg.bloom.assign(static_cast<std::size_t>(config_.bloom_kb) * 1024 / sizeof(std::uint64_t), 0);
+
+    std::uint32_t unindexed = 0;
+    std::ifstream is(seg.file.string().c_str(), std::ios::binary);
+    std::string line;
+    while (std::getline(is, line) && !is.eof())
+    {
+        line += '\n';
+        _add_line(seg, unindexed, line, parse_time(line));
+    }
+    is.close();
+
+    // drop a torn last line, appends continue after the last whole one
+    if (seg.size != file_size)
+    {
+        boost::filesystem::resize_file(seg.file, seg.size, ec);
+    }
+
+    if (seg.size == 0)
+    {
+        boost::filesystem::remove(seg.file, ec);
+        return false;
+    }
+
+    return true;
+}
+
+void output_store::_add_line(segment& seg, std::uint32_t& unindexed, const std::string& line, std::uint64_t time)
+{
+    if (seg.index.empty() || unindexed >= config_.index_interval_kb * 1024)
+    {
+        seg.index.push_back(std::make_pair(time, seg.size));
+        unindexed = 0;
+    }
+
+    if (seg.first_time == 0)
+    {
+        seg.first_time = time;
+    }
+    seg.last_time = (std::max)(seg.last_time, time);
+    seg.size += static_cast<std::uint32_t>(line.size());
+    unindexed += static_cast<std::uint32_t>(line.size());
+
+    if (!seg.bloom.empty())
+    {
+        std::size_t text = text_offset(line);
+        for_each_word(line.data() + text, line.size() - text, [&seg](const std::string& word) {
+            bloom_add(seg.bloom, word_hash(word));
+        });
+    }
+}
+
+bool output_store::_open_active(program_log& log, std::uint64_t time)
+{
+    std::uint64_t bucket_size = static_cast<std::uint64_t>((std::max)(config_.segment_second, 1u)) * 1000000;
+
+    char name[32];
+    sprintf_s(name, sizeof(name), "%020llu", static_cast<unsigned long long>(time / bucket_size * bucket_size));
+
+    segment seg;
+    seg.file = log.directory / (std::string(name) + segment_extension);
+    seg.bloom.assign(static_cast<std::size_t>(config_.bloom_kb) * 1024 / sizeof(std::uint64_t), 0);
+
+    // a bucket sealed earlier, by a restart of the supervisor, is started over under a later name
+    if (boost::filesystem::exists(seg.file))
+    {
+        sprintf_s(name, sizeof(name), "%020llu", static_cast<unsigned long long>(time));
+        seg.file = log.directory / (std::string(name) + segment_extension);
+    }
+
+    log.active.open(seg.file.string().c_str(), std::ios::binary | std::ios::trunc);
+    if (!log.active.is_open())
+    {
+        WRITE_LOG_LIMIT(error, 10, 60) << "open output segment failed >> " << seg.file.string();
+        return false;
+    }
+
+    log.segments.push_back(seg);
+    log.unindexed = 0;
+    return true;
+}
+
+void output_store::_seal_active(program_log& log)
+{
+    if (log.active.is_open())
+    {
+        log.active.close();
+    }
+
+    if (log.segments.empty())
+    {
+        return;
+    }
+
+    segment& seg = log.segments.back();
+    boost::filesystem::path idx(index_file(seg.file));
+    boost::filesystem::path tmp_file(idx);
+    tmp_file += ".tmp";
+
+    {
+        std::ofstream os(tmp_file.string().c_str(), std::ios::binary | std::ios::trunc);
+        cereal::BinaryOutputArchive ar(os);
+        ar(seg);
+    }
+
+    if (!::MoveFileEx(tmp_file.string().c_str(), idx.string().c_str(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        WRITE_LOG(error) << "seal output segment failed >> " << seg.file.string() << " | error :" << GetLastError();
+    }
+}
+
+void output_store::_retain(program_log& log)
+{
+    std::uint64_t oldest = 0;
+    if (config_.max_age_day != 0)
+    {
+        oldest = time_utils::now() - static_cast<std::uint64_t>(config_.max_age_day) * 24 * 3600 * 1000000;
+    }
+
+    std::uint64_t max_size = static_cast<std::uint64_t>(config_.max_mb) * 1024 * 1024;
+    std::uint64_t total_size = 0;
+    std::for_each(log.segments.begin(), log.segments.end(),
+        [&](const segment& seg) {
+        total_size += seg.size;
+    }
+    );
+
+    // the oldest go first, until every limit holds. the active segment is never removed
+    std::size_t keep = log.active.is_open() ? 1 : 0;
+    while (log.segments.size() > keep)
+    {
+        const segment& seg = log.segments.front();
+        if (seg.last_time >= oldest &&
+            (config_.max_segments == 0 || log.segments.size() <= config_.max_segments) &&
+            (max_size == 0 || total_size <= max_size))
+        {
+            break;
+        }
+
+        total_size -= seg.size;
+
+        boost::system::error_code ec;
+        boost::filesystem::remove(seg.file, ec);
+        boost::filesystem::remove(index_file(seg.file), ec);
+        log.segments.erase(log.segments.begin());
+    }
+}
@@ -0,0 +1,157 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	output_store.h for keeping and searching the captured output of programs.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+
+#include <Windows.h>
+#include <boost/atomic.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/types/utility.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <fstream>
+
+//
+// the output of every capturing program, one line per record as
+// "<utc time> <instance key> <text>", in one directory per program. the
+// output of one segment_second bucket makes a segment. each segment keeps a
+// sparse index of the time at every index_interval_kb of output and a bloom
+// filter of the words in it, both written next to it once it is sealed. a
+// search skips the segments older than since or missing a word of the query,
+// and seeks into the first one it reads.
+//
+// the pipes are only known to the supervisor that spawned the child, an
+// adopted child is not captured again until it restarts.
+//
+class output_store : boost::noncopyable
+{
+public:
+    // a batch of matching lines, false to end the search
+    typedef boost::function<bool(const std::string& lines)> search_sink;
+
+    // every captured line as it is stored, time in microseconds since the unix epoch
+    typedef boost::function<void(const std::string& name, const std::string& key,
+        std::uint64_t time, const char* text, std::size_t size)> line_listener;
+
+    output_store();
+    ~output_store();
+
+    bool open(const output_config& config, boost::system::error_code& ec);
+    void close();
+
+    bool enabled();
+
+    // set before open, called on the capture thread
+    void set_listener(line_listener listener);
+
+    // a pipe for a child's stdout and stderr, only the write end is inheritable. false when disabled
+    bool create_pipe(HANDLE& read_pipe, HANDLE& write_pipe);
+
+    // takes over the read end of a child's output pipe
+    void attach(const std::string& name, const std::string& key, HANDLE pipe);
+
+    // lines of a program at or after since (microseconds since the unix epoch)
+    // holding every word of query as a whole word, whatever the case, oldest first.
+    // the first limit of them, or the last limit when newest is set
+    std::size_t search(const std::string& name, const std::string& query,
+        std::uint64_t since, std::size_t limit, bool newest, search_sink sink);
+
+private:
+    struct segment
+    {
+        segment() :
+            first_time(0), last_time(0), size(0)
+        {
+        }
+
+        boost::filesystem::path file;
+        std::uint64_t first_time;
+        std::uint64_t last_time;
+        std::uint32_t size;
+        std::vector<std::pair<std::uint64_t, std::uint32_t> > index;   // (time, offset) of a line every index_interval_kb
+        std::vector<std::uint64_t> bloom;
+
+        template<class Archive>
+        void serialize(Archive & ar)
+        {
+            ar(first_time, last_time, size, index, bloom);
+        }
+    };
+
+    struct program_log
+    {
+        program_log() :
+            unindexed(0)
+        {
+        }
+
+        boost::filesystem::path directory;
+        std::vector<segment> segments;  // oldest first, the last one is active while active is open
+        std::ofstream active;
+        std::uint32_t unindexed;        // bytes appended since the last index entry
+    };
+
+    struct capture
+    {
+        std::string name;
+        std::string key;
+        HANDLE pipe;
+        std::string partial;            // a line not yet ended
+    };
+
+    typedef boost::shared_ptr<program_log> program_ptr;
+
+    void _run();
+    bool _read(capture& item);
+    void _append(const std::string& name, const std::string& key, const char* text, std::size_t size, std::uint64_t time);
+    program_ptr _program(const std::string& name);
+    bool _load_segment(segment& seg);
+    void _add_line(segment& seg, std::uint32_t& unindexed, const std::string& line, std::uint64_t time);
+    bool _open_active(program_log& log, std::uint64_t time);
+    void _seal_active(program_log& log);
+    void _retain(program_log& log);
+
+    MUTEX mutex_;
+    output_config config_;
+    bool opened_;
+    line_listener listener_;
+    std::map<std::string, program_ptr> programs_;
+
+    MUTEX captures_mutex_;
+    std::vector<capture> captures_;
+    boost::atomic<bool> stopping_;
+    boost::shared_ptr<boost::thread> thread_;
+};
@@ -0,0 +1,480 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	page_prewarmer.cpp for reading program binaries into memory before they start.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "page_prewarmer.h"
+#include "trace.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+
+namespace
+{
+    const std::size_t read_chunk = 1024 * 1024;
+
+    // file offset of a relative virtual address, 0 when no section holds it
+    DWORD rva_to_offset(const IMAGE_SECTION_HEADER* sections, WORD count, DWORD rva)
+    {
+        for (WORD i = 0; i < count; ++i)
+        {
+            DWORD size = (std::max)(sections[i].Misc.VirtualSize, sections[i].SizeOfRawData);
+            if (rva >= sections[i].VirtualAddress && rva < sections[i].VirtualAddress + size)
+            {
+                return rva - sections[i].VirtualAddress + sections[i].PointerToRawData;
+            }
+        }
+        return 0;
+    }
+}
+
+page_prewarmer::page_prewarmer() :
+    timer_(NULL), locked_bytes_(0), stopping_(false)
+{
+}
+
+page_prewarmer::~page_prewarmer()
+{
+    stop();
+}
+
+bool page_prewarmer::start(const prewarm_config& config, const std::vector<process_config>& process_info,
+    timer_generator& timer, boost::system::error_code& ec)
+{
+    std::for_each(process_info.begin(), process_info.end(),
+        [&](const process_config& info) {
+        if ((info.prewarm == "read" || info.prewarm == "lock") && !info.process_name.empty())
+        {
+            programs_.push_back(info);
+        }
+    }
+    );
+
+    if (programs_.empty())
+    {
+        return true;
+    }
+
+    char directory[MAX_PATH] = { 0 };
+    if (GetWindowsDirectoryA(directory, MAX_PATH) == 0)
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        programs_.clear();
+        return false;
+    }
+
+    windows_directory_ = directory;
+    config_ = config;
+    timer_ = &timer;
+    stopping_ = false;
+
+    thread_.reset(new boost::thread(boost::bind(&page_prewarmer::_run, this)));
+
+    WRITE_LOG(trace) << "page prewarmer started >> programs " << programs_.size();
+    return true;
+}
+
+void page_prewarmer::stop()
+{
+    if (!thread_)
+    {
+        return;
+    }
+
+    stopping_ = true;
+    thread_->join();
+    thread_.reset();
+
+    {
+        LOCK lock(mutex_);
+        waiting_.clear();
+    }
+
+    std::for_each(locked_.begin(), locked_.end(),
+        [](locked_view& view) {
+        VirtualUnlock(view.base, view.size);
+        UnmapViewOfFile(view.base);
+    }
+    );
+    locked_.clear();
+    locked_bytes_ = 0;
+
+    WRITE_LOG(trace) << "page prewarmer stopped";
+}
+
+void page_prewarmer::when_warm(const std::string& name, ready_callback callback)
+{
+    {
+        LOCK lock(mutex_);
+
+        bool pending = timer_ != NULL && warm_.count(name) == 0 &&
+            std::find_if(programs_.begin(), programs_.end(),
+            [&name](const process_config& info) {
+            return info.name == name;
+        }) != programs_.end();
+
+        if (pending)
+        {
+            waiting_[name].push_back(callback);
+            timer_->post(boost::bind(&page_prewarmer::_fire, this, name, "timeout"), config_.wait_second);
+            return;
+        }
+    }
+
+    callback();
+}
+
+void page_prewarmer::_run()
+{
+    std::for_each(programs_.begin(), programs_.end(),
+        [&](const process_config& info) {
+        if (stopping_)
+        {
+            return;
+        }
+
+        _warm(info);
+
+        {
+            LOCK lock(mutex_);
+            warm_.insert(info.name);
+        }
+
+        timer_->post(boost::bind(&page_prewarmer::_fire, this, info.name, "warm"));
+    }
+    );
+}
+
+void page_prewarmer::_warm(const process_config& info)
+{
+    TRACE_SPAN_DETAIL("process", "prewarm", info.name);
+
+    ULONGLONG begin = GetTickCount64();
+
+    std::string exe = _resolve(info.process_name, info.directory);
+    if (exe.empty())
+    {
+        WRITE_LOG(warning) << "prewarm skipped, binary not found >> " << info.name << " | " << info.process_name;
+        return;
+    }
+
+    std::vector<std::string> files;
+    _collect(exe, config_.import_depth, files);
+
+    unsigned long long bytes = 0;
+    std::for_each(files.begin(), files.end(),
+        [&](const std::string& file) {
+        if (stopping_)
+        {
+            return;
+        }
+
+        bytes += info.prewarm == "lock" ? _lock(file) : _read(file);
+        warmed_files_.insert(boost::algorithm::to_lower_copy(file));
+    }
+    );
+
+    WRITE_LOG(trace) << "prewarmed >> " << info.name << " | " << info.prewarm << " | files " << files.size()
+        << " | " << bytes / 1024 << "kb | " << GetTickCount64() - begin << "ms";
+}
+
+void page_prewarmer::_collect(const std::string& file, unsigned int depth, std::vector<std::string>& files)
+{
+    std::string key = boost::algorithm::to_lower_copy(file);
+    if (warmed_files_.count(key) != 0 ||
+        std::find_if(files.begin(), files.end(), [&key](const std::string& item) {
+        return boost::algorithm::iequals(item, key);
+    }) != files.end())
+    {
+        return;
+    }
+
+    files.push_back(file);
+
+    std::vector<std::string> names;
+    if (depth == 0 || !_imports(file, names))
+    {
+        return;
+    }
+
+    std::string directory = boost::filesystem::path(file).parent_path().string();
+    std::for_each(names.begin(), names.end(),
+        [&](const std::string& name) {
+        std::string resolved = _resolve(name, directory);
+        if (resolved.empty() || boost::algorithm::istarts_with(resolved, windows_directory_))
+        {
+            return;
+        }
+
+        _collect(resolved, depth - 1, files);
+    }
+    );
+}
+
+bool page_prewarmer::_imports(const std::string& file, std::vector<std::string>& names)
+{
+    HANDLE handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    SCOPE_EXIT_REF(CloseHandle(handle));
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(sizeof(IMAGE_DOS_HEADER)))
+    {
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        return false;
+    }
+    SCOPE_EXIT_REF(CloseHandle(mapping));
+
+    const BYTE* base = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (base == NULL)
+    {
+        return false;
+    }
+    SCOPE_EXIT_REF(UnmapViewOfFile(base));
+
+    // every structure is bounds checked, the file may be anything
+    unsigned long long size = static_cast<unsigned long long>(file_size.QuadPart);
+    auto at = [&](unsigned long long offset, unsigned long long length) -> const BYTE* {
+        return offset + length <= size ? base + offset : NULL;
+    };
+
+    const IMAGE_DOS_HEADER* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(base);
+    if (dos->e_magic != IMAGE_DOS_SIGNATURE || dos->e_lfanew < 0)
+    {
+        return false;
+    }
+
+    unsigned long long nt = static_cast<unsigned long long>(dos->e_lfanew);
+    const DWORD* signature = reinterpret_cast<const DWORD*>(at(nt, sizeof(DWORD)));
+    const IMAGE_FILE_HEADER* header = reinterpret_cast<const IMAGE_FILE_HEADER*>(at(nt + sizeof(DWORD), sizeof(IMAGE_FILE_HEADER)));
+    if (signature == NULL || *signature != IMAGE_NT_SIGNATURE || header == NULL)
+    {
+        return false;
+    }
+
+    // pe32 and pe32+ differ in the optional header, the import directory is read from either
+    unsigned long long optional = nt + sizeof(DWORD) + sizeof(IMAGE_FILE_HEADER);
+    const WORD* magic = reinterpret_cast<const WORD*>(at(optional, sizeof(WORD)));
+    const IMAGE_DATA_DIRECTORY* imports = NULL;
+    if (magic != NULL && *magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        const IMAGE_OPTIONAL_HEADER64* header64 = reinterpret_cast<const IMAGE_OPTIONAL_HEADER64*>(at(optional, sizeof(IMAGE_OPTIONAL_HEADER64)));
+        if (header64 != NULL && header64->NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_IMPORT)
+        {
+            imports = &header64->DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+        }
+    }
+    else if (magic != NULL && *magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        const IMAGE_OPTIONAL_HEADER32* header32 = reinterpret_cast<const IMAGE_OPTIONAL_HEADER32*>(at(optional, sizeof(IMAGE_OPTIONAL_HEADER32)));
+        if (header32 != NULL && header32->NumberOfRvaAndSizes > IMAGE_DIRECTORY_ENTRY_IMPORT)
+        {
+            imports = &header32->DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+        }
+    }
+
+    const IMAGE_SECTION_HEADER* sections = reinterpret_cast<const IMAGE_SECTION_HEADER*>(
+        at(optional + header->SizeOfOptionalHeader, sizeof(IMAGE_SECTION_HEADER) * header->NumberOfSections));
+    if (imports == NULL || imports->VirtualAddress == 0 || sections == NULL)
+    {
+        return false;
+    }
+
+    DWORD offset = rva_to_offset(sections, header->NumberOfSections, imports->VirtualAddress);
+    for (const IMAGE_IMPORT_DESCRIPTOR* descriptor = reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(at(offset, sizeof(IMAGE_IMPORT_DESCRIPTOR)));
+        offset != 0 && descriptor != NULL && descriptor->Name != 0;
+        offset += sizeof(IMAGE_IMPORT_DESCRIPTOR), descriptor = reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(at(offset, sizeof(IMAGE_IMPORT_DESCRIPTOR))))
+    {
+        DWORD name_offset = rva_to_offset(sections, header->NumberOfSections, descriptor->Name);
+        if (name_offset == 0 || at(name_offset, 1) == NULL)
+        {
+            continue;
+        }
+
+        const char* name = reinterpret_cast<const char*>(base + name_offset);
+        std::size_t length = 0;
+        while (name_offset + length < size && length < MAX_PATH && name[length] != '\0')
+        {
+            ++length;
+        }
+        names.push_back(std::string(name, length));
+    }
+
+    return true;
+}
+
+std::string page_prewarmer::_resolve(const std::string& name, const std::string& directory)
+{
+    boost::system::error_code ec;
+    boost::filesystem::path path(name);
+
+    if (path.is_absolute())
+    {
+        return boost::filesystem::is_regular_file(path, ec) ? path.string() : std::string();
+    }
+
+    if (!directory.empty() && boost::filesystem::is_regular_file(boost::filesystem::path(directory) / path, ec))
+    {
+        return (boost::filesystem::path(directory) / path).string();
+    }
+
+    // the loader's own order is not reproduced, PATH is good enough for finding what to warm
+    char found[MAX_PATH] = { 0 };
+    DWORD length = SearchPathA(NULL, name.c_str(), path.has_extension() ? NULL : ".exe", MAX_PATH, found, NULL);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return std::string();
+    }
+
+    return found;
+}
+
+unsigned long long page_prewarmer::_read(const std::string& file)
+{
+    HANDLE handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        WRITE_LOG(warning) << "prewarm read failed >> " << file << " | error :" << GetLastError();
+        return 0;
+    }
+    SCOPE_EXIT_REF(CloseHandle(handle));
+
+    // the data goes nowhere, reading it is what leaves it in the file cache
+    std::vector<char> buffer(read_chunk);
+    unsigned long long total = 0;
+    DWORD bytes = 0;
+    while (!stopping_ && ReadFile(handle, &buffer[0], static_cast<DWORD>(buffer.size()), &bytes, NULL) && bytes != 0)
+    {
+        total += bytes;
+    }
+
+    return total;
+}
+
+unsigned long long page_prewarmer::_lock(const std::string& file)
+{
+    HANDLE handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return _read(file);
+    }
+    SCOPE_EXIT_REF(CloseHandle(handle));
+
+    // an image section is shared with every process that loads the same file
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY | SEC_IMAGE, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        return _read(file);
+    }
+    SCOPE_EXIT_REF(CloseHandle(mapping));
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (base == NULL)
+    {
+        return _read(file);
+    }
+
+    SIZE_T size = 0;
+    MEMORY_BASIC_INFORMATION region;
+    while (VirtualQuery(static_cast<BYTE*>(base) + size, &region, sizeof(region)) != 0 && region.AllocationBase == base)
+    {
+        size += region.RegionSize;
+    }
+
+    unsigned long long limit = static_cast<unsigned long long>(config_.lock_limit_mb) * 1024 * 1024;
+    if (locked_bytes_ + size > limit)
+    {
+        WRITE_LOG(warning) << "prewarm lock limit reached, reading instead >> " << file;
+        UnmapViewOfFile(base);
+        return _read(file);
+    }
+
+    // the locked pages count against the working set minimum, which has to grow with them
+    SIZE_T minimum = 0, maximum = 0;
+    GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum);
+    SetProcessWorkingSetSize(GetCurrentProcess(), minimum + size, maximum + size);
+
+    if (!VirtualLock(base, size))
+    {
+        WRITE_LOG(warning) << "prewarm lock failed, reading instead >> " << file << " | error :" << GetLastError();
+        SetProcessWorkingSetSize(GetCurrentProcess(), minimum, maximum);
+        UnmapViewOfFile(base);
+        return _read(file);
+    }
+
+    locked_view view;
+    view.file = file;
+    view.base = base;
+    view.size = size;
+    locked_.push_back(view);
+    locked_bytes_ += size;
+
+    return size;
+}
+
+void page_prewarmer::_fire(const std::string& name, const char* reason)
+{
+    std::vector<ready_callback> callbacks;
+    {
+        LOCK lock(mutex_);
+        auto iter = waiting_.find(name);
+        if (iter == waiting_.end())
+        {
+            return;
+        }
+        callbacks.swap(iter->second);
+        waiting_.erase(iter);
+    }
+
+    if (std::string(reason) == "timeout")
+    {
+        WRITE_LOG(warning) << "prewarm not done in time, starting anyway >> " << name;
+    }
+
+    std::for_each(callbacks.begin(), callbacks.end(),
+        [](ready_callback& callback) {
+        callback();
+    }
+    );
+}
@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	page_prewarmer.h for reading program binaries into memory before they start.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+#include "timer.h"
+
+#include <Windows.h>
+#include <boost/atomic.hpp>
+
+//
+// pulls the process_name of every "read" or "lock" program, and the dlls it
+// imports, into the file cache on a background thread so that the first
+// start after a boot does not page-fault them from disk one page at a time.
+// "read" reads each file once, sequentially. "lock" also maps it as an image
+// and locks the view into the supervisor's working set, the pages are shared
+// with the programs that load the same file and stay resident until stop.
+// dlls below the windows directory are skipped, they are usually resident already.
+//
+class page_prewarmer : boost::noncopyable
+{
+public:
+    typedef boost::function<void()> ready_callback;
+
+    page_prewarmer();
+    ~page_prewarmer();
+
+    bool start(const prewarm_config& config, const std::vector<process_config>& process_info,
+        timer_generator& timer, boost::system::error_code& ec);
+    void stop();
+
+    // runs callback on the timer once the program is warm, or after wait_second at the latest
+    void when_warm(const std::string& name, ready_callback callback);
+
+private:
+    struct locked_view
+    {
+        std::string file;
+        void* base;
+        SIZE_T size;
+    };
+
+    void _run();
+    void _warm(const process_config& info);
+    void _collect(const std::string& file, unsigned int depth, std::vector<std::string>& files);
+    bool _imports(const std::string& file, std::vector<std::string>& names);
+    std::string _resolve(const std::string& name, const std::string& directory);
+    unsigned long long _read(const std::string& file);
+    unsigned long long _lock(const std::string& file);
+    void _fire(const std::string& name, const char* reason);
+
+    prewarm_config config_;
+    timer_generator* timer_;
+    std::vector<process_config> programs_;
+    std::string windows_directory_;
+    unsigned long long locked_bytes_;
+    std::vector<locked_view> locked_;
+    std::set<std::string> warmed_files_;
+
+    MUTEX mutex_;
+    std::set<std::string> warm_;
+    std::map<std::string, std::vector<ready_callback> > waiting_;
+    boost::atomic<bool> stopping_;
+    boost::shared_ptr<boost::thread> thread_;
+};
@@ -29,7 +29,10 @@
 	parse_config.cpp for parsing the config file.
 */
 
+#define WINPCS_LOG_MODULE log_config
+
 #include "parse_config.h"
+#include "trace.h"
 
 
 extern "C" {
@@ -39,19 +42,78 @@ extern "C" {
 
 parse_config::parse_config(boost::filesystem::path file, boost::system::error_code &ec)
 {
-    std::string json_str(_parse_jsonnet(file, ec));
+    TRACE_SPAN("config", "load");
+
+    boost::posix_time::ptime begin = boost::posix_time::microsec_clock::universal_time();
+
+    boost::shared_array<char> json(_parse_jsonnet(file, ec));
     if (ec)
     {
         return;
     }
 
-    std::stringstream ss(json_str);
-    cereal::JSONInputArchive ar(ss);
+    boost::posix_time::ptime evaluated = boost::posix_time::microsec_clock::universal_time();
+
+    // parse the jsonnet output buffer in place, string values are copied
+    // straight from it into the process_config fields.
+    cereal::JSONInputArchive ar(json.get());
     ar(cereal::make_nvp("processes", processes_));
 
+    // every optional section is loaded, so all of the invalid ones are reported at once
+    bool valid = true;
+    valid = _load_section(ar, "server", server_) && valid;
+    valid = _load_section(ar, "aggregator", aggregator_) && valid;
+    valid = _load_section(ar, "logs", logs_) && valid;
+    valid = _load_section(ar, "history", history_) && valid;
+    valid = _load_section(ar, "jobs", jobs_) && valid;
+    valid = _load_section(ar, "pressure", pressure_) && valid;
+    valid = _load_section(ar, "autoscaler", autoscaler_) && valid;
+    valid = _load_section(ar, "prewarm", prewarm_) && valid;
+    valid = _load_section(ar, "output", output_) && valid;
+    valid = _load_section(ar, "forward", forward_) && valid;
+
+    if (!valid)
+    {
+        ec = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        return;
+    }
+
+    boost::posix_time::ptime loaded = boost::posix_time::microsec_clock::universal_time();
+
+    WRITE_LOG(trace) << "config " << file.string() << " loaded " << processes_.size()
+        << " processes, evaluate " << (evaluated - begin).total_microseconds()
+        << "us, parse " << (loaded - evaluated).total_microseconds() << "us";
+
     return;
 }
 
+template <class T>
+bool parse_config::_load_section(cereal::JSONInputArchive& ar, const char* name, T& section)
+{
+    // an absent section keeps its defaults
+    if (!ar.hasName(name))
+    {
+        section = T();
+        return true;
+    }
+
+    std::size_t depth = ar.nodeDepth();
+    try
+    {
+        ar(cereal::make_nvp(name, section));
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        // a node the failed load started is still on the stack, later sections must not resolve against it
+        ar.unwindTo(depth);
+        WRITE_LOG(error) << "config section invalid >> " << name << " | " << e.what();
+    }
+
+    section = T();
+    return false;
+}
+
 parse_config::~parse_config()
 {
 
@@ -62,19 +124,75 @@ std::vector<process_config>& parse_config::get_processes()
     return processes_;
 }
 
-std::string parse_config::_parse_jsonnet(boost::filesystem::path& file, boost::system::error_code &ec)
+server_config& parse_config::get_server()
+{
+    return server_;
+}
+
+aggregator_config& parse_config::get_aggregator()
+{
+    return aggregator_;
+}
+
+log_retention_config& parse_config::get_logs()
 {
+    return logs_;
+}
+
+history_config& parse_config::get_history()
+{
+    return history_;
+}
+
+jobs_config& parse_config::get_jobs()
+{
+    return jobs_;
+}
+
+pressure_config& parse_config::get_pressure()
+{
+    return pressure_;
+}
+
+autoscaler_config& parse_config::get_autoscaler()
+{
+    return autoscaler_;
+}
+
+prewarm_config& parse_config::get_prewarm()
+{
+    return prewarm_;
+}
+
+output_config& parse_config::get_output()
+{
+    return output_;
+}
+
+forward_config& parse_config::get_forward()
+{
+    return forward_;
+}
+
+boost::shared_array<char> parse_config::_parse_jsonnet(boost::filesystem::path& file, boost::system::error_code &ec)
+{
+    TRACE_SPAN("config", "evaluate");
+
     int error;
 
     boost::shared_ptr<JsonnetVm> vm(jsonnet_make(), boost::bind(jsonnet_destroy, _1));
+
+    // the output buffer is owned by the vm, so the deleter keeps the vm alive
+    // until the caller has finished parsing it.
     boost::shared_array<char> output(
-        jsonnet_evaluate_file(vm.get(), file.string().c_str(), &error), boost::bind(jsonnet_realloc, vm.get(), _1, 0));
+        jsonnet_evaluate_file(vm.get(), file.string().c_str(), &error),
+        [vm](char* buffer) { jsonnet_realloc(vm.get(), buffer, 0); });
 
     if (error != 0) {
         ec = boost::system::error_code(error,
             make_app_cat(std::string(output.get())));
-        return std::string();
+        return boost::shared_array<char>();
     }
 
-    return output.get();
+    return output;
 }
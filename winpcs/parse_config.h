@@ -46,18 +46,136 @@
 
 #include <cereal/archives/json.hpp>
 
+#include <boost/functional/hash.hpp>
+
 #pragma comment(lib, "libjsonnet.lib")
 
 
+// a json load that fails inside a nested object or array leaves its started
+// nodes on the archive's stack, they are dropped before the next field
+template <class Archive>
+inline std::size_t config_node_depth(Archive&)
+{
+	return 0;
+}
+
+inline std::size_t config_node_depth(cereal::JSONInputArchive& ar)
+{
+	return ar.nodeDepth();
+}
+
+template <class Archive>
+inline void config_unwind(Archive&, std::size_t)
+{
+}
+
+inline void config_unwind(cereal::JSONInputArchive& ar, std::size_t depth)
+{
+	ar.unwindTo(depth);
+}
+
+// an absent field is the common case in a large config, it takes its
+// default without a throw
+template <class Archive>
+inline bool config_has_name(Archive&, const char*)
+{
+	return true;
+}
+
+inline bool config_has_name(cereal::JSONInputArchive& ar, const char* name)
+{
+	return ar.hasName(name);
+}
+
 #define CEREAL_AR_NVP_DEFAULT(ar, name, value) \
-	try { \
-		ar(CEREAL_NVP(name));\
-	}\
-	catch (...) {\
-		name = value;\
+	if (!config_has_name(ar, #name)) { \
+		name = value; \
+	} \
+	else { \
+		std::size_t name##_depth = config_node_depth(ar); \
+		try { \
+			ar(CEREAL_NVP(name));\
+		}\
+		catch (...) {\
+			config_unwind(ar, name##_depth);\
+			name = value;\
+		}\
+	}
+
+
+
+struct autoscale_config
+{
+	autoscale_config() :
+		metric("none"),
+		target(0),
+		min(1),
+		max(1),
+		tolerance_percent(10),
+		up_cooldown_second(60),
+		down_cooldown_second(300)
+	{
+	}
+
+	std::string metric;					// "none", "cpu" for the average percent of one core per instance, "report" for the average the instances report
+	double target;						// the metric per instance the group is sized for
+	unsigned int min;					// 0 only with "report", a report for the whole program brings an empty group back
+	unsigned int max;
+	unsigned int tolerance_percent;		// no scaling while the metric stays within this much of the target
+	unsigned int up_cooldown_second;	// time after a scaling before the group grows again
+	unsigned int down_cooldown_second;	// and before it shrinks
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, metric, "none");
+		CEREAL_AR_NVP_DEFAULT(ar, target, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, min, 1);
+		CEREAL_AR_NVP_DEFAULT(ar, max, 1);
+		CEREAL_AR_NVP_DEFAULT(ar, tolerance_percent, 10);
+		CEREAL_AR_NVP_DEFAULT(ar, up_cooldown_second, 60);
+		CEREAL_AR_NVP_DEFAULT(ar, down_cooldown_second, 300);
+	}
+
+	bool enabled() const
+	{
+		// cpu is measured on the running instances, a group at zero would never grow again
+		return metric != "none" && target > 0 && max >= min && max != 0 && (min != 0 || metric == "report");
+	}
+};
+
+struct proxy_config
+{
+	proxy_config() :
+		listen_port(0),
+		listen_address("0.0.0.0"),
+		backend_port(0),
+		balance("leastconn"),
+		drain_second(10)
+	{
 	}
 
+	unsigned int listen_port;			// port the group is reached on, 0 for no proxy
+	std::string listen_address;
+	unsigned int backend_port;			// loopback port of the first instance, each further instance listens one higher
+	std::string balance;				// "leastconn" or "roundrobin"
+	unsigned int drain_second;			// longest an instance is given to finish its connections before a restart or retirement
 
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, listen_port, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, listen_address, "0.0.0.0");
+		CEREAL_AR_NVP_DEFAULT(ar, backend_port, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, balance, "leastconn");
+		CEREAL_AR_NVP_DEFAULT(ar, drain_second, 10);
+	}
+
+	bool enabled() const
+	{
+		return listen_port != 0 && backend_port != 0;
+	}
+};
 
 struct process_config
 {
@@ -76,6 +194,33 @@ struct process_config
 	
 	std::string user;
 
+	std::string cpu_affinity;	// cpu list, "0-3,8"
+	int numa_node;				// preferred node, -1 for any
+	std::string placement;		// "none", "cores" or "nodes", spreads numprocs instances round-robin
+
+	int nice;					// -20 to 19, mapped onto the windows priority classes
+	std::string sched_policy;	// "other", "batch" or "idle"
+	std::string ioprio_class;	// "none", "realtime", "best-effort" or "idle"
+	unsigned int ioprio_level;	// 0 to 7 for best-effort
+	int oom_score_adj;			// -1000 to 1000, higher is trimmed first under memory pressure
+	std::string shed;			// "none", "pause" or "stop", what sustained memory or cpu pressure does to the program
+
+	std::string schedule;		// cron expression, "@hourly" style alias or "@every 90s", empty for a supervised program
+	std::string overlap;		// "skip", "queue" or "kill", what a run does while the previous one is still running
+	unsigned int jitter_second;	// runs are delayed by a stable per-host offset up to this
+	unsigned int catch_up_second;	// a run missed while winpcs was down is made up if it is no older than this
+
+	std::vector<std::string> watch;	// files or directories whose change restarts the program, instance by instance
+	unsigned int watch_debounce_ms;	// a burst of changes restarts once, this long after the last of them
+
+	autoscale_config autoscale;	// sizes numprocs between min and max by a metric, numprocs is the starting size
+
+	std::string prewarm;		// "none", "read" or "lock", pulls process_name and its dlls into memory before the first start
+
+	proxy_config proxy;			// a tcp port in front of the instances, connections go to the running ones
+
+	bool capture_output;		// stdout and stderr go to the output store, searchable through /log/<name>/search
+
 	template<class Archive>
 	void load(Archive & ar)
 	{
@@ -92,6 +237,362 @@ struct process_config
 		CEREAL_AR_NVP_DEFAULT(ar, numprocs, 1);
 		CEREAL_AR_NVP_DEFAULT(ar, numprocs_start, 0);
 		CEREAL_AR_NVP_DEFAULT(ar, user, "system");
+		CEREAL_AR_NVP_DEFAULT(ar, cpu_affinity, "");
+		CEREAL_AR_NVP_DEFAULT(ar, numa_node, -1);
+		CEREAL_AR_NVP_DEFAULT(ar, placement, "none");
+		CEREAL_AR_NVP_DEFAULT(ar, nice, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, sched_policy, "other");
+		CEREAL_AR_NVP_DEFAULT(ar, ioprio_class, "none");
+		CEREAL_AR_NVP_DEFAULT(ar, ioprio_level, 4);
+		CEREAL_AR_NVP_DEFAULT(ar, oom_score_adj, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, shed, "none");
+		CEREAL_AR_NVP_DEFAULT(ar, schedule, "");
+		CEREAL_AR_NVP_DEFAULT(ar, overlap, "skip");
+		CEREAL_AR_NVP_DEFAULT(ar, jitter_second, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, catch_up_second, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, watch, std::vector<std::string>());
+		CEREAL_AR_NVP_DEFAULT(ar, watch_debounce_ms, 1000);
+		CEREAL_AR_NVP_DEFAULT(ar, autoscale, autoscale_config());
+		CEREAL_AR_NVP_DEFAULT(ar, prewarm, "none");
+		CEREAL_AR_NVP_DEFAULT(ar, proxy, proxy_config());
+		CEREAL_AR_NVP_DEFAULT(ar, capture_output, false);
+	}
+
+	// identity of the launch parameters, a running child is only
+	// re-adopted when it was started with the same ones.
+	std::size_t hash() const
+	{
+		std::size_t seed = 0;
+		boost::hash_combine(seed, command);
+		boost::hash_combine(seed, process_name);
+		boost::hash_combine(seed, directory);
+		boost::hash_combine(seed, environment);
+		boost::hash_combine(seed, user);
+		boost::hash_combine(seed, cpu_affinity);
+		boost::hash_combine(seed, numa_node);
+		boost::hash_combine(seed, placement);
+		boost::hash_combine(seed, nice);
+		boost::hash_combine(seed, sched_policy);
+		boost::hash_combine(seed, ioprio_class);
+		boost::hash_combine(seed, ioprio_level);
+		boost::hash_combine(seed, oom_score_adj);
+		return seed;
+	}
+};
+
+struct server_config
+{
+	server_config() :
+		port(80),
+		listen_address("127.0.0.1"),
+		io_threads(2),
+		keep_children_on_exit(false),
+		journal_file("winpcs.journal"),
+		journal_compact_second(60),
+		status_table("Local\\winpcs_status"),
+		status_table_slots(256),
+		trace_events(8192)
+	{
+	}
+
+	unsigned int port;
+	std::string listen_address;				// loopback by default, the fleet peers need it opened up
+	std::string admin_token;				// required in X-Winpcs-Token by the routes that act, empty refuses them
+	unsigned int io_threads;				// threads of the event loop shared by signals, timers, child exits and http
+	bool keep_children_on_exit;
+	std::string journal_file;
+	unsigned int journal_compact_second;
+	std::string status_table;				// shared memory name of the status table, empty to disable
+	unsigned int status_table_slots;
+	unsigned int trace_events;				// trace spans kept per thread for /debug/trace, 0 to disable
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, port, 80);
+		CEREAL_AR_NVP_DEFAULT(ar, listen_address, "127.0.0.1");
+		CEREAL_AR_NVP_DEFAULT(ar, admin_token, "");
+		CEREAL_AR_NVP_DEFAULT(ar, io_threads, 2);
+		CEREAL_AR_NVP_DEFAULT(ar, keep_children_on_exit, false);
+		CEREAL_AR_NVP_DEFAULT(ar, journal_file, "winpcs.journal");
+		CEREAL_AR_NVP_DEFAULT(ar, journal_compact_second, 60);
+		CEREAL_AR_NVP_DEFAULT(ar, status_table, "Local\\winpcs_status");
+		CEREAL_AR_NVP_DEFAULT(ar, status_table_slots, 256);
+		CEREAL_AR_NVP_DEFAULT(ar, trace_events, 8192);
+	}
+};
+
+struct aggregator_config
+{
+	aggregator_config() :
+		poll_second(5),
+		timeout_second(3)
+	{
+	}
+
+	std::vector<std::string> peers;	// "host:port" of the winpcs instances to fan in
+	unsigned int poll_second;
+	unsigned int timeout_second;
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, peers, std::vector<std::string>());
+		CEREAL_AR_NVP_DEFAULT(ar, poll_second, 5);
+		CEREAL_AR_NVP_DEFAULT(ar, timeout_second, 3);
+	}
+};
+
+struct log_retention_config
+{
+	log_retention_config() :
+		compress(true),
+		compress_kb_per_second(4096),
+		idle_second(300),
+		scan_second(60),
+		max_files(30),
+		max_age_day(30),
+		max_total_mb(1024)
+	{
+	}
+
+	bool compress;							// gzip rotated logs in the background
+	unsigned int compress_kb_per_second;	// input read rate of the compressor, 0 for no limit
+	unsigned int idle_second;				// untouched this long and not dated today means rotated
+	unsigned int scan_second;
+	unsigned int max_files;					// retention limits, 0 for no limit
+	unsigned int max_age_day;
+	unsigned int max_total_mb;
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, compress, true);
+		CEREAL_AR_NVP_DEFAULT(ar, compress_kb_per_second, 4096);
+		CEREAL_AR_NVP_DEFAULT(ar, idle_second, 300);
+		CEREAL_AR_NVP_DEFAULT(ar, scan_second, 60);
+		CEREAL_AR_NVP_DEFAULT(ar, max_files, 30);
+		CEREAL_AR_NVP_DEFAULT(ar, max_age_day, 30);
+		CEREAL_AR_NVP_DEFAULT(ar, max_total_mb, 1024);
+	}
+};
+
+struct history_config
+{
+	history_config() :
+		directory("history"),
+		segment_kb(4096),
+		segment_second(3600),
+		max_segments(336),
+		max_age_day(14)
+	{
+	}
+
+	std::string directory;				// empty disables the history
+	unsigned int segment_kb;			// a segment is sealed at this size or age
+	unsigned int segment_second;
+	unsigned int max_segments;			// retention limits, 0 for no limit
+	unsigned int max_age_day;
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, directory, "history");
+		CEREAL_AR_NVP_DEFAULT(ar, segment_kb, 4096);
+		CEREAL_AR_NVP_DEFAULT(ar, segment_second, 3600);
+		CEREAL_AR_NVP_DEFAULT(ar, max_segments, 336);
+		CEREAL_AR_NVP_DEFAULT(ar, max_age_day, 14);
+	}
+};
+
+struct jobs_config
+{
+	jobs_config() :
+		max_concurrency(4),
+		max_queued(256),
+		timeout_second(3600),
+		output_kb(64),
+		keep_finished(256)
+	{
+	}
+
+	unsigned int max_concurrency;		// jobs running at once, 0 disables the job runner
+	unsigned int max_queued;			// submissions beyond this many waiting jobs are refused
+	unsigned int timeout_second;		// run time limit of a job that names none, 0 for no limit
+	unsigned int output_kb;				// captured output kept per job, the tail is kept
+	unsigned int keep_finished;			// finished jobs kept for lookup by id
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, max_concurrency, 4);
+		CEREAL_AR_NVP_DEFAULT(ar, max_queued, 256);
+		CEREAL_AR_NVP_DEFAULT(ar, timeout_second, 3600);
+		CEREAL_AR_NVP_DEFAULT(ar, output_kb, 64);
+		CEREAL_AR_NVP_DEFAULT(ar, keep_finished, 256);
+	}
+};
+
+struct pressure_config
+{
+	pressure_config() :
+		memory_load_percent(90),
+		cpu_percent(0),
+		sustain_second(10),
+		relief_second(60)
+	{
+	}
+
+	unsigned int memory_load_percent;	// memory in use at which the host is under pressure, 0 to ignore memory
+	unsigned int cpu_percent;			// busy cpu at which the host is under pressure, 0 to ignore cpu
+	unsigned int sustain_second;		// pressure lasting this long sheds the programs marked with shed
+	unsigned int relief_second;			// and this long without pressure brings them back
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, memory_load_percent, 90);
+		CEREAL_AR_NVP_DEFAULT(ar, cpu_percent, 0);
+		CEREAL_AR_NVP_DEFAULT(ar, sustain_second, 10);
+		CEREAL_AR_NVP_DEFAULT(ar, relief_second, 60);
+	}
+};
+
+struct autoscaler_config
+{
+	autoscaler_config() :
+		evaluate_second(15),
+		report_port(0)
+	{
+	}
+
+	unsigned int evaluate_second;		// how often every autoscaled group is measured and sized
+	unsigned int report_port;			// udp port on the loopback where programs report "name[:instance] value" lines, 0 to disable
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, evaluate_second, 15);
+		CEREAL_AR_NVP_DEFAULT(ar, report_port, 0);
+	}
+};
+
+struct prewarm_config
+{
+	prewarm_config() :
+		wait_second(30),
+		lock_limit_mb(256),
+		import_depth(2)
+	{
+	}
+
+	unsigned int wait_second;			// longest a first start waits for its program to be warmed
+	unsigned int lock_limit_mb;			// total size the "lock" programs may keep locked in memory
+	unsigned int import_depth;			// levels of dll imports followed from process_name, system dlls are skipped
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, wait_second, 30);
+		CEREAL_AR_NVP_DEFAULT(ar, lock_limit_mb, 256);
+		CEREAL_AR_NVP_DEFAULT(ar, import_depth, 2);
+	}
+};
+
+struct output_config
+{
+	output_config() :
+		directory("output"),
+		segment_second(3600),
+		index_interval_kb(64),
+		bloom_kb(64),
+		max_age_day(7),
+		max_segments(168),
+		max_mb(1024),
+		pipe_kb(1024),
+		poll_ms(50)
+	{
+	}
+
+	std::string directory;				// one sub directory per program, empty disables the capture
+	unsigned int segment_second;		// a segment holds the output of one such time bucket
+	unsigned int index_interval_kb;		// a timestamp is indexed at every this much output, for seeking to since
+	unsigned int bloom_kb;				// word filter per segment, lets a search skip segments, 0 to disable
+	unsigned int max_age_day;			// older segments are removed, 0 to keep them
+	unsigned int max_segments;			// per program limits checked as a segment is sealed, the oldest go first, 0 for no limit
+	unsigned int max_mb;
+	unsigned int pipe_kb;				// pipe buffer of each child, the child blocks when it is full
+	unsigned int poll_ms;				// how often the pipes are read
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, directory, "output");
+		CEREAL_AR_NVP_DEFAULT(ar, segment_second, 3600);
+		CEREAL_AR_NVP_DEFAULT(ar, index_interval_kb, 64);
+		CEREAL_AR_NVP_DEFAULT(ar, bloom_kb, 64);
+		CEREAL_AR_NVP_DEFAULT(ar, max_age_day, 7);
+		CEREAL_AR_NVP_DEFAULT(ar, max_segments, 168);
+		CEREAL_AR_NVP_DEFAULT(ar, max_mb, 1024);
+		CEREAL_AR_NVP_DEFAULT(ar, pipe_kb, 1024);
+		CEREAL_AR_NVP_DEFAULT(ar, poll_ms, 50);
+	}
+};
+
+struct forward_config
+{
+	forward_config() :
+		address(""),
+		format("syslog"),
+		compress(false),
+		output(true),
+		own_log_level("warning"),
+		batch_kb(64),
+		batch_ms(500),
+		queue_kb(4096),
+		spill_directory("spill"),
+		spill_mb(256),
+		min_backoff_ms(500),
+		max_backoff_ms(30000),
+		timeout_second(10)
+	{
+	}
+
+	std::string address;				// host:port of the collector, empty disables the forwarding
+	std::string format;					// "syslog" for RFC 5424 with octet counting, or "json" for one object per line
+	bool compress;						// each batch is sent as one gzip member
+	bool output;						// forward the captured output of the programs
+	std::string own_log_level;			// trace, warning, error or off for the supervisor's own log
+	unsigned int batch_kb;				// a batch is sent once it reaches this size
+	unsigned int batch_ms;				// or once its oldest record waited this long
+	unsigned int queue_kb;				// records held in memory before they go to the spill directory
+	std::string spill_directory;		// batches wait here while the collector is down, empty drops them instead
+	unsigned int spill_mb;				// the oldest spilled batches are dropped beyond this
+	unsigned int min_backoff_ms;		// first reconnect delay, doubled on every failure
+	unsigned int max_backoff_ms;
+	unsigned int timeout_second;		// connect and send timeout
+
+	template<class Archive>
+	void load(Archive & ar)
+	{
+		CEREAL_AR_NVP_DEFAULT(ar, address, "");
+		CEREAL_AR_NVP_DEFAULT(ar, format, "syslog");
+		CEREAL_AR_NVP_DEFAULT(ar, compress, false);
+		CEREAL_AR_NVP_DEFAULT(ar, output, true);
+		CEREAL_AR_NVP_DEFAULT(ar, own_log_level, "warning");
+		CEREAL_AR_NVP_DEFAULT(ar, batch_kb, 64);
+		CEREAL_AR_NVP_DEFAULT(ar, batch_ms, 500);
+		CEREAL_AR_NVP_DEFAULT(ar, queue_kb, 4096);
+		CEREAL_AR_NVP_DEFAULT(ar, spill_directory, "spill");
+		CEREAL_AR_NVP_DEFAULT(ar, spill_mb, 256);
+		CEREAL_AR_NVP_DEFAULT(ar, min_backoff_ms, 500);
+		CEREAL_AR_NVP_DEFAULT(ar, max_backoff_ms, 30000);
+		CEREAL_AR_NVP_DEFAULT(ar, timeout_second, 10);
+	}
+
+	bool enabled() const
+	{
+		return !address.empty();
 	}
 };
 
@@ -104,12 +605,46 @@ public:
 
     std::vector<process_config>& get_processes();
 
+    server_config& get_server();
+
+    aggregator_config& get_aggregator();
+
+    log_retention_config& get_logs();
+
+    history_config& get_history();
+
+    jobs_config& get_jobs();
+
+    pressure_config& get_pressure();
+
+    autoscaler_config& get_autoscaler();
+
+    prewarm_config& get_prewarm();
+
+    output_config& get_output();
+
+    forward_config& get_forward();
+
 
 private:
 
-    std::string _parse_jsonnet(boost::filesystem::path& file, boost::system::error_code &ec);
+    boost::shared_array<char> _parse_jsonnet(boost::filesystem::path& file, boost::system::error_code &ec);
+
+    // false when the section is present but does not load
+    template <class T>
+    bool _load_section(cereal::JSONInputArchive& ar, const char* name, T& section);
 
 	boost::filesystem::path config_filename_;
 	std::vector<process_config> processes_;
+	server_config server_;
+	aggregator_config aggregator_;
+	log_retention_config logs_;
+	history_config history_;
+	jobs_config jobs_;
+	pressure_config pressure_;
+	autoscaler_config autoscaler_;
+	prewarm_config prewarm_;
+	output_config output_;
+	forward_config forward_;
 
 };
\ No newline at end of file
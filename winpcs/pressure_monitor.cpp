@@ -0,0 +1,249 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	pressure_monitor.cpp for shedding low priority programs under memory or cpu pressure.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "pressure_monitor.h"
+#include "time_utils.h"
+
+
+namespace
+{
+    unsigned long long filetime_value(const FILETIME& time)
+    {
+        return (static_cast<unsigned long long>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    }
+}
+
+pressure_monitor::pressure_monitor() :
+    pm_(NULL), timer_(NULL), timer_handler_(0), waiting_(false), last_idle_(0), last_total_(0)
+{
+}
+
+pressure_monitor::~pressure_monitor()
+{
+    stop();
+}
+
+bool pressure_monitor::start(const pressure_config& config, process_manager& pm, timer_generator& timer, boost::system::error_code& ec)
+{
+    if (config.memory_load_percent == 0 && config.cpu_percent == 0)
+    {
+        return true;
+    }
+
+    config_ = config;
+    pm_ = &pm;
+    timer_ = &timer;
+
+    if (config_.memory_load_percent != 0)
+    {
+        HANDLE notification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+        if (notification == NULL)
+        {
+            ec.assign(GetLastError(), boost::system::system_category());
+            WRITE_LOG(warning) << "low memory notification unavailable, memory load is polled only >> " << ec.message();
+            ec.clear();
+        }
+        else
+        {
+            low_memory_.reset(new boost::asio::windows::object_handle(timer.io_service(), notification));
+            _arm();
+        }
+    }
+
+    timer_handler_ = timer.set_timer(boost::bind(&pressure_monitor::_tick, this), 1);
+
+    WRITE_LOG(trace) << "pressure monitor started >> memory " << config_.memory_load_percent
+        << "% | cpu " << config_.cpu_percent << "% | sustain " << config_.sustain_second << "s";
+    return true;
+}
+
+void pressure_monitor::stop()
+{
+    if (timer_ == NULL)
+    {
+        return;
+    }
+
+    if (timer_handler_ != 0)
+    {
+        timer_->kill_timer(timer_handler_);
+        timer_handler_ = 0;
+    }
+
+    if (low_memory_)
+    {
+        boost::system::error_code ec;
+        low_memory_->close(ec);
+        low_memory_.reset();
+    }
+
+    // paused children are resumed by the runners when they are detached
+    timer_ = NULL;
+    pm_ = NULL;
+}
+
+pressure_status pressure_monitor::status()
+{
+    LOCK lock(mutex_);
+    return status_;
+}
+
+void pressure_monitor::_arm()
+{
+    waiting_ = true;
+    low_memory_->async_wait(timer_->wrap(boost::bind(&pressure_monitor::_on_low_memory, this, boost::asio::placeholders::error)));
+}
+
+void pressure_monitor::_on_low_memory(const boost::system::error_code& error)
+{
+    if (error || timer_ == NULL)
+    {
+        return;
+    }
+
+    // the notification stays signalled while memory is low, the tick re-arms it once it clears
+    waiting_ = false;
+    WRITE_LOG(warning) << "low memory notification signalled";
+    _tick();
+}
+
+void pressure_monitor::_sample(unsigned int& memory_load, bool& low_memory, unsigned int& cpu_busy)
+{
+    memory_load = 0;
+    low_memory = false;
+    cpu_busy = 0;
+
+    MEMORYSTATUSEX memory = { 0 };
+    memory.dwLength = sizeof(memory);
+    if (GlobalMemoryStatusEx(&memory))
+    {
+        memory_load = memory.dwMemoryLoad;
+    }
+
+    if (low_memory_)
+    {
+        BOOL state = FALSE;
+        if (QueryMemoryResourceNotification(low_memory_->native_handle(), &state))
+        {
+            low_memory = state != FALSE;
+        }
+    }
+
+    // kernel time includes the idle time
+    FILETIME idle_time, kernel_time, user_time;
+    if (GetSystemTimes(&idle_time, &kernel_time, &user_time))
+    {
+        unsigned long long idle = filetime_value(idle_time);
+        unsigned long long total = filetime_value(kernel_time) + filetime_value(user_time);
+        if (last_total_ != 0 && total > last_total_)
+        {
+            cpu_busy = static_cast<unsigned int>(100 - (idle - last_idle_) * 100 / (total - last_total_));
+        }
+        last_idle_ = idle;
+        last_total_ = total;
+    }
+}
+
+void pressure_monitor::_tick()
+{
+    unsigned int memory_load = 0, cpu_busy = 0;
+    bool low_memory = false;
+    _sample(memory_load, low_memory, cpu_busy);
+
+    bool memory_pressure = config_.memory_load_percent != 0 && (low_memory || memory_load >= config_.memory_load_percent);
+    bool cpu_pressure = config_.cpu_percent != 0 && cpu_busy >= config_.cpu_percent;
+    bool under_pressure = memory_pressure || cpu_pressure;
+
+    boost::posix_time::ptime now = timer_->now();
+
+    LOCK lock(mutex_);
+
+    status_.memory_load = memory_load;
+    status_.low_memory = low_memory;
+    status_.cpu_busy = cpu_busy;
+    status_.under_pressure = under_pressure;
+
+    if (under_pressure)
+    {
+        relief_since_ = boost::posix_time::not_a_date_time;
+        if (pressure_since_.is_not_a_date_time())
+        {
+            pressure_since_ = now;
+            WRITE_LOG(warning) << "host under pressure >> memory " << memory_load << "%" << (low_memory ? " low" : "")
+                << " | cpu " << cpu_busy << "%";
+        }
+
+        if (status_.shedding || now - pressure_since_ >= boost::posix_time::seconds(config_.sustain_second))
+        {
+            // kept up while the pressure lasts, so instances started since are shed too
+            std::string reason = memory_pressure
+                ? "memory load " + boost::lexical_cast<std::string>(memory_load) + "%"
+                : "cpu busy " + boost::lexical_cast<std::string>(cpu_busy) + "%";
+            std::size_t changed = pm_->shed(true, reason);
+            if (!status_.shedding || changed != 0)
+            {
+                WRITE_LOG(warning) << "shedding programs under pressure >> " << reason << " | instances " << changed;
+            }
+            status_.shedding = true;
+            status_.shed_instances += changed;
+        }
+    }
+    else
+    {
+        pressure_since_ = boost::posix_time::not_a_date_time;
+        if (status_.shedding)
+        {
+            if (relief_since_.is_not_a_date_time())
+            {
+                relief_since_ = now;
+            }
+
+            if (now - relief_since_ >= boost::posix_time::seconds(config_.relief_second))
+            {
+                std::size_t changed = pm_->shed(false, "pressure relieved");
+                WRITE_LOG(warning) << "pressure relieved, programs brought back >> instances " << changed;
+                status_.shedding = false;
+                status_.shed_instances = 0;
+                relief_since_ = boost::posix_time::not_a_date_time;
+            }
+        }
+    }
+
+    status_.pressure_since = time_utils::format_time(pressure_since_);
+
+    if (low_memory_ && !waiting_ && !low_memory)
+    {
+        _arm();
+    }
+}
@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	pressure_monitor.h for shedding low priority programs under memory or cpu pressure.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+#include "process_manager.h"
+#include "timer.h"
+
+#include <Windows.h>
+#include <boost/asio/windows/object_handle.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+
+//
+// the pressure monitor as returned by the /pressure route.
+//
+struct pressure_status
+{
+    pressure_status() :
+        memory_load(0), low_memory(false), cpu_busy(0), under_pressure(false), shedding(false), shed_instances(0)
+    {
+    }
+
+    unsigned int memory_load;       // percent of physical memory in use
+    bool low_memory;                // the system's low memory notification is signalled
+    unsigned int cpu_busy;          // percent of the last second
+    bool under_pressure;
+    bool shedding;
+    std::string pressure_since;
+    std::size_t shed_instances;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(memory_load),
+            CEREAL_NVP(low_memory),
+            CEREAL_NVP(cpu_busy),
+            CEREAL_NVP(under_pressure),
+            CEREAL_NVP(shedding),
+            CEREAL_NVP(pressure_since),
+            CEREAL_NVP(shed_instances)
+        );
+    }
+};
+
+//
+// samples memory load and cpu once a second, and waits on the low memory
+// resource notification so the onset of memory pressure is seen at once.
+// pressure that lasts sustain_second pauses or stops the programs with a
+// shed setting, everything else keeps its memory. relief_second without
+// pressure brings them back.
+//
+class pressure_monitor : boost::noncopyable
+{
+public:
+    pressure_monitor();
+    ~pressure_monitor();
+
+    bool start(const pressure_config& config, process_manager& pm, timer_generator& timer, boost::system::error_code& ec);
+    void stop();
+
+    pressure_status status();
+
+private:
+    void _tick();
+    void _sample(unsigned int& memory_load, bool& low_memory, unsigned int& cpu_busy);
+    void _arm();
+    void _on_low_memory(const boost::system::error_code& error);
+
+    pressure_config config_;
+    process_manager* pm_;
+    timer_generator* timer_;
+    unsigned long timer_handler_;
+
+    boost::shared_ptr<boost::asio::windows::object_handle> low_memory_;
+    bool waiting_;
+
+    unsigned long long last_idle_;
+    unsigned long long last_total_;
+
+    boost::posix_time::ptime pressure_since_;
+    boost::posix_time::ptime relief_since_;
+
+    MUTEX mutex_;
+    pressure_status status_;
+};
@@ -0,0 +1,427 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	process_backend.cpp for the processes behind the runners, real or simulated.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "process_backend.h"
+
+#include <boost/asio/windows/object_handle.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+
+namespace {
+
+    //
+    // the exit of a real child, waited on by the io_service of the timers.
+    //
+    class native_exit_wait : public process_exit_wait, public boost::enable_shared_from_this<native_exit_wait>
+    {
+    public:
+        native_exit_wait(boost::asio::io_service& io_service, HANDLE duplicate) :
+            handle_(io_service, duplicate), cancelled_(false)
+        {
+        }
+
+        void start(timer_generator& timer, const boost::function<void()>& on_exit)
+        {
+            boost::shared_ptr<native_exit_wait> self = shared_from_this();
+            timer_generator* generator = &timer;
+            handle_.async_wait(timer.wrap([self, generator, on_exit](const boost::system::error_code& error)
+            {
+                // a completion already queued when the wait was cancelled, or the timer stopped, is dropped here
+                if (!error && !self->cancelled_ && !generator->stopped())
+                {
+                    on_exit();
+                }
+            }));
+        }
+
+        virtual void cancel()
+        {
+            cancelled_ = true;
+
+            boost::system::error_code ec;
+            handle_.close(ec);
+        }
+
+    private:
+        boost::asio::windows::object_handle handle_;
+        bool cancelled_;
+    };
+
+    class native_process_backend : public process_backend
+    {
+    public:
+        virtual bool create_process(std::string& process_name, std::string& command, std::string& directory,
+            const process_utils::spawn_options& options, unsigned long& pid, HANDLE& handle)
+        {
+            return process_utils::create_process(process_name, command, directory, options, pid, handle);
+        }
+
+        virtual HANDLE adopt_process(unsigned long pid, unsigned long long start_time, const std::string& process_name)
+        {
+            return process_utils::adopt_process(pid, start_time, process_name);
+        }
+
+        virtual void kill_last_processes(const std::string& process_name, const std::vector<DWORD>& keep_pids)
+        {
+            process_utils::kill_last_processes(process_name, keep_pids);
+        }
+
+        virtual void kill_processes(HANDLE handle, unsigned long pid)
+        {
+            process_utils::kill_processes(handle, pid);
+        }
+
+        virtual void terminate_process(HANDLE handle, unsigned long exit_code)
+        {
+            TerminateProcess(handle, exit_code);
+        }
+
+        virtual bool suspend_process(HANDLE handle, bool suspend)
+        {
+            return process_utils::suspend_process(handle, suspend);
+        }
+
+        virtual bool wait(HANDLE handle, unsigned long milliseconds)
+        {
+            return WaitForSingleObject(handle, milliseconds) == WAIT_OBJECT_0;
+        }
+
+        virtual unsigned long exit_code(HANDLE handle)
+        {
+            unsigned long code = 0;
+            GetExitCodeProcess(handle, &code);
+            return code;
+        }
+
+        virtual void close(HANDLE handle)
+        {
+            CloseHandle(handle);
+        }
+
+        virtual void describe(HANDLE handle, unsigned long long& start_time, unsigned long long& affinity,
+            process_utils::process_priority& priority)
+        {
+            start_time = process_utils::get_process_start_time(handle);
+            affinity = process_utils::get_process_affinity(handle);
+            priority = process_utils::get_process_priority(handle);
+        }
+
+        virtual bool usage(HANDLE handle, unsigned long long& cpu_time, unsigned long long& working_set)
+        {
+            return process_utils::get_process_usage(handle, cpu_time, working_set);
+        }
+
+        virtual unsigned long long now()
+        {
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            return (static_cast<unsigned long long>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+        }
+
+        virtual boost::shared_ptr<process_exit_wait> wait_exit(HANDLE handle, timer_generator& timer,
+            const boost::function<void()>& on_exit)
+        {
+            // the wait owns a duplicate, the caller's handle stays as it is
+            HANDLE duplicate = NULL;
+            if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &duplicate,
+                SYNCHRONIZE, FALSE, 0))
+            {
+                WRITE_LOG(warning) << "wait for process exit failed, error :" << GetLastError();
+                return boost::shared_ptr<process_exit_wait>();
+            }
+
+            boost::shared_ptr<native_exit_wait> wait = boost::make_shared<native_exit_wait>(boost::ref(timer.io_service()), duplicate);
+            wait->start(timer, on_exit);
+            return wait;
+        }
+    };
+
+    HANDLE to_handle(unsigned long long id)
+    {
+        return reinterpret_cast<HANDLE>(static_cast<std::uintptr_t>(id));
+    }
+
+    unsigned long long from_handle(HANDLE handle)
+    {
+        return static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(handle));
+    }
+}
+
+
+process_backend& process_backend::native()
+{
+    static native_process_backend ins;
+    return ins;
+}
+
+
+//
+// the exit handler of a simulated process, posted to the timer when the
+// process exits so it never runs inside the call that killed it.
+//
+class simulated_process_backend::exit_wait : public process_exit_wait
+{
+public:
+    exit_wait(timer_generator& timer, const boost::function<void()>& on_exit) :
+        timer(timer), on_exit(on_exit), cancelled(false)
+    {
+    }
+
+    virtual void cancel()
+    {
+        cancelled = true;
+    }
+
+    timer_generator& timer;
+    boost::function<void()> on_exit;
+    bool cancelled;
+};
+
+
+simulated_process_backend::simulated_process_backend(virtual_clock& clock, unsigned int seed) :
+    clock_(clock), random_(seed), next_handle_(1), next_pid_(1000), spawned_(0)
+{
+}
+
+void simulated_process_backend::script(const std::string& process_name, const simulated_script& script)
+{
+    LOCK lock(mutex_);
+    scripts_[process_name] = script;
+}
+
+unsigned long long simulated_process_backend::spawned()
+{
+    LOCK lock(mutex_);
+    return spawned_;
+}
+
+std::size_t simulated_process_backend::running()
+{
+    LOCK lock(mutex_);
+    return std::count_if(processes_.begin(), processes_.end(),
+        [](const std::pair<const unsigned long long, simulated_process>& item) {
+        return item.second.exit_code == STILL_ACTIVE;
+    });
+}
+
+bool simulated_process_backend::create_process(std::string& process_name, std::string& /* command */, std::string& /* directory */,
+    const process_utils::spawn_options& options, unsigned long& pid, HANDLE& handle)
+{
+    LOCK lock(mutex_);
+
+    simulated_script script;
+    auto found = scripts_.find(process_name);
+    if (found != scripts_.end())
+    {
+        script = found->second;
+    }
+
+    if (script.spawn_fails)
+    {
+        return false;
+    }
+
+    unsigned long long id = next_handle_++;
+    simulated_process& process = processes_[id];
+    process.pid = next_pid_;
+    process.affinity = options.affinity_mask;
+    process.start_time = _filetime(clock_.now());
+
+    // pids step like the kernel's, by four
+    next_pid_ += 4;
+    ++spawned_;
+
+    if (script.lifetime_second != 0)
+    {
+        unsigned long lifetime = script.lifetime_second;
+        if (script.lifetime_jitter_second != 0)
+        {
+            lifetime += boost::random::uniform_int_distribution<unsigned long>(0, script.lifetime_jitter_second)(random_);
+        }
+
+        unsigned long code = script.exit_code;
+        process.exit_id = clock_.schedule(clock_.now() + boost::posix_time::seconds(lifetime),
+            [this, id, code]() { this->_exit(id, code); });
+    }
+
+    pid = process.pid;
+    handle = to_handle(id);
+    return true;
+}
+
+HANDLE simulated_process_backend::adopt_process(unsigned long /* pid */, unsigned long long /* start_time */, const std::string& /* process_name */)
+{
+    return NULL;
+}
+
+void simulated_process_backend::kill_last_processes(const std::string& /* process_name */, const std::vector<DWORD>& /* keep_pids */)
+{
+}
+
+void simulated_process_backend::kill_processes(HANDLE handle, unsigned long /* pid */)
+{
+    _exit(from_handle(handle), 0);
+}
+
+void simulated_process_backend::terminate_process(HANDLE handle, unsigned long exit_code)
+{
+    _exit(from_handle(handle), exit_code);
+}
+
+bool simulated_process_backend::suspend_process(HANDLE handle, bool /* suspend */)
+{
+    // the scripted lifetime keeps running, a paused simulated process still exits on time
+    return exit_code(handle) == STILL_ACTIVE;
+}
+
+bool simulated_process_backend::wait(HANDLE handle, unsigned long /* milliseconds */)
+{
+    // the clock does not move inside a call, the process has exited or it never will here
+    return exit_code(handle) != STILL_ACTIVE;
+}
+
+unsigned long simulated_process_backend::exit_code(HANDLE handle)
+{
+    LOCK lock(mutex_);
+
+    auto iter = processes_.find(from_handle(handle));
+    if (iter == processes_.end())
+    {
+        return 0;
+    }
+
+    return iter->second.exit_code;
+}
+
+void simulated_process_backend::close(HANDLE handle)
+{
+    LOCK lock(mutex_);
+
+    // a running process is forgotten with its handle, like a detached child
+    auto iter = processes_.find(from_handle(handle));
+    if (iter == processes_.end())
+    {
+        return;
+    }
+
+    if (iter->second.exit_id != 0)
+    {
+        clock_.cancel(iter->second.exit_id);
+    }
+    processes_.erase(iter);
+}
+
+void simulated_process_backend::describe(HANDLE handle, unsigned long long& start_time, unsigned long long& affinity,
+    process_utils::process_priority& priority)
+{
+    LOCK lock(mutex_);
+
+    start_time = 0;
+    affinity = 0;
+    priority = process_utils::process_priority();
+
+    auto iter = processes_.find(from_handle(handle));
+    if (iter != processes_.end())
+    {
+        start_time = iter->second.start_time;
+        affinity = iter->second.affinity;
+    }
+}
+
+bool simulated_process_backend::usage(HANDLE /* handle */, unsigned long long& cpu_time, unsigned long long& working_set)
+{
+    cpu_time = 0;
+    working_set = 0;
+    return true;
+}
+
+unsigned long long simulated_process_backend::now()
+{
+    return _filetime(clock_.now());
+}
+
+boost::shared_ptr<process_exit_wait> simulated_process_backend::wait_exit(HANDLE handle, timer_generator& timer,
+    const boost::function<void()>& on_exit)
+{
+    LOCK lock(mutex_);
+
+    auto iter = processes_.find(from_handle(handle));
+    if (iter == processes_.end())
+    {
+        return boost::shared_ptr<process_exit_wait>();
+    }
+
+    boost::shared_ptr<exit_wait> wait = boost::make_shared<exit_wait>(boost::ref(timer), on_exit);
+    if (iter->second.exit_code != STILL_ACTIVE)
+    {
+        timer.post([wait]() { if (!wait->cancelled) wait->on_exit(); });
+        return wait;
+    }
+
+    iter->second.waits.push_back(wait);
+    return wait;
+}
+
+void simulated_process_backend::_exit(unsigned long long id, unsigned long exit_code)
+{
+    std::vector<boost::shared_ptr<exit_wait> > waits;
+    {
+        LOCK lock(mutex_);
+
+        auto iter = processes_.find(id);
+        if (iter == processes_.end() || iter->second.exit_code != STILL_ACTIVE)
+        {
+            return;
+        }
+
+        if (iter->second.exit_id != 0)
+        {
+            clock_.cancel(iter->second.exit_id);
+            iter->second.exit_id = 0;
+        }
+
+        iter->second.exit_code = exit_code;
+        waits.swap(iter->second.waits);
+    }
+
+    std::for_each(waits.begin(), waits.end(), [](boost::shared_ptr<exit_wait>& wait) {
+        wait->timer.post([wait]() { if (!wait->cancelled) wait->on_exit(); });
+    });
+}
+
+unsigned long long simulated_process_backend::_filetime(const boost::posix_time::ptime& time)
+{
+    static const boost::posix_time::ptime filetime_epoch(boost::gregorian::date(1601, 1, 1));
+    return static_cast<unsigned long long>((time - filetime_epoch).total_microseconds()) * 10;
+}
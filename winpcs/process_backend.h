@@ -0,0 +1,179 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	process_backend.h for the processes behind the runners, real or simulated.
+*/
+#pragma once
+
+#include "config.hpp"
+
+#include <Windows.h>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "process_utils.h"
+#include "timer.h"
+#include "virtual_clock.h"
+
+
+//
+// a pending exit notification, cancel guarantees the handler is not called.
+//
+class process_exit_wait : boost::noncopyable
+{
+public:
+    virtual ~process_exit_wait()
+    {
+    }
+
+    virtual void cancel() = 0;
+};
+
+//
+// everything the runners and the scheduler do to a child. the native
+// backend is process_utils and the win32 api, the simulated one plays
+// scripted lifetimes on a virtual clock.
+//
+class process_backend : boost::noncopyable
+{
+public:
+    virtual ~process_backend()
+    {
+    }
+
+    static process_backend& native();
+
+    virtual bool create_process(std::string& process_name, std::string& command, std::string& directory,
+        const process_utils::spawn_options& options, unsigned long& pid, HANDLE& handle) = 0;
+    virtual HANDLE adopt_process(unsigned long pid, unsigned long long start_time, const std::string& process_name) = 0;
+    virtual void kill_last_processes(const std::string& process_name, const std::vector<DWORD>& keep_pids) = 0;
+    virtual void kill_processes(HANDLE handle, unsigned long pid) = 0;
+    virtual void terminate_process(HANDLE handle, unsigned long exit_code) = 0;
+    virtual bool suspend_process(HANDLE handle, bool suspend) = 0;
+
+    // true once the process has exited, waiting at most milliseconds
+    virtual bool wait(HANDLE handle, unsigned long milliseconds) = 0;
+
+    // STILL_ACTIVE while the process runs
+    virtual unsigned long exit_code(HANDLE handle) = 0;
+    virtual void close(HANDLE handle) = 0;
+
+    virtual void describe(HANDLE handle, unsigned long long& start_time, unsigned long long& affinity,
+        process_utils::process_priority& priority) = 0;
+    virtual bool usage(HANDLE handle, unsigned long long& cpu_time, unsigned long long& working_set) = 0;
+
+    // FILETIME of the clock the processes live by
+    virtual unsigned long long now() = 0;
+
+    // calls on_exit in order with the timer callbacks once the process has
+    // exited. a null result means the exit is only noticed by polling
+    virtual boost::shared_ptr<process_exit_wait> wait_exit(HANDLE handle, timer_generator& timer,
+        const boost::function<void()>& on_exit) = 0;
+};
+
+//
+// how the simulated processes of one program behave.
+//
+struct simulated_script
+{
+    simulated_script() :
+        lifetime_second(0), lifetime_jitter_second(0), exit_code(0), spawn_fails(false)
+    {
+    }
+
+    unsigned long lifetime_second;          // 0 runs until killed
+    unsigned long lifetime_jitter_second;   // random extra lifetime, from a seeded generator
+    unsigned long exit_code;                // exit code when the lifetime ends
+    bool spawn_fails;
+};
+
+//
+// processes that exist only as entries in a table. a process exits when the
+// virtual clock reaches the end of its scripted lifetime, so a timer_generator
+// and this backend on the same clock replay a day of restarts in the time
+// the handlers take. nothing is ever adopted or left behind.
+//
+class simulated_process_backend : public process_backend
+{
+public:
+    explicit simulated_process_backend(virtual_clock& clock, unsigned int seed = 1);
+
+    // the script of the programs with this process_name, the rest run until killed
+    void script(const std::string& process_name, const simulated_script& script);
+
+    unsigned long long spawned();
+    std::size_t running();
+
+    virtual bool create_process(std::string& process_name, std::string& command, std::string& directory,
+        const process_utils::spawn_options& options, unsigned long& pid, HANDLE& handle);
+    virtual HANDLE adopt_process(unsigned long pid, unsigned long long start_time, const std::string& process_name);
+    virtual void kill_last_processes(const std::string& process_name, const std::vector<DWORD>& keep_pids);
+    virtual void kill_processes(HANDLE handle, unsigned long pid);
+    virtual void terminate_process(HANDLE handle, unsigned long exit_code);
+    virtual bool suspend_process(HANDLE handle, bool suspend);
+    virtual bool wait(HANDLE handle, unsigned long milliseconds);
+    virtual unsigned long exit_code(HANDLE handle);
+    virtual void close(HANDLE handle);
+    virtual void describe(HANDLE handle, unsigned long long& start_time, unsigned long long& affinity,
+        process_utils::process_priority& priority);
+    virtual bool usage(HANDLE handle, unsigned long long& cpu_time, unsigned long long& working_set);
+    virtual unsigned long long now();
+    virtual boost::shared_ptr<process_exit_wait> wait_exit(HANDLE handle, timer_generator& timer,
+        const boost::function<void()>& on_exit);
+
+private:
+    class exit_wait;
+
+    struct simulated_process
+    {
+        simulated_process() :
+            pid(0), affinity(0), exit_code(STILL_ACTIVE), start_time(0), exit_id(0)
+        {
+        }
+
+        unsigned long pid;
+        unsigned long long affinity;
+        unsigned long exit_code;
+        unsigned long long start_time;
+        unsigned long long exit_id;
+        std::vector<boost::shared_ptr<exit_wait> > waits;
+    };
+
+    void _exit(unsigned long long id, unsigned long exit_code);
+    unsigned long long _filetime(const boost::posix_time::ptime& time);
+
+    MUTEX mutex_;
+    virtual_clock& clock_;
+    boost::random::mt19937 random_;
+    boost::unordered_map<std::string, simulated_script> scripts_;
+    boost::unordered_map<unsigned long long, simulated_process> processes_;
+    unsigned long long next_handle_;
+    unsigned long next_pid_;
+    unsigned long long spawned_;
+};
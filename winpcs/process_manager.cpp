@@ -31,7 +31,131 @@
 */
 #pragma once
 
+#define WINPCS_LOG_MODULE log_process
+
 #include "process_manager.h"
+#include "tcp_proxy.h"
+
+namespace {
+
+    const long retire_second = 10;
+
+    unsigned long priority_class(const process_config& info)
+    {
+        if (info.sched_policy == "idle" || info.nice >= 15)
+        {
+            return IDLE_PRIORITY_CLASS;
+        }
+
+        if (info.sched_policy == "batch" || info.nice > 0)
+        {
+            return BELOW_NORMAL_PRIORITY_CLASS;
+        }
+
+        if (info.nice <= -15)
+        {
+            return HIGH_PRIORITY_CLASS;
+        }
+
+        if (info.nice < 0)
+        {
+            return ABOVE_NORMAL_PRIORITY_CLASS;
+        }
+
+        return 0;
+    }
+
+    // windows io priority hints: 0 very low, 1 low, 2 normal. high is reserved for the system.
+    int io_priority(const process_config& info)
+    {
+        if (info.ioprio_class == "idle")
+        {
+            return 0;
+        }
+
+        if (info.ioprio_class == "best-effort")
+        {
+            // 4 is the linux default, so 0 to 4 stay normal and only 5 to 7 ask for less
+            return info.ioprio_level > 4 ? 1 : 2;
+        }
+
+        if (info.ioprio_class == "realtime")
+        {
+            return 2;
+        }
+
+        return -1;
+    }
+
+    // the memory manager trims low memory priority pages first, the closest thing to an oom score
+    int memory_priority(const process_config& info)
+    {
+        if (info.oom_score_adj <= 0)
+        {
+            return -1;
+        }
+
+        if (info.oom_score_adj <= 250)
+        {
+            return MEMORY_PRIORITY_BELOW_NORMAL;
+        }
+
+        if (info.oom_score_adj <= 500)
+        {
+            return MEMORY_PRIORITY_MEDIUM;
+        }
+
+        if (info.oom_score_adj <= 750)
+        {
+            return MEMORY_PRIORITY_LOW;
+        }
+
+        return MEMORY_PRIORITY_VERY_LOW;
+    }
+}
+
+// scheduling of one instance, spreading the instances round-robin over cores or nodes
+process_utils::spawn_options instance_spawn_options(const process_config& info, unsigned int slot)
+{
+    process_utils::spawn_options options;
+    options.numa_node = info.numa_node;
+    options.priority_class = priority_class(info);
+    options.io_priority = io_priority(info);
+    options.memory_priority = memory_priority(info);
+
+    std::vector<unsigned int> cpus;
+    if (!info.cpu_affinity.empty())
+    {
+        process_utils::parse_cpu_list(info.cpu_affinity, cpus);
+    }
+
+    if (info.placement == "cores")
+    {
+        if (cpus.empty())
+        {
+            cpus = process_utils::system_cpus();
+        }
+
+        if (!cpus.empty())
+        {
+            options.affinity_mask = 1ULL << cpus[slot % cpus.size()];
+        }
+        return options;
+    }
+
+    if (info.placement == "nodes")
+    {
+        unsigned int first_node = info.numa_node >= 0 ? info.numa_node : 0;
+        options.numa_node = static_cast<int>((first_node + slot) % process_utils::numa_node_count());
+    }
+
+    for (std::vector<unsigned int>::iterator iter = cpus.begin(); iter != cpus.end(); ++iter)
+    {
+        options.affinity_mask |= 1ULL << *iter;
+    }
+
+    return options;
+}
 
 exec_runner::~exec_runner(void)
 {
@@ -48,13 +172,130 @@ process_config& exec_runner::get_info()
     return info_;
 }
 
+process_config exec_runner::info_copy()
+{
+    LOCK lock(info_mutex_);
+    return info_;
+}
+
 unsigned long exec_runner::process_id() {
     return process_id_;
 }
 
-bool exec_runner::init()
+unsigned int exec_runner::instance()
+{
+    return instance_;
+}
+
+const std::string& exec_runner::key()
+{
+    return key_;
+}
+
+const process_utils::spawn_options& exec_runner::spawn_options()
+{
+    return options_;
+}
+
+void exec_runner::set_output(output_store* output)
+{
+    this->output_ = output;
+}
+
+unsigned long long exec_runner::affinity()
+{
+    return affinity_;
+}
+
+const process_utils::process_priority& exec_runner::priority()
+{
+    return priority_;
+}
+
+status_table::process_state exec_runner::state()
+{
+    if (this->stop_flag_)
+    {
+        return status_table::state_stopped;
+    }
+
+    if (this->process_handle_ != 0)
+    {
+        return status_table::state_running;
+    }
+
+    return this->started_ ? status_table::state_exited : status_table::state_starting;
+}
+
+unsigned int exec_runner::restart_count()
+{
+    return restart_count_;
+}
+
+unsigned long exec_runner::last_exit_code()
+{
+    return last_exit_code_;
+}
+
+unsigned long long exec_runner::start_time()
+{
+    return start_time_;
+}
+
+unsigned long long exec_runner::last_exit_time()
+{
+    return last_exit_time_;
+}
+
+void exec_runner::usage(unsigned long long& cpu_time, unsigned long long& working_set)
 {
-    process_utils::kill_last_processes(this->info_.process_name);
+    cpu_time = 0;
+    working_set = 0;
+
+    if (this->process_handle_ != 0)
+    {
+        this->backend_.usage(this->process_handle_, cpu_time, working_set);
+    }
+}
+
+bool exec_runner::adopt()
+{
+    journal_record record;
+    if (!this->journal_.find(this->key_, record))
+    {
+        return false;
+    }
+
+    if (record.op != journal_record::op_started || record.config_hash != this->info_.hash())
+    {
+        return false;
+    }
+
+    HANDLE handle = this->backend_.adopt_process(record.pid, record.start_time, this->info_.process_name);
+    if (handle == NULL)
+    {
+        this->journal_.record_exited(this->key_);
+        return false;
+    }
+
+    WRITE_LOG(trace) << "adopt process >> " << this->key_ << " | pid >> " << record.pid;
+
+    this->process_handle_ = handle;
+    this->process_id_ = record.pid;
+    this->exit_code_ = STILL_ACTIVE;
+    this->started_ = true;
+    this->start_time_ = record.start_time;
+    this->history_.record(this->key_, history_event::ev_adopted, record.pid, 0, "supervisor restarted");
+
+    unsigned long long start_time = 0;
+    this->backend_.describe(handle, start_time, this->affinity_, this->priority_);
+    this->_wait_exit();
+    return true;
+}
+
+bool exec_runner::init(const std::vector<DWORD>& keep_pids)
+{
+    this->backend_.kill_last_processes(this->info_.process_name, keep_pids);
     return true;
 }
 
@@ -67,8 +308,176 @@ bool exec_runner::start()
 
 void exec_runner::stop()
 {
+    this->_set_stop(true);
+    this->_kill_timer();
+
+    if (this->process_handle_ != 0)
+    {
+        this->history_.record(this->key_, history_event::ev_stopped, this->process_id_, 0, "stopped by supervisor");
+    }
+
+    this->_stop_process();
+}
+
+void exec_runner::detach()
+{
+    this->_kill_timer();
+
+    if (this->process_handle_ == 0)
+    {
+        return;
+    }
+
+    // leave the child running, the journal entry lets the next supervisor adopt it
+    if (this->shed_ && this->info_.shed == "pause")
+    {
+        this->backend_.suspend_process(this->process_handle_, false);
+        this->shed_ = false;
+    }
+
+    WRITE_LOG(trace) << "detach process >> " << this->key_ << " | pid >> " << this->process_id_;
+    this->history_.record(this->key_, history_event::ev_detached, this->process_id_, 0, "supervisor exiting");
+    this->_cancel_exit_wait();
+    this->backend_.close(this->process_handle_);
+    this->process_handle_ = 0;
+    this->process_id_ = 0;
+}
+
+void exec_runner::restart(const std::string& reason)
+{
+    if (this->_check_stop_flag() == true)
+    {
+        return;
+    }
+
+    if (this->process_handle_ != 0)
+    {
+        WRITE_LOG(warning) << "restart process >> " << this->key_ << " | " << reason;
+        this->history_.record(this->key_, history_event::ev_stopped, this->process_id_, 0, reason);
+        this->_stop_process();
+    }
+
+    // start it now rather than at the next poll
+    this->timer_run_exe();
+}
+
+bool exec_runner::running()
+{
+    this->_flush_exit_code();
+    return this->_check_process_running();
+}
+
+bool exec_runner::shed(const std::string& reason)
+{
+    if (this->shed_ || this->_check_stop_flag() == true)
+    {
+        return false;
+    }
+
+    if (this->info_.shed == "pause")
+    {
+        if (this->process_handle_ == 0 || !this->backend_.suspend_process(this->process_handle_, true))
+        {
+            return false;
+        }
+
+        WRITE_LOG(warning) << "pause process >> " << this->key_ << " | " << reason;
+        this->history_.record(this->key_, history_event::ev_paused, this->process_id_, 0, reason);
+        this->shed_ = true;
+        return true;
+    }
+
+    if (this->info_.shed == "stop")
+    {
+        WRITE_LOG(warning) << "shed process >> " << this->key_ << " | " << reason;
+        this->shed_ = true;
+        this->_set_stop(true);
+        this->_kill_timer();
+        if (this->process_handle_ != 0)
+        {
+            this->history_.record(this->key_, history_event::ev_stopped, this->process_id_, 0, reason);
+        }
+        this->_stop_process();
+        return true;
+    }
+
+    return false;
+}
+
+bool exec_runner::unshed(const std::string& reason)
+{
+    if (!this->shed_)
+    {
+        return false;
+    }
+
+    this->shed_ = false;
+
+    if (this->info_.shed == "pause")
+    {
+        if (this->process_handle_ != 0 && this->backend_.suspend_process(this->process_handle_, false))
+        {
+            WRITE_LOG(warning) << "resume process >> " << this->key_ << " | " << reason;
+            this->history_.record(this->key_, history_event::ev_resumed, this->process_id_, 0, reason);
+        }
+        return true;
+    }
+
+    WRITE_LOG(warning) << "bring back process >> " << this->key_ << " | " << reason;
+    this->history_.record(this->key_, history_event::ev_resumed, 0, 0, reason);
+    this->_set_stop(false);
+    this->timer_handler_ = this->timer_.set_timer(boost::bind(&exec_runner::timer_run_exe, this), this->info_.startsecs, true);
+    return true;
+}
+
+bool exec_runner::hold(const std::string& reason)
+{
+    if (this->held_)
+    {
+        return false;
+    }
+
+    WRITE_LOG(warning) << "hold process >> " << this->key_ << " | " << reason;
+    this->held_ = true;
+    this->shed_ = false;
+    this->_set_stop(true);
     this->_kill_timer();
+    if (this->process_handle_ != 0)
+    {
+        this->history_.record(this->key_, history_event::ev_stopped, this->process_id_, 0, reason);
+    }
     this->_stop_process();
+    return true;
+}
+
+bool exec_runner::release(const std::string& reason)
+{
+    if (!this->held_)
+    {
+        return false;
+    }
+
+    WRITE_LOG(warning) << "release process >> " << this->key_ << " | " << reason;
+    this->held_ = false;
+    this->_set_stop(false);
+    this->timer_handler_ = this->timer_.set_timer(boost::bind(&exec_runner::timer_run_exe, this), this->info_.startsecs, true);
+    return true;
+}
+
+bool exec_runner::update(const process_config& info)
+{
+    if (this->info_.process_name == info.process_name && this->info_.command == info.command &&
+        this->info_.directory == info.directory && this->info_.environment == info.environment)
+    {
+        return false;
+    }
+
+    LOCK lock(this->info_mutex_);
+    this->info_.process_name = info.process_name;
+    this->info_.command = info.command;
+    this->info_.directory = info.directory;
+    this->info_.environment = info.environment;
+    return true;
 }
 
 void exec_runner::timer_delay()
@@ -83,9 +492,9 @@ void exec_runner::timer_delay()
 
 void exec_runner::timer_run_exe()
 {
-    SCOPE_EXIT(WRITE_LOG(trace) << "[timer_run_exe][end]" << this->info_.name);
+    SCOPE_EXIT(WRITE_LOG_LIMIT(trace, 20, 10) << "[timer_run_exe][end]" << this->info_.name);
 
-    WRITE_LOG(trace) << "[timer_run_exe][begin]" << this->info_.name;
+    WRITE_LOG_LIMIT(trace, 20, 10) << "[timer_run_exe][begin]" << this->info_.name;
 
     if (this->_check_stop_flag() == true)
     {
@@ -98,16 +507,64 @@ void exec_runner::timer_run_exe()
         return;
     }
 
-    WRITE_LOG(trace) << "timer_run_exe pass check! >> " << this->info_.name;
+    WRITE_LOG_LIMIT(trace, 10, 60) << "timer_run_exe pass check! >> " << this->info_.name;
+
 
+    // a capturing child writes both of its outputs into one pipe, the output store reads the other end
+    process_utils::spawn_options options = this->options_;
+    HANDLE read_pipe = NULL;
+    HANDLE write_pipe = NULL;
+    if (this->output_ != NULL && this->info_.capture_output && this->output_->create_pipe(read_pipe, write_pipe))
+    {
+        options.std_output = write_pipe;
+        options.std_error = write_pipe;
+    }
 
-    bool success = process_utils::create_process(
+    bool success = this->backend_.create_process(
         this->info_.process_name,
         this->info_.command,
         this->info_.directory,
+        options,
         this->process_id_,
         this->process_handle_);
 
+    // the child holds its own copy, the pipe breaks once it and its children have exited
+    if (write_pipe != NULL)
+    {
+        CloseHandle(write_pipe);
+    }
+    if (read_pipe != NULL)
+    {
+        if (success)
+        {
+            this->output_->attach(this->info_.name, this->key_, read_pipe);
+        }
+        else
+        {
+            CloseHandle(read_pipe);
+        }
+    }
+
+    if (success)
+    {
+        std::string reason("autostart");
+        if (this->started_)
+        {
+            ++this->restart_count_;
+            reason = "restart after exit " + boost::lexical_cast<std::string>(this->last_exit_code_);
+        }
+        this->history_.record(this->key_, history_event::ev_started, this->process_id_, 0, reason);
+
+        this->started_ = true;
+        this->backend_.describe(this->process_handle_, this->start_time_, this->affinity_, this->priority_);
+        this->journal_.record_started(this->key_, this->process_id_, this->start_time_, this->info_.hash());
+        this->_wait_exit();
+    }
+    else
+    {
+        this->history_.record(this->key_, history_event::ev_spawn_failed, 0, 0, "create process failed");
+    }
+
     this->_flush_exit_code();
 }
 
@@ -118,11 +575,13 @@ void exec_runner::_flush_exit_code()
         return;
     }
 
-    unsigned long code = 0;
-    GetExitCodeProcess(this->process_handle_, &code);
+    unsigned long code = this->backend_.exit_code(this->process_handle_);
     this->exit_code_ = code;
     if (code != STILL_ACTIVE)
     {
+        this->last_exit_code_ = code;
+        this->last_exit_time_ = this->backend_.now();
+        this->history_.record(this->key_, history_event::ev_exited, this->process_id_, code, "exited");
         this->_close_handle();
     }
 }
@@ -168,7 +627,7 @@ void exec_runner::_stop_process()
         }
 
         if (this->process_handle_ != NULL) {
-            process_utils::kill_processes(this->process_handle_, this->process_id_);
+            this->backend_.kill_processes(this->process_handle_, this->process_id_);
             this->_close_handle();
         }
     }
@@ -180,7 +639,7 @@ bool exec_runner::_check_process_running()
 {
     auto ret = false;
 
-    SCOPE_EXIT(WRITE_LOG(trace) << "check process running >> " << this->info_.name << " | running >> " << ret; );
+    SCOPE_EXIT_REF(WRITE_LOG_SAMPLE(trace, 16) << "check process running >> " << this->info_.name << " | running >> " << ret; );
 
     if (this->process_handle_ == 0)
     {
@@ -198,9 +657,38 @@ void exec_runner::_close_handle()
         return;
     }
 
-    CloseHandle(this->process_handle_);
+    this->_cancel_exit_wait();
+    this->backend_.close(this->process_handle_);
     this->process_handle_ = 0;
     this->process_id_ = 0;
+
+    this->journal_.record_exited(this->key_);
+}
+
+void exec_runner::_wait_exit()
+{
+    this->exit_wait_ = this->backend_.wait_exit(this->process_handle_, this->timer_, boost::bind(&exec_runner::_on_exit, this));
+    if (!this->exit_wait_)
+    {
+        WRITE_LOG(warning) << "wait for process exit failed, exit noticed on the next poll >> " << this->key_;
+    }
+}
+
+void exec_runner::_on_exit()
+{
+    // the exit is recorded as it happens, the restart still waits for the next poll
+    this->_flush_exit_code();
+}
+
+void exec_runner::_cancel_exit_wait()
+{
+    if (!this->exit_wait_)
+    {
+        return;
+    }
+
+    this->exit_wait_->cancel();
+    this->exit_wait_.reset();
 }
 
 
@@ -209,24 +697,94 @@ void exec_runner::_kill_process()
     if (this->process_handle_ != 0)
     {
         WRITE_LOG(trace) << "kill process >> " << this->info_.name << " finished.";
-        TerminateProcess(this->process_handle_, 0);
+        this->backend_.terminate_process(this->process_handle_, 0);
         this->_close_handle();
     }
 }
 
 
-void process_manager::start(std::vector<process_config>& process_info, timer_generator& timer, boost::system::error_code& ec)
+void process_manager::set_backend(process_backend& backend)
 {
+    this->backend_ = &backend;
+}
+
+void process_manager::set_prewarmer(page_prewarmer& prewarmer)
+{
+    this->prewarmer_ = &prewarmer;
+}
+
+void process_manager::set_proxy(tcp_proxy& proxy)
+{
+    this->proxy_ = &proxy;
+}
+
+void process_manager::set_output(output_store& output)
+{
+    this->output_ = &output;
+}
+
+void process_manager::start(std::vector<process_config>& process_info, timer_generator& timer, state_journal& journal, history_store& history, boost::system::error_code& ec)
+{
+    this->timer_ = &timer;
+    this->journal_ = &journal;
+    this->history_ = &history;
+
+    LOCK lock(this->runners_mutex_);
+
+    std::vector<DWORD> adopted_pids;
+    std::vector<boost::shared_ptr<exec_runner> > cold_runners;
+
     std::for_each(process_info.begin(), process_info.end(),
         [&](process_config& info) {
-        auto tmp = boost::make_shared<exec_runner>(info, timer);
-        tmp->init();
-        this->runners_.push_back(tmp);
+        // scheduled programs are started by the scheduler, not kept running
+        if (!info.schedule.empty())
+        {
+            return;
+        }
+
+        this->programs_[info.name] = info;
+
+        unsigned int numprocs = info.numprocs == 0 ? 1 : info.numprocs;
+        if (info.autoscale.enabled())
+        {
+            numprocs = (std::min)((std::max)(numprocs, info.autoscale.min), info.autoscale.max);
+        }
+
+        for (unsigned int slot = 0; slot < numprocs; ++slot)
+        {
+            auto tmp = boost::make_shared<exec_runner>(info, info.numprocs_start + slot,
+                instance_spawn_options(info, slot), *this->backend_, timer, journal, history);
+            tmp->set_output(this->output_);
+            if (tmp->adopt())
+            {
+                adopted_pids.push_back(tmp->process_id());
+            }
+            else
+            {
+                cold_runners.push_back(tmp);
+            }
+            this->runners_.push_back(tmp);
+        }
+    }
+    );
+
+    // kill the leftovers only after every runner had a chance to adopt its child
+    std::for_each(cold_runners.begin(), cold_runners.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        runner->init(adopted_pids);
     }
     );
 
     std::for_each(this->runners_.begin(), this->runners_.end(),
         [&](boost::shared_ptr<exec_runner>& runner) {
+        // an adopted child is already running, there is nothing to wait for
+        bool cold = std::find(cold_runners.begin(), cold_runners.end(), runner) != cold_runners.end();
+        if (cold && this->prewarmer_ != NULL && runner->get_info().prewarm != "none")
+        {
+            this->prewarmer_->when_warm(runner->get_info().name, [runner]() { runner->start(); });
+            return;
+        }
+
         runner->start();
     }
     );
@@ -234,27 +792,200 @@ void process_manager::start(std::vector<process_config>& process_info, timer_gen
 
 void process_manager::stop()
 {
+    LOCK lock(this->runners_mutex_);
+
     std::for_each(this->runners_.begin(), this->runners_.end(),
         [&](boost::shared_ptr<exec_runner>& runner) {
         runner->stop();
     }
     );
+
+    std::for_each(this->retiring_.begin(), this->retiring_.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        runner->stop();
+    }
+    );
+}
+
+void process_manager::detach()
+{
+    LOCK lock(this->runners_mutex_);
+
+    std::for_each(this->runners_.begin(), this->runners_.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        runner->detach();
+    }
+    );
+
+    std::for_each(this->retiring_.begin(), this->retiring_.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        runner->detach();
+    }
+    );
+}
+
+std::vector<boost::shared_ptr<exec_runner> > process_manager::runners()
+{
+    LOCK lock(this->runners_mutex_);
+    return runners_;
+}
+
+std::size_t process_manager::max_instances()
+{
+    LOCK lock(this->runners_mutex_);
+
+    std::size_t count = this->runners_.size();
+    std::for_each(this->programs_.begin(), this->programs_.end(),
+        [&](const std::pair<const std::string, process_config>& program) {
+        if (program.second.autoscale.enabled())
+        {
+            count += program.second.autoscale.max;
+        }
+    }
+    );
+
+    return count;
+}
+
+std::size_t process_manager::instances(const std::string& name)
+{
+    LOCK lock(this->runners_mutex_);
+
+    return std::count_if(this->runners_.begin(), this->runners_.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        return runner->get_info().name == name;
+    }
+    );
+}
+
+bool process_manager::scale(const std::string& name, std::size_t count, const std::string& reason)
+{
+    auto program = this->programs_.find(name);
+    if (program == this->programs_.end() || this->timer_ == NULL)
+    {
+        return false;
+    }
+
+    process_config& info = program->second;
+    std::vector<boost::shared_ptr<exec_runner> > retired;
+    std::vector<boost::shared_ptr<exec_runner> > added;
+    {
+        LOCK lock(this->runners_mutex_);
+
+        std::size_t current = std::count_if(this->runners_.begin(), this->runners_.end(),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            return runner->get_info().name == name;
+        }
+        );
+
+        for (std::size_t slot = current; slot < count; ++slot)
+        {
+            // a slot still draining is not reused, its late stop would close the journal
+            // entry of the new child. the group grows past it once it is gone
+            unsigned int instance = info.numprocs_start + static_cast<unsigned int>(slot);
+            bool draining = std::any_of(this->retiring_.begin(), this->retiring_.end(),
+                [&](boost::shared_ptr<exec_runner>& runner) {
+                return runner->get_info().name == name && runner->instance() == instance;
+            }
+            );
+            if (draining)
+            {
+                break;
+            }
+
+            // no leftovers are killed here, they would be the group's running instances
+            auto runner = boost::make_shared<exec_runner>(info, info.numprocs_start + static_cast<unsigned int>(slot),
+                instance_spawn_options(info, static_cast<unsigned int>(slot)), *this->backend_, *this->timer_, *this->journal_, *this->history_);
+            runner->set_output(this->output_);
+            this->runners_.push_back(runner);
+            added.push_back(runner);
+        }
+
+        for (std::size_t slot = current; slot > count; --slot)
+        {
+            unsigned int instance = info.numprocs_start + static_cast<unsigned int>(slot - 1);
+            auto iter = std::find_if(this->runners_.begin(), this->runners_.end(),
+                [&](boost::shared_ptr<exec_runner>& runner) {
+                return runner->get_info().name == name && runner->instance() == instance;
+            }
+            );
+            if (iter != this->runners_.end())
+            {
+                retired.push_back(*iter);
+                this->retiring_.push_back(*iter);
+                this->runners_.erase(iter);
+            }
+        }
+    }
+
+    if (added.empty() && retired.empty())
+    {
+        return false;
+    }
+
+    WRITE_LOG(warning) << "scale program >> " << name << " | instances " << count << " | " << reason;
+
+    std::for_each(added.begin(), added.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        runner->start();
+    }
+    );
+
+    std::for_each(retired.begin(), retired.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        timer_generator* timer = this->timer_;
+        auto retire = [this, runner, timer]() {
+            runner->stop();
+
+            {
+                LOCK lock(this->runners_mutex_);
+                this->retiring_.erase(std::remove(this->retiring_.begin(), this->retiring_.end(), runner),
+                    this->retiring_.end());
+            }
+
+            // a callback of the runner may already be queued, it lives until that has run
+            timer->post([runner]() {}, retire_second);
+        };
+
+        if (this->proxy_ == NULL || !this->proxy_->drain(runner->key(), retire))
+        {
+            retire();
+        }
+    }
+    );
+
+    return true;
 }
 
 std::vector<process_status> process_manager::status(unsigned long pid)
 {
     std::vector<process_status> res;
 
-    std::for_each(this->runners_.begin(), this->runners_.end(), [&](boost::shared_ptr<exec_runner>& runner)
+    auto runners = this->runners();
+    std::for_each(runners.begin(), runners.end(), [&](boost::shared_ptr<exec_runner>& runner)
     {
+        process_config info = runner->info_copy();
+
         process_status ps;
-        ps.command = runner->get_info().command;
-        ps.directory = runner->get_info().directory;
+        ps.command = info.command;
+        ps.directory = info.directory;
         ps.exit_code = runner->exit_code();
-        ps.name = runner->get_info().name;
-        ps.process_name = runner->get_info().process_name;
+        ps.name = info.name;
+        ps.process_name = info.process_name;
         ps.pid = runner->process_id();
-        ps.environment = runner->get_info().environment;
+        ps.environment = info.environment;
+        ps.instance = runner->instance();
+        ps.numa_node = runner->spawn_options().numa_node;
+
+        std::ostringstream affinity;
+        affinity << "0x" << std::hex << runner->affinity();
+        ps.cpu_affinity = affinity.str();
+
+        ps.priority_class = runner->priority().priority_class;
+        ps.io_priority = runner->priority().io_priority;
+        ps.memory_priority = runner->priority().memory_priority;
+        ps.restart_count = runner->restart_count();
+        ps.last_exit_code = runner->last_exit_code();
 
         res.push_back(ps);
     });
@@ -262,4 +993,212 @@ std::vector<process_status> process_manager::status(unsigned long pid)
     return res;
 }
 
+bool process_manager::restart(const std::string& name, const std::string& reason)
+{
+    auto rolling = boost::make_shared<rolling_restart>();
+    rolling->reason = reason;
+
+    // called from the file watcher thread too, while the timer may be scaling the same list
+    {
+        LOCK lock(this->runners_mutex_);
+
+        std::copy_if(this->runners_.begin(), this->runners_.end(), std::back_inserter(rolling->runners),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            return runner->get_info().name == name;
+        }
+        );
+    }
+
+    if (rolling->runners.empty() || this->timer_ == NULL)
+    {
+        return false;
+    }
+
+    WRITE_LOG(warning) << "restart program >> " << name << " | instances " << rolling->runners.size() << " | " << reason;
+    this->timer_->post(boost::bind(&process_manager::_rolling_step, this, rolling));
+    return true;
+}
+
+std::size_t process_manager::shed(bool on, const std::string& reason)
+{
+    std::size_t changed = 0;
+
+    std::for_each(this->runners_.begin(), this->runners_.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        if (on ? runner->shed(reason) : runner->unshed(reason))
+        {
+            ++changed;
+        }
+    }
+    );
+
+    return changed;
+}
+
+bool process_manager::control(const std::string& name, const std::string& action, const std::string& reason)
+{
+    // the program set is fixed once started, only the timer changes the definitions
+    if (this->timer_ == NULL || this->programs_.find(name) == this->programs_.end())
+    {
+        return false;
+    }
+
+    if (action != "start" && action != "stop" && action != "restart")
+    {
+        return false;
+    }
+
+    this->timer_->post(boost::bind(&process_manager::_control, this, name, action, reason));
+    return true;
+}
+
+void process_manager::reload(const std::vector<process_config>& process_info,
+    std::vector<std::string>& added, std::vector<std::string>& removed)
+{
+    std::set<std::string> names;
+    std::for_each(process_info.begin(), process_info.end(),
+        [&](const process_config& info) {
+        if (!info.schedule.empty())
+        {
+            return;
+        }
+
+        names.insert(info.name);
+        if (this->programs_.find(info.name) == this->programs_.end())
+        {
+            added.push_back(info.name);
+        }
+    }
+    );
+
+    std::for_each(this->programs_.begin(), this->programs_.end(),
+        [&](const std::pair<const std::string, process_config>& program) {
+        if (names.find(program.first) == names.end())
+        {
+            removed.push_back(program.first);
+        }
+    }
+    );
+
+    if (this->timer_ != NULL)
+    {
+        this->timer_->post(boost::bind(&process_manager::_reload, this,
+            boost::make_shared<std::vector<process_config> >(process_info)));
+    }
+}
+
+void process_manager::_control(const std::string& name, const std::string& action, const std::string& reason)
+{
+    std::vector<boost::shared_ptr<exec_runner> > instances;
+    {
+        LOCK lock(this->runners_mutex_);
+
+        std::copy_if(this->runners_.begin(), this->runners_.end(), std::back_inserter(instances),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            return runner->get_info().name == name;
+        }
+        );
+    }
+
+    if (action == "stop")
+    {
+        std::for_each(instances.begin(), instances.end(),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            auto hold = [runner, reason]() {
+                runner->hold(reason);
+            };
+
+            if (this->proxy_ == NULL || !this->proxy_->drain(runner->key(), hold))
+            {
+                hold();
+            }
+        }
+        );
+        return;
+    }
+
+    // a held instance comes back first, a restart then rolls over all of them
+    std::size_t released = std::count_if(instances.begin(), instances.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        return runner->release(reason);
+    }
+    );
+
+    if (action == "restart" || (action == "start" && released != 0))
+    {
+        WRITE_LOG(warning) << action << " program >> " << name << " | released " << released << " | " << reason;
+    }
+
+    if (action == "restart")
+    {
+        this->restart(name, reason);
+    }
+}
+
+void process_manager::_reload(boost::shared_ptr<std::vector<process_config> > process_info)
+{
+    std::for_each(process_info->begin(), process_info->end(),
+        [&](const process_config& info) {
+        auto program = this->programs_.find(info.name);
+        if (!info.schedule.empty() || program == this->programs_.end())
+        {
+            return;
+        }
+
+        std::size_t changed = 0;
+        {
+            LOCK lock(this->runners_mutex_);
+
+            std::for_each(this->runners_.begin(), this->runners_.end(),
+                [&](boost::shared_ptr<exec_runner>& runner) {
+                if (runner->get_info().name == info.name && runner->update(info))
+                {
+                    ++changed;
+                }
+            }
+            );
+        }
+
+        if (changed == 0)
+        {
+            return;
+        }
+
+        // later instances of a scaled group start from the new definition as well
+        program->second.process_name = info.process_name;
+        program->second.command = info.command;
+        program->second.directory = info.directory;
+        program->second.environment = info.environment;
+
+        this->restart(info.name, "configuration reloaded");
+    }
+    );
+}
+
+void process_manager::_rolling_step(boost::shared_ptr<rolling_restart> rolling)
+{
+    if (rolling->next != 0 && !rolling->runners[rolling->next - 1]->running())
+    {
+        WRITE_LOG(error) << "rolling restart halted, instance did not come back >> "
+            << rolling->runners[rolling->next - 1]->key();
+        return;
+    }
 
+    if (rolling->next == rolling->runners.size())
+    {
+        return;
+    }
+
+    boost::shared_ptr<exec_runner> runner = rolling->runners[rolling->next++];
+    auto restart = [this, runner, rolling]() {
+        runner->restart(rolling->reason);
+
+        this->timer_->post(boost::bind(&process_manager::_rolling_step, this, rolling),
+            (std::max)(runner->get_info().startsecs, 1u));
+    };
+
+    if (this->proxy_ == NULL || !this->proxy_->drain(runner->key(), restart))
+    {
+        restart();
+    }
+}
@@ -35,32 +35,85 @@
 #include <Windows.h>
 
 #include "process_utils.h"
+#include "process_backend.h"
 #include "timer.h"
 #include "parse_config.h"
 #include "http_struct.hpp"
+#include "state_journal.h"
+#include "history_store.h"
+#include "status_table.h"
+#include "page_prewarmer.h"
+#include "output_store.h"
+
+class tcp_proxy;
 
 
 struct exec_runner : boost::noncopyable
 {
-    exec_runner(process_config& info, timer_generator& timer) :
-        info_(info), timer_(timer), stop_flag_(false),
-        exit_code_(0), process_id_(0), process_handle_(0)
+    exec_runner(process_config& info, unsigned int instance, const process_utils::spawn_options& options,
+        process_backend& backend, timer_generator& timer, state_journal& journal, history_store& history) :
+        info_(info), instance_(instance), options_(options), backend_(backend), timer_(timer), journal_(journal), history_(history), stop_flag_(false),
+        exit_code_(0), process_id_(0), process_handle_(0), timer_handler_(0), affinity_(0),
+        started_(false), shed_(false), held_(false), restart_count_(0), last_exit_code_(0), start_time_(0), last_exit_time_(0), output_(NULL)
     {
-
+        key_ = info_.name;
+        if (info_.numprocs > 1 || info_.autoscale.enabled())
+        {
+            key_ += ":" + boost::lexical_cast<std::string>(instance_);
+        }
     }
 
     ~exec_runner(void);
 
-    bool init();
+    bool adopt();
+    bool init(const std::vector<DWORD>& keep_pids);
     bool start();
     void stop();
+    void detach();
+
+    // kills the child and starts it again, from a timer callback
+    void restart(const std::string& reason);
+
+    // collects the exit code first, from a timer callback
+    bool running();
+
+    // pauses or stops the child as its shed setting says, and undoes it. from a timer callback
+    bool shed(const std::string& reason);
+    bool unshed(const std::string& reason);
+
+    // stops the child on an operator's request and keeps it down until
+    // release, through pressure relief too. from a timer callback
+    bool hold(const std::string& reason);
+    bool release(const std::string& reason);
+
+    // takes a re-read process name, command, directory and environment, used
+    // from the next start. false when none changed. from a timer callback
+    bool update(const process_config& info);
 
     void timer_delay();
     void timer_run_exe();
 
     unsigned long exit_code();
     process_config& get_info();
+
+    // a copy of the definition for another thread, update() may be changing it on the timer
+    process_config info_copy();
     unsigned long process_id();
+    unsigned int instance();
+    const std::string& key();
+    const process_utils::spawn_options& spawn_options();
+
+    // where the child's output goes when the program captures it, before start
+    void set_output(output_store* output);
+    unsigned long long affinity();
+    const process_utils::process_priority& priority();
+
+    status_table::process_state state();
+    unsigned int restart_count();
+    unsigned long last_exit_code();
+    unsigned long long start_time();
+    unsigned long long last_exit_time();
+    void usage(unsigned long long& cpu_time, unsigned long long& working_set);
 
 private:
 
@@ -70,6 +123,10 @@ private:
     void _close_handle();
     void _kill_process();
 
+    void _wait_exit();
+    void _on_exit();
+    void _cancel_exit_wait();
+
     void _kill_timer();
     bool _check_stop_flag();
     void _set_stop(bool flag);
@@ -77,23 +134,121 @@ private:
 
     bool stop_flag_;
 
+    // guards the strings of info_ that update() replaces
+    MUTEX info_mutex_;
     process_config info_;
+    unsigned int instance_;
+    std::string key_;
+    process_utils::spawn_options options_;
+    unsigned long long affinity_;
+    process_utils::process_priority priority_;
     HANDLE process_handle_;
     unsigned long process_id_;
     unsigned long exit_code_;
+    process_backend& backend_;
     timer_generator& timer_;
+    state_journal& journal_;
+    history_store& history_;
     unsigned long timer_handler_;
+    boost::shared_ptr<process_exit_wait> exit_wait_;
+
+    bool started_;
+    bool shed_;
+    bool held_;
+    unsigned int restart_count_;
+    unsigned long last_exit_code_;
+    unsigned long long start_time_;
+    unsigned long long last_exit_time_;
+    output_store* output_;
 };
 
+// scheduling options of one instance of a program, shared with the job runner
+process_utils::spawn_options instance_spawn_options(const process_config& info, unsigned int slot);
+
 class process_manager : boost::noncopyable
 {
 public:
+    process_manager() :
+        backend_(&process_backend::native()), prewarmer_(NULL), proxy_(NULL), output_(NULL), timer_(NULL), journal_(NULL), history_(NULL)
+    {
+    }
+
+    // the processes behind the runners, before start. a simulation swaps in
+    // a simulated backend driven by the same virtual clock as the timer
+    void set_backend(process_backend& backend);
+
+    // before start. the first start of a prewarmed program waits for its binaries to be warm
+    void set_prewarmer(page_prewarmer& prewarmer);
+
+    // before start. a proxied instance is drained of its connections before a restart or retirement
+    void set_proxy(tcp_proxy& proxy);
+
+    // before start. the output of capturing programs is kept there
+    void set_output(output_store& output);
+
     void start(std::vector<process_config>& process_info, 
-        timer_generator& timer, boost::system::error_code& ec);
+        timer_generator& timer, state_journal& journal, history_store& history, boost::system::error_code& ec);
     void stop();
+    void detach();
     std::vector<process_status> status(unsigned long pid);
+    std::vector<boost::shared_ptr<exec_runner> > runners();
+
+    // the most instances the programs can have, autoscaled groups at their max
+    std::size_t max_instances();
+
+    // instances of a program, and its resize through the normal start and stop
+    // of a runner. the highest instances go first. from a timer callback
+    std::size_t instances(const std::string& name);
+    bool scale(const std::string& name, std::size_t count, const std::string& reason);
+
+    // restarts every instance of a program, one at a time. the next instance
+    // goes once the previous one has stayed up for startsecs, and the roll
+    // stops at an instance that did not come back.
+    bool restart(const std::string& name, const std::string& reason);
+
+    // sheds or brings back every program with a shed setting, returns the instances changed
+    std::size_t shed(bool on, const std::string& reason);
+
+    // an operator's start, stop or restart of every instance of a program,
+    // queued to the timer from any thread. a stopped program stays down until
+    // it is started or restarted. false for an unknown program or action
+    bool control(const std::string& name, const std::string& action, const std::string& reason);
+
+    // takes a re-read program list from any thread, the changes are applied
+    // on the timer. a program whose command, directory or environment changed
+    // restarts with them one instance at a time. added and removed programs
+    // are only reported, they take effect at the next supervisor start
+    void reload(const std::vector<process_config>& process_info,
+        std::vector<std::string>& added, std::vector<std::string>& removed);
 
 private:
+    struct rolling_restart
+    {
+        rolling_restart() :
+            next(0)
+        {
+        }
+
+        std::vector<boost::shared_ptr<exec_runner> > runners;
+        std::string reason;
+        std::size_t next;
+    };
+
+    void _rolling_step(boost::shared_ptr<rolling_restart> rolling);
+    void _control(const std::string& name, const std::string& action, const std::string& reason);
+    void _reload(boost::shared_ptr<std::vector<process_config> > process_info);
+
+	MUTEX runners_mutex_;
 	std::vector<boost::shared_ptr<exec_runner> > runners_;
+	// scaled away and draining, still stopped or detached with the rest
+	std::vector<boost::shared_ptr<exec_runner> > retiring_;
+	std::map<std::string, process_config> programs_;
+	process_backend* backend_;
+	page_prewarmer* prewarmer_;
+	tcp_proxy* proxy_;
+	output_store* output_;
+	timer_generator* timer_;
+	state_journal* journal_;
+	history_store* history_;
 };
 
@@ -1,4 +1,6 @@
 
+#define WINPCS_LOG_MODULE log_process
+
 #include "config.hpp"
 
 #include <Windows.h>
@@ -7,9 +9,31 @@
 #include <Psapi.h>
 
 #include "process_utils.h"
+#include "trace.h"
 
 namespace process_utils {
 
+namespace {
+
+    // ProcessIoPriority of PROCESSINFOCLASS, only reachable through ntdll
+    const ULONG process_io_priority = 33;
+
+    typedef LONG(NTAPI *nt_information_process_t)(HANDLE, ULONG, PVOID, ULONG);
+    typedef LONG(NTAPI *nt_query_information_process_t)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+    typedef LONG(NTAPI *nt_suspend_process_t)(HANDLE);
+
+    FARPROC ntdll_proc(const char* name)
+    {
+        HMODULE ntdll = ::GetModuleHandle("ntdll.dll");
+        if (ntdll == NULL)
+        {
+            return NULL;
+        }
+
+        return ::GetProcAddress(ntdll, name);
+    }
+}
+
 
 void terminate_process(DWORD pid, UINT exit_code)
 {
@@ -219,20 +243,33 @@ std::string dos_device_path2logical_path(const char* lpszDosPath)
 }
 
 
-bool create_process(std::string& process_name, std::string& command, std::string& directory, unsigned long& pid, HANDLE& handle)
+bool create_process(std::string& process_name, std::string& command, std::string& directory,
+    const spawn_options& options, unsigned long& pid, HANDLE& handle)
 {
+    TRACE_SPAN_DETAIL("process", "spawn", process_name);
+
     auto ret = false;
 
-    SCOPE_EXIT(WRITE_LOG(error) << "create process >> " << process_name << " | result >> " << ret;);
+    // two sites, so the trace lines of a crash loop do not use up the budget of the failures
+    SCOPE_EXIT_REF(
+        if (ret)
+        {
+            WRITE_LOG_LIMIT(trace, 10, 60) << "create process >> " << process_name << " | result >> " << ret;
+        }
+        else
+        {
+            WRITE_LOG_LIMIT(error, 10, 60) << "create process >> " << process_name << " | result >> " << ret;
+        }
+    );
 
-    STARTUPINFO si = { 0 };
+    STARTUPINFOEX si = { 0 };
     PROCESS_INFORMATION pi = { 0 };
 
     ZeroMemory(&si, sizeof(si));
     ZeroMemory(&pi, sizeof(pi));
-    si.cb = sizeof(STARTUPINFO);
-    si.dwFlags = STARTF_USESHOWWINDOW;
-    si.wShowWindow = SW_HIDE;
+    si.StartupInfo.cb = sizeof(STARTUPINFO);
+    si.StartupInfo.dwFlags = STARTF_USESHOWWINDOW;
+    si.StartupInfo.wShowWindow = SW_HIDE;
 
     boost::scoped_array<char> cmd_line_char;
 
@@ -253,14 +290,127 @@ bool create_process(std::string& process_name, std::string& command, std::string
 		return NULL;
 	};
 
-	BOOL process_created = CreateProcess(process_name.c_str(), cmd_line_char.get(),
-        NULL, NULL, FALSE, 0, get_env(), get_dir(), &si, &pi);
+    DWORD creation_flags = 0;
+
+    // captured output goes to the given handles, and only those are inherited
+    HANDLE inherit_handles[2] = { 0 };
+    DWORD inherit_count = 0;
+    if (options.std_output != NULL || options.std_error != NULL)
+    {
+        si.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+        si.StartupInfo.hStdOutput = options.std_output;
+        si.StartupInfo.hStdError = options.std_error;
+
+        if (options.std_output != NULL)
+        {
+            inherit_handles[inherit_count++] = options.std_output;
+        }
+        if (options.std_error != NULL && options.std_error != options.std_output)
+        {
+            inherit_handles[inherit_count++] = options.std_error;
+        }
+    }
+
+    // the preferred node steers the memory of the child, the same way set_mempolicy does
+    boost::scoped_array<char> attribute_buffer;
+    bool attributes_initialized = false;
+    USHORT preferred_node = static_cast<USHORT>(options.numa_node);
+    DWORD attribute_count = (options.numa_node >= 0 ? 1 : 0) + (inherit_count != 0 ? 1 : 0);
+    if (attribute_count != 0)
+    {
+        SIZE_T attribute_size = 0;
+        InitializeProcThreadAttributeList(NULL, attribute_count, 0, &attribute_size);
+        attribute_buffer.reset(new char[attribute_size]);
+        si.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attribute_buffer.get());
+
+        attributes_initialized = InitializeProcThreadAttributeList(si.lpAttributeList, attribute_count, 0, &attribute_size) != FALSE;
+        bool attributes_set = attributes_initialized;
+        if (attributes_set && options.numa_node >= 0)
+        {
+            attributes_set = UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_PREFERRED_NODE,
+                &preferred_node, sizeof(preferred_node), NULL, NULL) != FALSE;
+        }
+        if (attributes_set && inherit_count != 0)
+        {
+            attributes_set = UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                inherit_handles, inherit_count * sizeof(HANDLE), NULL, NULL) != FALSE;
+        }
+
+        if (attributes_set)
+        {
+            si.StartupInfo.cb = sizeof(STARTUPINFOEX);
+            creation_flags |= EXTENDED_STARTUPINFO_PRESENT;
+        }
+        else
+        {
+            WRITE_LOG(error) << "set process attributes failed >> " << process_name << " | error :" << GetLastError();
+
+            // without the handle list the child would inherit every inheritable handle of the
+            // supervisor, other children's pipe write ends among them, and those never see eof
+            if (inherit_count != 0)
+            {
+                if (attributes_initialized)
+                {
+                    DeleteProcThreadAttributeList(si.lpAttributeList);
+                }
+                return ret;
+            }
+        }
+    }
+
+    unsigned long long affinity_mask = options.affinity_mask;
+    if (options.numa_node >= 0)
+    {
+        unsigned long long node_mask = numa_node_mask(options.numa_node);
+        if (node_mask != 0)
+        {
+            affinity_mask = (affinity_mask == 0 || (affinity_mask & node_mask) == 0) ? node_mask : (affinity_mask & node_mask);
+        }
+    }
+
+    creation_flags |= options.priority_class;
+
+    bool hold_suspended = affinity_mask != 0 || options.io_priority >= 0 || options.memory_priority >= 0;
+    if (hold_suspended)
+    {   // held suspended until the affinity and priorities are in place
+        creation_flags |= CREATE_SUSPENDED;
+    }
+
+    // without an image name the first token of the command line is the program
+	BOOL process_created = CreateProcess(process_name.empty() ? NULL : process_name.c_str(), cmd_line_char.get(),
+        NULL, NULL, inherit_count != 0 ? TRUE : FALSE, creation_flags, get_env(), get_dir(), &si.StartupInfo, &pi);
+
+    // an initialized list is deleted even when a later update failed and it was not used
+    if (attributes_initialized)
+    {
+        DeleteProcThreadAttributeList(si.lpAttributeList);
+    }
 
     if (!process_created)
         return ret;
 
     ret = true;
 
+    if (affinity_mask != 0 && !SetProcessAffinityMask(pi.hProcess, static_cast<DWORD_PTR>(affinity_mask)))
+    {
+        WRITE_LOG(error) << "set process affinity failed >> " << process_name << " | error :" << GetLastError();
+    }
+
+    if (options.io_priority >= 0)
+    {
+        set_io_priority(pi.hProcess, options.io_priority);
+    }
+
+    if (options.memory_priority >= 0)
+    {
+        set_memory_priority(pi.hProcess, options.memory_priority);
+    }
+
+    if (hold_suspended)
+    {
+        ResumeThread(pi.hThread);
+    }
+
     CloseHandle(pi.hThread);
 
     handle = pi.hProcess;
@@ -269,6 +419,101 @@ bool create_process(std::string& process_name, std::string& command, std::string
     return ret;
 }
 
+bool parse_cpu_list(const std::string& text, std::vector<unsigned int>& cpus)
+{
+    std::vector<std::string> ranges;
+    boost::split(ranges, text, boost::is_any_of(","), boost::token_compress_on);
+
+    try
+    {
+        for (std::vector<std::string>::iterator iter = ranges.begin(); iter != ranges.end(); ++iter)
+        {
+            std::string range = boost::trim_copy(*iter);
+            if (range.empty())
+            {
+                continue;
+            }
+
+            std::string::size_type dash = range.find('-');
+            unsigned int first = boost::lexical_cast<unsigned int>(range.substr(0, dash));
+            unsigned int last = first;
+            if (dash != std::string::npos)
+            {
+                last = boost::lexical_cast<unsigned int>(range.substr(dash + 1));
+            }
+
+            for (unsigned int cpu = first; cpu <= last && cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+        WRITE_LOG(error) << "invalid cpu list >> " << text;
+        cpus.clear();
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<unsigned int> system_cpus()
+{
+    std::vector<unsigned int> cpus;
+
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    {
+        return cpus;
+    }
+
+    for (unsigned int cpu = 0; cpu < sizeof(DWORD_PTR) * 8; ++cpu)
+    {
+        if (system_mask & (static_cast<DWORD_PTR>(1) << cpu))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+unsigned int numa_node_count()
+{
+    ULONG highest_node = 0;
+    if (!GetNumaHighestNodeNumber(&highest_node))
+    {
+        return 1;
+    }
+
+    return highest_node + 1;
+}
+
+unsigned long long numa_node_mask(int node)
+{
+    ULONGLONG mask = 0;
+    if (node < 0 || !GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask))
+    {
+        return 0;
+    }
+
+    return mask;
+}
+
+unsigned long long get_process_affinity(HANDLE handle)
+{
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+    if (handle == 0 || !GetProcessAffinityMask(handle, &process_mask, &system_mask))
+    {
+        return 0;
+    }
+
+    return process_mask;
+}
+
 bool is_exclude(const std::string& pe32_name)
 {
     static std::vector<std::string> exclude_names = { "csrss.exe" , "lsass.exe" , "smss.exe" , "services.exe" , "svchost.exe" , "wininit.exe" , "winlogon.exe" };
@@ -284,13 +529,18 @@ bool is_exclude(const std::string& pe32_name)
 }
 
 
-void kill_last_processes(const std::string& process_name)
+void kill_last_processes(const std::string& process_name, const std::vector<DWORD>& keep_pids)
 {
     SCOPE_EXIT(WRITE_LOG(error) << "kill last processes finished >> " << process_name; );
 
     std::vector<DWORD> pids = process_utils::find_last_process(process_name);
     for (std::vector<DWORD>::iterator iter = pids.begin(); iter != pids.end(); ++iter)
     {
+        if (std::find(keep_pids.begin(), keep_pids.end(), *iter) != keep_pids.end())
+        {   // adopted by another runner
+            continue;
+        }
+
         process_utils::terminate_process(*iter, 0);
     }
 }
@@ -298,6 +548,8 @@ void kill_last_processes(const std::string& process_name)
 
 void kill_processes(HANDLE process_handle, unsigned long pid)
 {
+    TRACE_SPAN("process", "kill_tree");
+
     SCOPE_EXIT(WRITE_LOG(trace) << "kill tree end. pid >> " << pid; );
 
     WRITE_LOG(trace) << "kill tree begin. pid >> " << pid;
@@ -312,4 +564,189 @@ void kill_processes(HANDLE process_handle, unsigned long pid)
     }
 }
 
+
+unsigned long long get_process_start_time(HANDLE handle)
+{
+    FILETIME creation_time = { 0 };
+    FILETIME exit_time = { 0 };
+    FILETIME kernel_time = { 0 };
+    FILETIME user_time = { 0 };
+
+    if (!::GetProcessTimes(handle, &creation_time, &exit_time, &kernel_time, &user_time))
+    {
+        return 0;
+    }
+
+    return (static_cast<unsigned long long>(creation_time.dwHighDateTime) << 32) | creation_time.dwLowDateTime;
+}
+
+bool get_process_usage(HANDLE handle, unsigned long long& cpu_time, unsigned long long& working_set)
+{
+    cpu_time = 0;
+    working_set = 0;
+
+    FILETIME creation_time = { 0 };
+    FILETIME exit_time = { 0 };
+    FILETIME kernel_time = { 0 };
+    FILETIME user_time = { 0 };
+
+    if (!::GetProcessTimes(handle, &creation_time, &exit_time, &kernel_time, &user_time))
+    {
+        return false;
+    }
+
+    cpu_time = ((static_cast<unsigned long long>(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime)
+        + ((static_cast<unsigned long long>(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime);
+
+    PROCESS_MEMORY_COUNTERS counters = { 0 };
+    if (::GetProcessMemoryInfo(handle, &counters, sizeof(counters)))
+    {
+        working_set = counters.WorkingSetSize;
+    }
+
+    return true;
+}
+
+
+HANDLE adopt_process(unsigned long pid, unsigned long long start_time, const std::string& process_name)
+{
+    HANDLE process_handle = ::OpenProcess(
+        SYNCHRONIZE | PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_SUSPEND_RESUME | PROCESS_SET_QUOTA,
+        FALSE, pid);
+    if (process_handle == NULL)
+    {
+        WRITE_LOG(trace) << "adopt process failed, not running >> " << pid;
+        return NULL;
+    }
+
+    // the pid may have been reused, the creation time tells them apart
+    unsigned long code = 0;
+    if (!::GetExitCodeProcess(process_handle, &code) || code != STILL_ACTIVE
+        || get_process_start_time(process_handle) != start_time)
+    {
+        WRITE_LOG(trace) << "adopt process failed, identity mismatch >> " << pid;
+        CloseHandle(process_handle);
+        return NULL;
+    }
+
+    if (!process_name.empty())
+    {
+        char image_name[MAX_PATH] = { 0 };
+        DWORD size = MAX_PATH;
+        bool matched = false;
+
+        if (::QueryFullProcessImageName(process_handle, 0, image_name, &size))
+        {
+            boost::system::error_code ec;
+            matched = boost::filesystem::equivalent(
+                boost::filesystem::path(process_name), boost::filesystem::path(image_name), ec);
+        }
+
+        if (!matched)
+        {
+            WRITE_LOG(trace) << "adopt process failed, image mismatch >> " << pid << " | " << process_name;
+            CloseHandle(process_handle);
+            return NULL;
+        }
+    }
+
+    return process_handle;
+}
+
+
+bool set_io_priority(HANDLE handle, int io_priority)
+{
+    nt_information_process_t set_information = reinterpret_cast<nt_information_process_t>(
+        ntdll_proc("NtSetInformationProcess"));
+    if (set_information == NULL)
+    {
+        return false;
+    }
+
+    ULONG hint = static_cast<ULONG>(io_priority);
+    LONG status = set_information(handle, process_io_priority, &hint, sizeof(hint));
+    if (status < 0)
+    {
+        WRITE_LOG(error) << "set io priority failed >> " << io_priority << " | status :" << status;
+        return false;
+    }
+
+    return true;
+}
+
+bool set_memory_priority(HANDLE handle, int memory_priority)
+{
+    MEMORY_PRIORITY_INFORMATION info = { 0 };
+    info.MemoryPriority = static_cast<ULONG>(memory_priority);
+
+    if (!::SetProcessInformation(handle, ProcessMemoryPriority, &info, sizeof(info)))
+    {
+        WRITE_LOG(error) << "set memory priority failed >> " << memory_priority << " | error :" << GetLastError();
+        return false;
+    }
+
+    return true;
+}
+
+bool suspend_process(HANDLE handle, bool suspend)
+{
+    nt_suspend_process_t call = reinterpret_cast<nt_suspend_process_t>(
+        ntdll_proc(suspend ? "NtSuspendProcess" : "NtResumeProcess"));
+    if (call == NULL)
+    {
+        return false;
+    }
+
+    LONG status = call(handle);
+    if (status < 0)
+    {
+        WRITE_LOG(error) << (suspend ? "suspend" : "resume") << " process failed >> status :" << status;
+        return false;
+    }
+
+    // a suspended process gives its pages back, the memory goes to the ones still running
+    if (suspend && !::SetProcessWorkingSetSize(handle, static_cast<SIZE_T>(-1), static_cast<SIZE_T>(-1)))
+    {
+        WRITE_LOG(warning) << "trim working set of suspended process failed >> error :" << GetLastError();
+    }
+
+    return true;
+}
+
+process_priority get_process_priority(HANDLE handle)
+{
+    process_priority priority;
+    if (handle == 0)
+    {
+        return priority;
+    }
+
+    switch (::GetPriorityClass(handle))
+    {
+    case IDLE_PRIORITY_CLASS:           priority.priority_class = "idle"; break;
+    case BELOW_NORMAL_PRIORITY_CLASS:   priority.priority_class = "below_normal"; break;
+    case NORMAL_PRIORITY_CLASS:         priority.priority_class = "normal"; break;
+    case ABOVE_NORMAL_PRIORITY_CLASS:   priority.priority_class = "above_normal"; break;
+    case HIGH_PRIORITY_CLASS:           priority.priority_class = "high"; break;
+    case REALTIME_PRIORITY_CLASS:       priority.priority_class = "realtime"; break;
+    default: break;
+    }
+
+    nt_query_information_process_t query_information = reinterpret_cast<nt_query_information_process_t>(
+        ntdll_proc("NtQueryInformationProcess"));
+    ULONG hint = 0;
+    if (query_information != NULL && query_information(handle, process_io_priority, &hint, sizeof(hint), NULL) >= 0)
+    {
+        priority.io_priority = static_cast<int>(hint);
+    }
+
+    MEMORY_PRIORITY_INFORMATION info = { 0 };
+    if (::GetProcessInformation(handle, ProcessMemoryPriority, &info, sizeof(info)))
+    {
+        priority.memory_priority = static_cast<int>(info.MemoryPriority);
+    }
+
+    return priority;
+}
+
 }
@@ -33,11 +33,47 @@
 
 namespace process_utils {
 
+    //
+    // settings applied to a child while it is still suspended, before its first instruction.
+    //
+    struct spawn_options
+    {
+        spawn_options() :
+            affinity_mask(0), numa_node(-1),
+            priority_class(0), io_priority(-1), memory_priority(-1),
+            std_output(NULL), std_error(NULL)
+        {
+        }
+
+        unsigned long long affinity_mask;   // 0 keeps the inherited affinity
+        int numa_node;                      // preferred node, -1 for any
+        unsigned long priority_class;       // CreateProcess priority flag, 0 to inherit
+        int io_priority;                    // IO_PRIORITY_HINT, -1 to inherit
+        int memory_priority;                // MEMORY_PRIORITY_*, -1 to inherit
+        HANDLE std_output;                  // inheritable handles for the child's output, NULL for none
+        HANDLE std_error;
+    };
+
+    //
+    // scheduling values read back from a running child.
+    //
+    struct process_priority
+    {
+        process_priority() :
+            io_priority(-1), memory_priority(-1)
+        {
+        }
+
+        std::string priority_class;
+        int io_priority;
+        int memory_priority;
+    };
+
     void terminate_process(DWORD pid, UINT exit_code);
 
     void kill_processes(HANDLE process_handle, unsigned long pid);
 
-    void kill_last_processes(const std::string& process_name);
+    void kill_last_processes(const std::string& process_name, const std::vector<DWORD>& keep_pids = std::vector<DWORD>());
 
     std::vector<DWORD> find_child_process(DWORD pid);
 
@@ -45,7 +81,34 @@ namespace process_utils {
 
     std::string dos_device_path2logical_path(const char* lpszDosPath);
 
-    bool create_process(std::string& process_name, std::string& command, std::string& directory, unsigned long& pid, HANDLE& handle);
+    bool create_process(std::string& process_name, std::string& command, std::string& directory,
+        const spawn_options& options, unsigned long& pid, HANDLE& handle);
+
+    bool parse_cpu_list(const std::string& text, std::vector<unsigned int>& cpus);
+
+    std::vector<unsigned int> system_cpus();
+
+    unsigned int numa_node_count();
+
+    unsigned long long numa_node_mask(int node);
+
+    unsigned long long get_process_affinity(HANDLE handle);
+
+    bool set_io_priority(HANDLE handle, int io_priority);
+
+    bool set_memory_priority(HANDLE handle, int memory_priority);
+
+    process_priority get_process_priority(HANDLE handle);
+
+    // every thread of the process, suspending also trims its working set
+    bool suspend_process(HANDLE handle, bool suspend);
 
     bool is_exclude(const std::string& pe32_name);
+
+    unsigned long long get_process_start_time(HANDLE handle);
+
+    // kernel plus user time in 100ns units and the working set in bytes
+    bool get_process_usage(HANDLE handle, unsigned long long& cpu_time, unsigned long long& working_set);
+
+    HANDLE adopt_process(unsigned long pid, unsigned long long start_time, const std::string& process_name);
 }
@@ -0,0 +1,597 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	scheduler.cpp for programs started on a cron schedule.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "scheduler.h"
+#include "time_utils.h"
+#include "process_manager.h"
+
+#include <boost/asio/ip/host_name.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/c_local_time_adjustor.hpp>
+
+
+namespace
+{
+    // a search that finds nothing within this many steps has no next run, like "0 0 30 2 *"
+    const unsigned int max_search_steps = 5000;
+
+    const boost::posix_time::ptime local_epoch(boost::gregorian::date(1970, 1, 1));
+
+    bool test_bit(std::uint64_t bits, unsigned int bit)
+    {
+        return (bits & (1ULL << bit)) != 0;
+    }
+}
+
+cron_schedule::cron_schedule() :
+    minutes_(0), hours_(0), days_(0), months_(0), weekdays_(0), any_day_(true), any_weekday_(true)
+{
+}
+
+bool cron_schedule::parse(const std::string& text)
+{
+    std::string expression = boost::algorithm::trim_copy(text);
+
+    if (boost::algorithm::starts_with(expression, "@every "))
+    {
+        std::string value = boost::algorithm::trim_copy(expression.substr(6));
+        if (value.empty())
+        {
+            return false;
+        }
+
+        long long count = 0;
+        try
+        {
+            count = boost::lexical_cast<long long>(value.substr(0, value.size() - 1));
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            return false;
+        }
+
+        switch (value[value.size() - 1])
+        {
+        case 's': interval_ = boost::posix_time::seconds(count); break;
+        case 'm': interval_ = boost::posix_time::minutes(count); break;
+        case 'h': interval_ = boost::posix_time::hours(count); break;
+        case 'd': interval_ = boost::posix_time::hours(count * 24); break;
+        default: return false;
+        }
+
+        return count > 0;
+    }
+
+    if (expression == "@yearly" || expression == "@annually")
+    {
+        expression = "0 0 1 1 *";
+    }
+    else if (expression == "@monthly")
+    {
+        expression = "0 0 1 * *";
+    }
+    else if (expression == "@weekly")
+    {
+        expression = "0 0 * * 0";
+    }
+    else if (expression == "@daily" || expression == "@midnight")
+    {
+        expression = "0 0 * * *";
+    }
+    else if (expression == "@hourly")
+    {
+        expression = "0 * * * *";
+    }
+
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, expression, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+    if (fields.size() != 5)
+    {
+        return false;
+    }
+
+    if (!_parse_field(fields[0], 0, 59, minutes_)
+        || !_parse_field(fields[1], 0, 23, hours_)
+        || !_parse_field(fields[2], 1, 31, days_)
+        || !_parse_field(fields[3], 1, 12, months_)
+        || !_parse_field(fields[4], 0, 7, weekdays_))
+    {
+        return false;
+    }
+
+    // sunday is both 0 and 7
+    if (test_bit(weekdays_, 7))
+    {
+        weekdays_ |= 1;
+    }
+
+    // as in vixie cron, a restricted day and weekday match when either does
+    any_day_ = fields[2][0] == '*';
+    any_weekday_ = fields[4][0] == '*';
+    interval_ = boost::posix_time::time_duration();
+    return true;
+}
+
+bool cron_schedule::_parse_field(const std::string& text, unsigned int low, unsigned int high, std::uint64_t& bits)
+{
+    bits = 0;
+
+    std::vector<std::string> parts;
+    boost::algorithm::split(parts, text, boost::algorithm::is_any_of(","));
+
+    for (std::vector<std::string>::iterator iter = parts.begin(); iter != parts.end(); ++iter)
+    {
+        std::string range = *iter;
+        unsigned int step = 1;
+
+        std::string::size_type slash = range.find('/');
+        try
+        {
+            if (slash != std::string::npos)
+            {
+                step = boost::lexical_cast<unsigned int>(range.substr(slash + 1));
+                range = range.substr(0, slash);
+            }
+
+            unsigned int first = low;
+            unsigned int last = high;
+            if (range != "*")
+            {
+                std::string::size_type dash = range.find('-');
+                first = boost::lexical_cast<unsigned int>(range.substr(0, dash));
+                if (dash != std::string::npos)
+                {
+                    last = boost::lexical_cast<unsigned int>(range.substr(dash + 1));
+                }
+                else if (slash == std::string::npos)
+                {
+                    last = first;
+                }
+            }
+
+            if (step == 0 || first < low || last > high || first > last)
+            {
+                return false;
+            }
+
+            for (unsigned int value = first; value <= last; value += step)
+            {
+                bits |= 1ULL << value;
+            }
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            return false;
+        }
+    }
+
+    return bits != 0;
+}
+
+bool cron_schedule::_match_day(const boost::gregorian::date& day) const
+{
+    bool day_match = test_bit(days_, day.day());
+    bool weekday_match = test_bit(weekdays_, day.day_of_week().as_number());
+
+    if (any_day_ || any_weekday_)
+    {
+        return day_match && weekday_match;
+    }
+
+    return day_match || weekday_match;
+}
+
+boost::posix_time::ptime cron_schedule::next(const boost::posix_time::ptime& time) const
+{
+    if (!interval_.is_special() && interval_.ticks() != 0)
+    {
+        return time + interval_;
+    }
+
+    if (minutes_ == 0)
+    {
+        return boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+    }
+
+    // start at the next whole minute and skip whole months, days and hours that cannot match
+    boost::posix_time::time_duration of_day = time.time_of_day();
+    boost::posix_time::ptime candidate(time.date(),
+        boost::posix_time::hours(of_day.hours()) + boost::posix_time::minutes(of_day.minutes() + 1));
+
+    for (unsigned int steps = 0; steps < max_search_steps; ++steps)
+    {
+        boost::gregorian::date day = candidate.date();
+
+        if (!test_bit(months_, day.month().as_number()))
+        {
+            candidate = boost::posix_time::ptime(day.end_of_month() + boost::gregorian::days(1));
+            continue;
+        }
+
+        if (!_match_day(day))
+        {
+            candidate = boost::posix_time::ptime(day + boost::gregorian::days(1));
+            continue;
+        }
+
+        of_day = candidate.time_of_day();
+        for (long hour = of_day.hours(); hour < 24; ++hour)
+        {
+            if (!test_bit(hours_, static_cast<unsigned int>(hour)))
+            {
+                continue;
+            }
+
+            for (long minute = (hour == of_day.hours() ? of_day.minutes() : 0); minute < 60; ++minute)
+            {
+                if (test_bit(minutes_, static_cast<unsigned int>(minute)))
+                {
+                    return boost::posix_time::ptime(day, boost::posix_time::hours(hour) + boost::posix_time::minutes(minute));
+                }
+            }
+        }
+
+        candidate = boost::posix_time::ptime(day + boost::gregorian::days(1));
+    }
+
+    return boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+}
+
+scheduler::scheduler() :
+    backend_(&process_backend::native()), timer_(NULL), journal_(NULL), history_(NULL), timer_handler_(0)
+{
+}
+
+void scheduler::set_backend(process_backend& backend)
+{
+    backend_ = &backend;
+}
+
+scheduler::~scheduler()
+{
+    stop();
+}
+
+void scheduler::start(std::vector<process_config>& process_info, timer_generator& timer,
+    state_journal& journal, history_store& history, boost::system::error_code& ec)
+{
+    LOCK lock(mutex_);
+
+    timer_ = &timer;
+    journal_ = &journal;
+    history_ = &history;
+
+    boost::posix_time::ptime now = _now();
+    std::string host = boost::asio::ip::host_name(ec);
+    ec.clear();
+
+    std::for_each(process_info.begin(), process_info.end(),
+        [&](process_config& info) {
+        if (info.schedule.empty())
+        {
+            return;
+        }
+
+        scheduled_program program;
+        program.info = info;
+        if (!program.schedule.parse(info.schedule))
+        {
+            WRITE_LOG(error) << "invalid schedule >> " << info.name << " | " << info.schedule;
+            return;
+        }
+
+        // the same host always gets the same offset, so its runs stay evenly spaced
+        if (info.jitter_second != 0)
+        {
+            std::size_t seed = 0;
+            boost::hash_combine(seed, host);
+            boost::hash_combine(seed, info.name);
+            program.jitter = boost::posix_time::seconds(static_cast<long>(seed % (info.jitter_second + 1)));
+        }
+
+        program.journal_key = "schedule:" + info.name;
+
+        journal_record record;
+        if (journal.find(program.journal_key, record) && record.start_time != 0)
+        {
+            program.last_run = local_epoch + boost::posix_time::seconds(static_cast<long>(record.start_time));
+        }
+
+        program.next_run = program.last_run.is_not_a_date_time()
+            ? _next_run(program, now)
+            : _next_run(program, program.last_run);
+
+        if (!program.next_run.is_not_a_date_time() && program.next_run < now)
+        {
+            if (info.catch_up_second != 0 && now - program.next_run <= boost::posix_time::seconds(info.catch_up_second))
+            {
+                WRITE_LOG(warning) << "schedule catching up missed run >> " << info.name << " | " << time_utils::format_time(program.next_run, false);
+                program.next_run = now;
+            }
+            else
+            {
+                program.next_run = _next_run(program, now);
+            }
+        }
+
+        if (program.next_run.is_not_a_date_time())
+        {
+            WRITE_LOG(error) << "schedule never runs >> " << info.name << " | " << info.schedule;
+            return;
+        }
+
+        WRITE_LOG(trace) << "program scheduled >> " << info.name << " | " << info.schedule << " | next " << time_utils::format_time(program.next_run, false);
+
+        heap_.push(std::make_pair(program.next_run, programs_.size()));
+        programs_.push_back(program);
+    }
+    );
+
+    if (!programs_.empty())
+    {
+        timer_handler_ = timer.set_timer(boost::bind(&scheduler::_tick, this), 1);
+    }
+}
+
+void scheduler::stop()
+{
+    _shutdown(true);
+}
+
+void scheduler::detach()
+{
+    _shutdown(false);
+}
+
+void scheduler::_shutdown(bool kill_running)
+{
+    LOCK lock(mutex_);
+
+    if (timer_ == NULL)
+    {
+        return;
+    }
+
+    if (timer_handler_ != 0)
+    {
+        timer_->kill_timer(timer_handler_);
+        timer_handler_ = 0;
+    }
+
+    std::for_each(running_.begin(), running_.end(),
+        [&](std::size_t index) {
+        scheduled_program& program = programs_[index];
+        if (kill_running)
+        {
+            // the kill is not waited for, the timer strand is not held up by a dying run
+            backend_->kill_processes(program.handle, program.pid);
+            history_->record(program.info.name, history_event::ev_stopped, program.pid, 0, "stopped by supervisor");
+            journal_->record_exited(program.journal_key);
+        }
+        else
+        {
+            history_->record(program.info.name, history_event::ev_detached, program.pid, 0, "supervisor exiting");
+        }
+
+        backend_->close(program.handle);
+        program.handle = NULL;
+        program.pid = 0;
+    }
+    );
+
+    running_.clear();
+    heap_ = heap_container();
+    timer_ = NULL;
+}
+
+std::vector<schedule_status> scheduler::status()
+{
+    std::vector<schedule_status> result;
+
+    LOCK lock(mutex_);
+    result.reserve(programs_.size());
+    std::for_each(programs_.begin(), programs_.end(),
+        [&](const scheduled_program& program) {
+        schedule_status status;
+        status.name = program.info.name;
+        status.schedule = program.info.schedule;
+        status.overlap = program.info.overlap;
+        status.next_run = time_utils::format_time(program.next_run, false);
+        status.last_run = time_utils::format_time(program.last_run, false);
+        status.pid = program.pid;
+        status.last_exit_code = program.last_exit_code;
+        status.runs = program.runs;
+        status.skipped = program.skipped;
+        status.queued = program.queued;
+        result.push_back(status);
+    }
+    );
+
+    return result;
+}
+
+void scheduler::_tick()
+{
+    LOCK lock(mutex_);
+
+    // a tick already queued when the scheduler stopped
+    if (timer_ == NULL)
+    {
+        return;
+    }
+
+    _reap();
+
+    boost::posix_time::ptime now = _now();
+    while (!heap_.empty() && heap_.top().first <= now)
+    {
+        std::size_t index = heap_.top().second;
+        heap_.pop();
+
+        _fire(index, now);
+
+        // a late tick runs a schedule once, the runs it slept through are not stacked up
+        scheduled_program& program = programs_[index];
+        boost::posix_time::ptime next_run = _next_run(program, program.next_run);
+        if (!next_run.is_not_a_date_time() && next_run <= now)
+        {
+            next_run = _next_run(program, now);
+        }
+
+        program.next_run = next_run;
+        if (!next_run.is_not_a_date_time())
+        {
+            heap_.push(std::make_pair(next_run, index));
+        }
+    }
+}
+
+void scheduler::_reap()
+{
+    std::vector<std::size_t> running;
+    running.swap(running_);
+
+    std::for_each(running.begin(), running.end(),
+        [&](std::size_t index) {
+        if (!backend_->wait(programs_[index].handle, 0))
+        {
+            running_.push_back(index);
+            return;
+        }
+
+        _exited(index);
+
+        scheduled_program& program = programs_[index];
+        if (program.queued)
+        {
+            program.queued = false;
+            _spawn(index, _now());
+        }
+    }
+    );
+}
+
+void scheduler::_fire(std::size_t index, const boost::posix_time::ptime& now)
+{
+    scheduled_program& program = programs_[index];
+
+    if (program.handle != NULL)
+    {
+        if (program.info.overlap == "queue" && !program.queued)
+        {
+            WRITE_LOG(trace) << "scheduled run queued behind the previous one >> " << program.info.name;
+            program.queued = true;
+            return;
+        }
+
+        if (program.info.overlap != "kill")
+        {
+            WRITE_LOG(warning) << "scheduled run skipped, previous one still running >> " << program.info.name << " | pid " << program.pid;
+            ++program.skipped;
+            return;
+        }
+
+        // the new run is started by _reap once the killed one is gone, the tick never waits for it
+        if (!program.queued)
+        {
+            WRITE_LOG(warning) << "scheduled run kills the previous one >> " << program.info.name << " | pid " << program.pid;
+            backend_->kill_processes(program.handle, program.pid);
+            program.queued = true;
+        }
+        return;
+    }
+
+    _spawn(index, program.next_run);
+}
+
+bool scheduler::_spawn(std::size_t index, const boost::posix_time::ptime& run_time)
+{
+    scheduled_program& program = programs_[index];
+
+    unsigned long pid = 0;
+    HANDLE handle = NULL;
+    if (!backend_->create_process(program.info.process_name, program.info.command, program.info.directory,
+        instance_spawn_options(program.info, 0), pid, handle))
+    {
+        history_->record(program.info.name, history_event::ev_spawn_failed, 0, 0, "scheduled run");
+        return false;
+    }
+
+    program.pid = pid;
+    program.handle = handle;
+    program.last_run = run_time;
+    ++program.runs;
+    running_.push_back(index);
+
+    journal_->record_started(program.journal_key, pid,
+        static_cast<unsigned long long>((run_time - local_epoch).total_seconds()), program.info.hash());
+    history_->record(program.info.name, history_event::ev_started, pid, 0, "scheduled run");
+
+    WRITE_LOG(trace) << "scheduled run started >> " << program.info.name << " | pid " << pid;
+    return true;
+}
+
+void scheduler::_exited(std::size_t index)
+{
+    scheduled_program& program = programs_[index];
+
+    unsigned long exit_code = backend_->exit_code(program.handle);
+    backend_->close(program.handle);
+
+    history_->record(program.info.name, history_event::ev_exited, program.pid, exit_code, "scheduled run finished");
+    journal_->record_exited(program.journal_key);
+
+    WRITE_LOG(trace) << "scheduled run exited >> " << program.info.name << " | pid " << program.pid << " | exit code " << exit_code;
+
+    program.last_exit_code = exit_code;
+    program.handle = NULL;
+    program.pid = 0;
+}
+
+boost::posix_time::ptime scheduler::_next_run(const scheduled_program& program, const boost::posix_time::ptime& after) const
+{
+    // runs happen at the schedule's times shifted by the host's jitter
+    boost::posix_time::ptime next = program.schedule.next(after - program.jitter);
+    if (next.is_not_a_date_time())
+    {
+        return next;
+    }
+    return next + program.jitter;
+}
+
+boost::posix_time::ptime scheduler::_now()
+{
+    // local time of the timer's clock, to the second like the cron fields
+    boost::posix_time::ptime now = boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(timer_->now());
+    return now - boost::posix_time::microseconds(now.time_of_day().total_microseconds() % 1000000);
+}
@@ -0,0 +1,183 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	scheduler.h for programs started on a cron schedule.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+#include "timer.h"
+#include "state_journal.h"
+#include "history_store.h"
+#include "process_backend.h"
+
+#include <Windows.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <queue>
+
+//
+// a parsed schedule: five cron fields (minute hour day month weekday) with
+// lists, ranges and steps, one of the @yearly, @monthly, @weekly, @daily and
+// @hourly aliases, or a fixed interval such as "@every 90s", "@every 5m".
+// times are local.
+//
+class cron_schedule
+{
+public:
+    cron_schedule();
+
+    bool parse(const std::string& text);
+
+    // the first run strictly after time, not_a_date_time when there is none
+    boost::posix_time::ptime next(const boost::posix_time::ptime& time) const;
+
+private:
+    bool _parse_field(const std::string& text, unsigned int low, unsigned int high, std::uint64_t& bits);
+    bool _match_day(const boost::gregorian::date& day) const;
+
+    boost::posix_time::time_duration interval_;
+    std::uint64_t minutes_;
+    std::uint64_t hours_;
+    std::uint64_t days_;
+    std::uint64_t months_;
+    std::uint64_t weekdays_;
+    bool any_day_;
+    bool any_weekday_;
+};
+
+//
+// a scheduled program as returned by the /schedules route.
+//
+struct schedule_status
+{
+    std::string name;
+    std::string schedule;
+    std::string overlap;
+    std::string next_run;
+    std::string last_run;
+    unsigned long pid;
+    unsigned long last_exit_code;
+    unsigned int runs;
+    unsigned int skipped;
+    bool queued;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(name),
+            CEREAL_NVP(schedule),
+            CEREAL_NVP(overlap),
+            CEREAL_NVP(next_run),
+            CEREAL_NVP(last_run),
+            CEREAL_NVP(pid),
+            CEREAL_NVP(last_exit_code),
+            CEREAL_NVP(runs),
+            CEREAL_NVP(skipped),
+            CEREAL_NVP(queued)
+        );
+    }
+};
+
+//
+// starts the programs that carry a schedule. every schedule has one entry
+// in a min-heap ordered by its next run, and a single one second tick of the
+// supervisor timer pops whatever is due, so thousands of schedules cost one
+// timer. the last run of every schedule is kept in the state journal, which
+// is what lets a run missed while winpcs was down be made up on start.
+//
+class scheduler : boost::noncopyable
+{
+public:
+    scheduler();
+    ~scheduler();
+
+    // the processes behind the scheduled runs, before start
+    void set_backend(process_backend& backend);
+
+    void start(std::vector<process_config>& process_info, timer_generator& timer,
+        state_journal& journal, history_store& history, boost::system::error_code& ec);
+
+    // stop kills the runs in flight, detach leaves them running
+    void stop();
+    void detach();
+
+    std::vector<schedule_status> status();
+
+private:
+    struct scheduled_program
+    {
+        scheduled_program() :
+            pid(0), handle(NULL), last_exit_code(0), runs(0), skipped(0), queued(false)
+        {
+        }
+
+        process_config info;
+        cron_schedule schedule;
+        boost::posix_time::time_duration jitter;
+        std::string journal_key;
+        boost::posix_time::ptime next_run;
+        boost::posix_time::ptime last_run;
+        unsigned long pid;
+        HANDLE handle;
+        unsigned long last_exit_code;
+        unsigned int runs;
+        unsigned int skipped;
+        bool queued;
+    };
+
+    typedef std::pair<boost::posix_time::ptime, std::size_t> heap_entry;
+    typedef std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry> > heap_container;
+
+    void _tick();
+    void _reap();
+    void _fire(std::size_t index, const boost::posix_time::ptime& now);
+    bool _spawn(std::size_t index, const boost::posix_time::ptime& run_time);
+    void _exited(std::size_t index);
+    void _shutdown(bool kill_running);
+    boost::posix_time::ptime _next_run(const scheduled_program& program, const boost::posix_time::ptime& after) const;
+
+    boost::posix_time::ptime _now();
+
+    MUTEX mutex_;
+    std::vector<scheduled_program> programs_;
+    heap_container heap_;
+    std::vector<std::size_t> running_;
+
+    process_backend* backend_;
+    timer_generator* timer_;
+    state_journal* journal_;
+    history_store* history_;
+    unsigned long timer_handler_;
+};
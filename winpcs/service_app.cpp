@@ -37,7 +37,7 @@
 #include <boost/filesystem.hpp>
 
 service_app::service_app(boost::application::context& context)
-    : context_(context)
+    : context_(context), timer_(loop_.io_service())
 {
     boost::application::handler<>::callback termination_callback
         = boost::bind(&service_app::stop, this);
@@ -46,6 +46,11 @@ service_app::service_app(boost::application::context& context)
         boost::application::csbl::make_shared<boost::application::termination_handler_default_behaviour>(termination_callback));
 }
 
+boost::asio::io_service& service_app::io_service()
+{
+    return loop_.io_service();
+}
+
 int service_app::operator()()
 {
     WRITE_LOG(trace) << "server running";
@@ -85,11 +90,120 @@ int service_app::operator()()
     }
 
 
+    server_config& server = config_->get_server();
+
+    // signals queued since launch are delivered from here on
+    trace_recorder::instance().configure(server.trace_events);
+    loop_.start(server.io_threads);
+
+    if (!journal_.open(server.journal_file, ec))
+    {
+        WRITE_LOG(error) << "state journal open failed, children will not be adopted! >> " << ec.message();
+        ec.clear();
+    }
+
+    if (!config_->get_history().directory.empty() && !history_.open(config_->get_history(), ec))
+    {
+        WRITE_LOG(error) << "history open failed, transitions will not be recorded! >> " << ec.message();
+        ec.clear();
+    }
+
+    forward_config& forward = config_->get_forward();
+    if (!forwarder_.start(forward, ec))
+    {
+        WRITE_LOG(error) << "log forwarder start failed, logs are only kept locally! >> " << ec.message();
+        ec.clear();
+    }
+    else if (forwarder_.enabled())
+    {
+        if (forward.output)
+        {
+            output_.set_listener(boost::bind(&log_forwarder::forward_output, &forwarder_, _1, _2, _3, _4, _5));
+        }
+
+        if (forward.own_log_level != "off" &&
+            !logger::instance().add_forward(forward.own_log_level, boost::bind(&log_forwarder::forward_log, &forwarder_, _1, _2)))
+        {
+            WRITE_LOG(warning) << "own log is not forwarded, binary log format or unknown level >> " << forward.own_log_level;
+        }
+    }
+
+    if (!output_.open(config_->get_output(), ec))
+    {
+        WRITE_LOG(error) << "output store open failed, child output will not be captured! >> " << ec.message();
+        ec.clear();
+    }
+
     timer_.start();
 
-    psmgr_.start(config_->get_processes(), timer_, ec);
+    if (server.journal_compact_second != 0)
+    {
+        timer_.set_timer(boost::bind(&state_journal::compact_if_needed, &journal_), server.journal_compact_second);
+    }
+
+    if (!prewarmer_.start(config_->get_prewarm(), config_->get_processes(), timer_, ec))
+    {
+        WRITE_LOG(error) << "page prewarmer start failed, programs start cold! >> " << ec.message();
+        ec.clear();
+    }
+    psmgr_.set_prewarmer(prewarmer_);
+    psmgr_.set_proxy(proxy_);
+    psmgr_.set_output(output_);
 
-    http_.start(psmgr_, ec);
+    psmgr_.start(config_->get_processes(), timer_, journal_, history_, ec);
+
+    scheduler_.start(config_->get_processes(), timer_, journal_, history_, ec);
+
+    if (!watcher_.start(config_->get_processes(), boost::bind(&process_manager::restart, &psmgr_, _1, _2), ec))
+    {
+        WRITE_LOG(error) << "file watcher start failed, watched programs will not restart on change! >> " << ec.message();
+        ec.clear();
+    }
+
+    if (!pressure_.start(config_->get_pressure(), psmgr_, timer_, ec))
+    {
+        WRITE_LOG(error) << "pressure monitor start failed, nothing is shed under pressure! >> " << ec.message();
+        ec.clear();
+    }
+
+    if (!autoscaler_.start(config_->get_autoscaler(), config_->get_processes(), psmgr_, timer_, history_, ec))
+    {
+        WRITE_LOG(error) << "autoscaler start failed, groups keep their size! >> " << ec.message();
+        ec.clear();
+    }
+
+    if (!proxy_.start(config_->get_processes(), psmgr_, timer_, ec))
+    {
+        WRITE_LOG(error) << "proxy start failed, some groups are not reachable through winpcs! >> " << ec.message();
+        ec.clear();
+    }
+
+    if (!server.status_table.empty())
+    {
+        unsigned int slots = (std::max)(server.status_table_slots, static_cast<unsigned int>(psmgr_.max_instances()));
+        if (status_table_.open(server.status_table, slots, ec))
+        {
+            timer_.set_timer(boost::bind(&status_publisher::publish, &status_table_, boost::ref(psmgr_)), 1, true);
+        }
+        ec.clear();
+    }
+
+    if (!config_->get_aggregator().peers.empty())
+    {
+        fleet_.start(config_->get_aggregator(), ec);
+    }
+
+    jobs_.start(config_->get_jobs(), ec);
+
+    http_.start(loop_.io_service(), psmgr_, server, fleet_, history_, jobs_, scheduler_, pressure_, autoscaler_, proxy_, output_, forwarder_, config_file, ec);
+
+    // the supervisor's own logs, named <exe>YYYY-MM-DD.log or .blog
+    boost::filesystem::path log_file(logger::instance().logfile());
+    std::vector<std::string> log_extensions;
+    log_extensions.push_back(".log");
+    log_extensions.push_back(".blog");
+    archiver_.add(log_file.parent_path(), log_file.filename().string(), log_extensions);
+    archiver_.start(config_->get_logs(), ec);
 
 
     WRITE_LOG(trace) << "server wait for termination request..";
@@ -98,9 +212,52 @@ int service_app::operator()()
 
     http_.stop();
 
-    psmgr_.stop();
+    jobs_.stop();
 
-    timer_.stop();
+    watcher_.stop();
+
+    archiver_.stop();
+
+    fleet_.stop();
+
+    // the loop threads keep running timer callbacks, so everything they touch
+    // is torn down on the timer strand, after the last of them
+    bool keep_children = server.keep_children_on_exit;
+    timer_.shutdown([this, keep_children]()
+    {
+        pressure_.stop();
+
+        autoscaler_.stop();
+
+        prewarmer_.stop();
+
+        proxy_.stop();
+
+        if (keep_children)
+        {
+            psmgr_.detach();
+            scheduler_.detach();
+        }
+        else
+        {
+            psmgr_.stop();
+            scheduler_.stop();
+        }
+    });
+
+    output_.close();
+
+    loop_.stop();
+
+    status_table_.close();
+
+    journal_.compact();
+    journal_.close();
+
+    history_.close();
+
+    logger::instance().remove_forward();
+    forwarder_.stop();
 
     WRITE_LOG(trace) << "server exiting..";
 
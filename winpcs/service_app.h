@@ -34,10 +34,24 @@
 
 
 
+#include "event_loop.h"
 #include "timer.h"
 #include "process_manager.h"
 #include "http_server.h"
 #include "parse_config.h"
+#include "state_journal.h"
+#include "fleet_aggregator.h"
+#include "log_archiver.h"
+#include "status_publisher.h"
+#include "job_runner.h"
+#include "scheduler.h"
+#include "file_watcher.h"
+#include "pressure_monitor.h"
+#include "autoscaler.h"
+#include "page_prewarmer.h"
+#include "tcp_proxy.h"
+#include "output_store.h"
+#include "log_forwarder.h"
 
 
 class service_app
@@ -47,6 +61,9 @@ public:
     service_app(boost::application::context& context);
 
     int operator()();
+
+    // the supervisor's event loop, signals are bound to it before launch
+    boost::asio::io_service& io_service();
  
     bool stop();
     bool pause();
@@ -55,9 +72,24 @@ public:
 private:
 
     boost::application::context            &context_;
+    event_loop                             loop_;
     timer_generator                        timer_;
     ns::shared_ptr<parse_config>           config_;
+    state_journal                          journal_;
+    history_store                          history_;
+    log_forwarder                          forwarder_;
+    output_store                           output_;
     process_manager                        psmgr_;
+    scheduler                              scheduler_;
+    file_watcher                           watcher_;
+    pressure_monitor                       pressure_;
+    autoscaler                             autoscaler_;
+    page_prewarmer                         prewarmer_;
+    tcp_proxy                              proxy_;
+    job_runner                             jobs_;
+    fleet_aggregator                       fleet_;
     http_server                            http_;
+    log_archiver                           archiver_;
+    status_publisher                       status_table_;
     boost::shared_ptr<boost::thread>       http_thread_;
 };
@@ -0,0 +1,154 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/*
+	simulation.cpp for replaying a configuration on a virtual clock.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "simulation.h"
+#include "parse_config.h"
+#include "process_manager.h"
+#include "scheduler.h"
+#include "virtual_clock.h"
+
+#include <boost/chrono.hpp>
+
+
+int simulation::run(const boost::filesystem::path& config_file, const simulation_options& options, std::ostream& out)
+{
+    boost::system::error_code ec;
+    parse_config config(config_file, ec);
+    if (ec)
+    {
+        out << "config file load failed >> " << config_file << " | " << ec.message() << std::endl;
+        return 1;
+    }
+
+    std::vector<process_config>& processes = config.get_processes();
+
+    // the io_service only backs the timer's strand, virtual timers never reach it
+    boost::asio::io_service io_service;
+    virtual_clock clock(options.start.is_not_a_date_time() ? boost::posix_time::second_clock::universal_time() : options.start);
+    timer_generator timer(io_service, &clock);
+    simulated_process_backend backend(clock, options.seed);
+
+    simulated_script script;
+    script.lifetime_second = options.lifetime_second;
+    script.lifetime_jitter_second = options.lifetime_jitter_second;
+    script.exit_code = options.exit_code;
+    std::for_each(processes.begin(), processes.end(),
+        [&](const process_config& info) {
+        backend.script(info.process_name, script);
+    }
+    );
+
+    // never opened, so nothing is written for the simulated processes
+    state_journal journal;
+    history_store history;
+
+    process_manager pm;
+    pm.set_backend(backend);
+    scheduler schedules;
+    schedules.set_backend(backend);
+
+    boost::chrono::steady_clock::time_point wall_begin = boost::chrono::steady_clock::now();
+
+    timer.start();
+    pm.start(processes, timer, journal, history, ec);
+    schedules.start(processes, timer, journal, history, ec);
+
+    std::size_t handlers = clock.run_for(boost::posix_time::seconds(static_cast<long>(options.hours * 3600)));
+
+    simulation_counts counts;
+    auto runners = pm.runners();
+    std::for_each(runners.begin(), runners.end(),
+        [&](boost::shared_ptr<exec_runner>& runner) {
+        counts.restarts += runner->restart_count();
+    }
+    );
+
+    auto runs = schedules.status();
+    std::for_each(runs.begin(), runs.end(),
+        [&](const schedule_status& status) {
+        counts.scheduled_runs += status.runs;
+        counts.skipped_runs += status.skipped;
+    }
+    );
+
+    counts.spawns = backend.spawned();
+    std::size_t running = backend.running();
+
+    schedules.stop();
+    pm.stop();
+    timer.stop();
+
+    double wall_second = boost::chrono::duration<double>(boost::chrono::steady_clock::now() - wall_begin).count();
+
+    out << "simulated " << options.hours << " hours of " << config_file << std::endl
+        << "  instances       " << runners.size() << std::endl
+        << "  schedules       " << runs.size() << std::endl
+        << "  spawns          " << counts.spawns << std::endl
+        << "  restarts        " << counts.restarts << std::endl
+        << "  scheduled runs  " << counts.scheduled_runs << " | skipped " << counts.skipped_runs << std::endl
+        << "  running at end  " << running << std::endl
+        << "  timer handlers  " << handlers << std::endl
+        << "  wall time       " << wall_second << " s" << std::endl;
+
+    if (!options.check)
+    {
+        return 0;
+    }
+
+    return _check(counts, options.expected, out) ? 0 : 2;
+}
+
+bool simulation::_check(const simulation_counts& counts, const simulation_counts& expected, std::ostream& out)
+{
+    bool met = true;
+    auto compare = [&](const char* name, unsigned long long value, unsigned long long wanted) {
+        if (value != wanted)
+        {
+            out << "diverged >> " << name << " | expected " << wanted << " | got " << value << std::endl;
+            met = false;
+        }
+    };
+
+    compare("spawns", counts.spawns, expected.spawns);
+    compare("restarts", counts.restarts, expected.restarts);
+    compare("scheduled runs", counts.scheduled_runs, expected.scheduled_runs);
+    compare("skipped runs", counts.skipped_runs, expected.skipped_runs);
+
+    if (met)
+    {
+        out << "expected counts met" << std::endl;
+    }
+    return met;
+}
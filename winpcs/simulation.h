@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/*
+	simulation.h for replaying a configuration on a virtual clock.
+*/
+#pragma once
+
+#include "config.hpp"
+
+#include <ostream>
+
+
+//
+// what a simulation counts, printed at the end and compared to the expected
+// counts of a scenario.
+//
+struct simulation_counts
+{
+    simulation_counts() :
+        spawns(0), restarts(0), scheduled_runs(0), skipped_runs(0)
+    {
+    }
+
+    unsigned long long spawns;
+    unsigned long long restarts;
+    unsigned long long scheduled_runs;
+    unsigned long long skipped_runs;
+};
+
+//
+// how the simulated processes behave, every program gets the same script.
+//
+struct simulation_options
+{
+    simulation_options() :
+        hours(24), lifetime_second(1800), lifetime_jitter_second(1800), exit_code(1), seed(1), check(false)
+    {
+    }
+
+    double hours;                           // virtual time to run
+    unsigned long lifetime_second;          // a process exits after this long, 0 runs until killed
+    unsigned long lifetime_jitter_second;   // random extra lifetime
+    unsigned long exit_code;
+    unsigned int seed;
+    boost::posix_time::ptime start;         // virtual time the run starts at, not_a_date_time for now
+    bool check;                             // the run fails when its counts are not expected
+    simulation_counts expected;
+};
+
+//
+// the process manager and the scheduler of a configuration, run on a virtual
+// clock against simulated processes that exit on their script. the clock
+// jumps from one due timer to the next, so hours of restarts and cron runs
+// take the time of their handlers. nothing is spawned, adopted or journaled,
+// and the counts and the wall time are printed at the end.
+//
+// with a fixed start the counts of a configuration are the same on every
+// run, a scenario checks them against its expected counts and returns 2
+// when one diverges. Debug/scenarios holds the fixed scenarios and the
+// command that runs them.
+//
+class simulation : boost::noncopyable
+{
+public:
+    static int run(const boost::filesystem::path& config_file, const simulation_options& options, std::ostream& out);
+
+private:
+    static bool _check(const simulation_counts& counts, const simulation_counts& expected, std::ostream& out);
+};
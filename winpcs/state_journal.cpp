@@ -0,0 +1,300 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	state_journal.cpp for the runner state journal.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "state_journal.h"
+
+#include <Windows.h>
+#include <boost/crc.hpp>
+
+namespace {
+
+    // rewrite the file once it holds this many records more than the live state
+    const unsigned long compact_threshold = 256;
+
+    // a record is a program name and a few numbers, a larger frame is garbage
+    const std::uint32_t max_frame_size = 64 * 1024;
+
+    std::uint32_t frame_crc(const std::string& payload)
+    {
+        boost::crc_32_type crc;
+        crc.process_bytes(payload.data(), payload.size());
+        return crc.checksum();
+    }
+}
+
+state_journal::state_journal() :
+    appended_(0)
+{
+}
+
+state_journal::~state_journal()
+{
+    close();
+}
+
+bool state_journal::open(const boost::filesystem::path& file, boost::system::error_code& ec)
+{
+    LOCK lock(mutex_);
+
+    file_ = file;
+    _load();
+
+    stream_.open(file_.string().c_str(), std::ios::binary | std::ios::app);
+    if (!stream_.is_open())
+    {
+        ec = boost::system::error_code(ERROR_OPEN_FAILED, boost::system::system_category());
+        WRITE_LOG(error) << "open state journal failed >> " << file_;
+        return false;
+    }
+
+    WRITE_LOG(trace) << "state journal loaded >> " << file_ << " | records >> " << records_.size();
+    return true;
+}
+
+void state_journal::close()
+{
+    LOCK lock(mutex_);
+
+    if (stream_.is_open())
+    {
+        stream_.flush();
+        stream_.close();
+    }
+}
+
+bool state_journal::find(const std::string& name, journal_record& record)
+{
+    LOCK lock(mutex_);
+
+    records_container::iterator iter = records_.find(name);
+    if (iter == records_.end())
+    {
+        return false;
+    }
+
+    record = iter->second;
+    return true;
+}
+
+void state_journal::record_started(const std::string& name, unsigned long pid,
+    unsigned long long start_time, std::size_t config_hash)
+{
+    journal_record record;
+    record.op = journal_record::op_started;
+    record.name = name;
+    record.pid = pid;
+    record.start_time = start_time;
+    record.config_hash = config_hash;
+
+    LOCK lock(mutex_);
+    records_[name] = record;
+    _append(record);
+}
+
+void state_journal::record_exited(const std::string& name)
+{
+    LOCK lock(mutex_);
+
+    records_container::iterator iter = records_.find(name);
+    if (iter == records_.end() || iter->second.op == journal_record::op_exited)
+    {
+        return;
+    }
+
+    iter->second.op = journal_record::op_exited;
+    iter->second.pid = 0;
+    _append(iter->second);
+}
+
+void state_journal::compact_if_needed()
+{
+    {
+        LOCK lock(mutex_);
+        if (appended_ < compact_threshold + records_.size())
+        {
+            return;
+        }
+    }
+
+    compact();
+}
+
+void state_journal::compact()
+{
+    SCOPE_EXIT(WRITE_LOG(trace) << "compact state journal end >> " << file_; );
+
+    LOCK lock(mutex_);
+
+    if (file_.empty())
+    {
+        return;
+    }
+
+    WRITE_LOG(trace) << "compact state journal begin >> " << file_ << " | records >> " << records_.size();
+
+    boost::filesystem::path tmp_file(file_);
+    tmp_file += ".tmp";
+
+    {
+        std::ofstream os(tmp_file.string().c_str(), std::ios::binary | std::ios::trunc);
+        for (records_container::iterator iter = records_.begin(); iter != records_.end(); ++iter)
+        {
+            if (!_write_frame(os, iter->second))
+            {
+                WRITE_LOG(error) << "compact state journal failed >> " << tmp_file;
+                return;
+            }
+        }
+    }
+
+    stream_.close();
+
+    // the old journal stays valid until the snapshot atomically replaces it
+    if (!::MoveFileEx(tmp_file.string().c_str(), file_.string().c_str(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        WRITE_LOG(error) << "replace state journal failed >> " << file_ << " | error :" << GetLastError();
+    }
+    else
+    {
+        appended_ = 0;
+    }
+
+    stream_.open(file_.string().c_str(), std::ios::binary | std::ios::app);
+}
+
+void state_journal::_load()
+{
+    records_.clear();
+    appended_ = 0;
+
+    boost::system::error_code ec;
+    boost::uintmax_t file_size = boost::filesystem::file_size(file_, ec);
+    if (ec)
+    {
+        return;
+    }
+
+    std::ifstream is(file_.string().c_str(), std::ios::binary);
+    if (!is.is_open())
+    {
+        return;
+    }
+
+    boost::uintmax_t good = 0;
+    for (;;)
+    {
+        std::uint32_t size = 0;
+        std::uint32_t crc = 0;
+        if (!is.read(reinterpret_cast<char*>(&size), sizeof(size))
+            || !is.read(reinterpret_cast<char*>(&crc), sizeof(crc)))
+        {
+            break;
+        }
+
+        if (size == 0 || size > max_frame_size)
+        {
+            break;
+        }
+
+        std::string payload(size, '\0');
+        if (!is.read(&payload[0], size) || frame_crc(payload) != crc)
+        {
+            break;
+        }
+
+        journal_record record;
+        try
+        {
+            std::istringstream ss(payload);
+            cereal::BinaryInputArchive ar(ss);
+            ar(record);
+        }
+        catch (...)
+        {
+            break;
+        }
+
+        records_[record.name] = record;
+        ++appended_;
+        good = static_cast<boost::uintmax_t>(is.tellg());
+    }
+    is.close();
+
+    // drop a torn tail so appends continue from the last good record
+    if (good != file_size)
+    {
+        WRITE_LOG(warning) << "state journal has a torn tail, dropped >> " << file_;
+        boost::filesystem::resize_file(file_, good, ec);
+        if (ec)
+        {
+            WRITE_LOG(error) << "truncate state journal failed >> " << file_ << " | " << ec.message();
+        }
+    }
+}
+
+void state_journal::_append(const journal_record& record)
+{
+    if (!stream_.is_open())
+    {
+        return;
+    }
+
+    if (!_write_frame(stream_, record))
+    {
+        WRITE_LOG(error) << "append state journal failed >> " << file_;
+        return;
+    }
+
+    stream_.flush();
+    ++appended_;
+}
+
+bool state_journal::_write_frame(std::ostream& os, const journal_record& record)
+{
+    std::ostringstream ss;
+    {
+        cereal::BinaryOutputArchive ar(ss);
+        ar(record);
+    }
+
+    std::string payload(ss.str());
+    std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+    std::uint32_t crc = frame_crc(payload);
+
+    os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    os.write(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    os.write(payload.data(), payload.size());
+
+    return os.good();
+}
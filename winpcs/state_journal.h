@@ -0,0 +1,106 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	state_journal.h for the runner state journal.
+*/
+#pragma once
+
+#include "config.hpp"
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <fstream>
+
+//
+// one journal entry, written every time a runner starts or loses its child.
+//
+struct journal_record
+{
+    enum op_type
+    {
+        op_started = 1,
+        op_exited = 2
+    };
+
+    journal_record() :
+        op(op_exited), pid(0), start_time(0), config_hash(0)
+    {
+    }
+
+    std::uint8_t op;
+    std::string name;
+    std::uint32_t pid;
+    std::uint64_t start_time;
+    std::uint64_t config_hash;
+
+    template<class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(op, name, pid, start_time, config_hash);
+    }
+};
+
+//
+// append-only binary journal of runner state. every record is framed with
+// its size and crc32, so a torn tail after a crash is detected and dropped.
+// the file is rewritten from the live state once it grows too long.
+//
+class state_journal : boost::noncopyable
+{
+public:
+    typedef std::map<std::string, journal_record> records_container;
+
+    state_journal();
+    ~state_journal();
+
+    bool open(const boost::filesystem::path& file, boost::system::error_code& ec);
+    void close();
+
+    bool find(const std::string& name, journal_record& record);
+
+    void record_started(const std::string& name, unsigned long pid,
+        unsigned long long start_time, std::size_t config_hash);
+    void record_exited(const std::string& name);
+
+    void compact();
+    void compact_if_needed();
+
+private:
+
+    void _load();
+    void _append(const journal_record& record);
+    bool _write_frame(std::ostream& os, const journal_record& record);
+
+    MUTEX mutex_;
+    boost::filesystem::path file_;
+    std::ofstream stream_;
+    records_container records_;
+    unsigned long appended_;
+};
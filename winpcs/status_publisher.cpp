@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	status_publisher.cpp for publishing runner status into the shared memory table.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "status_publisher.h"
+
+
+status_publisher::status_publisher() :
+    mapping_(NULL), header_(nullptr)
+{
+}
+
+status_publisher::~status_publisher()
+{
+    close();
+}
+
+bool status_publisher::open(const std::string& name, unsigned int slot_count, boost::system::error_code& ec)
+{
+    close();
+
+    std::uint64_t size = status_table::table_size(slot_count);
+    mapping_ = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name.c_str());
+    if (mapping_ == NULL)
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        WRITE_LOG(error) << "create status table failed >> " << name << " | error :" << ec.value();
+        return false;
+    }
+
+    // another supervisor publishing under the same name would corrupt the table
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        ec = boost::system::error_code(ERROR_ALREADY_EXISTS, boost::system::system_category());
+        WRITE_LOG(error) << "status table already exists >> " << name;
+        close();
+        return false;
+    }
+
+    header_ = static_cast<status_table::table_header*>(MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+    if (header_ == nullptr)
+    {
+        ec = boost::system::error_code(GetLastError(), boost::system::system_category());
+        close();
+        return false;
+    }
+
+    // pages of a new mapping are zero, so every slot starts at sequence 0
+    header_->slot_size = sizeof(status_table::slot);
+    header_->slot_count = slot_count;
+    header_->used_slots.store(0);
+    header_->writer_pid = GetCurrentProcessId();
+    header_->publish_time.store(0);
+    header_->version = status_table::table_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = status_table::table_magic;
+
+    WRITE_LOG(trace) << "status table opened >> " << name << " | slots >> " << slot_count;
+    return true;
+}
+
+void status_publisher::close()
+{
+    if (header_ != nullptr)
+    {
+        UnmapViewOfFile(header_);
+        header_ = nullptr;
+    }
+
+    if (mapping_ != NULL)
+    {
+        CloseHandle(mapping_);
+        mapping_ = NULL;
+    }
+}
+
+void status_publisher::publish(process_manager& pm)
+{
+    if (header_ == nullptr)
+    {
+        return;
+    }
+
+    const std::vector<boost::shared_ptr<exec_runner> >& runners = pm.runners();
+    std::uint32_t count = static_cast<std::uint32_t>((std::min)(runners.size(), static_cast<std::size_t>(header_->slot_count)));
+    status_table::slot* slots = status_table::table_slots(header_);
+
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        exec_runner& runner = *runners[i];
+
+        status_table::slot_data data = { 0 };
+        data.state = runner.state();
+        data.pid = runner.process_id();
+        data.instance = runner.instance();
+        data.restart_count = runner.restart_count();
+        data.last_exit_code = runner.last_exit_code();
+        data.start_time = runner.start_time();
+        data.last_exit_time = runner.last_exit_time();
+
+        unsigned long long cpu_time, working_set;
+        runner.usage(cpu_time, working_set);
+        data.cpu_time = cpu_time;
+        data.working_set = working_set;
+
+        const std::string& key = runner.key();
+        std::size_t len = (std::min)(key.size(), sizeof(data.name) - 1);
+        std::memcpy(data.name, key.data(), len);
+
+        status_table::write_slot(slots[i], data);
+    }
+
+    header_->used_slots.store(count, std::memory_order_release);
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    header_->publish_time.store((static_cast<std::uint64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime,
+        std::memory_order_release);
+}
@@ -0,0 +1,230 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	status_table.h for the shared memory status table and its reader.
+
+	header only and free of the rest of winpcs, local agents include it to
+	read the table without talking to the supervisor.
+*/
+#pragma once
+
+#include <Windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace status_table {
+
+#define STATUS_TABLE_NAME "Local\\winpcs_status"
+
+const std::uint32_t table_magic = 0x53435057;     // "WPCS"
+const std::uint32_t table_version = 1;
+
+enum process_state
+{
+    state_starting = 0,     // waiting for the first start
+    state_running = 1,
+    state_exited = 2,       // exited, the runner restarts it on its next tick
+    state_stopped = 3       // stopped by the supervisor
+};
+
+//
+// the first cache line of the mapping.
+//
+struct alignas(64) table_header
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t slot_size;
+    std::uint32_t slot_count;
+    std::atomic<std::uint32_t> used_slots;
+    std::uint32_t writer_pid;
+    std::atomic<std::uint64_t> publish_time;    // FILETIME of the last publish
+};
+
+//
+// what one slot holds, copied out as a whole by the reader.
+//
+struct slot_data
+{
+    std::uint32_t state;
+    std::uint32_t pid;
+    std::uint32_t instance;
+    std::uint32_t restart_count;
+    std::uint32_t last_exit_code;
+    std::uint32_t reserved;
+    std::uint64_t start_time;       // FILETIME
+    std::uint64_t last_exit_time;   // FILETIME
+    std::uint64_t cpu_time;         // kernel plus user, 100ns units
+    std::uint64_t working_set;      // bytes
+    char name[64];                  // runner key, truncated and null terminated
+};
+
+//
+// one program. the sequence is odd while the supervisor writes the slot.
+//
+struct alignas(64) slot
+{
+    std::atomic<std::uint32_t> sequence;
+    slot_data data;
+};
+
+static_assert(sizeof(table_header) == 64, "status table header must be one cache line");
+static_assert(sizeof(slot) % 64 == 0, "status table slots must be cache line aligned");
+
+inline std::size_t table_size(std::uint32_t slot_count)
+{
+    return sizeof(table_header) + sizeof(slot) * slot_count;
+}
+
+inline slot* table_slots(table_header* header)
+{
+    return reinterpret_cast<slot*>(header + 1);
+}
+
+// single writer side of the seqlock
+inline void write_slot(slot& s, const slot_data& data)
+{
+    std::uint32_t sequence = s.sequence.load(std::memory_order_relaxed);
+    s.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&s.data, &data, sizeof(data));
+    s.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// reader side, retries until it copied a slot no write overlapped
+inline void read_slot(const slot& s, slot_data& data)
+{
+    for (;;)
+    {
+        std::uint32_t before = s.sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        std::memcpy(&data, &s.data, sizeof(data));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (s.sequence.load(std::memory_order_relaxed) == before)
+        {
+            return;
+        }
+    }
+}
+
+//
+// maps the table read only. open and close are the only system calls,
+// taking snapshots only reads memory.
+//
+class reader
+{
+public:
+    reader() :
+        mapping_(NULL), header_(nullptr)
+    {
+    }
+
+    ~reader()
+    {
+        close();
+    }
+
+    bool open(const char* name = STATUS_TABLE_NAME)
+    {
+        close();
+
+        mapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+        if (mapping_ == NULL)
+        {
+            return false;
+        }
+
+        header_ = static_cast<table_header*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (header_ == nullptr || header_->magic != table_magic ||
+            header_->version != table_version || header_->slot_size != sizeof(slot))
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+        if (header_ != nullptr)
+        {
+            UnmapViewOfFile(header_);
+            header_ = nullptr;
+        }
+
+        if (mapping_ != NULL)
+        {
+            CloseHandle(mapping_);
+            mapping_ = NULL;
+        }
+    }
+
+    bool is_open() const
+    {
+        return header_ != nullptr;
+    }
+
+    std::uint32_t size() const
+    {
+        return header_ ? header_->used_slots.load(std::memory_order_acquire) : 0;
+    }
+
+    std::uint64_t publish_time() const
+    {
+        return header_ ? header_->publish_time.load(std::memory_order_acquire) : 0;
+    }
+
+    bool snapshot(std::uint32_t index, slot_data& data) const
+    {
+        if (index >= size())
+        {
+            return false;
+        }
+
+        read_slot(table_slots(header_)[index], data);
+        return true;
+    }
+
+private:
+    reader(const reader&);
+    reader& operator=(const reader&);
+
+    HANDLE mapping_;
+    table_header* header_;
+};
+
+}
@@ -0,0 +1,509 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	tcp_proxy.cpp for balancing connections across the instances of a program.
+*/
+
+#define WINPCS_LOG_MODULE log_process
+
+#include "tcp_proxy.h"
+#include "process_manager.h"
+
+
+namespace
+{
+    const std::size_t relay_buffer = 16 * 1024;
+    const long down_second = 5;         // an instance that refused a connection is skipped this long
+    const long accept_retry_ms = 100;
+}
+
+tcp_proxy::tcp_proxy() :
+    pm_(NULL), timer_(NULL), timer_handler_(0), stopping_(false)
+{
+}
+
+tcp_proxy::~tcp_proxy()
+{
+    stop();
+}
+
+bool tcp_proxy::start(std::vector<process_config>& process_info, process_manager& pm,
+    timer_generator& timer, boost::system::error_code& ec)
+{
+    using boost::asio::ip::tcp;
+
+    pm_ = &pm;
+    timer_ = &timer;
+    stopping_ = false;
+
+    std::for_each(process_info.begin(), process_info.end(),
+        [&](process_config& info) {
+        if (!info.schedule.empty() || !info.proxy.enabled())
+        {
+            return;
+        }
+
+        group_ptr item(new group(timer.io_service()));
+        item->info = info;
+
+        boost::system::error_code listen_ec;
+        tcp::endpoint endpoint(boost::asio::ip::address::from_string(info.proxy.listen_address, listen_ec),
+            static_cast<unsigned short>(info.proxy.listen_port));
+        if (!listen_ec)
+        {
+            item->acceptor.open(endpoint.protocol(), listen_ec);
+        }
+        if (!listen_ec)
+        {
+            item->acceptor.set_option(tcp::acceptor::reuse_address(true), listen_ec);
+        }
+        if (!listen_ec)
+        {
+            item->acceptor.bind(endpoint, listen_ec);
+        }
+        if (!listen_ec)
+        {
+            item->acceptor.listen(boost::asio::socket_base::max_connections, listen_ec);
+        }
+
+        if (listen_ec)
+        {
+            WRITE_LOG(error) << "proxy listen failed >> " << info.name << " | "
+                << info.proxy.listen_address << ":" << info.proxy.listen_port << " | " << listen_ec.message();
+            ec = listen_ec;
+            return;
+        }
+
+        WRITE_LOG(trace) << "proxy listening >> " << info.name << " | "
+            << info.proxy.listen_address << ":" << info.proxy.listen_port << " | " << info.proxy.balance;
+        groups_.push_back(item);
+    }
+    );
+
+    if (groups_.empty())
+    {
+        return !ec;
+    }
+
+    timer_handler_ = timer.set_timer(boost::bind(&tcp_proxy::_refresh, this), 1, true);
+
+    std::for_each(groups_.begin(), groups_.end(),
+        [&](group_ptr& item) {
+        boost::asio::spawn(item->strand, boost::bind(&tcp_proxy::_accept_loop, this, item, _1));
+    }
+    );
+
+    return !ec;
+}
+
+void tcp_proxy::stop()
+{
+    if (timer_ == NULL || stopping_)
+    {
+        return;
+    }
+
+    stopping_ = true;
+
+    if (timer_handler_ != 0)
+    {
+        timer_->kill_timer(timer_handler_);
+        timer_handler_ = 0;
+    }
+
+    // open connections end with the io_service. the acceptor is closed on the
+    // strand of its accept loop, never while an accept is being started
+    std::for_each(groups_.begin(), groups_.end(),
+        [](group_ptr& item) {
+        item->strand.post([item]() {
+            boost::system::error_code ec;
+            item->acceptor.close(ec);
+        });
+    }
+    );
+}
+
+bool tcp_proxy::drain(const std::string& key, drained_callback then)
+{
+    if (timer_ == NULL || stopping_)
+    {
+        return false;
+    }
+
+    LOCK lock(mutex_);
+
+    for (std::size_t i = 0; i < groups_.size(); ++i)
+    {
+        std::vector<backend>& backends = groups_[i]->backends;
+        auto iter = std::find_if(backends.begin(), backends.end(),
+            [&key](const backend& item) {
+            return item.key == key;
+        });
+
+        if (iter != backends.end())
+        {
+            iter->draining = true;
+            WRITE_LOG(trace) << "proxy draining >> " << key << " | connections " << iter->active;
+
+            boost::posix_time::ptime deadline = timer_->now() + boost::posix_time::seconds(groups_[i]->info.proxy.drain_second);
+            timer_->post(boost::bind(&tcp_proxy::_drain_step, this, groups_[i], key, then, deadline));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<proxy_status> tcp_proxy::status()
+{
+    std::vector<proxy_status> result;
+
+    LOCK lock(mutex_);
+    std::for_each(groups_.begin(), groups_.end(),
+        [&](const group_ptr& item) {
+        proxy_status status;
+        status.name = item->info.name;
+        status.listen = item->info.proxy.listen_address + ":" + boost::lexical_cast<std::string>(item->info.proxy.listen_port);
+        status.balance = item->info.proxy.balance;
+        status.accepted = item->accepted;
+        status.refused = item->refused;
+
+        std::for_each(item->backends.begin(), item->backends.end(),
+            [&](const backend& entry) {
+            proxy_backend_status backend_status;
+            backend_status.key = entry.key;
+            backend_status.port = entry.port;
+            backend_status.up = entry.up;
+            backend_status.draining = entry.draining;
+            backend_status.active = entry.active;
+            backend_status.total = entry.total;
+            backend_status.failures = entry.failures;
+            status.backends.push_back(backend_status);
+        }
+        );
+
+        result.push_back(status);
+    }
+    );
+
+    return result;
+}
+
+void tcp_proxy::_refresh()
+{
+    auto runners = pm_->runners();
+
+    LOCK lock(mutex_);
+
+    std::for_each(groups_.begin(), groups_.end(),
+        [&](group_ptr& item) {
+        std::vector<backend> backends;
+
+        std::for_each(runners.begin(), runners.end(),
+            [&](boost::shared_ptr<exec_runner>& runner) {
+            if (runner->get_info().name != item->info.name)
+            {
+                return;
+            }
+
+            backend entry;
+            auto last = std::find_if(item->backends.begin(), item->backends.end(),
+                [&runner](const backend& old) {
+                return old.key == runner->key();
+            });
+            if (last != item->backends.end())
+            {
+                entry = *last;
+            }
+
+            entry.key = runner->key();
+            entry.port = item->info.proxy.backend_port + (runner->instance() - item->info.numprocs_start);
+            entry.up = runner->state() == status_table::state_running;
+            backends.push_back(entry);
+        }
+        );
+
+        // a retired instance stays listed until its last connection is gone
+        std::for_each(item->backends.begin(), item->backends.end(),
+            [&](const backend& old) {
+            bool listed = std::find_if(backends.begin(), backends.end(),
+                [&old](const backend& entry) {
+                return entry.key == old.key;
+            }) != backends.end();
+
+            if (!listed && old.active != 0)
+            {
+                backends.push_back(old);
+                backends.back().up = false;
+            }
+        }
+        );
+
+        item->backends.swap(backends);
+    }
+    );
+}
+
+void tcp_proxy::_accept_loop(group_ptr item, boost::asio::yield_context yield)
+{
+    boost::asio::io_service& io_service = item->io_service;
+    boost::asio::deadline_timer retry(io_service);
+
+    while (!stopping_)
+    {
+        socket_ptr client(new boost::asio::ip::tcp::socket(io_service));
+        boost::system::error_code ec;
+        item->acceptor.async_accept(*client, yield[ec]);
+
+        if (stopping_ || ec == boost::asio::error::operation_aborted)
+        {
+            return;
+        }
+
+        if (ec)
+        {
+            // out of sockets or memory, wait rather than spin
+            WRITE_LOG_LIMIT(error, 10, 60) << "proxy accept failed >> " << item->info.name << " | " << ec.message();
+            retry.expires_from_now(boost::posix_time::milliseconds(accept_retry_ms));
+            retry.async_wait(yield[ec]);
+            continue;
+        }
+
+        {
+            LOCK lock(mutex_);
+            ++item->accepted;
+        }
+
+        client->set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+        // a spawned coroutine gets a strand of its own
+        boost::asio::spawn(io_service, boost::bind(&tcp_proxy::_serve, this, item, client, _1));
+    }
+}
+
+void tcp_proxy::_serve(group_ptr item, socket_ptr client, boost::asio::yield_context yield)
+{
+    boost::asio::io_service& io_service = item->io_service;
+    std::vector<std::string> tried;
+    std::string key;
+    unsigned int port = 0;
+
+    // a refused instance is marked down and the next one is tried for the same client
+    socket_ptr server;
+    while (_pick(item, tried, key, port))
+    {
+        boost::system::error_code ec;
+        server.reset(new boost::asio::ip::tcp::socket(io_service));
+        server->async_connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(),
+            static_cast<unsigned short>(port)), yield[ec]);
+        if (!ec)
+        {
+            break;
+        }
+
+        WRITE_LOG_LIMIT(warning, 10, 60) << "proxy instance refused >> " << key << " | port " << port << " | " << ec.message();
+        _release(item, key, true);
+        tried.push_back(key);
+        server.reset();
+    }
+
+    if (!server)
+    {
+        {
+            LOCK lock(mutex_);
+            ++item->refused;
+        }
+
+        boost::system::error_code ec;
+        client->close(ec);
+        return;
+    }
+
+    boost::system::error_code ec;
+    server->set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+    session_ptr connection(new session);
+    connection->item = item;
+    connection->key = key;
+    connection->client = client;
+    connection->server = server;
+    connection->relaying = 2;
+
+    boost::asio::spawn(yield, boost::bind(&tcp_proxy::_relay, this, connection, false, _1));
+    _relay(connection, true, yield);
+}
+
+void tcp_proxy::_relay(session_ptr connection, bool upstream, boost::asio::yield_context yield)
+{
+    socket_ptr from = upstream ? connection->client : connection->server;
+    socket_ptr to = upstream ? connection->server : connection->client;
+    std::vector<char> buffer(relay_buffer);
+    boost::system::error_code ec;
+
+    for (;;)
+    {
+        std::size_t size = from->async_read_some(boost::asio::buffer(buffer), yield[ec]);
+        if (ec)
+        {
+            break;
+        }
+
+        boost::asio::async_write(*to, boost::asio::buffer(&buffer[0], size), yield[ec]);
+        if (ec)
+        {
+            break;
+        }
+    }
+
+    // an orderly end is passed on as a half close, anything else ends both directions
+    boost::system::error_code ignored;
+    if (ec == boost::asio::error::eof)
+    {
+        to->shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+    }
+    else
+    {
+        from->close(ignored);
+        to->close(ignored);
+    }
+
+    if (--connection->relaying == 0)
+    {
+        connection->client->close(ignored);
+        connection->server->close(ignored);
+        _release(connection->item, connection->key, false);
+    }
+}
+
+bool tcp_proxy::_pick(group_ptr item, std::vector<std::string>& tried, std::string& key, unsigned int& port)
+{
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    LOCK lock(mutex_);
+
+    std::vector<backend>& backends = item->backends;
+    std::size_t count = backends.size();
+    std::size_t best = count;
+
+    // least connections breaks ties in round-robin order, so equal instances still take turns
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t index = (item->next + i) % count;
+        const backend& entry = backends[index];
+        if (!entry.up || entry.draining ||
+            (!entry.down_until.is_not_a_date_time() && entry.down_until > now) ||
+            std::find(tried.begin(), tried.end(), entry.key) != tried.end())
+        {
+            continue;
+        }
+
+        if (best == count || (item->info.proxy.balance != "roundrobin" && entry.active < backends[best].active))
+        {
+            best = index;
+            if (item->info.proxy.balance == "roundrobin")
+            {
+                break;
+            }
+        }
+    }
+
+    if (best == count)
+    {
+        return false;
+    }
+
+    item->next = best + 1;
+    ++backends[best].active;
+    ++backends[best].total;
+    key = backends[best].key;
+    port = backends[best].port;
+    return true;
+}
+
+void tcp_proxy::_release(group_ptr item, const std::string& key, bool failed)
+{
+    LOCK lock(mutex_);
+
+    auto iter = std::find_if(item->backends.begin(), item->backends.end(),
+        [&key](const backend& entry) {
+        return entry.key == key;
+    });
+    if (iter == item->backends.end())
+    {
+        return;
+    }
+
+    if (iter->active != 0)
+    {
+        --iter->active;
+    }
+
+    if (failed)
+    {
+        ++iter->failures;
+        iter->down_until = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(down_second);
+    }
+}
+
+void tcp_proxy::_drain_step(group_ptr item, const std::string& key, drained_callback then, boost::posix_time::ptime deadline)
+{
+    {
+        LOCK lock(mutex_);
+
+        auto iter = std::find_if(item->backends.begin(), item->backends.end(),
+            [&key](const backend& entry) {
+            return entry.key == key;
+        });
+
+        std::size_t active = iter == item->backends.end() ? 0 : iter->active;
+        if (active != 0 && timer_->now() < deadline && !stopping_)
+        {
+            timer_->post(boost::bind(&tcp_proxy::_drain_step, this, item, key, then, deadline), 1);
+            return;
+        }
+
+        if (active != 0)
+        {
+            WRITE_LOG(warning) << "proxy drain timed out >> " << key << " | connections " << active;
+        }
+    }
+
+    then();
+
+    // a restarted instance takes connections again, one that refuses them is skipped for a while
+    LOCK lock(mutex_);
+    std::for_each(item->backends.begin(), item->backends.end(),
+        [&key](backend& entry) {
+        if (entry.key == key)
+        {
+            entry.draining = false;
+        }
+    }
+    );
+}
@@ -0,0 +1,191 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	tcp_proxy.h for balancing connections across the instances of a program.
+*/
+#pragma once
+
+#include "config.hpp"
+#include "parse_config.h"
+#include "timer.h"
+
+#include <boost/asio/spawn.hpp>
+#include <boost/atomic.hpp>
+
+#include <cereal/cereal.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+class process_manager;
+
+struct proxy_backend_status
+{
+    std::string key;
+    unsigned int port;
+    bool up;
+    bool draining;
+    std::size_t active;
+    unsigned long long total;
+    unsigned long long failures;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(key),
+            CEREAL_NVP(port),
+            CEREAL_NVP(up),
+            CEREAL_NVP(draining),
+            CEREAL_NVP(active),
+            CEREAL_NVP(total),
+            CEREAL_NVP(failures)
+        );
+    }
+};
+
+//
+// a proxied group as returned by the /proxy route.
+//
+struct proxy_status
+{
+    std::string name;
+    std::string listen;
+    std::string balance;
+    unsigned long long accepted;
+    unsigned long long refused;     // no instance could take the connection
+    std::vector<proxy_backend_status> backends;
+
+    template<class Archive>
+    void save(Archive & ar) const
+    {
+        ar(
+            CEREAL_NVP(name),
+            CEREAL_NVP(listen),
+            CEREAL_NVP(balance),
+            CEREAL_NVP(accepted),
+            CEREAL_NVP(refused),
+            CEREAL_NVP(backends)
+        );
+    }
+};
+
+//
+// listens on the proxy port of every program that has one and relays each
+// connection to one of its running instances on the loopback, picked by
+// least connections or round-robin. an instance whose port refuses a
+// connection is skipped for a while, the client is handed to the next one.
+// before an instance is restarted or retired it is drained: it gets no new
+// connections and its open ones are given up to drain_second to finish.
+// every connection is a pair of coroutines sharing a strand, one per
+// direction, each with a fixed buffer.
+//
+class tcp_proxy : boost::noncopyable
+{
+public:
+    typedef boost::function<void()> drained_callback;
+
+    tcp_proxy();
+    ~tcp_proxy();
+
+    bool start(std::vector<process_config>& process_info, process_manager& pm,
+        timer_generator& timer, boost::system::error_code& ec);
+    void stop();
+
+    // stops new connections to an instance and runs then on the timer once it
+    // has none left, or after drain_second. false when the instance is not proxied
+    bool drain(const std::string& key, drained_callback then);
+
+    std::vector<proxy_status> status();
+
+private:
+    struct backend
+    {
+        backend() :
+            port(0), up(false), draining(false), active(0), total(0), failures(0)
+        {
+        }
+
+        std::string key;
+        unsigned int port;
+        bool up;                    // running as last seen by the refresh
+        bool draining;
+        boost::posix_time::ptime down_until;
+        std::size_t active;
+        unsigned long long total;
+        unsigned long long failures;
+    };
+
+    struct group : boost::noncopyable
+    {
+        group(boost::asio::io_service& asio_service) :
+            io_service(asio_service), strand(asio_service), acceptor(asio_service), next(0), accepted(0), refused(0)
+        {
+        }
+
+        process_config info;
+        boost::asio::io_service& io_service;
+        boost::asio::io_service::strand strand;    // the accept loop runs on it, the acceptor is closed on it
+        boost::asio::ip::tcp::acceptor acceptor;
+        std::vector<backend> backends;  // guarded by tcp_proxy::mutex_
+        std::size_t next;
+        unsigned long long accepted;
+        unsigned long long refused;
+    };
+
+    typedef boost::shared_ptr<group> group_ptr;
+    typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
+
+    // one relayed connection, touched only on its strand
+    struct session
+    {
+        group_ptr item;
+        std::string key;
+        socket_ptr client;
+        socket_ptr server;
+        int relaying;
+    };
+
+    typedef boost::shared_ptr<session> session_ptr;
+
+    void _refresh();
+    void _accept_loop(group_ptr item, boost::asio::yield_context yield);
+    void _serve(group_ptr item, socket_ptr client, boost::asio::yield_context yield);
+    void _relay(session_ptr connection, bool upstream, boost::asio::yield_context yield);
+    bool _pick(group_ptr item, std::vector<std::string>& tried, std::string& key, unsigned int& port);
+    void _release(group_ptr item, const std::string& key, bool failed);
+    void _drain_step(group_ptr item, const std::string& key, drained_callback then, boost::posix_time::ptime deadline);
+
+    process_manager* pm_;
+    timer_generator* timer_;
+    unsigned long timer_handler_;
+    boost::atomic<bool> stopping_;
+
+    MUTEX mutex_;
+    std::vector<group_ptr> groups_;
+};
@@ -0,0 +1,70 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+/*
+	time_utils.cpp for the time stamps shared by the stores, the status routes and the forwarder.
+*/
+
+#include "time_utils.h"
+
+#include <cstdio>
+
+namespace time_utils {
+
+const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+std::uint64_t now()
+{
+    return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+std::string format_time(std::uint64_t time)
+{
+    boost::posix_time::ptime t = epoch + boost::posix_time::microseconds(static_cast<long long>(time));
+    boost::gregorian::date::ymd_type ymd = t.date().year_month_day();
+    boost::posix_time::time_duration tod = t.time_of_day();
+
+    char text[32];
+    sprintf_s(text, sizeof(text), "%04u-%02u-%02uT%02u:%02u:%02u.%06uZ",
+        static_cast<unsigned int>(ymd.year), static_cast<unsigned int>(ymd.month), static_cast<unsigned int>(ymd.day),
+        static_cast<unsigned int>(tod.hours()), static_cast<unsigned int>(tod.minutes()), static_cast<unsigned int>(tod.seconds()),
+        static_cast<unsigned int>(tod.total_microseconds() % 1000000));
+    return text;
+}
+
+std::string format_time(const boost::posix_time::ptime& time, bool utc)
+{
+    if (time.is_not_a_date_time())
+    {
+        return std::string();
+    }
+    return boost::posix_time::to_iso_extended_string(time) + (utc ? "Z" : "");
+}
+
+}
@@ -29,6 +29,8 @@
 	timer.cpp for timer generator.
 */
 
+#define WINPCS_LOG_MODULE log_timer
+
 #include "timer.h"
 
 
@@ -39,6 +41,13 @@ time_duration_t timer_item::interval() const
 
 void timer_item::start()
 {
+    if (this->clock_ != NULL)
+    {
+        this->due_ = this->clock_->now() + (this->do_once_immediately_ ? second_t(0) : this->interval_);
+        this->clock_id_ = this->clock_->schedule(this->due_, boost::bind(&timer_item::_clock_run, shared_from_this()));
+        return;
+    }
+
     if (!this->do_once_immediately_)
     {
         this->timer_.reset(new timer_t(asio_service_, interval_));
@@ -48,7 +57,7 @@ void timer_item::start()
         this->timer_.reset(new timer_t(asio_service_, second_t(0)));
     }
 
-    this->timer_->async_wait(boost::bind(&timer_item::run, shared_from_this(), boost::asio::placeholders::error));
+    this->timer_->async_wait(strand_.wrap(boost::bind(&timer_item::run, shared_from_this(), boost::asio::placeholders::error)));
 }
 
 functor_type timer_item::func()
@@ -58,26 +67,54 @@ functor_type timer_item::func()
 
 void timer_item::cancel()
 {
+    this->cancelled_ = true;
+
+    if (this->clock_ != NULL)
+    {
+        this->clock_->cancel(this->clock_id_);
+        return;
+    }
+
     this->timer_->cancel();
 }
 
 void timer_item::run(const boost::system::error_code &error)
 {
-    if (error != 0) {
+    // a completion queued before the cancel still arrives without an error
+    if (error != 0 || this->cancelled_) {
         return;
     }
 
     this->timer_->expires_at(this->timer_->expires_at() + this->interval_);
-    this->timer_->async_wait(boost::bind(&timer_item::run, shared_from_this(), boost::asio::placeholders::error));
+    this->timer_->async_wait(strand_.wrap(boost::bind(&timer_item::run, shared_from_this(), boost::asio::placeholders::error)));
+
+    TRACE_SPAN("timer", "callback");
     this->func_();
 }
 
+void timer_item::_clock_run()
+{
+    if (this->cancelled_)
+    {
+        return;
+    }
+
+    // the next run keeps the cadence of the first one, as expires_at does
+    this->due_ += this->interval_;
+    this->clock_id_ = this->clock_->schedule(this->due_, boost::bind(&timer_item::_clock_run, shared_from_this()));
+
+    TRACE_SPAN("timer", "callback");
+    this->func_();
+}
 
-timer_generator::timer_generator() :
+
+timer_generator::timer_generator(boost::asio::io_service& asio_service, virtual_clock* clock) :
     max_timer_id_(1),
-    stopped_(0)
+    stopped_(0),
+    asio_service_(asio_service),
+    strand_(asio_service),
+    clock_(clock)
 {
-    asio_work_.reset(new boost::asio::io_service::work(asio_service_));
 }
 
 timer_generator::~timer_generator(void)
@@ -87,7 +124,6 @@ timer_generator::~timer_generator(void)
 
 int timer_generator::start()
 {
-    thread_.reset(new boost::thread(boost::bind(&timer_generator::thread_loop, this)));
     return 0;
 }
 
@@ -98,25 +134,58 @@ void timer_generator::stop()
         return;
     }
 
+    // the io_service is shared, so only the timers are cancelled
+    LOCK lock(mutex_);
     for (timers_container::iterator iter = timers_.begin(); iter != timers_.end(); ++iter)
     {
         iter->second->cancel();
     }
 
-    asio_service_.stop();
-    asio_work_.reset();
-    this->wait();
-
     // clean timers when stopping
     this->timers_.clear();
 }
 
-void timer_generator::wait()
+void timer_generator::shutdown(const functor_type& teardown)
+{
+    // a simulation runs every handler on the caller's thread already
+    if (clock_ != NULL || strand_.running_in_this_thread())
+    {
+        stop();
+        teardown();
+        return;
+    }
+
+    boost::promise<void> done;
+    strand_.dispatch([this, &teardown, &done]()
+    {
+        stop();
+        try
+        {
+            teardown();
+            done.set_value();
+        }
+        catch (...)
+        {
+            done.set_exception(boost::current_exception());
+        }
+    });
+
+    done.get_future().get();
+}
+
+boost::asio::io_service& timer_generator::io_service()
+{
+    return asio_service_;
+}
+
+boost::posix_time::ptime timer_generator::now()
 {
-    if (thread_ != 0)
+    if (clock_ != NULL)
     {
-        thread_->join();
+        return clock_->now();
     }
+
+    return boost::posix_time::microsec_clock::universal_time();
 }
 
 void timer_generator::kill_timer(unsigned long id)
@@ -135,9 +204,3 @@ void timer_generator::kill_timer(unsigned long id)
         timers_.erase(iter);
     }
 }
-
-// thread function
-void timer_generator::thread_loop()
-{
-    asio_service_.run();
-}
@@ -31,6 +31,8 @@
 #pragma once
 
 #include "config.hpp"
+#include "trace.h"
+#include "virtual_clock.h"
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
 
@@ -49,10 +51,10 @@ class timer_item : public boost::enable_shared_from_this<timer_item>
 {
 public:
     template <typename Func>
-    timer_item(Func func, boost::asio::io_service& asio_service,
-        time_duration_t& interval, bool do_once_immediately) :
-        func_(func), interval_(interval), asio_service_(asio_service),
-        do_once_immediately_(do_once_immediately)
+    timer_item(Func func, boost::asio::io_service& asio_service, boost::asio::io_service::strand& strand,
+        virtual_clock* clock, time_duration_t& interval, bool do_once_immediately) :
+        func_(func), interval_(interval), asio_service_(asio_service), strand_(strand),
+        clock_(clock), clock_id_(0), do_once_immediately_(do_once_immediately), cancelled_(false)
     {
     }
 
@@ -65,31 +67,66 @@ public:
     functor_type func();
 
 private:
+    void _clock_run();
+
 	timer_ptr_t timer_;
+	virtual_clock* clock_;
+	unsigned long long clock_id_;
+	boost::posix_time::ptime due_;
 	functor_type func_;
 	time_duration_t interval_;
 	bool do_once_immediately_;
+	boost::atomic<bool> cancelled_;
 	boost::asio::io_service& asio_service_;
+	boost::asio::io_service::strand& strand_;
 };
 
 
+//
+// timers run on the supervisor's shared io_service. every callback goes
+// through one strand, so callbacks never run concurrently however many
+// threads drive the io_service. given a virtual clock, the timers are
+// scheduled on it instead and run when the simulation advances it.
+//
 class timer_generator : boost::noncopyable
 {
 public:
 	typedef std::map<unsigned long, boost::shared_ptr<timer_item> > timers_container;
 
-    timer_generator();
+    explicit timer_generator(boost::asio::io_service& asio_service, virtual_clock* clock = NULL);
     ~timer_generator(void);
 
     int start();
 
     void stop();
 
+    // stops the timers and runs teardown on their strand, waiting for it. no
+    // timer, post or wrapped handler runs after, so teardown never races one
+    void shutdown(const functor_type& teardown);
+
+    bool stopped() const
+    {
+        return stopped_ == 1;
+    }
+
     void kill_timer(unsigned long id);
 
-    // thread function
-    void thread_loop();
-    void wait();
+    boost::asio::io_service& io_service();
+
+    // utc time of the timers, virtual in a simulation
+    boost::posix_time::ptime now();
+
+    bool simulated() const
+    {
+        return clock_ != NULL;
+    }
+
+    // a handler that runs in order with the timer callbacks
+    template <typename Handler>
+    auto wrap(Handler handler) -> decltype(boost::declval<boost::asio::io_service::strand&>().wrap(handler))
+    {
+        return strand_.wrap(handler);
+    }
 
 	//  interface function
     template <typename Func>
@@ -103,7 +140,7 @@ public:
         LOCK lock(mutex_);
 
         auto timer_item_ptr = boost::make_shared<timer_item>(func, boost::ref(this->asio_service_),
-            second_t(seconds), do_once_immediately);
+            boost::ref(this->strand_), this->clock_, second_t(seconds), do_once_immediately);
 
         auto result = timers_.insert(std::make_pair(max_timer_id_++, timer_item_ptr));
 
@@ -116,13 +153,50 @@ public:
         return 0;
     }
 
+    // runs func once after seconds, in order with every timer callback
+    template <typename Func>
+    void post(Func func, long seconds = 0)
+    {
+        if (stopped_ == 1)
+        {
+            return;
+        }
+
+        functor_type handler(func);
+        if (this->clock_ != NULL)
+        {
+            this->clock_->schedule(this->clock_->now() + second_t(seconds), [this, handler]()
+            {
+                if (this->stopped_ == 1)
+                {
+                    return;
+                }
+
+                TRACE_SPAN("timer", "post");
+                handler();
+            });
+            return;
+        }
+
+        timer_ptr_t timer(new timer_t(this->asio_service_, second_t(seconds)));
+        timer->async_wait(strand_.wrap([this, timer, handler](const boost::system::error_code& error)
+        {
+            // one-shots are not tracked, a stopped generator drops them here
+            if (!error && this->stopped_ == 0)
+            {
+                TRACE_SPAN("timer", "post");
+                handler();
+            }
+        }));
+    }
+
 private:
 	MUTEX mutex_;
 	boost::atomic_long stopped_;
-	boost::shared_ptr<boost::thread> thread_;
 
-	boost::asio::io_service asio_service_;
-	boost::shared_ptr<boost::asio::io_service::work> asio_work_;
+	boost::asio::io_service& asio_service_;
+	boost::asio::io_service::strand strand_;
+	virtual_clock* clock_;
 
 	unsigned long max_timer_id_;
 	timers_container timers_;
@@ -0,0 +1,230 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	trace.cpp for the chrome trace timeline of supervisor hot paths.
+*/
+
+#include "trace.h"
+
+#include <Windows.h>
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+    void write_json_string(std::ostream& out, const char* text)
+    {
+        out << '"';
+        for (; *text != 0; ++text)
+        {
+            unsigned char c = static_cast<unsigned char>(*text);
+            if (c == '"' || c == '\\')
+            {
+                out << '\\' << static_cast<char>(c);
+            }
+            else if (c < 0x20)
+            {
+                static const char hex[] = "0123456789abcdef";
+                out << "\\u00" << hex[c >> 4] << hex[c & 0x0f];
+            }
+            else
+            {
+                out << static_cast<char>(c);
+            }
+        }
+        out << '"';
+    }
+
+    struct thread_event
+    {
+        unsigned long tid;
+        trace_event event;
+    };
+}
+
+
+trace_recorder::trace_recorder() :
+    capacity_(8192)
+{
+}
+
+trace_recorder& trace_recorder::instance()
+{
+    static trace_recorder ins;
+    return ins;
+}
+
+void trace_recorder::configure(unsigned int events_per_thread)
+{
+    capacity_.store(events_per_thread);
+}
+
+boost::uint64_t trace_recorder::now()
+{
+    static LARGE_INTEGER frequency = []() {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f;
+    }();
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // split the conversion so the multiplication cannot overflow
+    boost::uint64_t ticks = static_cast<boost::uint64_t>(counter.QuadPart);
+    boost::uint64_t freq = static_cast<boost::uint64_t>(frequency.QuadPart);
+    return (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+trace_recorder::thread_ring* trace_recorder::_local_ring()
+{
+    thread_ring_holder* holder = local_ring_.get();
+    if (holder == nullptr)
+    {
+        unsigned int capacity = capacity_.load(boost::memory_order_relaxed);
+        if (capacity == 0)
+        {
+            return nullptr;
+        }
+
+        holder = new thread_ring_holder;
+        holder->ring = boost::make_shared<thread_ring>(capacity);
+        holder->ring->tid = GetCurrentThreadId();
+        local_ring_.reset(holder);
+
+        boost::mutex::scoped_lock lock(rings_mutex_);
+        rings_.push_back(holder->ring);
+    }
+
+    return holder->ring.get();
+}
+
+void trace_recorder::record(const char* category, const char* name, boost::uint64_t begin_us,
+    boost::uint64_t duration_us, const char* detail, std::size_t detail_size)
+{
+    thread_ring* ring = _local_ring();
+    if (ring == nullptr)
+    {
+        return;
+    }
+
+    // only the owning thread writes, the head is published after the slot
+    boost::uint64_t head = ring->head.load(boost::memory_order_relaxed);
+    trace_event& event = ring->events[head % ring->events.size()];
+    event.category = category;
+    event.name = name;
+    event.begin_us = begin_us;
+    event.duration_us = duration_us;
+
+    std::size_t size = (std::min)(detail_size, sizeof(event.detail) - 1);
+    if (size != 0)
+    {
+        std::memcpy(event.detail, detail, size);
+    }
+    event.detail[size] = 0;
+
+    ring->head.store(head + 1, boost::memory_order_release);
+}
+
+void trace_recorder::dump(unsigned int seconds, std::ostream& out)
+{
+    std::vector< boost::shared_ptr<thread_ring> > rings;
+    {
+        boost::mutex::scoped_lock lock(rings_mutex_);
+        rings = rings_;
+
+        // rings of exited threads are dropped once they have been dumped
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](boost::shared_ptr<thread_ring>& ring) {
+            return ring->orphaned.load();
+        }), rings_.end());
+    }
+
+    boost::uint64_t window = static_cast<boost::uint64_t>(seconds) * 1000000;
+    boost::uint64_t now_us = now();
+    boost::uint64_t since = now_us > window ? now_us - window : 0;
+
+    std::vector<thread_event> events;
+    std::for_each(rings.begin(), rings.end(), [&](boost::shared_ptr<thread_ring>& ring) {
+        std::size_t capacity = ring->events.size();
+        boost::uint64_t head = ring->head.load(boost::memory_order_acquire);
+        boost::uint64_t first = head > capacity ? head - capacity : 0;
+
+        std::size_t copied = events.size();
+        for (boost::uint64_t i = first; i < head; ++i)
+        {
+            thread_event item;
+            item.tid = ring->tid;
+            item.event = ring->events[i % capacity];
+            events.push_back(item);
+        }
+
+        // slots the owner overwrote while they were copied are not trusted, nor
+        // the slot of event number after, which it may be writing right now
+        boost::uint64_t after = ring->head.load(boost::memory_order_acquire);
+        boost::uint64_t torn = after + 1 > capacity ? after + 1 - capacity : 0;
+        if (torn > first)
+        {
+            std::size_t skip = static_cast<std::size_t>((std::min)(torn, head) - first);
+            events.erase(events.begin() + copied, events.begin() + copied + skip);
+        }
+    });
+
+    events.erase(std::remove_if(events.begin(), events.end(), [since](const thread_event& item) {
+        return item.event.begin_us < since;
+    }), events.end());
+
+    std::stable_sort(events.begin(), events.end(), [](const thread_event& l, const thread_event& r) {
+        return l.event.begin_us < r.event.begin_us;
+    });
+
+    unsigned long pid = GetCurrentProcessId();
+
+    out << "{\"traceEvents\":[";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":\"winpcs\"}}";
+    std::for_each(events.begin(), events.end(), [&](const thread_event& item) {
+        out << ",{\"name\":";
+        write_json_string(out, item.event.name);
+        out << ",\"cat\":";
+        write_json_string(out, item.event.category);
+        out << ",\"ph\":\"X\",\"ts\":" << item.event.begin_us
+            << ",\"dur\":" << item.event.duration_us
+            << ",\"pid\":" << pid << ",\"tid\":" << item.tid;
+        if (item.event.detail[0] != 0)
+        {
+            out << ",\"args\":{\"detail\":";
+            write_json_string(out, item.event.detail);
+            out << "}";
+        }
+        out << "}";
+    });
+    out << "],\"displayTimeUnit\":\"ms\"}";
+}
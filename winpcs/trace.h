@@ -0,0 +1,162 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	trace.h for the chrome trace timeline of supervisor hot paths.
+*/
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+//
+// one completed span. name and category are string literals, the detail is
+// copied and cut to fit so recording never allocates.
+//
+struct trace_event
+{
+    const char* category;
+    const char* name;
+    boost::uint64_t begin_us;
+    boost::uint64_t duration_us;
+    char detail[48];
+};
+
+//
+// the trace recorder. every thread records into its own ring, the oldest
+// events are overwritten. dump copies the rings and writes the events of
+// the last seconds as Chrome Trace Event JSON.
+//
+class trace_recorder : boost::noncopyable
+{
+public:
+    static trace_recorder& instance();
+
+    // events kept per thread, 0 disables tracing. rings already created keep their size
+    void configure(unsigned int events_per_thread);
+
+    bool enabled() const
+    {
+        return capacity_.load(boost::memory_order_relaxed) != 0;
+    }
+
+    // microseconds of the monotonic trace clock
+    static boost::uint64_t now();
+
+    void record(const char* category, const char* name, boost::uint64_t begin_us,
+        boost::uint64_t duration_us, const char* detail, std::size_t detail_size);
+
+    void dump(unsigned int seconds, std::ostream& out);
+
+private:
+    trace_recorder();
+
+    struct thread_ring
+    {
+        explicit thread_ring(unsigned int capacity) :
+            events(capacity), head(0), tid(0), orphaned(false)
+        {
+        }
+
+        std::vector<trace_event> events;
+        boost::atomic<boost::uint64_t> head;
+        unsigned long tid;
+        boost::atomic<bool> orphaned;
+    };
+
+    // owned by the thread local pointer, marks the ring orphaned on thread exit
+    struct thread_ring_holder
+    {
+        ~thread_ring_holder()
+        {
+            ring->orphaned.store(true);
+        }
+
+        boost::shared_ptr<thread_ring> ring;
+    };
+
+    thread_ring* _local_ring();
+
+    boost::atomic<unsigned int> capacity_;
+
+    boost::mutex rings_mutex_;
+    std::vector< boost::shared_ptr<thread_ring> > rings_;
+    boost::thread_specific_ptr<thread_ring_holder> local_ring_;
+};
+
+//
+// records the lifetime of the enclosing scope as one span.
+//
+class trace_span : boost::noncopyable
+{
+public:
+    trace_span(const char* category, const char* name) :
+        category_(category), name_(name), detail_(nullptr),
+        begin_(trace_recorder::instance().enabled() ? trace_recorder::now() : 0)
+    {
+    }
+
+    trace_span(const char* category, const char* name, const std::string& detail) :
+        category_(category), name_(name), detail_(&detail),
+        begin_(trace_recorder::instance().enabled() ? trace_recorder::now() : 0)
+    {
+    }
+
+    ~trace_span()
+    {
+        if (begin_ == 0)
+        {
+            return;
+        }
+
+        trace_recorder::instance().record(category_, name_, begin_, trace_recorder::now() - begin_,
+            detail_ ? detail_->data() : nullptr, detail_ ? detail_->size() : 0);
+    }
+
+private:
+    const char* category_;
+    const char* name_;
+    const std::string* detail_;
+    boost::uint64_t begin_;
+};
+
+#define TRACE_SPAN(category, name) \
+    trace_span BOOST_PP_CAT(trace_span_, __LINE__)(category, name)
+
+// the detail string must outlive the scope
+#define TRACE_SPAN_DETAIL(category, name, detail) \
+    trace_span BOOST_PP_CAT(trace_span_, __LINE__)(category, name, detail)
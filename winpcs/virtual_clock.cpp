@@ -0,0 +1,109 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	virtual_clock.cpp for the simulated time behind timer_generator.
+*/
+
+#include "virtual_clock.h"
+
+
+virtual_clock::virtual_clock(const boost::posix_time::ptime& start) :
+    now_(start), next_id_(1)
+{
+}
+
+boost::posix_time::ptime virtual_clock::now()
+{
+    LOCK lock(mutex_);
+    return now_;
+}
+
+unsigned long long virtual_clock::schedule(const boost::posix_time::ptime& due, const handler_type& handler)
+{
+    LOCK lock(mutex_);
+
+    // a handler is never due before now, the clock does not run backwards
+    unsigned long long id = next_id_++;
+    heap_.push(heap_entry((std::max)(due, now_), id));
+    handlers_.insert(std::make_pair(id, handler));
+    return id;
+}
+
+void virtual_clock::cancel(unsigned long long id)
+{
+    // the heap entry stays until it is popped, it finds no handler then
+    LOCK lock(mutex_);
+    handlers_.erase(id);
+}
+
+std::size_t virtual_clock::run_until(const boost::posix_time::ptime& end)
+{
+    std::size_t count = 0;
+
+    for (;;)
+    {
+        handler_type handler;
+        {
+            LOCK lock(mutex_);
+            if (heap_.empty() || heap_.top().first > end)
+            {
+                now_ = (std::max)(now_, end);
+                return count;
+            }
+
+            heap_entry entry = heap_.top();
+            heap_.pop();
+
+            auto iter = handlers_.find(entry.second);
+            if (iter == handlers_.end())
+            {
+                continue;
+            }
+
+            now_ = entry.first;
+            handler.swap(iter->second);
+            handlers_.erase(iter);
+        }
+
+        // run without the lock, handlers schedule and cancel
+        handler();
+        ++count;
+    }
+}
+
+std::size_t virtual_clock::run_for(const boost::posix_time::time_duration& duration)
+{
+    return run_until(now() + duration);
+}
+
+std::size_t virtual_clock::pending()
+{
+    LOCK lock(mutex_);
+    return handlers_.size();
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	virtual_clock.h for the simulated time behind timer_generator.
+*/
+#pragma once
+
+#include "config.hpp"
+
+#include <boost/unordered_map.hpp>
+
+#include <queue>
+
+
+//
+// a clock that only moves when it is told to. handlers scheduled on it run
+// in time order on the thread that advances it, and the clock jumps straight
+// from one due handler to the next, so a day of timers costs only the
+// handlers themselves. a timer_generator built on it never touches asio.
+//
+class virtual_clock : boost::noncopyable
+{
+public:
+    typedef boost::function<void()> handler_type;
+
+    explicit virtual_clock(const boost::posix_time::ptime& start);
+
+    boost::posix_time::ptime now();
+
+    // runs handler once the clock reaches due, the id cancels it
+    unsigned long long schedule(const boost::posix_time::ptime& due, const handler_type& handler);
+    void cancel(unsigned long long id);
+
+    // runs every handler due up to end, including the ones they schedule,
+    // and leaves the clock at end. returns the number of handlers run
+    std::size_t run_until(const boost::posix_time::ptime& end);
+    std::size_t run_for(const boost::posix_time::time_duration& duration);
+
+    std::size_t pending();
+
+private:
+    typedef std::pair<boost::posix_time::ptime, unsigned long long> heap_entry;
+    typedef std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry> > heap_container;
+
+    MUTEX mutex_;
+    boost::posix_time::ptime now_;
+    unsigned long long next_id_;
+    heap_container heap_;
+    boost::unordered_map<unsigned long long, handler_type> handlers_;
+};
@@ -0,0 +1,322 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	ctl_client.cpp for talking to the winpcs admin api over one connection.
+*/
+
+#include "ctl_client.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <Windows.h>
+
+using boost::asio::ip::tcp;
+
+ctl_client::ctl_client(const std::string& host, const std::string& port, const std::string& token, unsigned int timeout_second) :
+    host_(host), port_(port), token_(token), timeout_second_(timeout_second), socket_(io_service_)
+{
+}
+
+ctl_client::~ctl_client()
+{
+    _close();
+}
+
+bool ctl_client::get(const std::string& path, bool retry, ctl_response& response, std::string& error)
+{
+    std::vector<ctl_response> responses;
+    bool answered = get(std::vector<std::string>(1, path), retry, responses, 1, error);
+
+    response = responses.front();
+    return answered;
+}
+
+bool ctl_client::get(const std::vector<std::string>& paths, bool retry, std::vector<ctl_response>& responses,
+    std::size_t window, std::string& error)
+{
+    responses.assign(paths.size(), ctl_response());
+    window = (std::max)(window, static_cast<std::size_t>(1));
+
+    std::size_t next = 0;
+    bool stalled = false;
+    bool answered = true;
+    while (next < paths.size())
+    {
+        // a request that is not resent must not go out on a connection the server has already closed
+        if (socket_.is_open() && !retry && !_alive())
+        {
+            _close();
+        }
+
+        if (!socket_.is_open() && !_connect(error))
+        {
+            return false;
+        }
+
+        // the whole window goes out in one write
+        std::size_t end = (std::min)(next + window, paths.size());
+        std::string headers = "HTTP/1.1\r\nHost: " + host_ + "\r\nConnection: Keep-Alive\r\n";
+        if (!token_.empty())
+        {
+            headers += "X-Winpcs-Token: " + token_ + "\r\n";
+        }
+
+        std::string requests;
+        for (std::size_t i = next; i < end; ++i)
+        {
+            requests += "GET " + paths[i] + " " + headers + "\r\n";
+        }
+
+        for (std::size_t i = next; i < end; ++i)
+        {
+            responses[i].sent = true;
+        }
+
+        boost::system::error_code ec;
+        boost::asio::write(socket_, boost::asio::buffer(requests), ec);
+
+        std::size_t done = next;
+        if (ec)
+        {
+            error = "send failed: " + ec.message();
+        }
+        else
+        {
+            while (done < end && _read_response(responses[done], error))
+            {
+                ++done;
+            }
+        }
+
+        if (done == end)
+        {
+            next = end;
+            stalled = false;
+            continue;
+        }
+
+        // the server may have closed an idle connection, the rest goes again on a new one
+        _close();
+        if (!retry)
+        {
+            // the server may have acted on what it did not answer, only the next window is sent
+            answered = false;
+            next = end;
+            continue;
+        }
+
+        if (done == next && stalled)
+        {
+            return false;
+        }
+
+        stalled = (done == next);
+        next = done;
+    }
+
+    return answered;
+}
+
+bool ctl_client::_alive()
+{
+    // peeking at a connection the server has closed reads eof at once, a live one would block
+    boost::system::error_code ec;
+    socket_.non_blocking(true, ec);
+
+    char byte = 0;
+    std::size_t read = socket_.receive(boost::asio::buffer(&byte, 1), tcp::socket::message_peek, ec);
+
+    boost::system::error_code ignored_ec;
+    socket_.non_blocking(false, ignored_ec);
+
+    return ec == boost::asio::error::would_block || (!ec && read != 0);
+}
+
+bool ctl_client::_connect(std::string& error)
+{
+    boost::system::error_code ec;
+
+    tcp::resolver resolver(io_service_);
+    tcp::resolver::iterator endpoints = resolver.resolve(tcp::resolver::query(host_, port_), ec);
+    if (!ec)
+    {
+        boost::asio::connect(socket_, endpoints, ec);
+    }
+
+    if (ec)
+    {
+        _close();
+        error = "connect failed: " + ec.message();
+        return false;
+    }
+
+    socket_.set_option(tcp::no_delay(true), ec);
+
+    // the blocking calls give up on a stuck server after this
+    DWORD timeout = timeout_second_ * 1000;
+    ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+    return true;
+}
+
+void ctl_client::_close()
+{
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
+    buffer_.consume(buffer_.size());
+}
+
+bool ctl_client::_read_response(ctl_response& response, std::string& error)
+{
+    boost::system::error_code ec;
+
+    std::size_t header_size = boost::asio::read_until(socket_, buffer_, "\r\n\r\n", ec);
+    if (ec)
+    {
+        error = "receive failed: " + ec.message();
+        return false;
+    }
+
+    std::string header(boost::asio::buffers_begin(buffer_.data()),
+        boost::asio::buffers_begin(buffer_.data()) + header_size);
+    buffer_.consume(header_size);
+
+    try
+    {
+        response.status = boost::lexical_cast<int>(header.substr(9, 3));
+    }
+    catch (std::exception&)
+    {
+        error = "bad response: " + header.substr(0, header.find('\r'));
+        return false;
+    }
+
+    response.body.clear();
+    if (boost::ifind_first(header, "transfer-encoding: chunked"))
+    {
+        if (!_read_chunked(response.body, error))
+        {
+            return false;
+        }
+    }
+    else if (auto length_field = boost::ifind_first(header, "content-length:"))
+    {
+        std::size_t content_length = 0;
+        try
+        {
+            std::string::size_type value_begin = length_field.end() - header.begin();
+            std::string::size_type value_end = header.find('\r', value_begin);
+            content_length = boost::lexical_cast<std::size_t>(
+                boost::trim_copy(header.substr(value_begin, value_end - value_begin)));
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+            error = "invalid content-length";
+            return false;
+        }
+
+        if (buffer_.size() < content_length)
+        {
+            boost::asio::read(socket_, buffer_, boost::asio::transfer_exactly(content_length - buffer_.size()), ec);
+            if (ec)
+            {
+                error = "receive failed: " + ec.message();
+                return false;
+            }
+        }
+
+        response.body.assign(boost::asio::buffers_begin(buffer_.data()),
+            boost::asio::buffers_begin(buffer_.data()) + content_length);
+        buffer_.consume(content_length);
+    }
+    else
+    {
+        // the body runs to the end of the connection
+        boost::asio::read(socket_, buffer_, boost::asio::transfer_all(), ec);
+        response.body.assign(boost::asio::buffers_begin(buffer_.data()), boost::asio::buffers_end(buffer_.data()));
+        _close();
+        return true;
+    }
+
+    if (boost::ifind_first(header, "connection: close"))
+    {
+        _close();
+    }
+
+    return true;
+}
+
+bool ctl_client::_read_chunked(std::string& body, std::string& error)
+{
+    for (;;)
+    {
+        boost::system::error_code ec;
+        std::size_t line_size = boost::asio::read_until(socket_, buffer_, "\r\n", ec);
+        if (ec)
+        {
+            error = "receive failed: " + ec.message();
+            return false;
+        }
+
+        std::string line(boost::asio::buffers_begin(buffer_.data()),
+            boost::asio::buffers_begin(buffer_.data()) + line_size);
+        buffer_.consume(line_size);
+
+        char* end = NULL;
+        std::size_t chunk_size = std::strtoul(line.c_str(), &end, 16);
+        if (end == line.c_str())
+        {
+            error = "invalid chunk size";
+            return false;
+        }
+
+        // the chunk and its trailing crlf, the last chunk is followed by an empty trailer
+        std::size_t wanted = chunk_size + 2;
+        if (buffer_.size() < wanted)
+        {
+            boost::asio::read(socket_, buffer_, boost::asio::transfer_exactly(wanted - buffer_.size()), ec);
+            if (ec)
+            {
+                error = "receive failed: " + ec.message();
+                return false;
+            }
+        }
+
+        body.append(boost::asio::buffers_begin(buffer_.data()),
+            boost::asio::buffers_begin(buffer_.data()) + chunk_size);
+        buffer_.consume(wanted);
+
+        if (chunk_size == 0)
+        {
+            return true;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	ctl_client.h for talking to the winpcs admin api over one connection.
+*/
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <vector>
+
+struct ctl_response
+{
+    ctl_response() :
+        status(0), sent(false)
+    {
+    }
+
+    int status;             // http status, 0 when no response came
+    bool sent;              // written to the server, without a status its outcome is unknown
+    std::string body;
+};
+
+//
+// one keep-alive http connection to the admin api. a bulk request writes up
+// to window requests back to back and then reads their responses, which
+// come in the same order, so a thousand programs cost one connection and a
+// round trip per window instead of a thousand handshakes. a dropped
+// connection is opened again for the requests not yet sent, and, when
+// retry is set because they only read, for the ones sent but not answered.
+//
+class ctl_client : boost::noncopyable
+{
+public:
+    ctl_client(const std::string& host, const std::string& port, const std::string& token, unsigned int timeout_second);
+    ~ctl_client();
+
+    bool get(const std::string& path, bool retry, ctl_response& response, std::string& error);
+
+    // responses[i] answers paths[i], false when some of them got no response
+    bool get(const std::vector<std::string>& paths, bool retry, std::vector<ctl_response>& responses,
+        std::size_t window, std::string& error);
+
+private:
+    bool _connect(std::string& error);
+    bool _alive();
+    void _close();
+    bool _read_response(ctl_response& response, std::string& error);
+    bool _read_chunked(std::string& body, std::string& error);
+
+    std::string host_;
+    std::string port_;
+    std::string token_;                 // sent as X-Winpcs-Token when not empty
+    unsigned int timeout_second_;
+
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::streambuf buffer_;
+};
@@ -0,0 +1,689 @@
+/*
+  Copyright (c) 2015, Ben Cheung (zqzjz1982@gmail.com)
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      * Neither the name of winpcs nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL RANDOLPH VOORHIES AND SHANE GRANT BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+	main.cpp for winpcsctl, the command line client of the winpcs admin api.
+*/
+
+#include "ctl_client.h"
+
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <cereal/external/rapidjson/document.h>
+#include <cereal/external/rapidjson/writer.h>
+#include <cereal/external/rapidjson/stringbuffer.h>
+
+#include <boost/function.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+
+namespace po = boost::program_options;
+
+namespace
+{
+    const int exit_ok = 0;
+    const int exit_failed = 1;      // the server answered, some of the programs failed
+    const int exit_usage = 2;       // bad arguments, or the server could not be reached
+    const int exit_unknown = 3;     // the connection dropped before some answers, the server may have acted on them
+
+    const std::size_t time_width = 27;  // "2026-10-19T08:30:00.000000Z", the head of every captured line
+    const std::size_t poll_limit = 10000;   // lines a tail poll asks for, the server's own cap
+
+    const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+    struct program_entry
+    {
+        std::string name;
+        unsigned int instance;
+        std::string status;
+        unsigned long pid;
+        unsigned long exit_code;
+        unsigned int restart_count;
+    };
+
+    typedef rapidjson::Writer<rapidjson::StringBuffer> json_writer;
+
+    // json prints one object per line, text one aligned line per record
+    bool json_output = true;
+
+    void print_json(const boost::function<void(json_writer&)>& fields, std::ostream& out = std::cout)
+    {
+        rapidjson::StringBuffer buffer;
+        json_writer writer(buffer);
+        writer.StartObject();
+        fields(writer);
+        writer.EndObject();
+        out << buffer.GetString() << std::endl;
+    }
+
+    void json_field(json_writer& writer, const char* name, const std::string& value)
+    {
+        writer.String(name);
+        writer.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()));
+    }
+
+    void json_field(json_writer& writer, const char* name, unsigned int value)
+    {
+        writer.String(name);
+        writer.Uint(value);
+    }
+
+    void print_error(const std::string& error)
+    {
+        if (json_output)
+        {
+            print_json([&](json_writer& writer) {
+                json_field(writer, "error", error);
+            }, std::cerr);
+        }
+        else
+        {
+            std::cerr << "winpcsctl: " << error << std::endl;
+        }
+    }
+
+    // '*' matches any run of characters, '?' any one
+    bool glob_match(const char* pattern, const char* text)
+    {
+        const char* star = NULL;
+        const char* resume = NULL;
+        while (*text != '\0')
+        {
+            if (*pattern == '*')
+            {
+                star = pattern++;
+                resume = text;
+            }
+            else if (*pattern == '?' || *pattern == *text)
+            {
+                ++pattern;
+                ++text;
+            }
+            else if (star != NULL)
+            {
+                pattern = star + 1;
+                text = ++resume;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        while (*pattern == '*')
+        {
+            ++pattern;
+        }
+        return *pattern == '\0';
+    }
+
+    bool has_wildcard(const std::string& pattern)
+    {
+        return pattern.find_first_of("*?") != std::string::npos;
+    }
+
+    std::string url_encode(const std::string& text)
+    {
+        static const char* const hex = "0123456789ABCDEF";
+
+        std::string encoded;
+        for (std::string::const_iterator iter = text.begin(); iter != text.end(); ++iter)
+        {
+            unsigned char c = static_cast<unsigned char>(*iter);
+            if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+            {
+                encoded += static_cast<char>(c);
+            }
+            else
+            {
+                encoded += '%';
+                encoded += hex[c >> 4];
+                encoded += hex[c & 0x0f];
+            }
+        }
+        return encoded;
+    }
+
+    std::string json_string(const rapidjson::Value& object, const char* name)
+    {
+        if (!object.HasMember(name) || !object[name].IsString())
+        {
+            return std::string();
+        }
+
+        return std::string(object[name].GetString(), object[name].GetStringLength());
+    }
+
+    unsigned long json_uint(const rapidjson::Value& object, const char* name)
+    {
+        if (!object.HasMember(name) || !object[name].IsUint())
+        {
+            return 0;
+        }
+
+        return object[name].GetUint();
+    }
+
+    bool parse_status(std::string& body, std::vector<program_entry>& programs)
+    {
+        if (body.empty())
+        {
+            return false;
+        }
+
+        rapidjson::Document doc;
+        doc.ParseInsitu<0>(&body[0]);
+        if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("status") || !doc["status"].IsArray())
+        {
+            return false;
+        }
+
+        const rapidjson::Value& status = doc["status"];
+        for (rapidjson::SizeType i = 0; i < status.Size(); ++i)
+        {
+            const rapidjson::Value& item = status[i];
+            if (!item.IsObject())
+            {
+                continue;
+            }
+
+            program_entry program;
+            program.name = json_string(item, "name");
+            program.instance = json_uint(item, "instance");
+            program.status = json_string(item, "status");
+            program.pid = json_uint(item, "pid");
+            program.exit_code = json_uint(item, "exit_code");
+            program.restart_count = json_uint(item, "restart_count");
+            programs.push_back(program);
+        }
+
+        return true;
+    }
+
+    bool fetch_status(ctl_client& client, std::vector<program_entry>& programs)
+    {
+        ctl_response response;
+        std::string error;
+        if (!client.get("/status/pid/0", true, response, error))
+        {
+            print_error(error);
+            return false;
+        }
+
+        if (response.status != 200 || !parse_status(response.body, programs))
+        {
+            print_error("invalid status response");
+            return false;
+        }
+
+        return true;
+    }
+
+    int run_status(ctl_client& client, const std::vector<std::string>& patterns)
+    {
+        std::vector<program_entry> programs;
+        if (!fetch_status(client, programs))
+        {
+            return exit_usage;
+        }
+
+        std::for_each(programs.begin(), programs.end(), [&](const program_entry& program) {
+            std::string key = program.name + ":" + std::to_string(program.instance);
+            bool selected = patterns.empty() || std::any_of(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+                return glob_match(pattern.c_str(), program.name.c_str()) || glob_match(pattern.c_str(), key.c_str());
+            });
+            if (!selected)
+            {
+                return;
+            }
+
+            if (json_output)
+            {
+                print_json([&](json_writer& writer) {
+                    json_field(writer, "name", program.name);
+                    json_field(writer, "instance", program.instance);
+                    json_field(writer, "status", program.status);
+                    json_field(writer, "pid", static_cast<unsigned int>(program.pid));
+                    json_field(writer, "exit_code", static_cast<unsigned int>(program.exit_code));
+                    json_field(writer, "restart_count", program.restart_count);
+                });
+            }
+            else
+            {
+                std::cout << std::left << std::setw(32) << key << std::setw(10) << program.status
+                    << "pid " << std::setw(8) << program.pid << "restarts " << program.restart_count << std::endl;
+            }
+        });
+
+        return exit_ok;
+    }
+
+    int run_action(ctl_client& client, const std::string& action, const std::vector<std::string>& patterns, std::size_t window)
+    {
+        // the patterns are expanded against the running program names, the
+        // exact names go out as they are and the server judges them
+        std::vector<std::string> names;
+        std::set<std::string> seen;
+
+        if (std::any_of(patterns.begin(), patterns.end(), has_wildcard))
+        {
+            std::vector<program_entry> programs;
+            if (!fetch_status(client, programs))
+            {
+                return exit_usage;
+            }
+
+            std::for_each(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+                std::for_each(programs.begin(), programs.end(), [&](const program_entry& program) {
+                    if (glob_match(pattern.c_str(), program.name.c_str()) && seen.insert(program.name).second)
+                    {
+                        names.push_back(program.name);
+                    }
+                });
+            });
+        }
+
+        std::for_each(patterns.begin(), patterns.end(), [&](const std::string& pattern) {
+            if (!has_wildcard(pattern) && seen.insert(pattern).second)
+            {
+                names.push_back(pattern);
+            }
+        });
+
+        std::vector<std::string> paths;
+        std::for_each(names.begin(), names.end(), [&](const std::string& name) {
+            paths.push_back("/" + action + "/" + url_encode(name));
+        });
+
+        std::vector<ctl_response> responses;
+        std::string error;
+        // actions are not sent again, an unanswered one may or may not have been applied
+        client.get(paths, false, responses, window, error);
+
+        int result = exit_ok;
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            bool ok = responses[i].status == 200 && responses[i].body.find("\"result\":0") != std::string::npos;
+            bool unknown = responses[i].status == 0 && responses[i].sent;
+
+            std::string outcome = ok ? "ok" : unknown ? "unknown outcome" : "failed";
+            std::string failure = ok ? std::string()
+                : responses[i].status == 0 ? error
+                : responses[i].status == 403 ? "refused, admin token missing or wrong" : "rejected, unknown program";
+
+            if (responses[i].status == 0 && !responses[i].sent)
+            {
+                result = exit_usage;
+            }
+            else if (unknown && result != exit_usage)
+            {
+                result = exit_unknown;
+            }
+            else if (!ok && result == exit_ok)
+            {
+                result = exit_failed;
+            }
+
+            if (json_output)
+            {
+                print_json([&](json_writer& writer) {
+                    json_field(writer, "name", names[i]);
+                    json_field(writer, "action", action);
+                    json_field(writer, "result", outcome);
+                    if (!ok)
+                    {
+                        json_field(writer, "error", failure);
+                    }
+                });
+            }
+            else
+            {
+                std::cout << std::left << std::setw(32) << names[i] << (ok ? outcome : outcome + ": " + failure) << std::endl;
+            }
+        }
+
+        return result;
+    }
+
+    int run_reload(ctl_client& client)
+    {
+        ctl_response response;
+        std::string error;
+        if (!client.get("/reload", false, response, error))
+        {
+            print_error(response.sent ? "reload outcome unknown, " + error : error);
+            return response.sent ? exit_unknown : exit_usage;
+        }
+
+        if (response.status == 403)
+        {
+            print_error("reload refused, admin token missing or wrong");
+            return exit_failed;
+        }
+
+        rapidjson::Document doc;
+        std::string body = response.body;
+        if (!body.empty())
+        {
+            doc.ParseInsitu<0>(&body[0]);
+        }
+
+        if (body.empty() || doc.HasParseError() || !doc.IsObject() || json_uint(doc, "result") != 0)
+        {
+            print_error("reload failed, see the winpcs log");
+            return exit_failed;
+        }
+
+        auto names = [&doc](const char* member) {
+            std::vector<std::string> result;
+            if (doc.HasMember(member) && doc[member].IsArray())
+            {
+                for (rapidjson::SizeType i = 0; i < doc[member].Size(); ++i)
+                {
+                    if (doc[member][i].IsString())
+                    {
+                        result.push_back(doc[member][i].GetString());
+                    }
+                }
+            }
+            return result;
+        };
+        std::vector<std::string> added = names("added");
+        std::vector<std::string> removed = names("removed");
+
+        if (json_output)
+        {
+            print_json([&](json_writer& writer) {
+                json_field(writer, "result", std::string("ok"));
+                writer.String("added");
+                writer.StartArray();
+                std::for_each(added.begin(), added.end(), [&](const std::string& name) { writer.String(name.c_str()); });
+                writer.EndArray();
+                writer.String("removed");
+                writer.StartArray();
+                std::for_each(removed.begin(), removed.end(), [&](const std::string& name) { writer.String(name.c_str()); });
+                writer.EndArray();
+            });
+        }
+        else
+        {
+            std::cout << "reloaded, changed programs restart one instance at a time" << std::endl;
+            std::for_each(added.begin(), added.end(), [](const std::string& name) {
+                std::cout << "added, starts with the next winpcs start >> " << name << std::endl;
+            });
+            std::for_each(removed.begin(), removed.end(), [](const std::string& name) {
+                std::cout << "removed, stops with the next winpcs start >> " << name << std::endl;
+            });
+        }
+
+        return exit_ok;
+    }
+
+    // unix seconds of a captured line's time, 0 when it has none
+    std::uint64_t line_second(const std::string& line)
+    {
+        if (line.size() < time_width)
+        {
+            return 0;
+        }
+
+        try
+        {
+            std::string text = line.substr(0, time_width - 1);
+            text[10] = ' ';
+            return (boost::posix_time::time_from_string(text) - epoch).total_seconds();
+        }
+        catch (std::exception&)
+        {
+            return 0;
+        }
+    }
+
+    void print_line(const std::string& name, const std::string& line)
+    {
+        if (!json_output)
+        {
+            std::cout << line << std::endl;
+            return;
+        }
+
+        // "<time> <instance key> <text>"
+        std::string::size_type key_end = line.find(' ', time_width + 1);
+        std::string key = line.size() > time_width ? line.substr(time_width + 1, key_end - time_width - 1) : std::string();
+        std::string text = key_end == std::string::npos ? std::string() : line.substr(key_end + 1);
+
+        print_json([&](json_writer& writer) {
+            json_field(writer, "name", name);
+            json_field(writer, "time", line.substr(0, (std::min)(line.size(), time_width)));
+            json_field(writer, "instance", key);
+            json_field(writer, "text", text);
+        });
+    }
+
+    int run_tail(ctl_client& client, const std::string& name, const std::string& query,
+        std::size_t lines, unsigned int since_second, bool follow)
+    {
+        std::uint64_t now_second = (boost::posix_time::second_clock::universal_time() - epoch).total_seconds();
+        std::uint64_t since = now_second > since_second ? now_second - since_second : 0;
+
+        // the lines at the newest printed time, a poll from that second returns them again
+        std::string last_time;
+        std::set<std::string> printed_at_last;
+        bool first = true;
+
+        for (;;)
+        {
+            // the first request asks for the newest lines only, a poll for what came after them
+            std::string path = "/log/" + url_encode(name) + "/search?since=" + std::to_string(since) +
+                (first ? "&tail=1&limit=" + std::to_string(lines) : "&limit=" + std::to_string(poll_limit));
+            if (!query.empty())
+            {
+                path += "&q=" + url_encode(query);
+            }
+
+            ctl_response response;
+            std::string error;
+            if (!client.get(path, true, response, error))
+            {
+                print_error(error);
+                return exit_usage;
+            }
+
+            if (response.status != 200 || response.body.compare(0, 10, "{\"result\":") == 0)
+            {
+                print_error("log search rejected >> " + name);
+                return exit_failed;
+            }
+
+            std::vector<std::string> found;
+            boost::split(found, response.body, boost::is_any_of("\n"));
+            found.erase(std::remove(found.begin(), found.end(), std::string()), found.end());
+
+            first = false;
+
+            std::size_t printed = 0;
+            for (std::size_t i = 0; i < found.size(); ++i)
+            {
+                std::string time = found[i].substr(0, (std::min)(found[i].size(), time_width));
+                if (time < last_time || (time == last_time && printed_at_last.count(found[i]) != 0))
+                {
+                    continue;
+                }
+
+                if (time != last_time)
+                {
+                    last_time = time;
+                    printed_at_last.clear();
+                }
+                printed_at_last.insert(found[i]);
+
+                print_line(name, found[i]);
+                since = (std::max)(since, line_second(found[i]));
+                ++printed;
+            }
+
+            // a full page that moved on may have more behind it, the next poll goes at once
+            bool full = found.size() >= poll_limit && printed != 0;
+
+            if (!follow)
+            {
+                return exit_ok;
+            }
+
+            std::cout.flush();
+            if (!full)
+            {
+                boost::this_thread::sleep_for(boost::chrono::seconds(1));
+            }
+        }
+    }
+
+    bool read_names(const std::string& file, std::vector<std::string>& names)
+    {
+        std::ifstream in(file.c_str());
+        if (!in.is_open())
+        {
+            return false;
+        }
+
+        // one name or pattern per line, '#' starts a comment
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            boost::trim(line);
+            if (!line.empty())
+            {
+                names.push_back(line);
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    po::options_description desc("usage: winpcsctl [options] <status|start|stop|restart|tail|reload> [program|pattern ...]");
+    desc.add_options()
+        ("help,h", "print this help")
+        ("host", po::value<std::string>()->default_value("127.0.0.1"), "admin api address")
+        ("port,p", po::value<std::string>()->default_value("9000"), "admin api port")
+        ("token", po::value<std::string>()->default_value(""), "admin token of the server, needed by start, stop, restart and reload")
+        ("timeout", po::value<unsigned int>()->default_value(10), "seconds to wait for the server")
+        ("output,o", po::value<std::string>()->default_value("json"), "json, one object per line, or text")
+        ("file,f", po::value<std::string>(), "read more programs or patterns from a file, one per line")
+        ("window", po::value<std::size_t>()->default_value(64), "requests in flight on the connection")
+        ("lines,n", po::value<std::size_t>()->default_value(20), "tail: lines to print first")
+        ("query,q", po::value<std::string>()->default_value(""), "tail: only lines holding every word")
+        ("since", po::value<unsigned int>()->default_value(3600), "tail: seconds back to look")
+        ("follow", "tail: keep printing new lines")
+        ("command", po::value<std::string>(), "")
+        ("args", po::value<std::vector<std::string> >(), "");
+
+    po::positional_options_description positional;
+    positional.add("command", 1);
+    positional.add("args", -1);
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        po::notify(vm);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "winpcsctl: " << e.what() << std::endl << desc << std::endl;
+        return exit_usage;
+    }
+
+    if (vm.count("help") || !vm.count("command"))
+    {
+        std::cout << desc << std::endl;
+        return vm.count("help") ? exit_ok : exit_usage;
+    }
+
+    json_output = (vm["output"].as<std::string>() != "text");
+
+    std::string command = vm["command"].as<std::string>();
+    std::vector<std::string> args;
+    if (vm.count("args"))
+    {
+        args = vm["args"].as<std::vector<std::string> >();
+    }
+
+    if (vm.count("file") && !read_names(vm["file"].as<std::string>(), args))
+    {
+        print_error("cannot read " + vm["file"].as<std::string>());
+        return exit_usage;
+    }
+
+    ctl_client client(vm["host"].as<std::string>(), vm["port"].as<std::string>(), vm["token"].as<std::string>(),
+        vm["timeout"].as<unsigned int>());
+
+    if (command == "status")
+    {
+        return run_status(client, args);
+    }
+
+    if (command == "start" || command == "stop" || command == "restart")
+    {
+        if (args.empty())
+        {
+            print_error(command + " needs a program, a pattern or --file");
+            return exit_usage;
+        }
+        return run_action(client, command, args, vm["window"].as<std::size_t>());
+    }
+
+    if (command == "tail")
+    {
+        if (args.size() != 1)
+        {
+            print_error("tail needs one program");
+            return exit_usage;
+        }
+        return run_tail(client, args.front(), vm["query"].as<std::string>(), vm["lines"].as<std::size_t>(),
+            vm["since"].as<unsigned int>(), vm.count("follow") != 0);
+    }
+
+    if (command == "reload")
+    {
+        return run_reload(client);
+    }
+
+    print_error("unknown command >> " + command);
+    return exit_usage;
+}